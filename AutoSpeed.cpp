@@ -1,13 +1,304 @@
-﻿#include <iostream>
+﻿#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
 #include <vector>
 #include "scanner.h"
 #include "parser.h"
+#include "ast_cache.h"
+#include "ast_interpreter.h"
+#include "ast_optimizer.h"
 #include "ast_printer.h"
+#include "benchmarks.h"
+#include "bytecode_compiler.h"
+#include "c_emitter.h"
+#include "driver.h"
+#include "function_cache.h"
+#include "mapped_file.h"
+#include "native_codegen.h"
+#include "selftests.h"
+#include "ssa_builder.h"
+#include "ssa_codegen.h"
+#include "ssa_passes.h"
+#include "thread_pool.h"
+#include "type_checker.h"
+#include "vm.h"
 
-int main() {
+int buildExecutable(const std::string& source, const std::string& output) {
+    std::string path = output + ".c";
+    {
+        std::ofstream file(path, std::ios::binary);
+        file << source;
+        if (!file) {
+            std::cerr << "Cannot write " << path << "\n";
+            return 1;
+        }
+    }
+    const char* cc = std::getenv("CC");
+    std::string command = std::string(cc && *cc ? cc : "cc") + " -O2 -o '" + output + "' '" + path + "'";
+    int status = std::system(command.c_str());
+    return status == 0 ? 0 : 1;
+}
 
-    // ===== All Test Programs =====
-    std::vector<std::string> tests = {
+// Simplifies the tree of a program that parsed without errors, and
+// reports how much that removed. Outside AST mode the program is compiled
+// first, as the optimizer drops code without checking it; returns false,
+// with the errors printed, if that fails.
+bool optimizeProgram(ParseResult& program, CompilationContext& ctx, const Options& options) {
+    if (options.mode != Options::AST) {
+        BytecodeCompiler(ctx).compile(program.statements);
+        if (!ctx.diagnostics.empty()) {
+            ctx.diagnostics.print(std::cerr);
+            return false;
+        }
+    }
+    OptimizerStats stats = AstOptimizer(program.arena, ctx.symbols).optimize(program.statements);
+    std::cerr << "Optimizer removed " << stats.removed() << " of " << stats.nodesBefore << " nodes: " << stats.folded
+              << " folded, " << stats.propagated << " propagated, " << stats.pruned << " pruned, " << stats.dropped
+              << " dropped.\n";
+    return true;
+}
+
+// Builds SSA IR for each function of a program that parsed without errors
+// and runs the chosen passes over it. In SSA mode it then lists the IR,
+// with what the passes did on stderr; in SSA_RUN mode it makes ignite()
+// into bytecode from the IR and runs that. Returns as runProgram does.
+int runSsa(const ParseResult& program, CompilationContext& ctx, const Options& options) {
+    Symbol ignite = ctx.symbols.find("ignite");
+    SsaBuilder builder(ctx.symbols, ctx.diagnostics);
+    SsaPassManager passes(options.passes);
+    std::vector<IrFunction> functions;
+    int entry = -1;
+    for (Stmt* stmt : program.statements) {
+        if (!stmt || stmt->kind != STMT_FUNC_DEF) continue;
+        auto& func = static_cast<FuncDefStmt&>(*stmt);
+        IrFunction function;
+        if (!builder.build(func, function)) continue;
+        passes.run(function);
+        if (func.name == ignite && entry < 0) entry = (int)functions.size();
+        functions.push_back(std::move(function));
+    }
+    if (options.mode == Options::SSA_RUN && entry < 0 && ctx.diagnostics.empty())
+        ctx.diagnostics.report(1, 0, DIAG_NO_ENTRY_POINT, "No ignite() to run.");
+    if (!ctx.diagnostics.empty()) {
+        ctx.diagnostics.print(std::cerr);
+        return 1;
+    }
+
+    if (options.mode == Options::SSA) {
+        for (const IrFunction& function : functions) std::cout << printIr(function, ctx.symbols) << "\n";
+        const PassStats& stats = passes.stats();
+        std::cerr << "SSA passes: " << stats.instructionsBefore << " -> " << stats.instructionsAfter
+                  << " instructions: " << stats.merged << " merged, " << stats.hoisted << " hoisted, " << stats.reduced
+                  << " reduced, " << stats.removed << " removed.\n";
+        return 0;
+    }
+    BytecodeFunction code;
+    if (!generateBytecode(functions[(size_t)entry], code, ctx.diagnostics)) {
+        ctx.diagnostics.print(std::cerr);
+        return 1;
+    }
+    Vm vm(std::cin, std::cout);
+    RunResult result = vm.run(code, ctx.diagnostics);
+    ctx.diagnostics.print(std::cerr);
+    return result.ok ? (int)result.value : 1;
+}
+
+FunctionBuild buildFunctions(FunctionCache& cache, const ParseResult& program, CompilationContext& ctx,
+                             Options::Mode mode) {
+    return cache.build(program.statements, ctx.symbols, ctx.diagnostics, [&](FuncDefStmt& func, Diagnostics& found) {
+        if (mode == Options::CHECK) {
+            TypeChecker(ctx.symbols, found).check(func);
+            return std::string();
+        }
+        std::swap(found, ctx.diagnostics); // The compiler reports to its context
+        BytecodeFunction code = BytecodeCompiler(ctx).compile(func);
+        std::swap(found, ctx.diagnostics);
+        return disassemble(code, ctx.symbols) + "\n";
+    });
+}
+
+FunctionCache functionCache(Options::Mode mode, const std::string& directory) {
+    if (mode == Options::CHECK) return FunctionCache("check 3", directory);
+    return FunctionCache("bytecode 3", directory, FunctionCache::ABSOLUTE_LINES);
+}
+
+// Compiles a program that parsed without errors, then lists its bytecode,
+// runs its ignite() (as machine code where it can, in NATIVE mode; from
+// the tree, in INTERPRET mode, with what its nodes did on stderr) or
+// translates it to C (in C mode). In CHECK mode it is only type-checked;
+// the SSA modes go to runSsa. With a cache directory, CHECK and BYTECODE
+// go through a FunctionCache kept there (see buildFunctions). A second ignite() is an error in every mode.
+// Returns what finishline returned, or 1 on errors.
+int runProgram(const ParseResult& program, CompilationContext& ctx, const Options& options) {
+    Options::Mode mode = options.mode;
+    if (!TypeChecker(ctx.symbols, ctx.diagnostics).checkEntryPoint(program.statements)) {
+        ctx.diagnostics.print(std::cerr);
+        return 1;
+    }
+    if (mode == Options::SSA || mode == Options::SSA_RUN) return runSsa(program, ctx, options);
+    if ((mode == Options::CHECK || mode == Options::BYTECODE) && !options.cacheDir.empty()) {
+        std::error_code ignored;
+        std::filesystem::create_directories(options.cacheDir, ignored);
+        FunctionCache cache = functionCache(mode, options.cacheDir);
+        FunctionBuild build = buildFunctions(cache, program, ctx, mode);
+        std::cerr << "Function cache: " << build.reused << " reused, " << build.rebuilt << " rebuilt.\n";
+        ctx.diagnostics.print(std::cerr);
+        if (!ctx.diagnostics.empty()) return 1;
+        for (const std::string* output : build.outputs) std::cout << *output;
+        return 0;
+    }
+    if (mode == Options::CHECK) {
+        bool ok = TypeChecker(ctx.symbols, ctx.diagnostics).check(program.statements);
+        ctx.diagnostics.print(std::cerr);
+        return ok ? 0 : 1;
+    }
+    if (mode == Options::NATIVE) {
+        RunResult result = runFromAst(program.statements, ctx, std::cin, std::cout);
+        ctx.diagnostics.print(std::cerr);
+        return result.ok ? (int)result.value : 1;
+    }
+    if (mode == Options::INTERPRET) {
+        InterpreterStats stats;
+        RunResult result = interpretFromAst(program.statements, ctx, std::cin, std::cout, &stats);
+        std::cerr << "AST interpreter: " << stats.rewrites << " rewrites, " << stats.deopts << " deopts; "
+                  << stats.hits << " specialized and " << stats.generic << " generic node runs.\n";
+        ctx.diagnostics.print(std::cerr);
+        return result.ok ? (int)result.value : 1;
+    }
+
+    BytecodeCompiler compiler(ctx);
+    BytecodeProgram code = compiler.compile(program.statements);
+    if ((mode == Options::RUN || mode == Options::C) && code.entry < 0 && ctx.diagnostics.empty())
+        ctx.diagnostics.report(1, 0, DIAG_NO_ENTRY_POINT, "No ignite() to run.");
+    if (!ctx.diagnostics.empty()) {
+        ctx.diagnostics.print(std::cerr);
+        return 1;
+    }
+
+    if (mode == Options::BYTECODE) {
+        for (const BytecodeFunction& function : code.functions)
+            std::cout << disassemble(function, ctx.symbols) << "\n";
+        return 0;
+    }
+    if (mode == Options::C) {
+        std::string source = CEmitter(ctx.symbols).emit(program.statements);
+        if (options.output.empty()) {
+            std::cout << source;
+            return 0;
+        }
+        return buildExecutable(source, options.output);
+    }
+    Vm vm(std::cin, std::cout);
+    RunResult result = vm.run(code.functions[(size_t)code.entry], ctx.diagnostics);
+    ctx.diagnostics.print(std::cerr);
+    return result.ok ? (int)result.value : 1;
+}
+
+// Parses a program file (or stdin, for "-") and prints its AST, then any
+// errors. Returns 1 if there were errors. In the other modes the program
+// is compiled instead (see runProgram). With options.optimize the tree is
+// simplified first (see optimizeProgram), and not cached. With
+// options.share a tree that is only printed as an S-expression is parsed
+// with shared subexpressions (see Parser::shareExpressions), and not
+// cached either: its nodes carry the line of their first use, which the
+// JSON format would print.
+// By default the streaming lexer is used: the file is memory-mapped and no
+// token list is built. With jobs != 1 the whole file is scanned first, so
+// that its functions can be parsed on 'jobs' threads (0: one per core).
+// With a cache directory, text that parsed without errors before is
+// printed straight from its cache entry, with no scanning or parsing.
+int runFile(const std::string& path, const Options& options) {
+    try {
+        CompilationContext ctx;
+        ctx.diagnostics.setLimit(options.maxErrors);
+        AstPrinter printer(ctx.symbols, options.format);
+        bool sharing = options.share && options.mode == Options::AST && options.format == AstPrinter::SEXPR &&
+                       !options.optimize;
+        if (options.share && !sharing)
+            std::cerr << "--share only applies to printing the tree as sexpr without --optimize; ignored.\n";
+        bool caching = !options.cacheDir.empty() && options.mode == Options::AST && !options.optimize && !sharing;
+
+        // Stdin is only read ahead when the whole text is needed up front.
+        std::unique_ptr<MappedFile> file;
+        std::string input;
+        std::string_view code;
+        if (path != "-") {
+            file = std::make_unique<MappedFile>(path);
+            code = file->view();
+        }
+        else if (options.jobs != 1 || caching) {
+            input.assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+            code = input;
+        }
+
+        uint64_t hash = 0;
+        std::string cachePath;
+        if (caching) {
+            hash = hashSource(code);
+            cachePath = astCachePath(options.cacheDir, hash);
+            AstImage image;
+            if (image.open(cachePath, hash, code.size())) {
+                printer.print(image, std::cout);
+                std::cout << "\n";
+                return 0;
+            }
+        }
+
+        ParseResult program;
+        std::string text;
+        if (options.jobs != 1) {
+            text = std::string(code);
+            auto tokens = scan(text, ctx);
+            ThreadPool pool(options.jobs);
+            Parser parser(tokens, ctx);
+            parser.shareExpressions(sharing);
+            program = parser.parseParallel(pool);
+        }
+        else {
+            std::unique_ptr<Lexer> lexer;
+            if (path == "-" && !caching) lexer = std::make_unique<Lexer>(std::cin, ctx);
+            else lexer = std::make_unique<Lexer>(code, ctx);
+
+            Parser parser(*lexer, ctx);
+            parser.shareExpressions(sharing);
+            program = parser.parse();
+        }
+
+        if (options.optimize && ctx.diagnostics.empty() && !optimizeProgram(program, ctx, options)) return 1;
+        if (options.mode != Options::AST) {
+            if (!ctx.diagnostics.empty()) {
+                ctx.diagnostics.print(std::cerr);
+                return 1;
+            }
+            return runProgram(program, ctx, options);
+        }
+
+        printer.print(program.statements, std::cout);
+        std::cout << "\n";
+        ctx.diagnostics.print(std::cerr);
+        if (!ctx.diagnostics.empty()) return 1;
+
+        if (caching) {
+            // Best effort: a cache that cannot be written is just not used.
+            std::error_code ignored;
+            std::filesystem::create_directories(options.cacheDir, ignored);
+            writeAstCache(cachePath, hash, code.size(), program.statements, ctx.symbols);
+        }
+        return 0;
+    }
+    catch (std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
+
+std::vector<std::string> builtInPrograms() {
+    return {
 
         // TEST 1
         R"(ignite() {
@@ -88,6 +379,51 @@ int main() {
             finishline 0;
         })"
     };
+}
+
+int main(int argc, char** argv) {
+
+    // AutoSpeed [--max-errors N] [--jobs N] [--mode ast|check|bytecode|run|interpret|native|c|ssa|ssa-run] [--passes default|all|none|gvn,licm,sr,dse] [--output PATH] [--optimize on|off] [--share on|off] [--format sexpr|json] [--cache DIR] <file>
+    // AutoSpeed --bench
+    // AutoSpeed --selftest
+    if (argc == 2 && std::string(argv[1]) == "--bench") return runBenchmarks();
+    if (argc == 2 && std::string(argv[1]) == "--selftest") return runSelfTests();
+
+    Options options;
+    int arg = 1;
+    for (; argc > arg + 1; arg += 2) {
+        std::string option = argv[arg];
+        if (option == "--max-errors") options.maxErrors = std::stoul(argv[arg + 1]);
+        else if (option == "--jobs") options.jobs = static_cast<unsigned>(std::stoul(argv[arg + 1]));
+        else if (option == "--mode") {
+            std::string mode = argv[arg + 1];
+            options.mode = mode == "check"     ? Options::CHECK
+                         : mode == "run"       ? Options::RUN
+                         : mode == "interpret" ? Options::INTERPRET
+                         : mode == "native"    ? Options::NATIVE
+                         : mode == "bytecode"  ? Options::BYTECODE
+                         : mode == "c"         ? Options::C
+                         : mode == "ssa"       ? Options::SSA
+                         : mode == "ssa-run"   ? Options::SSA_RUN
+                                               : Options::AST;
+        }
+        else if (option == "--format") options.format = std::string(argv[arg + 1]) == "json" ? AstPrinter::JSON : AstPrinter::SEXPR;
+        else if (option == "--cache") options.cacheDir = argv[arg + 1];
+        else if (option == "--output") options.output = argv[arg + 1];
+        else if (option == "--optimize") options.optimize = std::string(argv[arg + 1]) == "on";
+        else if (option == "--share") options.share = std::string(argv[arg + 1]) == "on";
+        else if (option == "--passes") {
+            if (!parsePasses(argv[arg + 1], options.passes)) {
+                std::cerr << "Unknown pass in '" << argv[arg + 1] << "': use default, all, none, or gvn,licm,sr,dse\n";
+                return 1;
+            }
+        }
+        else break;
+    }
+    if (argc > arg) return runFile(argv[arg], options);
+
+    // ===== All Test Programs =====
+    std::vector<std::string> tests = builtInPrograms();
 
     int test_number = 1;
 
@@ -99,22 +435,32 @@ int main() {
 
         try {
             // ===== Scanner =====
-            auto tokens = scan(code);
+            CompilationContext ctx;
+            auto tokens = scan(code, ctx);
             std::cout << "TOKENS:\n";
-            for (auto& t : tokens) {
+            for (size_t i = 0; i < tokens.size(); i++) {
+                Token t = tokens[i];
                 std::cout << "[" << t.line << "] "
                     << tokenTypeToString(t.type)
                     << " : " << t.value << "\n";
             }
 
             // ===== Parser =====
-            Parser parser(tokens);
-            auto stmts = parser.parse();
-            std::cout << "\n PARSE SUCCESS — " << stmts.size() << " statement(s)\n";
+            Parser parser(tokens, ctx);
+            auto program = parser.parse();
+            if (ctx.diagnostics.empty()) {
+                std::cout << "\n PARSE SUCCESS — " << program.statements.size() << " statement(s)\n";
+            }
+            else {
+                std::cout << "\n PARSE FAILED — " << ctx.diagnostics.size() << " error(s):\n";
+                ctx.diagnostics.print(std::cout);
+            }
 
             // ===== AST Printer =====
-            AstPrinter printer;
-            std::cout << "\nAST:\n" << printer.print(stmts) << "\n";
+            AstPrinter printer(ctx.symbols);
+            std::cout << "\nAST:\n";
+            printer.print(program.statements, std::cout);
+            std::cout << "\n";
         }
         catch (std::exception& e) {
             std::cout << "\n PARSE FAILED: " << e.what() << "\n";
@@ -0,0 +1,35 @@
+#include "ast_arena.h"
+
+#include <iterator>
+
+void AstArena::adopt(AstArena&& other) {
+    chunks.insert(chunks.end(), std::make_move_iterator(other.chunks.begin()), std::make_move_iterator(other.chunks.end()));
+    used += other.used;
+    other.chunks.clear();
+    other.next = nullptr;
+    other.left = 0;
+    other.used = 0;
+}
+
+void* AstArena::allocate(size_t size, size_t align) {
+    size_t pad = (align - (reinterpret_cast<uintptr_t>(next) & (align - 1))) & (align - 1);
+    if (pad + size > left) {
+        if (size > CHUNK_SIZE / 4) {
+            // Big requests get a chunk of their own; the current one stays open.
+            chunks.emplace_back(new char[size + align]);
+            char* p = chunks.back().get();
+            p += (align - (reinterpret_cast<uintptr_t>(p) & (align - 1))) & (align - 1);
+            used += size;
+            return p;
+        }
+        chunks.emplace_back(new char[CHUNK_SIZE]);
+        next = chunks.back().get();
+        left = CHUNK_SIZE;
+        pad = (align - (reinterpret_cast<uintptr_t>(next) & (align - 1))) & (align - 1);
+    }
+    char* p = next + pad;
+    next = p + size;
+    left -= pad + size;
+    used += size;
+    return p;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+ * ArenaList
+ * A fixed-size array that lives in an AstArena (e.g. a block's statements).
+ */
+template <typename T>
+struct ArenaList {
+    T* items = nullptr;
+    uint32_t count = 0;
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    T& operator[](size_t i) const { return items[i]; }
+    T* begin() const { return items; }
+    T* end() const { return items + count; }
+};
+
+/*
+ * AstArena
+ * Owns the nodes of a parse. Nodes are bump-allocated into large chunks
+ * and are never destroyed one by one: dropping the arena frees the whole
+ * tree at once. That is why everything put in it must be trivially
+ * destructible (no std::string, std::vector or shared_ptr members).
+ */
+class AstArena {
+public:
+    AstArena() = default;
+    AstArena(AstArena&&) = default;
+    AstArena& operator=(AstArena&&) = default;
+    AstArena(const AstArena&) = delete;
+    AstArena& operator=(const AstArena&) = delete;
+
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        static_assert(std::is_trivially_destructible<T>::value, "AST nodes must be trivially destructible");
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    // Copies n items into a new list.
+    template <typename T>
+    ArenaList<T> list(const T* items, size_t n) {
+        static_assert(std::is_trivially_copyable<T>::value, "Arena lists hold plain values");
+        ArenaList<T> out;
+        if (n == 0) return out;
+        out.items = static_cast<T*>(allocate(sizeof(T) * n, alignof(T)));
+        out.count = static_cast<uint32_t>(n);
+        for (size_t i = 0; i < n; i++) out.items[i] = items[i];
+        return out;
+    }
+
+    // Takes over all of other's chunks; nodes in them stay where they are.
+    void adopt(AstArena&& other);
+
+    // Total bytes handed out (not counting unused chunk space).
+    size_t bytesUsed() const { return used; }
+
+private:
+    void* allocate(size_t size, size_t align);
+
+    static constexpr size_t CHUNK_SIZE = 64 * 1024;
+    std::vector<std::unique_ptr<char[]>> chunks;
+    char* next = nullptr;
+    size_t left = 0;
+    size_t used = 0;
+};
@@ -0,0 +1,309 @@
+#include "ast_cache.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+using namespace std;
+
+LiteralValue CachedNode::literal() const {
+    LiteralValue value;
+    value.kind = static_cast<LiteralValue::Kind>(detail);
+    uint64_t bits = (uint64_t)b << 32 | a;
+    memcpy(&value.i, &bits, sizeof bits);
+    return value;
+}
+
+uint64_t hashSource(string_view source) {
+    const uint64_t K = 0x9E3779B97F4A7C15ull;
+    uint64_t h = source.size() * K;
+    size_t i = 0;
+    for (; i + 8 <= source.size(); i += 8) {
+        uint64_t w;
+        memcpy(&w, source.data() + i, 8);
+        h = (h ^ w) * K;
+        h ^= h >> 32;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, source.data() + i, source.size() - i);
+    h = (h ^ tail) * K;
+    return h ^ (h >> 29);
+}
+
+string astCachePath(const string& directory, uint64_t sourceHash) {
+    char name[32];
+    snprintf(name, sizeof name, "%016llx.ast", (unsigned long long)sourceHash);
+    return directory + "/" + name;
+}
+
+/////////////////////// READING ///////////////////////
+
+namespace {
+
+bool inside(uint64_t offset, uint64_t count, uint64_t size, uint64_t fileSize) {
+    return offset % 8 == 0 && offset <= fileSize && count <= (fileSize - offset) / size;
+}
+
+// Checks every node and string of an image whose sections are in bounds.
+// Each child or list entry must be NO_NODE (lists: never) or an earlier
+// node of the right sort (statement or expression) that no other node
+// uses; every name, list and string must lie inside its table; tags,
+// operators, literal kinds and declared types must be ones the parser
+// makes. The Flattener writes children before their parents, so a valid
+// image is a tree: any walk of it ends, touching each node at most once.
+class ImageChecker {
+public:
+    ImageChecker(const AstCacheHeader& header, const CachedNode* nodes, const uint32_t* lists,
+                 const CachedString* strings, uint64_t textSize)
+        : header(header), nodes(nodes), lists(lists), strings(strings), textSize(textSize), used(header.nodeCount) {}
+
+    bool valid() {
+        for (uint32_t id = 0; id < header.stringCount; id++)
+            if ((uint64_t)strings[id].offset + strings[id].length > textSize) return false;
+        for (uint32_t i = 0; i < header.nodeCount; i++)
+            if (!(nodes[i].isStmt() ? statement(i) : expression(i))) return false;
+        for (uint32_t k = 0; k < header.rootCount; k++)
+            if (!child(lists[header.rootFirst + k], header.nodeCount, true, false)) return false;
+        return true;
+    }
+
+private:
+    bool name(uint32_t id) const { return id < header.stringCount; }
+
+    // 'index' as a child of node 'parent'.
+    bool child(uint32_t index, uint32_t parent, bool isStmt, bool optional = true) {
+        if (index == NO_NODE) return optional;
+        if (index >= parent || used[index] || nodes[index].isStmt() != isStmt) return false;
+        used[index] = true;
+        return true;
+    }
+
+    bool expression(uint32_t i) {
+        const CachedNode& n = nodes[i];
+        switch (n.tag) {
+        case EXPR_BINARY:
+            return isOperator(static_cast<TokenType>(n.detail)) && child(n.a, i, false) && child(n.b, i, false);
+        case EXPR_LITERAL:
+            switch (n.detail) {
+            case LiteralValue::INT:
+            case LiteralValue::DOUBLE: return true;
+            case LiteralValue::BOOL:   return (n.a & 0xFF) <= 1;
+            case LiteralValue::STRING: return name(n.a);
+            default:                   return false;
+            }
+        case EXPR_VARIABLE:
+            return name(n.a);
+        case EXPR_ASSIGN:
+            return name(n.a) && child(n.b, i, false);
+        default:
+            return false;
+        }
+    }
+
+    bool statement(uint32_t i) {
+        const CachedNode& n = nodes[i];
+        switch (n.stmtKind()) {
+        case STMT_EXPR:
+        case STMT_ANNOUNCE:
+        case STMT_FINISHLINE:
+            return child(n.a, i, false);
+        case STMT_VAR_DECL:
+            return n.detail >= KW_GEAR && n.detail <= KW_FLAG && name(n.a) && child(n.b, i, false);
+        case STMT_BLOCK:
+            if ((uint64_t)n.a + n.b > header.listCount) return false;
+            for (uint32_t k = 0; k < n.b; k++)
+                if (!child(lists[n.a + k], i, true, false)) return false;
+            return true;
+        case STMT_LOOP:
+            return child(n.a, i, false) && child(n.b, i, true);
+        case STMT_FUNC_DEF:
+            return name(n.a) && child(n.b, i, true);
+        case STMT_IF:
+            return child(n.a, i, false) && child(n.b, i, true) && child(n.c, i, true);
+        case STMT_LISTEN:
+            return name(n.a);
+        default:
+            return false;
+        }
+    }
+
+    const AstCacheHeader& header;
+    const CachedNode* nodes;
+    const uint32_t* lists;
+    const CachedString* strings;
+    uint64_t textSize;
+    vector<bool> used;
+};
+
+} // namespace
+
+bool AstImage::open(const string& path, uint64_t sourceHash, uint64_t sourceSize) {
+    try {
+        file = make_unique<MappedFile>(path);
+    }
+    catch (const exception&) {
+        return false;
+    }
+    uint64_t size = file->size();
+    if (size < sizeof(AstCacheHeader)) return false;
+
+    header = reinterpret_cast<const AstCacheHeader*>(file->data());
+    if (memcmp(header->magic, "ASTCACHE", 8) != 0 || header->version != AST_CACHE_VERSION ||
+        header->nodeSize != sizeof(CachedNode) || header->fileSize != size ||
+        header->sourceHash != sourceHash || header->sourceSize != sourceSize)
+        return false;
+    const size_t summed = offsetof(AstCacheHeader, sourceHash);
+    if (header->checksum != hashSource(string_view(file->data() + summed, size - summed))) return false;
+    if (!inside(header->nodesOffset, header->nodeCount, sizeof(CachedNode), size) ||
+        !inside(header->listsOffset, header->listCount, sizeof(uint32_t), size) ||
+        !inside(header->stringsOffset, header->stringCount, sizeof(CachedString), size) ||
+        header->textOffset > size ||
+        (uint64_t)header->rootFirst + header->rootCount > header->listCount)
+        return false;
+
+    nodes = reinterpret_cast<const CachedNode*>(file->data() + header->nodesOffset);
+    lists = reinterpret_cast<const uint32_t*>(file->data() + header->listsOffset);
+    strings = reinterpret_cast<const CachedString*>(file->data() + header->stringsOffset);
+    text = file->data() + header->textOffset;
+    return ImageChecker(*header, nodes, lists, strings, size - header->textOffset).valid();
+}
+
+/////////////////////// WRITING ///////////////////////
+
+namespace {
+
+// Flattens a tree into node and list tables, children before parents.
+class Flattener {
+public:
+    vector<CachedNode> nodes;
+    vector<uint32_t> lists;
+
+    uint32_t add(Stmt* stmt) { return stmt ? stmt->accept(*this) : NO_NODE; }
+    uint32_t add(Expr* expr) { return expr ? expr->accept(*this) : NO_NODE; }
+
+    // Appends the statements as one run of 'lists'; returns its start.
+    uint32_t addList(Stmt* const* first, Stmt* const* last) {
+        vector<uint32_t> items;
+        for (Stmt* const* s = first; s != last; s++)
+            if (*s) items.push_back(add(*s));
+        uint32_t start = static_cast<uint32_t>(lists.size());
+        lists.insert(lists.end(), items.begin(), items.end());
+        return start;
+    }
+
+    uint32_t visit(BinaryExpr& expr) {
+        uint32_t left = add(expr.left), right = add(expr.right);
+        return node(EXPR_BINARY, static_cast<uint8_t>(expr.op), expr.line, left, right);
+    }
+    uint32_t visit(LiteralExpr& expr) {
+        uint64_t bits;
+        memcpy(&bits, &expr.value.i, sizeof bits);
+        return node(EXPR_LITERAL, expr.value.kind, expr.line, static_cast<uint32_t>(bits), static_cast<uint32_t>(bits >> 32));
+    }
+    uint32_t visit(VariableExpr& expr) { return node(EXPR_VARIABLE, 0, expr.line, expr.name); }
+    uint32_t visit(AssignExpr& expr) {
+        uint32_t value = add(expr.value);
+        return node(EXPR_ASSIGN, 0, expr.line, expr.name, value);
+    }
+
+    uint32_t visit(ExprStmt& stmt) { return statement(STMT_EXPR, 0, 0, add(stmt.expression)); }
+    uint32_t visit(AnnounceStmt& stmt) { return statement(STMT_ANNOUNCE, 0, 0, add(stmt.expression)); }
+    uint32_t visit(FinishlineStmt& stmt) { return statement(STMT_FINISHLINE, 0, 0, add(stmt.value)); }
+    uint32_t visit(VarDeclStmt& stmt) {
+        uint32_t init = add(stmt.initializer);
+        return statement(STMT_VAR_DECL, static_cast<uint8_t>(stmt.type), stmt.line, stmt.name, init);
+    }
+    uint32_t visit(BlockStmt& stmt) {
+        uint32_t first = addList(stmt.statements.begin(), stmt.statements.end());
+        return statement(STMT_BLOCK, 0, 0, first, static_cast<uint32_t>(lists.size()) - first);
+    }
+    uint32_t visit(LoopStmt& stmt) {
+        uint32_t condition = add(stmt.condition), body = add(stmt.body);
+        return statement(STMT_LOOP, 0, 0, condition, body);
+    }
+    uint32_t visit(FuncDefStmt& stmt) {
+        uint32_t body = add(stmt.body);
+        return statement(STMT_FUNC_DEF, 0, stmt.line, stmt.name, body);
+    }
+    uint32_t visit(IfStmt& stmt) {
+        uint32_t condition = add(stmt.condition), thenBranch = add(stmt.thenBranch), elseBranch = add(stmt.elseBranch);
+        return statement(STMT_IF, 0, 0, condition, thenBranch, elseBranch);
+    }
+    uint32_t visit(ListenStmt& stmt) { return statement(STMT_LISTEN, 0, stmt.line, stmt.name); }
+
+private:
+    uint32_t node(uint8_t tag, uint8_t detail, int line, uint32_t a = NO_NODE, uint32_t b = NO_NODE, uint32_t c = NO_NODE) {
+        nodes.push_back({ tag, detail, 0, line, a, b, c });
+        return static_cast<uint32_t>(nodes.size() - 1);
+    }
+    uint32_t statement(StmtKind kind, uint8_t detail, int line, uint32_t a = NO_NODE, uint32_t b = NO_NODE, uint32_t c = NO_NODE) {
+        return node(static_cast<uint8_t>(CACHED_STMT | kind), detail, line, a, b, c);
+    }
+};
+
+uint64_t align8(uint64_t n) { return (n + 7) & ~uint64_t(7); }
+
+} // namespace
+
+bool writeAstCache(const string& path, uint64_t sourceHash, uint64_t sourceSize,
+                   const vector<Stmt*>& statements, const SymbolTable& symbols) {
+    Flattener flat;
+    uint32_t rootFirst = flat.addList(statements.data(), statements.data() + statements.size());
+
+    vector<CachedString> strings(symbols.size());
+    string text;
+    for (Symbol id = 0; id < symbols.size(); id++) {
+        string_view name = symbols.name(id);
+        strings[id] = { static_cast<uint32_t>(text.size()), static_cast<uint32_t>(name.size()) };
+        text.append(name.data(), name.size());
+    }
+
+    AstCacheHeader header = {};
+    memcpy(header.magic, "ASTCACHE", 8);
+    header.version = AST_CACHE_VERSION;
+    header.nodeSize = sizeof(CachedNode);
+    header.sourceHash = sourceHash;
+    header.sourceSize = sourceSize;
+    header.nodeCount = static_cast<uint32_t>(flat.nodes.size());
+    header.listCount = static_cast<uint32_t>(flat.lists.size());
+    header.stringCount = static_cast<uint32_t>(strings.size());
+    header.rootFirst = rootFirst;
+    header.rootCount = static_cast<uint32_t>(flat.lists.size()) - rootFirst;
+    header.nodesOffset = align8(sizeof header);
+    header.listsOffset = align8(header.nodesOffset + flat.nodes.size() * sizeof(CachedNode));
+    header.stringsOffset = align8(header.listsOffset + flat.lists.size() * sizeof(uint32_t));
+    header.textOffset = align8(header.stringsOffset + strings.size() * sizeof(CachedString));
+    header.fileSize = header.textOffset + text.size();
+
+    // The file is built in memory first, so the checksum can go in its header.
+    string image(header.fileSize, '\0');
+    auto section = [&](uint64_t offset, const void* data, size_t size) {
+        if (size > 0) memcpy(&image[offset], data, size);
+    };
+    section(header.nodesOffset, flat.nodes.data(), flat.nodes.size() * sizeof(CachedNode));
+    section(header.listsOffset, flat.lists.data(), flat.lists.size() * sizeof(uint32_t));
+    section(header.stringsOffset, strings.data(), strings.size() * sizeof(CachedString));
+    section(header.textOffset, text.data(), text.size());
+    const size_t summed = offsetof(AstCacheHeader, sourceHash);
+    section(summed, reinterpret_cast<const char*>(&header) + summed, sizeof header - summed);
+    header.checksum = hashSource(string_view(image).substr(summed));
+    section(0, &header, sizeof header);
+
+    string temp = temporaryPath(path);
+    {
+        ofstream out(temp, ios::binary | ios::trunc);
+        if (!out) return false;
+        out.write(image.data(), static_cast<streamsize>(image.size()));
+        if (!out) {
+            out.close();
+            remove(temp.c_str());
+            return false;
+        }
+    }
+    if (rename(temp.c_str(), path.c_str()) != 0) {
+        remove(temp.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "mapped_file.h"
+#include "parser.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ * AST cache
+ * A parsed program saved as one flat, position-independent file that is
+ * used in place: AstImage maps it and hands out its nodes directly, with no
+ * step that rebuilds a tree, a symbol table or anything else.
+ *
+ * Layout (integers in host byte order; each section 8-byte aligned):
+ *   AstCacheHeader
+ *   CachedNode nodes[nodeCount]         Children are indices into this table
+ *   uint32_t   lists[listCount]         Statement lists: runs of node indices
+ *   CachedString strings[stringCount]   Indexed by Symbol
+ *   char       text[]                   The strings' bytes
+ *
+ * The header records the format version, the hash and size of the source
+ * the tree came from, and a checksum over the rest of the file; a file
+ * that does not match is ignored. Only
+ * parses without errors are cached, so a cached program has no
+ * diagnostics to replay.
+ */
+constexpr uint32_t AST_CACHE_VERSION = 2;
+constexpr uint32_t NO_NODE = 0xFFFFFFFFu;
+
+// Statement tags are CACHED_STMT | StmtKind; expression tags the ExprKind.
+constexpr uint8_t CACHED_STMT = 0x80;
+
+struct AstCacheHeader {
+    char magic[8];      // "ASTCACHE"
+    uint32_t version;   // AST_CACHE_VERSION
+    uint32_t nodeSize;  // sizeof(CachedNode), as a layout check
+    uint64_t checksum;  // hashSource of the file from sourceHash to its end
+    uint64_t sourceHash;
+    uint64_t sourceSize;
+    uint32_t nodeCount;
+    uint32_t listCount;
+    uint32_t stringCount;
+    uint32_t rootFirst; // The program's statements: lists[rootFirst ..]
+    uint32_t rootCount;
+    uint32_t reserved;
+    uint64_t nodesOffset;
+    uint64_t listsOffset;
+    uint64_t stringsOffset;
+    uint64_t textOffset;
+    uint64_t fileSize;
+};
+
+/*
+ * CachedNode
+ * One Expr or Stmt. What a, b and c hold depends on the tag:
+ *   BinaryExpr     detail: operator    a: left    b: right
+ *   LiteralExpr    detail: value kind  a, b: low and high half of the value
+ *   VariableExpr   a: name
+ *   AssignExpr     a: name    b: value
+ *   ExprStmt, AnnounceStmt, FinishlineStmt     a: expression
+ *   VarDeclStmt    detail: type        a: name    b: initializer
+ *   BlockStmt      a: first list entry b: count
+ *   LoopStmt       a: condition        b: body
+ *   FuncDefStmt    a: name    b: body
+ *   IfStmt         a: condition        b: then    c: else
+ *   ListenStmt     a: name
+ * Names are Symbols (indices into the string table); a missing child is
+ * NO_NODE.
+ */
+struct CachedNode {
+    uint8_t tag;
+    uint8_t detail;
+    uint16_t reserved;
+    int32_t line;
+    uint32_t a;
+    uint32_t b;
+    uint32_t c;
+
+    bool isStmt() const { return (tag & CACHED_STMT) != 0; }
+    ExprKind exprKind() const { return static_cast<ExprKind>(tag); }
+    StmtKind stmtKind() const { return static_cast<StmtKind>(tag & ~CACHED_STMT); }
+    LiteralValue literal() const;
+};
+
+struct CachedString {
+    uint32_t offset; // Into text
+    uint32_t length;
+};
+
+/*
+ * hashSource
+ * The content hash a cache entry is keyed on. Reads 8 bytes at a time, so
+ * checking a warm cache costs little more than touching the source once.
+ */
+uint64_t hashSource(std::string_view source);
+
+/*
+ * AstImage
+ * A mapped cache file. open() checks the header and the checksum, that
+ * every section lies inside the file, and every node: that each child and
+ * list entry is an earlier node of the right sort used nowhere else, and
+ * that every name and list is inside its table. A torn or corrupted file
+ * therefore fails to open (and the caller parses the source instead)
+ * rather than handing out a different tree, or leading a walk out of
+ * bounds or round in circles.
+ */
+class AstImage {
+public:
+    // False if the file is missing, from another format version, for
+    // other source text, truncated or otherwise malformed.
+    bool open(const std::string& path, uint64_t sourceHash, uint64_t sourceSize);
+
+    const CachedNode& node(uint32_t index) const { return nodes[index]; }
+    const uint32_t* list(uint32_t first) const { return lists + first; }
+    std::string_view name(uint32_t id) const {
+        return std::string_view(text + strings[id].offset, strings[id].length);
+    }
+
+    const uint32_t* roots() const { return lists + header->rootFirst; }
+    uint32_t rootCount() const { return header->rootCount; }
+
+private:
+    std::unique_ptr<MappedFile> file;
+    const AstCacheHeader* header = nullptr;
+    const CachedNode* nodes = nullptr;
+    const uint32_t* lists = nullptr;
+    const CachedString* strings = nullptr;
+    const char* text = nullptr;
+};
+
+/*
+ * writeAstCache
+ * Saves 'statements' (names from 'symbols') as the cache file 'path' for
+ * source text with the given hash and size. The file is written under a
+ * temporary name of its own (see temporaryPath) and renamed into place,
+ * so readers never see half of it, even with several writers. Returns
+ * false if it could not be written. Shared subexpressions
+ * (Parser::shareExpressions) are written once per use.
+ */
+bool writeAstCache(const std::string& path, uint64_t sourceHash, uint64_t sourceSize,
+                   const std::vector<Stmt*>& statements, const SymbolTable& symbols);
+
+/*
+ * astCachePath
+ * Where the cache entry for source with 'sourceHash' lives in 'directory'.
+ */
+std::string astCachePath(const std::string& directory, uint64_t sourceHash);
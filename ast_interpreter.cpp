@@ -0,0 +1,766 @@
+#include "ast_interpreter.h"
+#include "literal.h"
+#include "type_checker.h"
+
+#include <charconv>
+
+using namespace std;
+
+namespace {
+
+// What an expression node has been rewritten into (Expr::spec).
+enum Spec : uint8_t {
+    SPEC_UNSEEN, // Not run yet
+    SPEC_GENERIC, // Saw types its specialization did not cover
+
+    // LiteralExpr
+    CONST_GEAR,
+    CONST_TURBO,
+    CONST_FLAG,
+    CONST_TEXT, // Expr::slot indexes the interpreter's literals
+
+    // VariableExpr, by the variable's type; Expr::slot is its slot
+    READ_GEAR,
+    READ_TURBO,
+    READ_FLAG,
+    READ_TEXT,
+
+    // AssignExpr, by the variable's type and the value's
+    STORE_GEAR,
+    STORE_TURBO,
+    STORE_FLAG,
+    STORE_TEXT,
+    STORE_GEAR_FROM_TURBO,
+    STORE_TURBO_FROM_GEAR,
+
+    // BinaryExpr: gear with gear (and flag with flag for == and !=)...
+    ADD_I, SUB_I, MUL_I, DIV_I,
+    EQ_I, NE_I, LT_I, LE_I, GT_I, GE_I,
+    // ...turbo with turbo or gear...
+    ADD_D, SUB_D, MUL_D, DIV_D,
+    EQ_D, NE_D, LT_D, LE_D, GT_D, GE_D,
+    // ...exhaust with exhaust, and '+' with an exhaust on either side
+    EQ_S, NE_S, LT_S, LE_S, GT_S, GE_S,
+    CONCAT
+};
+
+// Offsets from ADD_x and EQ_x, in the order of the specs above.
+int arithmeticIndex(TokenType op) { return op == OP_PLUS ? 0 : op == OP_MINUS ? 1 : op == OP_STAR ? 2 : 3; }
+
+int comparisonIndex(TokenType op) {
+    switch (op) {
+    case OP_EQUAL:         return 0;
+    case OP_NOT_EQUAL:     return 1;
+    case OP_LESS:          return 2;
+    case OP_LESS_EQUAL:    return 3;
+    case OP_GREATER:       return 4;
+    default:               return 5;
+    }
+}
+
+bool isArithmetic(TokenType op) { return op == OP_PLUS || op == OP_MINUS || op == OP_STAR || op == OP_SLASH; }
+
+bool isNumeric(ValueType type) { return type == TYPE_GEAR || type == TYPE_TURBO; }
+
+double toTurbo(ValueType type, int64_t i, double d) { return type == TYPE_TURBO ? d : (double)i; }
+
+template <typename T>
+bool compare(int index, const T& a, const T& b) {
+    switch (index) {
+    case 0:  return a == b;
+    case 1:  return a != b;
+    case 2:  return a < b;
+    case 3:  return a <= b;
+    case 4:  return a > b;
+    default: return a >= b;
+    }
+}
+
+bool assigns(Expr* expr) {
+    if (!expr) return false;
+    switch (expr->kind) {
+    case EXPR_ASSIGN: return true;
+    case EXPR_BINARY: {
+        auto binary = static_cast<BinaryExpr*>(expr);
+        return assigns(binary->left) || assigns(binary->right);
+    }
+    default: return false;
+    }
+}
+
+int lineOf(Expr* expr) {
+    if (!expr) return 0;
+    switch (expr->kind) {
+    case EXPR_BINARY:   return static_cast<BinaryExpr*>(expr)->line;
+    case EXPR_LITERAL:  return static_cast<LiteralExpr*>(expr)->line;
+    case EXPR_VARIABLE: return static_cast<VariableExpr*>(expr)->line;
+    default:            return static_cast<AssignExpr*>(expr)->line;
+    }
+}
+
+// Puts a tree's expression nodes back to unseen.
+class Unspecializer {
+public:
+    friend struct ::Expr;
+    friend struct ::Stmt;
+
+    void walk(Stmt* stmt) { if (stmt) stmt->accept(*this); }
+    void walk(Expr* expr) {
+        if (!expr) return;
+        expr->spec = SPEC_UNSEEN;
+        expr->accept(*this);
+    }
+
+private:
+    void visit(BinaryExpr& expr) { walk(expr.left); walk(expr.right); }
+    void visit(LiteralExpr&) {}
+    void visit(VariableExpr&) {}
+    void visit(AssignExpr& expr) { walk(expr.value); }
+
+    void visit(ExprStmt& stmt) { walk(stmt.expression); }
+    void visit(AnnounceStmt& stmt) { walk(stmt.expression); }
+    void visit(VarDeclStmt& stmt) { walk(stmt.initializer); }
+    void visit(BlockStmt& stmt) { for (Stmt* s : stmt.statements) walk(s); }
+    void visit(LoopStmt& stmt) { walk(stmt.condition); walk(stmt.body); }
+    void visit(FinishlineStmt& stmt) { walk(stmt.value); }
+    void visit(FuncDefStmt&) {}
+    void visit(IfStmt& stmt) { walk(stmt.condition); walk(stmt.thenBranch); walk(stmt.elseBranch); }
+    void visit(ListenStmt&) {}
+};
+
+} // namespace
+
+RunResult AstInterpreter::run(FuncDefStmt& func, Diagnostics& diags, bool countHits) {
+    TypeChecker checker(symbols, diags);
+    if (!checker.check(func)) return { false, 0, 0 };
+    Unspecializer().walk(func.body);
+
+    // Every slot starts as 0 or "", as a declaration without a value would.
+    types = checker.slotTypes();
+    numbers.assign(func.frameSize, Number{ 0 });
+    if (texts.size() < func.frameSize) texts.resize(func.frameSize);
+    for (size_t k = 0; k < func.frameSize; k++) texts[k].clear();
+
+    diagnostics = &diags;
+    counting = countHits;
+    literals.clear();
+    scratchUsed = 0;
+    failed = finished = false;
+    result = 0;
+
+    if (func.body && func.body->kind == STMT_BLOCK) {
+        for (Stmt* s : static_cast<BlockStmt*>(func.body)->statements) {
+            execute(s);
+            if (failed || finished) break;
+        }
+    }
+    else {
+        execute(func.body);
+    }
+    flush();
+    return { !failed, failed ? 0 : result, 0 };
+}
+
+/////////////////////// OUTPUT ///////////////////////
+
+void AstInterpreter::flush() {
+    out.write(output.data(), (streamsize)output.size());
+    output.clear();
+}
+
+// The first error stops the run; anything computed after it is dropped.
+void AstInterpreter::fail(int line, DiagCode code, string message) {
+    if (failed) return;
+    failed = true;
+    diagnostics->report(line, 0, code, move(message));
+}
+
+/////////////////////// SCRATCH ///////////////////////
+
+// A string for text made while the current statement runs.
+string& AstInterpreter::temporary() {
+    if (scratchUsed == scratch.size()) scratch.emplace_back();
+    string& s = scratch[scratchUsed++];
+    s.clear();
+    return s;
+}
+
+/////////////////////// EXPRESSIONS ///////////////////////
+
+AstInterpreter::Value AstInterpreter::eval(Expr* expr) {
+    Value v;
+    switch (expr->spec) {
+    case CONST_GEAR:
+    case CONST_FLAG:
+        if (counting) counters.hits++;
+        v.type = expr->spec == CONST_GEAR ? TYPE_GEAR : TYPE_FLAG;
+        v.i = expr->spec == CONST_GEAR ? static_cast<LiteralExpr*>(expr)->value.i : static_cast<LiteralExpr*>(expr)->value.b;
+        return v;
+    case CONST_TURBO:
+        if (counting) counters.hits++;
+        v.type = TYPE_TURBO;
+        v.d = static_cast<LiteralExpr*>(expr)->value.d;
+        return v;
+    case CONST_TEXT:
+        if (counting) counters.hits++;
+        v.type = TYPE_EXHAUST;
+        v.s = &literals[expr->slot];
+        return v;
+
+    case READ_GEAR:
+    case READ_FLAG:
+    case READ_TURBO:
+        if (counting) counters.hits++;
+        v.type = expr->spec == READ_GEAR ? TYPE_GEAR : expr->spec == READ_FLAG ? TYPE_FLAG : TYPE_TURBO;
+        v.i = numbers[expr->slot].i;
+        return v;
+    case READ_TEXT:
+        if (counting) counters.hits++;
+        v.type = TYPE_EXHAUST;
+        v.s = &texts[expr->slot];
+        return v;
+
+    case STORE_GEAR:
+    case STORE_TURBO:
+    case STORE_FLAG:
+    case STORE_GEAR_FROM_TURBO:
+    case STORE_TURBO_FROM_GEAR: {
+        auto& assign = static_cast<AssignExpr&>(*expr);
+        static const ValueType from[] = { TYPE_GEAR, TYPE_TURBO, TYPE_FLAG, TYPE_EXHAUST, TYPE_TURBO, TYPE_GEAR };
+        static const ValueType to[] = { TYPE_GEAR, TYPE_TURBO, TYPE_FLAG, TYPE_EXHAUST, TYPE_GEAR, TYPE_TURBO };
+        int index = expr->spec - STORE_GEAR;
+        v = eval(assign.value);
+        if (v.type != from[index]) return store(static_cast<AssignExpr&>(deopt(*expr)), v);
+        if (counting) counters.hits++;
+        if (expr->spec == STORE_GEAR_FROM_TURBO) v.i = turboToGear(v.d);
+        else if (expr->spec == STORE_TURBO_FROM_GEAR) v.d = (double)v.i;
+        v.type = to[index];
+        numbers[expr->slot].i = v.i;
+        return v;
+    }
+    case STORE_TEXT: {
+        auto& assign = static_cast<AssignExpr&>(*expr);
+        v = eval(assign.value);
+        if (v.type != TYPE_EXHAUST) return store(static_cast<AssignExpr&>(deopt(*expr)), v);
+        if (counting) counters.hits++;
+        string& variable = texts[expr->slot];
+        if (v.s != &variable) variable.assign(*v.s);
+        v.s = &variable;
+        return v;
+    }
+
+    case ADD_I:
+    case SUB_I:
+    case MUL_I:
+    case DIV_I: {
+        auto& node = static_cast<BinaryExpr&>(*expr);
+        Value left = operand(node.left);
+        Value right = operand(node.right);
+        if (left.type != TYPE_GEAR || right.type != TYPE_GEAR) return binary(static_cast<BinaryExpr&>(deopt(*expr)), left, right);
+        if (counting) counters.hits++;
+        v.type = TYPE_GEAR;
+        switch (expr->spec) {
+        case ADD_I: v.i = wrapGear((uint64_t)left.i + (uint64_t)right.i); break;
+        case SUB_I: v.i = wrapGear((uint64_t)left.i - (uint64_t)right.i); break;
+        case MUL_I: v.i = wrapGear((uint64_t)left.i * (uint64_t)right.i); break;
+        default:
+            if (right.i == 0) {
+                fail(node.line, DIAG_DIVISION_BY_ZERO, "Division by zero.");
+                v.i = 0;
+            }
+            else {
+                v.i = right.i == -1 ? wrapGear(0 - (uint64_t)left.i) : left.i / right.i;
+            }
+            break;
+        }
+        return v;
+    }
+    case EQ_I:
+    case NE_I:
+    case LT_I:
+    case LE_I:
+    case GT_I:
+    case GE_I: {
+        auto& node = static_cast<BinaryExpr&>(*expr);
+        Value left = operand(node.left);
+        Value right = operand(node.right);
+        // Flags only reach here for == and !=, as specialize() never picks
+        // another integer comparison for them.
+        if (left.type != right.type || (left.type != TYPE_GEAR && left.type != TYPE_FLAG))
+            return binary(static_cast<BinaryExpr&>(deopt(*expr)), left, right);
+        if (counting) counters.hits++;
+        v.type = TYPE_FLAG;
+        switch (expr->spec) {
+        case EQ_I: v.i = left.i == right.i; break;
+        case NE_I: v.i = left.i != right.i; break;
+        case LT_I: v.i = left.i < right.i; break;
+        case LE_I: v.i = left.i <= right.i; break;
+        case GT_I: v.i = left.i > right.i; break;
+        default:   v.i = left.i >= right.i; break;
+        }
+        return v;
+    }
+    case ADD_D:
+    case SUB_D:
+    case MUL_D:
+    case DIV_D:
+    case EQ_D:
+    case NE_D:
+    case LT_D:
+    case LE_D:
+    case GT_D:
+    case GE_D: {
+        auto& node = static_cast<BinaryExpr&>(*expr);
+        Value left = operand(node.left);
+        Value right = operand(node.right);
+        if (!isNumeric(left.type) || !isNumeric(right.type) || (left.type == TYPE_GEAR && right.type == TYPE_GEAR))
+            return binary(static_cast<BinaryExpr&>(deopt(*expr)), left, right);
+        if (counting) counters.hits++;
+        double a = toTurbo(left.type, left.i, left.d);
+        double b = toTurbo(right.type, right.i, right.d);
+        if (expr->spec <= DIV_D) v.type = TYPE_TURBO;
+        else v.type = TYPE_FLAG;
+        switch (expr->spec) {
+        case ADD_D: v.d = a + b; break;
+        case SUB_D: v.d = a - b; break;
+        case MUL_D: v.d = a * b; break;
+        case DIV_D: v.d = a / b; break;
+        case EQ_D:  v.i = a == b; break;
+        case NE_D:  v.i = a != b; break;
+        case LT_D:  v.i = a < b; break;
+        case LE_D:  v.i = a <= b; break;
+        case GT_D:  v.i = a > b; break;
+        default:    v.i = a >= b; break;
+        }
+        return v;
+    }
+    case EQ_S:
+    case NE_S:
+    case LT_S:
+    case LE_S:
+    case GT_S:
+    case GE_S: {
+        auto& node = static_cast<BinaryExpr&>(*expr);
+        Value left = eval(node.left);
+        Value right = eval(node.right);
+        if (left.type != TYPE_EXHAUST || right.type != TYPE_EXHAUST)
+            return binary(static_cast<BinaryExpr&>(deopt(*expr)), left, right);
+        if (counting) counters.hits++;
+        v.type = TYPE_FLAG;
+        v.i = compare(expr->spec - EQ_S, *left.s, *right.s);
+        return v;
+    }
+    case CONCAT: {
+        auto& node = static_cast<BinaryExpr&>(*expr);
+        Value left = eval(node.left);
+        Value right = eval(node.right);
+        if (left.type != TYPE_EXHAUST && right.type != TYPE_EXHAUST)
+            return binary(static_cast<BinaryExpr&>(deopt(*expr)), left, right);
+        if (counting) counters.hits++;
+        string& joined = temporary();
+        joined = text(left);
+        joined += text(right);
+        v.type = TYPE_EXHAUST;
+        v.s = &joined;
+        return v;
+    }
+
+    default:
+        if (counting && expr->spec == SPEC_GENERIC) counters.generic++;
+        switch (expr->kind) {
+        case EXPR_BINARY:   return evalBinary(static_cast<BinaryExpr&>(*expr));
+        case EXPR_LITERAL:  return evalLiteral(static_cast<LiteralExpr&>(*expr));
+        case EXPR_VARIABLE: return evalVariable(static_cast<VariableExpr&>(*expr));
+        default:            return evalAssign(static_cast<AssignExpr&>(*expr));
+        }
+    }
+}
+
+// eval() with the commonest leaves done here, saving a call.
+inline AstInterpreter::Value AstInterpreter::operand(Expr* expr) {
+    Value v;
+    switch (expr->spec) {
+    case READ_GEAR:
+        if (counting) counters.hits++;
+        v.type = TYPE_GEAR;
+        v.i = numbers[expr->slot].i;
+        return v;
+    case READ_TURBO:
+        if (counting) counters.hits++;
+        v.type = TYPE_TURBO;
+        v.d = numbers[expr->slot].d;
+        return v;
+    case CONST_GEAR:
+        if (counting) counters.hits++;
+        v.type = TYPE_GEAR;
+        v.i = static_cast<LiteralExpr*>(expr)->value.i;
+        return v;
+    default:
+        return eval(expr);
+    }
+}
+
+// The general case of each node, which also picks its specialization
+// the first time it runs.
+AstInterpreter::Value AstInterpreter::evalBinary(BinaryExpr& expr) {
+    Value left = eval(expr.left);
+    // A variable is read where the operator runs, so if the right side
+    // may assign to it, its text is copied first (numbers already are).
+    bool inVariable = expr.left && (expr.left->kind == EXPR_VARIABLE || expr.left->kind == EXPR_ASSIGN);
+    bool copy = left.type == TYPE_EXHAUST && inVariable && assigns(expr.right);
+    if (copy) {
+        string& saved = temporary();
+        saved = *left.s;
+        left.s = &saved;
+    }
+    Value right = eval(expr.right);
+    if (expr.spec != SPEC_UNSEEN || failed) return binary(expr, left, right);
+
+    // The specialized variants never copy, so a node that must stays
+    // generic.
+    uint8_t spec = SPEC_GENERIC;
+    ValueType l = left.type, r = right.type;
+    if (isArithmetic(expr.op)) {
+        if (expr.op == OP_PLUS && (l == TYPE_EXHAUST || r == TYPE_EXHAUST)) spec = copy ? SPEC_GENERIC : CONCAT;
+        else if (l == TYPE_GEAR && r == TYPE_GEAR) spec = (uint8_t)(ADD_I + arithmeticIndex(expr.op));
+        else if (isNumeric(l) && isNumeric(r)) spec = (uint8_t)(ADD_D + arithmeticIndex(expr.op));
+    }
+    else {
+        int index = comparisonIndex(expr.op);
+        if ((l == TYPE_GEAR && r == TYPE_GEAR) || (l == TYPE_FLAG && r == TYPE_FLAG && index < 2)) spec = (uint8_t)(EQ_I + index);
+        else if (isNumeric(l) && isNumeric(r)) spec = (uint8_t)(EQ_D + index);
+        else if (l == TYPE_EXHAUST && r == TYPE_EXHAUST && !copy) spec = (uint8_t)(EQ_S + index);
+    }
+    Value v = binary(expr, left, right);
+    if (failed) return v;
+    expr.spec = spec;
+    if (spec != SPEC_GENERIC) counters.rewrites++;
+    return v;
+}
+
+// A slot's type never changes, so a read is specialized at once.
+AstInterpreter::Value AstInterpreter::evalVariable(VariableExpr& expr) {
+    ValueType type = types[expr.slot];
+    static const uint8_t reads[] = { READ_GEAR, READ_TURBO, READ_TEXT, READ_FLAG };
+    expr.spec = reads[type];
+    counters.rewrites++;
+    Value v;
+    v.type = type;
+    if (type == TYPE_EXHAUST) v.s = &texts[expr.slot];
+    else v.i = numbers[expr.slot].i;
+    return v;
+}
+
+AstInterpreter::Value AstInterpreter::evalAssign(AssignExpr& expr) {
+    Value value = eval(expr.value);
+    if (expr.spec != SPEC_UNSEEN || failed) return store(expr, value);
+
+    ValueType type = types[expr.slot];
+    uint8_t spec = SPEC_GENERIC;
+    if (value.type == type) {
+        static const uint8_t stores[] = { STORE_GEAR, STORE_TURBO, STORE_TEXT, STORE_FLAG };
+        spec = stores[type];
+    }
+    else if (type == TYPE_GEAR && value.type == TYPE_TURBO) {
+        spec = STORE_GEAR_FROM_TURBO;
+    }
+    else if (type == TYPE_TURBO && value.type == TYPE_GEAR) {
+        spec = STORE_TURBO_FROM_GEAR;
+    }
+    Value v = store(expr, value);
+    if (failed) return v;
+    expr.spec = spec;
+    if (spec != SPEC_GENERIC) counters.rewrites++;
+    return v;
+}
+
+AstInterpreter::Value AstInterpreter::evalLiteral(LiteralExpr& expr) {
+    Value v;
+    switch (expr.value.kind) {
+    case LiteralValue::INT:
+        expr.spec = CONST_GEAR;
+        v.type = TYPE_GEAR;
+        v.i = expr.value.i;
+        break;
+    case LiteralValue::DOUBLE:
+        expr.spec = CONST_TURBO;
+        v.type = TYPE_TURBO;
+        v.d = expr.value.d;
+        break;
+    case LiteralValue::BOOL:
+        expr.spec = CONST_FLAG;
+        v.type = TYPE_FLAG;
+        v.i = expr.value.b;
+        break;
+    default:
+        expr.spec = CONST_TEXT;
+        expr.slot = (uint32_t)literals.size();
+        literals.emplace_back(symbols.name(expr.value.s));
+        v.type = TYPE_EXHAUST;
+        v.s = &literals.back();
+        break;
+    }
+    counters.rewrites++;
+    return v;
+}
+
+// 'expr' computed from its operands' values, for any types.
+AstInterpreter::Value AstInterpreter::binary(BinaryExpr& expr, Value left, Value right) {
+    Value v;
+    v.type = TYPE_ERROR;
+    v.i = 0;
+    if (left.type == TYPE_ERROR || right.type == TYPE_ERROR) return v;
+    ValueType l = left.type, r = right.type;
+
+    if (isArithmetic(expr.op)) {
+        if (expr.op == OP_PLUS && (l == TYPE_EXHAUST || r == TYPE_EXHAUST)) {
+            string& joined = temporary();
+            joined = text(left);
+            joined += text(right);
+            v.type = TYPE_EXHAUST;
+            v.s = &joined;
+            return v;
+        }
+        if (!isNumeric(l) || !isNumeric(r)) {
+            fail(expr.line, DIAG_TYPE_MISMATCH, "Operator '" + string(tokenSpelling(expr.op)) + "' cannot be applied to " +
+                 typeName(l) + " and " + typeName(r) + ".");
+            return v;
+        }
+        if (l == TYPE_GEAR && r == TYPE_GEAR) {
+            v.type = TYPE_GEAR;
+            uint64_t a = (uint64_t)left.i, b = (uint64_t)right.i;
+            switch (expr.op) {
+            case OP_PLUS:  v.i = wrapGear(a + b); break;
+            case OP_MINUS: v.i = wrapGear(a - b); break;
+            case OP_STAR:  v.i = wrapGear(a * b); break;
+            default:
+                if (right.i == 0) fail(expr.line, DIAG_DIVISION_BY_ZERO, "Division by zero.");
+                else v.i = right.i == -1 ? wrapGear(0 - a) : left.i / right.i;
+                break;
+            }
+            return v;
+        }
+        double a = toTurbo(l, left.i, left.d), b = toTurbo(r, right.i, right.d);
+        v.type = TYPE_TURBO;
+        switch (expr.op) {
+        case OP_PLUS:  v.d = a + b; break;
+        case OP_MINUS: v.d = a - b; break;
+        case OP_STAR:  v.d = a * b; break;
+        default:       v.d = a / b; break;
+        }
+        return v;
+    }
+
+    int index = comparisonIndex(expr.op);
+    v.type = TYPE_FLAG;
+    if (isNumeric(l) && isNumeric(r)) {
+        if (l == TYPE_GEAR && r == TYPE_GEAR) v.i = compare(index, left.i, right.i);
+        else v.i = compare(index, toTurbo(l, left.i, left.d), toTurbo(r, right.i, right.d));
+    }
+    else if (l == TYPE_EXHAUST && r == TYPE_EXHAUST) {
+        v.i = compare(index, *left.s, *right.s);
+    }
+    else if (l == TYPE_FLAG && r == TYPE_FLAG && index < 2) {
+        v.i = compare(index, left.i, right.i);
+    }
+    else {
+        fail(expr.line, DIAG_TYPE_MISMATCH, "Cannot compare " + string(typeName(l)) + " and " + typeName(r) + " with '" +
+             string(tokenSpelling(expr.op)) + "'.");
+        v.type = TYPE_ERROR;
+    }
+    return v;
+}
+
+// 'value' stored in the variable of 'expr', converted
+// to the variable's type. Returns the variable's new value.
+AstInterpreter::Value AstInterpreter::store(AssignExpr& expr, Value value) {
+    if (value.type == TYPE_ERROR || failed) return value;
+    ValueType type = types[expr.slot];
+    if (!convert(value, type, expr.line, "Assignment")) return value;
+    if (type == TYPE_EXHAUST) {
+        string& variable = texts[expr.slot];
+        if (value.s != &variable) variable.assign(*value.s);
+        value.s = &variable;
+    }
+    else {
+        numbers[expr.slot].i = value.i;
+    }
+    return value;
+}
+
+// A specialized node that saw other types: generic from now on.
+Expr& AstInterpreter::deopt(Expr& expr) {
+    expr.spec = SPEC_GENERIC;
+    counters.deopts++;
+    if (counting) counters.generic++;
+    return expr;
+}
+
+// Only gear and turbo convert into each other.
+bool AstInterpreter::convert(Value& value, ValueType type, int line, const char* what) {
+    if (value.type == type) return true;
+    if (value.type == TYPE_ERROR) return false;
+    if (isNumeric(value.type) && isNumeric(type)) {
+        if (type == TYPE_TURBO) value.d = (double)value.i;
+        else value.i = turboToGear(value.d);
+        value.type = type;
+        return true;
+    }
+    fail(line, DIAG_TYPE_MISMATCH, string(what) + ": expected " + typeName(type) + ", got " + typeName(value.type) + ".");
+    return false;
+}
+
+// Any value as text, for '+' with an exhaust.
+const string& AstInterpreter::text(Value value) {
+    if (value.type == TYPE_EXHAUST) return *value.s;
+    string& s = temporary();
+    if (value.type == TYPE_GEAR) {
+        char digits[24];
+        auto res = to_chars(digits, digits + sizeof(digits), value.i);
+        s.assign(digits, res.ptr);
+    }
+    else if (value.type == TYPE_TURBO) {
+        s = formatDouble(value.d);
+    }
+    else {
+        s = value.i ? "true" : "false";
+    }
+    return s;
+}
+
+// Non-zero is true.
+bool AstInterpreter::truthy(Expr* expr, int line) {
+    Value v = eval(expr);
+    switch (v.type) {
+    case TYPE_GEAR:
+    case TYPE_FLAG:
+        return v.i != 0;
+    case TYPE_TURBO:
+        return v.d != 0.0;
+    case TYPE_EXHAUST:
+        fail(line, DIAG_TYPE_MISMATCH, "Condition: expected flag, gear or turbo, got exhaust.");
+        return false;
+    default:
+        return false;
+    }
+}
+
+/////////////////////// STATEMENTS ///////////////////////
+
+// Text a statement made is dropped after it.
+void AstInterpreter::execute(Stmt* stmt) {
+    if (!stmt) return;
+    stmt->accept(*this);
+    scratchUsed = 0;
+}
+
+void AstInterpreter::visit(ExprStmt& stmt) {
+    if (stmt.expression) eval(stmt.expression);
+}
+
+void AstInterpreter::visit(AnnounceStmt& stmt) {
+    if (!stmt.expression) return;
+    Value v = eval(stmt.expression);
+    if (failed) return;
+    switch (v.type) {
+    case TYPE_GEAR: {
+        char digits[24];
+        auto res = to_chars(digits, digits + sizeof(digits), v.i);
+        output.append(digits, res.ptr);
+        break;
+    }
+    case TYPE_TURBO:   output += formatDouble(v.d); break;
+    case TYPE_FLAG:    output += v.i ? "true" : "false"; break;
+    default:           output += *v.s; break;
+    }
+    output += '\n';
+    if (output.size() >= FLUSH_SIZE) flush();
+}
+
+void AstInterpreter::visit(VarDeclStmt& stmt) {
+    ValueType type = types[stmt.slot];
+    Value v;
+    v.type = type;
+    v.i = 0;
+    static const string empty;
+    v.s = type == TYPE_EXHAUST ? &empty : v.s;
+    if (stmt.initializer) {
+        v = eval(stmt.initializer);
+        if (failed || !convert(v, type, stmt.line, "Declaration")) return;
+    }
+    if (type == TYPE_EXHAUST) texts[stmt.slot].assign(*v.s);
+    else numbers[stmt.slot].i = v.i;
+}
+
+void AstInterpreter::visit(BlockStmt& stmt) {
+    for (Stmt* s : stmt.statements) {
+        execute(s);
+        if (failed || finished) break;
+    }
+}
+
+void AstInterpreter::visit(LoopStmt& stmt) {
+    int line = lineOf(stmt.condition);
+    while (!failed && truthy(stmt.condition, line)) {
+        scratchUsed = 0;
+        execute(stmt.body);
+        if (failed || finished) return;
+    }
+}
+
+void AstInterpreter::visit(FinishlineStmt& stmt) {
+    if (!stmt.value) return;
+    Value v = eval(stmt.value);
+    if (failed) return;
+    if (v.type == TYPE_EXHAUST) {
+        fail(lineOf(stmt.value), DIAG_TYPE_MISMATCH, "finishline: expected gear, flag or turbo, got exhaust.");
+        return;
+    }
+    result = v.type == TYPE_TURBO ? turboToGear(v.d) : v.i;
+    finished = true;
+}
+
+void AstInterpreter::visit(FuncDefStmt&) {}
+
+void AstInterpreter::visit(IfStmt& stmt) {
+    bool taken = truthy(stmt.condition, lineOf(stmt.condition));
+    if (failed) return;
+    scratchUsed = 0;
+    if (taken) execute(stmt.thenBranch);
+    else execute(stmt.elseBranch);
+}
+
+// Reads a line into the variable; output so far is shown first.
+void AstInterpreter::visit(ListenStmt& stmt) {
+    flush();
+    out.flush();
+    Number unusedNumber;
+    string unusedText;
+    ValueType type = types[stmt.slot];
+    bool ok = type == TYPE_EXHAUST ? readInput(in, type, unusedNumber, texts[stmt.slot], *diagnostics, stmt.line)
+                                   : readInput(in, type, numbers[stmt.slot], unusedText, *diagnostics, stmt.line);
+    if (!ok) failed = true;
+}
+
+RunResult interpretFromAst(const vector<Stmt*>& statements, CompilationContext& ctx, istream& in, ostream& out,
+                           InterpreterStats* stats) {
+    Symbol ignite = ctx.symbols.find("ignite");
+    TypeChecker checker(ctx.symbols, ctx.diagnostics);
+    FuncDefStmt* entry = nullptr;
+    bool ok = true;
+    for (Stmt* stmt : statements) {
+        if (!stmt || stmt->kind != STMT_FUNC_DEF) continue;
+        auto& func = static_cast<FuncDefStmt&>(*stmt);
+        if (func.name == ignite && !entry) entry = &func;
+        else if (!checker.check(func)) ok = false;
+    }
+    if (!ok) return { false, 0, 0 };
+    if (entry) {
+        AstInterpreter interpreter(ctx.symbols, in, out);
+        RunResult result = interpreter.run(*entry, ctx.diagnostics, stats != nullptr);
+        if (stats) *stats = interpreter.stats();
+        return result;
+    }
+    ctx.diagnostics.report(1, 0, DIAG_NO_ENTRY_POINT, "No ignite() to run.");
+    return { false, 0, 0 };
+}
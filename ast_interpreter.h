@@ -0,0 +1,136 @@
+#pragma once
+
+#include "diagnostics.h"
+#include "parser.h"
+#include "vm.h"
+#include <cstdint>
+#include <deque>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*
+ * InterpreterStats
+ * What the AST interpreter's nodes did, over all its runs.
+ */
+struct InterpreterStats {
+    uint64_t rewrites = 0; // Nodes specialized for the types they saw
+    uint64_t deopts = 0;   // Specialized nodes that saw other types and went generic
+    uint64_t hits = 0;     // Runs of specialized nodes, if counted
+    uint64_t generic = 0;  // Runs of generic nodes, if counted
+};
+
+/*
+ * AstInterpreter
+ * Runs a function straight from its tree, with no compile step: for short
+ * scripts, where compiling to bytecode would cost more than it saves.
+ *
+ * The first time an expression node runs, it does the general thing and
+ * then rewrites itself (Expr::spec) into a variant for the types it saw:
+ * gear add, turbo compare, text join, a read of a gear variable, ... A
+ * specialized node checks that its operands still have the types it was
+ * made for; if not, it counts a deopt and turns generic for good.
+ * Variables live in a flat frame, at the slots ScopeResolver gave them
+ * before the run, so no name is looked up while it runs. Hot looplap
+ * bodies so run as a few switches on already resolved nodes.
+ *
+ * Behaviour, output buffering and runtime errors match the VM's. The
+ * function is type-checked (TypeChecker) before the run: undefined and
+ * redeclared names and type errors are reported as for every engine,
+ * and the run then does not start. Each run checks and
+ * starts the function's nodes afresh, so a tree may be edited between
+ * runs; the tree must not share expressions (Parser::shareExpressions),
+ * as a shared node can mean a different variable in each place it is
+ * used.
+ */
+class AstInterpreter {
+public:
+    AstInterpreter(const SymbolTable& symbols, std::istream& in, std::ostream& out)
+        : symbols(symbols), in(in), out(out) {}
+    AstInterpreter(const AstInterpreter&) = delete;
+    AstInterpreter& operator=(const AstInterpreter&) = delete;
+
+    RunResult run(FuncDefStmt& func, Diagnostics& diagnostics, bool countHits = false);
+    const InterpreterStats& stats() const { return counters; }
+
+private:
+    friend struct Expr; // accept() calls the visit() overloads
+    friend struct Stmt;
+
+    static constexpr size_t FLUSH_SIZE = 64 * 1024;
+
+    // A value as an expression produces it. Text is not copied: it points
+    // into a variable, a literal or the scratch strings.
+    struct Value {
+        ValueType type;
+        union {
+            int64_t i; // gear; flag as 0 or 1
+            double d;
+            const std::string* s;
+        };
+    };
+
+    const SymbolTable& symbols;
+    std::istream& in;
+    std::ostream& out;
+    Diagnostics* diagnostics = nullptr;
+    std::string output;
+    InterpreterStats counters;
+    bool counting = false;
+
+    // The frame: a variable's value is at its slot (see ScopeResolver) in
+    // 'numbers' or 'texts', by its type.
+    std::vector<ValueType> types;
+    std::vector<Number> numbers;
+    std::deque<std::string> texts;    // Stable addresses, as Values point into them
+    std::deque<std::string> literals; // Text literals, by LiteralExpr::slot
+    std::deque<std::string> scratch;  // Text made by the statement running
+    size_t scratchUsed = 0;
+
+    bool failed = false;
+    bool finished = false;
+    int64_t result = 0;
+
+    // Output
+    void flush();
+    void fail(int line, DiagCode code, std::string message);
+
+    std::string& temporary();
+
+    // Expressions
+    Value eval(Expr* expr);
+    Value operand(Expr* expr);
+    Value evalBinary(BinaryExpr& expr);
+    Value evalVariable(VariableExpr& expr);
+    Value evalAssign(AssignExpr& expr);
+    Value evalLiteral(LiteralExpr& expr);
+    Value binary(BinaryExpr& expr, Value left, Value right);
+    Value store(AssignExpr& expr, Value value);
+    Expr& deopt(Expr& expr);
+    bool convert(Value& value, ValueType type, int line, const char* what);
+    const std::string& text(Value value);
+    bool truthy(Expr* expr, int line);
+
+    // Statements
+    void execute(Stmt* stmt);
+    void visit(ExprStmt& stmt);
+    void visit(AnnounceStmt& stmt);
+    void visit(VarDeclStmt& stmt);
+    void visit(BlockStmt& stmt);
+    void visit(LoopStmt& stmt);
+    void visit(FinishlineStmt& stmt);
+    void visit(FuncDefStmt& stmt);
+    void visit(IfStmt& stmt);
+    void visit(ListenStmt& stmt);
+};
+
+/*
+ * interpretFromAst
+ * Runs a parsed program's ignite() on an AstInterpreter. The other
+ * functions are type-checked first, as the compiler would, and nothing
+ * runs if they have errors. Errors go to ctx.diagnostics; a program with
+ * no ignite() reports that and runs nothing. 'stats', if given, gets the interpreter's counters.
+ */
+RunResult interpretFromAst(const std::vector<Stmt*>& statements, CompilationContext& ctx,
+                           std::istream& in, std::ostream& out, InterpreterStats* stats = nullptr);
@@ -0,0 +1,387 @@
+#include "ast_optimizer.h"
+
+#include <charconv>
+#include <string>
+
+using namespace std;
+
+namespace {
+
+bool isNumeric(LiteralValue::Kind kind) { return kind == LiteralValue::INT || kind == LiteralValue::DOUBLE; }
+
+double toDouble(const LiteralValue& value) { return value.kind == LiteralValue::DOUBLE ? value.d : (double)value.i; }
+
+template <typename T>
+bool compare(TokenType op, const T& a, const T& b) {
+    switch (op) {
+    case OP_EQUAL:         return a == b;
+    case OP_NOT_EQUAL:     return a != b;
+    case OP_LESS:          return a < b;
+    case OP_LESS_EQUAL:    return a <= b;
+    case OP_GREATER:       return a > b;
+    default:               return a >= b;
+    }
+}
+
+// Whether 'expr' is a literal condition, and which way it goes.
+bool isConstant(const Expr* expr, bool& value) {
+    if (!expr || expr->kind != EXPR_LITERAL) return false;
+    const LiteralValue& v = static_cast<const LiteralExpr*>(expr)->value;
+    switch (v.kind) {
+    case LiteralValue::INT:    value = v.i != 0; return true;
+    case LiteralValue::DOUBLE: value = v.d != 0.0; return true;
+    case LiteralValue::BOOL:   value = v.b; return true;
+    default:                   return false;
+    }
+}
+
+// A whole track or looplap body that declares a variable in the
+// enclosing block.
+bool declares(const Stmt* body) { return body && (body->kind == STMT_VAR_DECL || body->kind == STMT_LISTEN); }
+
+// Counts the nodes of a tree, and clears the statements' hashes if asked.
+class NodeCounter {
+public:
+    friend struct ::Expr;
+    friend struct ::Stmt;
+
+    explicit NodeCounter(bool clearHashes) : clearHashes(clearHashes) {}
+    size_t count = 0;
+
+    void walk(Stmt* stmt) {
+        if (!stmt) return;
+        count++;
+        if (clearHashes) stmt->hash = 0;
+        stmt->accept(*this);
+    }
+    void walk(Expr* expr) {
+        if (!expr) return;
+        count++;
+        expr->accept(*this);
+    }
+
+private:
+    bool clearHashes;
+
+    void visit(BinaryExpr& expr) { walk(expr.left); walk(expr.right); }
+    void visit(LiteralExpr&) {}
+    void visit(VariableExpr&) {}
+    void visit(AssignExpr& expr) { walk(expr.value); }
+
+    void visit(ExprStmt& stmt) { walk(stmt.expression); }
+    void visit(AnnounceStmt& stmt) { walk(stmt.expression); }
+    void visit(VarDeclStmt& stmt) { walk(stmt.initializer); }
+    void visit(BlockStmt& stmt) { for (Stmt* s : stmt.statements) walk(s); }
+    void visit(LoopStmt& stmt) { walk(stmt.condition); walk(stmt.body); }
+    void visit(FinishlineStmt& stmt) { walk(stmt.value); }
+    void visit(FuncDefStmt& stmt) { walk(stmt.body); }
+    void visit(IfStmt& stmt) { walk(stmt.condition); walk(stmt.thenBranch); walk(stmt.elseBranch); }
+    void visit(ListenStmt&) {}
+};
+
+} // namespace
+
+OptimizerStats AstOptimizer::optimize(const vector<Stmt*>& statements) {
+    for (Stmt* stmt : statements)
+        if (stmt && stmt->kind == STMT_FUNC_DEF) optimize(static_cast<FuncDefStmt&>(*stmt));
+    return counters;
+}
+
+// Each round first finds which declarations are ever assigned, then
+// rewrites with the same scopes; what one round removes (an assignment in
+// a dropped branch, say) can make more constant in the next.
+void AstOptimizer::optimize(FuncDefStmt& func) {
+    NodeCounter before(false);
+    before.walk(&func);
+    counters.nodesBefore += before.count;
+
+    size_t total = 0;
+    do {
+        changes = 0;
+        for (bool pass : { false, true }) {
+            rewriting = pass;
+            if (!rewriting) assigned.clear();
+            scope.clear();
+            depth = 0;
+            func.body = body(func.body);
+        }
+        total += changes;
+    } while (changes > 0);
+
+    NodeCounter after(total > 0);
+    after.walk(&func);
+    counters.nodesAfter += after.count;
+}
+
+/////////////////////// SCOPES ///////////////////////
+
+const AstOptimizer::Binding* AstOptimizer::find(Symbol name) const {
+    for (auto it = scope.rbegin(); it != scope.rend(); ++it)
+        if (it->name == name) return &*it;
+    return nullptr;
+}
+
+void AstOptimizer::declare(Symbol name, const Stmt* declaration, bool constant, const LiteralValue& value) {
+    scope.push_back({ name, depth, declaration, constant, value });
+}
+
+/////////////////////// EXPRESSIONS ///////////////////////
+
+Expr* AstOptimizer::expression(Expr* expr) {
+    if (!expr) return nullptr;
+    return expr->accept(*this);
+}
+
+Expr* AstOptimizer::visit(BinaryExpr& expr) {
+    expr.left = expression(expr.left);
+    expr.right = expression(expr.right);
+    if (!rewriting || !expr.left || !expr.right || expr.left->kind != EXPR_LITERAL || expr.right->kind != EXPR_LITERAL)
+        return &expr;
+    return fold(expr, static_cast<LiteralExpr*>(expr.left)->value, static_cast<LiteralExpr*>(expr.right)->value);
+}
+
+Expr* AstOptimizer::visit(LiteralExpr& expr) {
+    return &expr;
+}
+
+Expr* AstOptimizer::visit(VariableExpr& expr) {
+    const Binding* binding = rewriting ? find(expr.name) : nullptr;
+    if (!binding || !binding->constant) return &expr;
+    counters.propagated++;
+    changes++;
+    return arena.make<LiteralExpr>(binding->value, expr.line);
+}
+
+Expr* AstOptimizer::visit(AssignExpr& expr) {
+    expr.value = expression(expr.value);
+    if (const Binding* binding = find(expr.name)) assigned.insert(binding->declaration);
+    return &expr;
+}
+
+// The literal 'expr' computes, as the VM would compute it; 'expr' itself
+// if it has to be left to run (or has a type error, which the compiler
+// reports).
+Expr* AstOptimizer::fold(BinaryExpr& expr, const LiteralValue& left, const LiteralValue& right) {
+    LiteralValue value;
+    switch (expr.op) {
+    case OP_PLUS:
+    case OP_MINUS:
+    case OP_STAR:
+    case OP_SLASH:
+        if (expr.op == OP_PLUS && (left.kind == LiteralValue::STRING || right.kind == LiteralValue::STRING)) {
+            auto text = [&](const LiteralValue& v) -> string {
+                if (v.kind == LiteralValue::INT) {
+                    char digits[24];
+                    auto res = to_chars(digits, digits + sizeof(digits), v.i);
+                    return string(digits, res.ptr);
+                }
+                return formatLiteral(v, symbols);
+            };
+            value = LiteralValue::ofString(symbols.intern(text(left) + text(right)));
+        }
+        else if (!isNumeric(left.kind) || !isNumeric(right.kind)) {
+            return &expr;
+        }
+        else if (left.kind == LiteralValue::INT && right.kind == LiteralValue::INT) {
+            uint64_t a = (uint64_t)left.i, b = (uint64_t)right.i;
+            switch (expr.op) {
+            case OP_PLUS:  value = LiteralValue::ofInt(wrapGear(a + b)); break;
+            case OP_MINUS: value = LiteralValue::ofInt(wrapGear(a - b)); break;
+            case OP_STAR:  value = LiteralValue::ofInt(wrapGear(a * b)); break;
+            default:
+                if (right.i == 0) return &expr;
+                value = LiteralValue::ofInt(right.i == -1 ? wrapGear(0 - a) : left.i / right.i);
+                break;
+            }
+        }
+        else {
+            double a = toDouble(left), b = toDouble(right), d;
+            switch (expr.op) {
+            case OP_PLUS:  d = a + b; break;
+            case OP_MINUS: d = a - b; break;
+            case OP_STAR:  d = a * b; break;
+            default:       d = a / b; break;
+            }
+            if (d != d) return &expr; // The sign of a NaN is not the same everywhere
+            value = LiteralValue::ofDouble(d);
+        }
+        break;
+
+    default:
+        if (isNumeric(left.kind) && isNumeric(right.kind)) {
+            if (left.kind == LiteralValue::INT && right.kind == LiteralValue::INT)
+                value = LiteralValue::ofBool(compare(expr.op, left.i, right.i));
+            else
+                value = LiteralValue::ofBool(compare(expr.op, toDouble(left), toDouble(right)));
+        }
+        else if (left.kind == LiteralValue::STRING && right.kind == LiteralValue::STRING) {
+            value = LiteralValue::ofBool(compare(expr.op, symbols.name(left.s), symbols.name(right.s)));
+        }
+        else if (left.kind == LiteralValue::BOOL && right.kind == LiteralValue::BOOL &&
+                 (expr.op == OP_EQUAL || expr.op == OP_NOT_EQUAL)) {
+            value = LiteralValue::ofBool(compare(expr.op, left.b, right.b));
+        }
+        else {
+            return &expr;
+        }
+        break;
+    }
+    counters.folded++;
+    changes++;
+    return arena.make<LiteralExpr>(value, expr.line);
+}
+
+// The value a declaration of 'type' gets from 'initializer', if that is a
+// literal the declaration accepts.
+bool AstOptimizer::constant(const Expr* initializer, TokenType type, LiteralValue& value) {
+    if (!initializer || initializer->kind != EXPR_LITERAL) return false;
+    const LiteralValue& v = static_cast<const LiteralExpr*>(initializer)->value;
+    switch (type) {
+    case KW_TURBO:
+        if (!isNumeric(v.kind)) return false;
+        value = LiteralValue::ofDouble(toDouble(v));
+        return true;
+    case KW_EXHAUST:
+        value = v;
+        return v.kind == LiteralValue::STRING;
+    case KW_FLAG:
+        value = v;
+        return v.kind == LiteralValue::BOOL;
+    default:
+        if (!isNumeric(v.kind)) return false;
+        value = v.kind == LiteralValue::INT ? v : LiteralValue::ofInt(turboToGear(v.d));
+        return true;
+    }
+}
+
+/////////////////////// STATEMENTS ///////////////////////
+
+// Returns what replaces 'stmt', or nullptr to remove it; sets 'ends'.
+Stmt* AstOptimizer::statement(Stmt* stmt) {
+    ends = false;
+    bare = false;
+    if (!stmt) return nullptr;
+    return stmt->accept(*this);
+}
+
+// A body that goes away is left as an empty block.
+Stmt* AstOptimizer::body(Stmt* stmt) {
+    ends = false;
+    bare = true;
+    if (!stmt) return nullptr;
+    Stmt* out = stmt->accept(*this);
+    bare = false;
+    if (out) return out;
+    auto empty = arena.make<BlockStmt>(ArenaList<Stmt*>{});
+    empty->tokenStart = stmt->tokenStart;
+    empty->tokenCount = stmt->tokenCount;
+    return empty;
+}
+
+Stmt* AstOptimizer::visit(ExprStmt& stmt) {
+    stmt.expression = expression(stmt.expression);
+    Expr* e = stmt.expression;
+    if (!rewriting || !e || (e->kind != EXPR_LITERAL && e->kind != EXPR_VARIABLE)) return &stmt;
+    counters.dropped++;
+    changes++;
+    return nullptr;
+}
+
+Stmt* AstOptimizer::visit(AnnounceStmt& stmt) {
+    stmt.expression = expression(stmt.expression);
+    return &stmt;
+}
+
+// The variable comes into scope after its initializer, as in the
+// compiler. A bare declaration may be skipped, or read before it runs by
+// the condition of its looplap, so it is never constant.
+Stmt* AstOptimizer::visit(VarDeclStmt& stmt) {
+    bool whole = bare;
+    stmt.initializer = expression(stmt.initializer);
+    LiteralValue value;
+    bool known = rewriting && !whole && !assigned.count(&stmt) && constant(stmt.initializer, stmt.type, value);
+    declare(stmt.name, &stmt, known, value);
+    return &stmt;
+}
+
+Stmt* AstOptimizer::visit(BlockStmt& stmt) {
+    int outer = depth++;
+    size_t count = stmt.statements.size();
+    size_t kept = 0;
+    bool stops = false;
+    for (size_t k = 0; k < count; k++) {
+        Stmt* s = statement(stmt.statements[k]);
+        stops = stops || ends;
+        if (!rewriting) continue;
+        if (s && s->kind == STMT_BLOCK && static_cast<BlockStmt*>(s)->statements.empty()) {
+            counters.dropped++;
+            changes++;
+            s = nullptr;
+        }
+        if (s) stmt.statements[kept++] = s;
+        if (stops && k + 1 < count) {
+            counters.dropped += count - k - 1;
+            changes++;
+            break;
+        }
+    }
+    if (rewriting) stmt.statements.count = (uint32_t)kept;
+    while (!scope.empty() && scope.back().depth > outer) scope.pop_back();
+    depth = outer;
+    ends = stops;
+    return &stmt;
+}
+
+// The compiler makes the body before the condition, so a declaration
+// that is the body is in scope in the condition.
+Stmt* AstOptimizer::visit(LoopStmt& stmt) {
+    stmt.body = body(stmt.body);
+    stmt.condition = expression(stmt.condition);
+    bool value = false;
+    bool known = isConstant(stmt.condition, value);
+    if (rewriting && known && !value && !declares(stmt.body)) {
+        counters.pruned++;
+        changes++;
+        ends = false;
+        return nullptr;
+    }
+    ends = known && value; // Only a finishline gets out
+    return &stmt;
+}
+
+Stmt* AstOptimizer::visit(FinishlineStmt& stmt) {
+    stmt.value = expression(stmt.value);
+    ends = true;
+    return &stmt;
+}
+
+Stmt* AstOptimizer::visit(FuncDefStmt& stmt) {
+    return &stmt;
+}
+
+Stmt* AstOptimizer::visit(IfStmt& stmt) {
+    stmt.condition = expression(stmt.condition);
+    stmt.thenBranch = body(stmt.thenBranch);
+    bool thenEnds = ends;
+    stmt.elseBranch = body(stmt.elseBranch);
+    bool elseEnds = stmt.elseBranch && ends;
+
+    bool value;
+    if (rewriting && isConstant(stmt.condition, value) && !declares(value ? stmt.elseBranch : stmt.thenBranch)) {
+        counters.pruned++;
+        changes++;
+        Stmt* taken = value ? stmt.thenBranch : stmt.elseBranch;
+        ends = value ? thenEnds : elseEnds;
+        if (taken) taken->tokenStart += stmt.tokenStart; // Now counted from the track's parent
+        return taken;
+    }
+    ends = thenEnds && elseEnds;
+    return &stmt;
+}
+
+// Listening into a variable assigns it; into a new name declares text.
+Stmt* AstOptimizer::visit(ListenStmt& stmt) {
+    if (const Binding* binding = find(stmt.name)) assigned.insert(binding->declaration);
+    else declare(stmt.name, &stmt, false, LiteralValue());
+    return &stmt;
+}
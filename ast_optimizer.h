@@ -0,0 +1,109 @@
+#pragma once
+
+#include "ast_arena.h"
+#include "literal.h"
+#include "parser.h"
+#include <cstddef>
+#include <cstdint>
+#include <unordered_set>
+#include <vector>
+
+/*
+ * OptimizerStats
+ * What AstOptimizer::optimize changed. 'nodesBefore' and 'nodesAfter'
+ * count every expression and statement in the functions.
+ */
+struct OptimizerStats {
+    size_t nodesBefore = 0;
+    size_t nodesAfter = 0;
+    size_t folded = 0;      // Operations on literals replaced by their value
+    size_t propagated = 0;  // Reads of never-assigned variables replaced by their value
+    size_t pruned = 0;      // track / looplap statements with a constant condition
+    size_t dropped = 0;     // Statements that could not run or did nothing
+
+    size_t removed() const { return nodesBefore - nodesAfter; }
+};
+
+/*
+ * AstOptimizer
+ * Simplifies a program's tree in place, before it is printed or run:
+ *  - folds operators whose operands are literals, including '+' on text
+ *    (but not a division by zero, which must fail when it runs, or an
+ *    operation whose result would be NaN);
+ *  - replaces a read of a variable whose declaration, a statement of a
+ *    block, has a literal initializer and which is never assigned or
+ *    listened into, by that value;
+ *  - replaces a track with a constant condition by the branch it takes,
+ *    and drops a looplap whose condition is constant false;
+ *  - drops the statements of a block after one that cannot fall through
+ *    (finishline, a looplap on a constant true, ...), and expression
+ *    statements that only read a literal or a variable.
+ * The passes repeat until nothing changes. A bare declaration as the
+ * branch that is not taken is kept with its track, as the compiler
+ * declares it in the enclosing block either way.
+ *
+ * The program must compile without errors: code the optimizer removes is
+ * not checked any more. New nodes go into 'arena'; text made by folding
+ * is interned in 'symbols'. Changed statements lose their structural
+ * hash. The tree must not share expressions (Parser::shareExpressions),
+ * as a shared read can mean a different variable in each place.
+ */
+class AstOptimizer {
+public:
+    AstOptimizer(AstArena& arena, SymbolTable& symbols) : arena(arena), symbols(symbols) {}
+
+    OptimizerStats optimize(const std::vector<Stmt*>& statements);
+    void optimize(FuncDefStmt& func);
+    const OptimizerStats& stats() const { return counters; }
+
+private:
+    friend struct Expr; // accept() calls the visit() overloads
+    friend struct Stmt;
+
+    // A variable in scope, with its value if it never changes.
+    struct Binding {
+        Symbol name;
+        int depth;
+        const Stmt* declaration; // Its VarDeclStmt or ListenStmt
+        bool constant;
+        LiteralValue value;      // Of the variable's type, if constant
+    };
+
+    AstArena& arena;
+    SymbolTable& symbols;
+    OptimizerStats counters;
+
+    bool rewriting = false; // false: only finding what is assigned
+    std::unordered_set<const Stmt*> assigned;
+    std::vector<Binding> scope;
+    int depth = 0;
+    bool bare = false;     // The statement being visited is a whole track or looplap body
+    bool ends = false;     // The statement just visited cannot fall through
+    size_t changes = 0;
+
+    // Scopes
+    const Binding* find(Symbol name) const;
+    void declare(Symbol name, const Stmt* declaration, bool constant, const LiteralValue& value);
+
+    // Expressions
+    Expr* expression(Expr* expr);
+    Expr* visit(BinaryExpr& expr);
+    Expr* visit(LiteralExpr& expr);
+    Expr* visit(VariableExpr& expr);
+    Expr* visit(AssignExpr& expr);
+    Expr* fold(BinaryExpr& expr, const LiteralValue& left, const LiteralValue& right);
+    static bool constant(const Expr* initializer, TokenType type, LiteralValue& value);
+
+    // Statements
+    Stmt* statement(Stmt* stmt);
+    Stmt* body(Stmt* stmt);
+    Stmt* visit(ExprStmt& stmt);
+    Stmt* visit(AnnounceStmt& stmt);
+    Stmt* visit(VarDeclStmt& stmt);
+    Stmt* visit(BlockStmt& stmt);
+    Stmt* visit(LoopStmt& stmt);
+    Stmt* visit(FinishlineStmt& stmt);
+    Stmt* visit(FuncDefStmt& stmt);
+    Stmt* visit(IfStmt& stmt);
+    Stmt* visit(ListenStmt& stmt);
+};
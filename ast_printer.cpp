@@ -1,101 +1,450 @@
 ﻿#include "ast_printer.h"
+#include "ast_cache.h"
 
-// Print whole program
-std::string AstPrinter::print(const std::vector<std::shared_ptr<Stmt>>& statements) {
-    std::string result = "(Program\n";
-    for (const auto& stmt : statements) {
-        if (stmt)
-            result += "  " + stmt->accept(*this) + "\n";
+#include <charconv>
+
+std::string AstPrinter::print(const std::vector<Stmt*>& statements) {
+    stream = nullptr;
+    program(statements);
+    return std::move(buffer);
+}
+
+void AstPrinter::print(const std::vector<Stmt*>& statements, std::ostream& out) {
+    stream = &out;
+    program(statements);
+    flushTo(out);
+}
+
+void AstPrinter::print(const AstImage& from, std::ostream& out) {
+    stream = &out;
+    image = &from;
+    buffer.clear();
+    depth = 0;
+    begin(json() ? "program" : "Program");
+    cachedList("statements", from.roots(), from.rootCount());
+    end();
+    flushTo(out);
+    image = nullptr;
+}
+
+void AstPrinter::program(const std::vector<Stmt*>& statements) {
+    buffer.clear();
+    depth = 0;
+    begin(json() ? "program" : "Program");
+    listField("statements", statements.size(),
+              [&](size_t i) { return statements[i] != nullptr; },
+              [&](size_t i) { statements[i]->accept(*this); });
+    end();
+}
+
+void AstPrinter::flushTo(std::ostream& out) {
+    out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    buffer.clear();
+    stream = nullptr;
+}
+
+std::string_view AstPrinter::name(Symbol id) const {
+    return image ? image->name(id) : symbols.name(id);
+}
+
+// ==== OUTPUT ====
+
+void AstPrinter::newline() {
+    if (stream && buffer.size() >= FLUSH_SIZE) {
+        stream->write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        buffer.clear();
+    }
+    put('\n');
+    buffer.append(static_cast<size_t>(depth * indentWidth), ' ');
+}
+
+void AstPrinter::quoted(std::string_view text) {
+    static const char hex[] = "0123456789abcdef";
+    put('"');
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            put('\\');
+            put(c);
+        }
+        else if (static_cast<unsigned char>(c) < 0x20) {
+            put("\\u00");
+            put(hex[c >> 4]);
+            put(hex[c & 15]);
+        }
+        else {
+            put(c);
+        }
+    }
+    put('"');
+}
+
+// ==== NODE BUILDING BLOCKS ====
+
+// S-expression: (node field field ...), with nested statements on lines
+// of their own. JSON: {"node":"node","key":field,...}.
+
+void AstPrinter::begin(std::string_view node) {
+    if (json()) {
+        put("{\"node\":\"");
+        put(node);
+        put('"');
+    }
+    else {
+        put('(');
+        put(node);
+    }
+}
+
+void AstPrinter::end() {
+    put(json() ? '}' : ')');
+}
+
+void AstPrinter::field(const char* key, std::string_view text) {
+    if (json()) {
+        put(",\"");
+        put(key);
+        put("\":");
+        quoted(text);
+    }
+    else {
+        put(' ');
+        put(text);
+    }
+}
+
+template <typename F>
+void AstPrinter::exprField(const char* key, bool present, F value) {
+    if (json()) {
+        put(",\"");
+        put(key);
+        put("\":");
+    }
+    else {
+        put(' ');
+    }
+    if (present) value();
+    else put(json() ? "null" : "(null)");
+}
+
+template <typename F>
+void AstPrinter::stmtField(const char* key, bool present, F value) {
+    if (json()) {
+        put(",\"");
+        put(key);
+        put("\":");
+        if (present) value();
+        else put("null");
     }
-    result += ")";
-    return result;
+    else if (present) {
+        depth++;
+        newline();
+        value();
+        depth--;
+    }
+}
+
+template <typename P, typename F>
+void AstPrinter::listField(const char* key, size_t count, P present, F item) {
+    if (json()) {
+        put(",\"");
+        put(key);
+        put("\":[");
+    }
+    depth++;
+    bool any = false;
+    for (size_t i = 0; i < count; i++) {
+        if (!present(i)) continue;
+        if (json() && any) put(',');
+        newline();
+        item(i);
+        any = true;
+    }
+    depth--;
+    if (json()) {
+        if (any) newline();
+        put(']');
+    }
+}
+
+void AstPrinter::line(int line) {
+    if (!json()) return;
+    char digits[16];
+    auto res = std::to_chars(digits, digits + sizeof(digits), line);
+    put(",\"line\":");
+    put(std::string_view(digits, static_cast<size_t>(res.ptr - digits)));
+}
+
+void AstPrinter::binaryHead(TokenType op, int line) {
+    if (json()) {
+        begin("binary");
+        field("op", tokenSpelling(op));
+        this->line(line);
+    }
+    else {
+        begin(tokenSpelling(op));
+    }
+}
+
+void AstPrinter::literal(const LiteralValue& v, int line) {
+    char digits[32];
+    std::string_view type, text;
+    std::string decimal;
+    switch (v.kind) {
+    case LiteralValue::INT: {
+        auto res = std::to_chars(digits, digits + sizeof(digits), v.i);
+        type = "int";
+        text = std::string_view(digits, static_cast<size_t>(res.ptr - digits));
+        break;
+    }
+    case LiteralValue::DOUBLE:
+        decimal = formatDouble(v.d);
+        type = "decimal";
+        text = decimal;
+        break;
+    case LiteralValue::BOOL:
+        type = "bool";
+        text = v.b ? "true" : "false";
+        break;
+    case LiteralValue::STRING:
+        type = "string";
+        text = name(v.s);
+        break;
+    default:
+        type = "none";
+        text = json() ? "null" : "(null)";
+        break;
+    }
+
+    if (!json()) {
+        if (v.kind == LiteralValue::STRING) {
+            put('"');
+            put(text);
+            put('"');
+        }
+        else {
+            if (v.kind == LiteralValue::BOOL) put('#');
+            put(text);
+        }
+        return;
+    }
+    begin("literal");
+    field("type", type);
+    put(",\"value\":");
+    if (v.kind == LiteralValue::STRING) quoted(text);
+    else put(text);
+    this->line(line);
+    end();
 }
 
-// Helper
-std::string AstPrinter::parenthesize(const std::string& name, const std::vector<std::shared_ptr<Expr>>& exprs) {
-    std::string result = "(" + name;
-    for (const auto& expr : exprs) {
-        if (expr)
-            result += " " + expr->accept(*this);
-        else
-            result += " (null)";
+void AstPrinter::declarationHead(TokenType type, Symbol id, int line) {
+    if (json()) {
+        begin("declare");
+        field("type", tokenSpelling(type));
     }
-    return result + ")";
+    else {
+        begin(tokenSpelling(type));
+    }
+    field("name", name(id));
+    this->line(line);
+}
+
+void AstPrinter::functionHead(Symbol id, int line) {
+    begin("function");
+    field("name", name(id));
+    if (!json()) put(" ()");
+    this->line(line);
+}
+
+// A track's else branch: a "pitstop" field in JSON, a (pitstop ...) line
+// in the S-expression.
+template <typename F>
+void AstPrinter::pitstop(F elseBranch) {
+    if (json()) {
+        stmtField("pitstop", true, elseBranch);
+        return;
+    }
+    depth++;
+    newline();
+    begin("pitstop");
+    stmtField("body", true, elseBranch);
+    end();
+    depth--;
 }
 
 // ==== EXPRESSIONS ====
 
-std::string AstPrinter::visit(std::shared_ptr<BinaryExpr> expr) {
-    return parenthesize(expr->op.value, { expr->left, expr->right });
+void AstPrinter::visit(BinaryExpr& expr) {
+    binaryHead(expr.op, expr.line);
+    exprField("left", expr.left, [&] { expr.left->accept(*this); });
+    exprField("right", expr.right, [&] { expr.right->accept(*this); });
+    end();
 }
 
-std::string AstPrinter::visit(std::shared_ptr<LiteralExpr> expr) {
-    if (expr->value.type == STRING)   return "\"" + expr->value.value + "\"";
-    if (expr->value.type == BOOLEAN) return expr->value.value == "true" ? "#true" : "#false";
-    return expr->value.value;  // number
+void AstPrinter::visit(LiteralExpr& expr) {
+    literal(expr.value, expr.line);
 }
 
-std::string AstPrinter::visit(std::shared_ptr<VariableExpr> expr) {
-    return "(var " + expr->name.value + ")";
+void AstPrinter::visit(VariableExpr& expr) {
+    begin(json() ? "variable" : "var");
+    field("name", name(expr.name));
+    line(expr.line);
+    end();
 }
 
-std::string AstPrinter::visit(std::shared_ptr<AssignExpr> expr) {
-    return parenthesize("= " + expr->name.value, { expr->value });
+void AstPrinter::visit(AssignExpr& expr) {
+    begin(json() ? "assign" : "=");
+    field("name", name(expr.name));
+    line(expr.line);
+    exprField("value", expr.value, [&] { expr.value->accept(*this); });
+    end();
 }
 
 // ==== STATEMENTS ====
 
-std::string AstPrinter::visit(std::shared_ptr<ExprStmt> stmt) {
-    return parenthesize("Expr", { stmt->expression });
+void AstPrinter::visit(ExprStmt& stmt) {
+    begin(json() ? "expression" : "Expr");
+    exprField("expression", stmt.expression, [&] { stmt.expression->accept(*this); });
+    end();
 }
 
-std::string AstPrinter::visit(std::shared_ptr<AnnounceStmt> stmt) {
-    return parenthesize("announce", { stmt->expression });
+void AstPrinter::visit(AnnounceStmt& stmt) {
+    begin("announce");
+    exprField("value", stmt.expression, [&] { stmt.expression->accept(*this); });
+    end();
 }
 
-std::string AstPrinter::visit(std::shared_ptr<VarDeclStmt> stmt) {
-    std::string name = stmt->typeToken.value + " " + stmt->name.value;
-    if (stmt->initializer)
-        return parenthesize(name, { stmt->initializer });
-    return "(" + name + ")";
+void AstPrinter::visit(VarDeclStmt& stmt) {
+    declarationHead(stmt.type, stmt.name, stmt.line);
+    if (stmt.initializer) exprField("initializer", true, [&] { stmt.initializer->accept(*this); });
+    end();
 }
 
-std::string AstPrinter::visit(std::shared_ptr<BlockStmt> stmt) {
-    std::string result = "(block\n";
-    for (const auto& s : stmt->statements) {
-        if (s)
-            result += "    " + s->accept(*this) + "\n";
-    }
-    result += "  )";
-    return result;
+void AstPrinter::visit(BlockStmt& stmt) {
+    begin("block");
+    listField("statements", stmt.statements.size(),
+              [&](size_t i) { return stmt.statements[i] != nullptr; },
+              [&](size_t i) { stmt.statements[i]->accept(*this); });
+    end();
+}
+
+void AstPrinter::visit(LoopStmt& stmt) {
+    begin("looplap");
+    exprField("condition", stmt.condition, [&] { stmt.condition->accept(*this); });
+    stmtField("body", stmt.body, [&] { stmt.body->accept(*this); });
+    end();
 }
 
-std::string AstPrinter::visit(std::shared_ptr<LoopStmt> stmt) {
-    return "(looplap " + stmt->condition->accept(*this) + "\n  " +
-        stmt->body->accept(*this) + "\n)";
+void AstPrinter::visit(FinishlineStmt& stmt) {
+    begin("finishline");
+    exprField("value", stmt.value, [&] { stmt.value->accept(*this); });
+    end();
 }
 
-std::string AstPrinter::visit(std::shared_ptr<FinishlineStmt> stmt) {
-    return parenthesize("finishline", { stmt->value });
+void AstPrinter::visit(FuncDefStmt& stmt) {
+    functionHead(stmt.name, stmt.line);
+    stmtField("body", stmt.body, [&] { stmt.body->accept(*this); });
+    end();
 }
 
-std::string AstPrinter::visit(std::shared_ptr<FuncDefStmt> stmt) {
-    return "(function " + stmt->name.value + " ()\n  " +
-        stmt->body->accept(*this) + "\n)";
+void AstPrinter::visit(IfStmt& stmt) {
+    begin("track");
+    exprField("condition", stmt.condition, [&] { stmt.condition->accept(*this); });
+    stmtField("then", stmt.thenBranch, [&] { stmt.thenBranch->accept(*this); });
+    if (stmt.elseBranch) pitstop([&] { stmt.elseBranch->accept(*this); });
+    end();
 }
 
-// ✅ NEW: if / pitstop
-std::string AstPrinter::visit(std::shared_ptr<IfStmt> stmt) {
-    std::string result = "(track " + stmt->condition->accept(*this) + "\n";
-    result += "  " + stmt->thenBranch->accept(*this);
-    if (stmt->elseBranch) {
-        result += "\n  (pitstop " + stmt->elseBranch->accept(*this) + ")";
+void AstPrinter::visit(ListenStmt& stmt) {
+    begin("listen");
+    field("name", name(stmt.name));
+    line(stmt.line);
+    end();
+}
+
+// ==== FROM AN IMAGE ====
+
+// The same output as the visitors above, for the CachedNode layout.
+void AstPrinter::cached(uint32_t index) {
+    const CachedNode& n = image->node(index);
+    if (!n.isStmt()) {
+        switch (n.exprKind()) {
+        case EXPR_BINARY:
+            binaryHead(static_cast<TokenType>(n.detail), n.line);
+            cachedExpr("left", n.a);
+            cachedExpr("right", n.b);
+            break;
+        case EXPR_LITERAL:
+            literal(n.literal(), n.line);
+            return;
+        case EXPR_VARIABLE:
+            begin(json() ? "variable" : "var");
+            field("name", name(n.a));
+            line(n.line);
+            break;
+        case EXPR_ASSIGN:
+            begin(json() ? "assign" : "=");
+            field("name", name(n.a));
+            line(n.line);
+            cachedExpr("value", n.b);
+            break;
+        }
+        end();
+        return;
+    }
+
+    switch (n.stmtKind()) {
+    case STMT_EXPR:
+        begin(json() ? "expression" : "Expr");
+        cachedExpr("expression", n.a);
+        break;
+    case STMT_ANNOUNCE:
+        begin("announce");
+        cachedExpr("value", n.a);
+        break;
+    case STMT_VAR_DECL:
+        declarationHead(static_cast<TokenType>(n.detail), n.a, n.line);
+        if (n.b != NO_NODE) cachedExpr("initializer", n.b);
+        break;
+    case STMT_BLOCK:
+        begin("block");
+        cachedList("statements", image->list(n.a), n.b);
+        break;
+    case STMT_LOOP:
+        begin("looplap");
+        cachedExpr("condition", n.a);
+        cachedStmt("body", n.b);
+        break;
+    case STMT_FINISHLINE:
+        begin("finishline");
+        cachedExpr("value", n.a);
+        break;
+    case STMT_FUNC_DEF:
+        functionHead(n.a, n.line);
+        cachedStmt("body", n.b);
+        break;
+    case STMT_IF:
+        begin("track");
+        cachedExpr("condition", n.a);
+        cachedStmt("then", n.b);
+        if (n.c != NO_NODE) pitstop([&] { cached(n.c); });
+        break;
+    case STMT_LISTEN:
+        begin("listen");
+        field("name", name(n.a));
+        line(n.line);
+        break;
     }
-    result += ")";
-    return result;
+    end();
+}
+
+void AstPrinter::cachedExpr(const char* key, uint32_t index) {
+    exprField(key, index != NO_NODE, [&] { cached(index); });
+}
+
+void AstPrinter::cachedStmt(const char* key, uint32_t index) {
+    stmtField(key, index != NO_NODE, [&] { cached(index); });
 }
 
-// ✅ NEW: listen statement
-std::string AstPrinter::visit(std::shared_ptr<ListenStmt> stmt) {
-    return "(listen " + stmt->name.value + ")";
+void AstPrinter::cachedList(const char* key, const uint32_t* items, uint32_t count) {
+    listField(key, count, [](size_t) { return true; }, [&](size_t i) { cached(items[i]); });
 }
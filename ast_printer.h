@@ -1,31 +1,104 @@
 ﻿#pragma once
 
 #include "parser.h"
+#include <ostream>
 #include <string>
+#include <string_view>
 #include <vector>
-#include <memory>
 
-class AstPrinter : public ExprVisitor<std::string>, public StmtVisitor<std::string> {
+class AstImage;
+
+/*
+ * AstPrinter
+ * Writes a program's AST as an S-expression (the default) or as JSON.
+ *
+ * Statements go on their own lines, indented indentWidth spaces per level
+ * of nesting; expressions stay on their statement's line. Output is
+ * appended to one buffer: print() to a string returns that buffer, and
+ * print() to a stream flushes it every FLUSH_SIZE bytes, so memory stays
+ * flat however big the tree is. Each node is visited once.
+ *
+ * A tree can also be printed straight from an AST cache file (AstImage),
+ * with the same output as for the tree it was saved from.
+ */
+class AstPrinter {
 public:
-    std::string print(const std::vector<std::shared_ptr<Stmt>>& statements);
+    enum Format { SEXPR, JSON };
+
+    explicit AstPrinter(const SymbolTable& symbols, Format format = SEXPR, int indentWidth = 2)
+        : symbols(symbols), format(format), indentWidth(indentWidth) {}
+
+    std::string print(const std::vector<Stmt*>& statements);
+    void print(const std::vector<Stmt*>& statements, std::ostream& out);
+    void print(const AstImage& image, std::ostream& out); // Names from the image, not 'symbols'
 
 private:
-    std::string parenthesize(const std::string& name, const std::vector<std::shared_ptr<Expr>>& exprs);
+    friend struct Expr; // accept() calls the visit() overloads
+    friend struct Stmt;
+
+    static constexpr size_t FLUSH_SIZE = 64 * 1024;
+
+    const SymbolTable& symbols;
+    Format format;
+    int indentWidth;
+    int depth = 0;
+    std::string buffer;
+    std::ostream* stream = nullptr; // Where full buffers go; none when printing to a string
+    const AstImage* image = nullptr; // Set while printing from a cache file
+
+    bool json() const { return format == JSON; }
+    std::string_view name(Symbol id) const;
+    void program(const std::vector<Stmt*>& statements);
+    void flushTo(std::ostream& out);
+
+    // Output
+    void put(std::string_view text) { buffer.append(text.data(), text.size()); }
+    void put(char c) { buffer.push_back(c); }
+    void newline();
+    void quoted(std::string_view text); // As a JSON string
+
+    // Node building blocks, in the current format. A node is begin(),
+    // then its fields, then end(). 'value' writes a field's node.
+    void begin(std::string_view node);
+    void end();
+    void field(const char* key, std::string_view text); // A name or spelling
+    template <typename F>
+    void exprField(const char* key, bool present, F value);
+    template <typename F>
+    void stmtField(const char* key, bool present, F value); // On a line of its own
+    template <typename P, typename F>
+    void listField(const char* key, size_t count, P present, F item); // item(i) for each present(i)
+    void line(int line);                                    // JSON only
+
+    // The parts of nodes that are more than their fields; shared by both
+    // kinds of tree.
+    void binaryHead(TokenType op, int line);
+    void literal(const LiteralValue& value, int line);
+    void declarationHead(TokenType type, Symbol name, int line);
+    void functionHead(Symbol name, int line);
+    template <typename F>
+    void pitstop(F elseBranch);
+
+    // Printing from an image
+    void cached(uint32_t index);
+    void cachedExpr(const char* key, uint32_t index);
+    void cachedStmt(const char* key, uint32_t index);
+    void cachedList(const char* key, const uint32_t* items, uint32_t count);
 
     // Expression visitors
-    std::string visit(std::shared_ptr<BinaryExpr> expr) override;
-    std::string visit(std::shared_ptr<LiteralExpr> expr) override;
-    std::string visit(std::shared_ptr<VariableExpr> expr) override;
-    std::string visit(std::shared_ptr<AssignExpr> expr) override;
+    void visit(BinaryExpr& expr);
+    void visit(LiteralExpr& expr);
+    void visit(VariableExpr& expr);
+    void visit(AssignExpr& expr);
 
     // Statement visitors
-    std::string visit(std::shared_ptr<ExprStmt> stmt) override;
-    std::string visit(std::shared_ptr<AnnounceStmt> stmt) override;
-    std::string visit(std::shared_ptr<VarDeclStmt> stmt) override;
-    std::string visit(std::shared_ptr<BlockStmt> stmt) override;
-    std::string visit(std::shared_ptr<LoopStmt> stmt) override;
-    std::string visit(std::shared_ptr<FinishlineStmt> stmt) override;
-    std::string visit(std::shared_ptr<FuncDefStmt> stmt) override;
-    std::string visit(std::shared_ptr<IfStmt> stmt) override;       // ✅ ADD
-    std::string visit(std::shared_ptr<ListenStmt> stmt) override;   // ✅ ADD
+    void visit(ExprStmt& stmt);
+    void visit(AnnounceStmt& stmt);
+    void visit(VarDeclStmt& stmt);
+    void visit(BlockStmt& stmt);
+    void visit(LoopStmt& stmt);
+    void visit(FinishlineStmt& stmt);
+    void visit(FuncDefStmt& stmt);
+    void visit(IfStmt& stmt);
+    void visit(ListenStmt& stmt);
 };
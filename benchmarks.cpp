@@ -0,0 +1,841 @@
+#include "benchmarks.h"
+#include "ast_arena.h"
+#include "ast_interpreter.h"
+#include "bytecode_compiler.h"
+#include "native_codegen.h"
+#include "parser.h"
+#include "scanner.h"
+#include "ssa_builder.h"
+#include "ssa_codegen.h"
+#include "ssa_passes.h"
+#include "thread_pool.h"
+#include "vm.h"
+
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+std::string frontEndSource(size_t functions) {
+    std::string code;
+    for (size_t f = 0; f < functions; f++) {
+        std::string n = std::to_string(f);
+        code += "engine lap" + n + "() {\n"
+                "    gear fuel = " + n + ";\n"
+                "    turbo speed = 2.5;\n"
+                "    exhaust car = \"Ferrari " + n + "\";\n"
+                "    flag boosting = false;\n"
+                "    looplap (fuel > 0) {\n"
+                "        fuel = fuel - 10;\n"
+                "        speed = speed * 1.5 + fuel / 3;\n"
+                "        track (speed >= 30.0) {\n"
+                "            announce \"Boost: \" + speed;\n"
+                "        }\n"
+                "        pitstop {\n"
+                "            boosting = fuel <= 5;\n"
+                "        }\n"
+                "    }\n"
+                "    listen car;\n"
+                "    finishline fuel;\n"
+                "}\n\n";
+    }
+    code += "ignite() {\n    finishline 0;\n}\n";
+    return code;
+}
+
+namespace {
+
+// The scanner as it was before the table-driven one: sets of heap strings
+// for the keywords and a <cctype> call per byte, and a std::string per
+// token. Kept only as the baseline of the scanner benchmark; errors are
+// counted instead of printed.
+enum ReferenceKind { REF_KEYWORD, REF_IDENTIFIER, REF_NUMBER, REF_STRING, REF_OPERATOR, REF_SYMBOL, REF_BOOLEAN, REF_END, REF_UNKNOWN };
+
+struct ReferenceToken {
+    ReferenceKind kind;
+    std::string value;
+    int line;
+};
+
+std::vector<ReferenceToken> referenceScan(const std::string& code, size_t& errors) {
+    static const std::unordered_set<std::string> keywords = {
+        "ignite", "engine", "gear", "turbo", "exhaust", "flag", "announce", "listen",
+        "track", "pitstop", "looplap", "overtake", "finishline", "key", "#oil", "#car"
+    };
+    static const std::unordered_set<std::string> booleans = { "true", "false" };
+    static const std::unordered_set<char> symbols = { '{', '}', '(', ')', ';' };
+
+    std::vector<ReferenceToken> tokens;
+    size_t i = 0;
+    int line = 1;
+    while (i < code.size()) {
+        char c = code[i];
+        if (isspace((unsigned char)c)) {
+            if (c == '\n') line++;
+            i++;
+        }
+        else if (c == '"') {
+            std::string text;
+            int startLine = line;
+            for (i++; i < code.size() && code[i] != '"'; i++) {
+                if (code[i] == '\n') line++;
+                text += code[i];
+            }
+            if (i == code.size()) {
+                errors++;
+                break;
+            }
+            tokens.push_back({ REF_STRING, text, startLine });
+            i++;
+        }
+        else if (isalpha((unsigned char)c) || c == '#') {
+            std::string word;
+            while (i < code.size() && (isalnum((unsigned char)code[i]) || code[i] == '#' || code[i] == '_')) word += code[i++];
+            ReferenceKind kind = keywords.count(word) ? REF_KEYWORD : booleans.count(word) ? REF_BOOLEAN : REF_IDENTIFIER;
+            tokens.push_back({ kind, word, line });
+        }
+        else if (isdigit((unsigned char)c)) {
+            std::string number;
+            bool decimal = false;
+            while (i < code.size() && (isdigit((unsigned char)code[i]) || code[i] == '.')) {
+                if (code[i] == '.') {
+                    if (decimal) break;
+                    decimal = true;
+                }
+                number += code[i++];
+            }
+            tokens.push_back({ REF_NUMBER, number, line });
+        }
+        else if (c == '+' || c == '-' || c == '*' || c == '/' || c == '=' || c == '<' || c == '>') {
+            char n = i + 1 < code.size() ? code[i + 1] : 0;
+            size_t length = n == '=' && (c == '=' || c == '<' || c == '>') ? 2 : 1;
+            tokens.push_back({ REF_OPERATOR, code.substr(i, length), line });
+            i += length;
+        }
+        else if (symbols.count(c)) {
+            tokens.push_back({ REF_SYMBOL, std::string(1, c), line });
+            i++;
+        }
+        else {
+            errors++;
+            tokens.push_back({ REF_UNKNOWN, std::string(1, c), line });
+            i++;
+        }
+    }
+    tokens.push_back({ REF_END, "EOF", line });
+    return tokens;
+}
+
+// A node of the tree as the parser built it before AstArena: made with
+// make_shared, so with a control block and atomic counts of its own, and
+// holding its children by shared_ptr and its name or value as a string.
+// Visitors reached it the old way too: a virtual accept() that passes
+// shared_from_this() to a virtual visit() returning a string. Only used
+// by the AST allocation and visitor benchmarks.
+struct SharedNode;
+
+struct SharedVisitor {
+    virtual std::string visit(std::shared_ptr<SharedNode> node) = 0;
+protected:
+    ~SharedVisitor() = default;
+};
+
+struct SharedNode : std::enable_shared_from_this<SharedNode> {
+    virtual ~SharedNode() = default;
+    virtual std::string accept(SharedVisitor& visitor) { return visitor.visit(shared_from_this()); }
+
+    int kind;
+    std::string text;
+    std::shared_ptr<SharedNode> first, second, third;
+    std::vector<std::shared_ptr<SharedNode>> list; // Of a block
+};
+
+// Counts the nodes of a SharedNode tree. Like any visitor of the old
+// scheme it cannot return the count, so it keeps it in a member.
+struct SharedNodeCounter : SharedVisitor {
+    size_t count = 0;
+
+    std::string visit(std::shared_ptr<SharedNode> node) override {
+        count++;
+        for (SharedNode* child : { node->first.get(), node->second.get(), node->third.get() })
+            if (child) child->accept(*this);
+        for (auto& child : node->list) child->accept(*this);
+        return {};
+    }
+};
+
+// Counts the nodes of a tree: the cheapest pass there is, so that timing
+// it times the dispatch.
+class NodeCounter {
+public:
+    size_t count(Stmt* stmt) { return stmt ? stmt->accept(*this) : 0; }
+    size_t count(Expr* expr) { return expr ? expr->accept(*this) : 0; }
+
+private:
+    friend struct ::Expr;
+    friend struct ::Stmt;
+
+    size_t visit(BinaryExpr& e) { return 1 + count(e.left) + count(e.right); }
+    size_t visit(LiteralExpr&) { return 1; }
+    size_t visit(VariableExpr&) { return 1; }
+    size_t visit(AssignExpr& e) { return 1 + count(e.value); }
+    size_t visit(ExprStmt& s) { return 1 + count(s.expression); }
+    size_t visit(AnnounceStmt& s) { return 1 + count(s.expression); }
+    size_t visit(VarDeclStmt& s) { return 1 + count(s.initializer); }
+    size_t visit(BlockStmt& s) {
+        size_t n = 1;
+        for (Stmt* stmt : s.statements) n += count(stmt);
+        return n;
+    }
+    size_t visit(LoopStmt& s) { return 1 + count(s.condition) + count(s.body); }
+    size_t visit(FinishlineStmt& s) { return 1 + count(s.value); }
+    size_t visit(FuncDefStmt& s) { return 1 + count(s.body); }
+    size_t visit(IfStmt& s) { return 1 + count(s.condition) + count(s.thenBranch) + count(s.elseBranch); }
+    size_t visit(ListenStmt&) { return 1; }
+};
+
+// Counts the distinct nodes of a tree: an expression shared by several
+// uses (see Parser::shareExpressions) is counted, and walked, once.
+class DistinctNodeCounter {
+public:
+    size_t count(Stmt* stmt) { return stmt ? stmt->accept(*this) : 0; }
+    size_t count(Expr* expr) { return expr && seen.insert(expr).second ? expr->accept(*this) : 0; }
+
+private:
+    friend struct ::Expr;
+    friend struct ::Stmt;
+
+    size_t visit(BinaryExpr& e) { return 1 + count(e.left) + count(e.right); }
+    size_t visit(LiteralExpr&) { return 1; }
+    size_t visit(VariableExpr&) { return 1; }
+    size_t visit(AssignExpr& e) { return 1 + count(e.value); }
+    size_t visit(ExprStmt& s) { return 1 + count(s.expression); }
+    size_t visit(AnnounceStmt& s) { return 1 + count(s.expression); }
+    size_t visit(VarDeclStmt& s) { return 1 + count(s.initializer); }
+    size_t visit(BlockStmt& s) {
+        size_t n = 1;
+        for (Stmt* stmt : s.statements) n += count(stmt);
+        return n;
+    }
+    size_t visit(LoopStmt& s) { return 1 + count(s.condition) + count(s.body); }
+    size_t visit(FinishlineStmt& s) { return 1 + count(s.value); }
+    size_t visit(FuncDefStmt& s) { return 1 + count(s.body); }
+    size_t visit(IfStmt& s) { return 1 + count(s.condition) + count(s.thenBranch) + count(s.elseBranch); }
+    size_t visit(ListenStmt&) { return 1; }
+
+    std::unordered_set<const Expr*> seen;
+};
+
+// The parser as it was before per-keyword token kinds: a recursive
+// descent over ReferenceTokens that compares token text at each step and
+// builds SharedNodes with make_shared. Kept only as the baseline of the
+// parser benchmark; throws at the first syntax error.
+class ReferenceParser {
+public:
+    explicit ReferenceParser(const std::vector<ReferenceToken>& tokens) : tokens(tokens) {}
+
+    std::vector<std::shared_ptr<SharedNode>> parse() {
+        std::vector<std::shared_ptr<SharedNode>> statements;
+        while (peek().kind != REF_END) statements.push_back(statement());
+        return statements;
+    }
+
+private:
+    using Node = std::shared_ptr<SharedNode>;
+
+    const ReferenceToken& peek() const { return tokens[current]; }
+    const ReferenceToken& advance() { return tokens[peek().kind == REF_END ? current : current++]; }
+    bool is(ReferenceKind kind, const char* text) const { return peek().kind == kind && peek().value == text; }
+    const ReferenceToken& expect(ReferenceKind kind, const char* what) {
+        if (peek().kind != kind) throw std::runtime_error(std::string("Expect ") + what + ".");
+        return advance();
+    }
+    void expect(const char* symbol) {
+        if (!is(REF_SYMBOL, symbol)) throw std::runtime_error(std::string("Expect '") + symbol + "'.");
+        advance();
+    }
+
+    static Node node(int kind, std::string text, Node first = nullptr, Node second = nullptr, Node third = nullptr) {
+        auto n = std::make_shared<SharedNode>();
+        n->kind = kind;
+        n->text = std::move(text);
+        n->first = std::move(first);
+        n->second = std::move(second);
+        n->third = std::move(third);
+        return n;
+    }
+
+    Node statement() {
+        ReferenceToken p = peek();
+        if (is(REF_KEYWORD, "engine") || is(REF_KEYWORD, "ignite")) {
+            advance();
+            std::string name = p.value == "engine" ? expect(REF_IDENTIFIER, "function name").value : "ignite";
+            expect("(");
+            expect(")");
+            return node(STMT_FUNC_DEF, name, block());
+        }
+        if (is(REF_KEYWORD, "gear") || is(REF_KEYWORD, "turbo") || is(REF_KEYWORD, "exhaust") || is(REF_KEYWORD, "flag")) {
+            advance();
+            std::string name = expect(REF_IDENTIFIER, "variable name").value;
+            Node initializer;
+            if (is(REF_OPERATOR, "=")) {
+                advance();
+                initializer = expression();
+            }
+            expect(";");
+            return node(STMT_VAR_DECL, name, initializer);
+        }
+        if (is(REF_KEYWORD, "looplap")) {
+            advance();
+            expect("(");
+            Node condition = expression();
+            expect(")");
+            return node(STMT_LOOP, {}, condition, statement());
+        }
+        if (is(REF_KEYWORD, "announce") || is(REF_KEYWORD, "finishline")) {
+            advance();
+            Node value = expression();
+            expect(";");
+            return node(p.value == "announce" ? STMT_ANNOUNCE : STMT_FINISHLINE, {}, value);
+        }
+        if (is(REF_KEYWORD, "track")) {
+            advance();
+            expect("(");
+            Node condition = expression();
+            expect(")");
+            Node thenBranch = statement();
+            Node elseBranch;
+            if (is(REF_KEYWORD, "pitstop")) {
+                advance();
+                elseBranch = statement();
+            }
+            return node(STMT_IF, {}, condition, thenBranch, elseBranch);
+        }
+        if (is(REF_KEYWORD, "listen")) {
+            advance();
+            std::string name = expect(REF_IDENTIFIER, "variable name").value;
+            expect(";");
+            return node(STMT_LISTEN, name);
+        }
+        if (is(REF_SYMBOL, "{")) return block();
+        Node expr = expression();
+        expect(";");
+        return node(STMT_EXPR, {}, expr);
+    }
+
+    Node block() {
+        expect("{");
+        Node n = node(STMT_BLOCK, {});
+        while (!is(REF_SYMBOL, "}")) {
+            if (peek().kind == REF_END) throw std::runtime_error("Unterminated block.");
+            n->list.push_back(statement());
+        }
+        advance();
+        return n;
+    }
+
+    Node expression() {
+        Node expr = binary(0);
+        if (!is(REF_OPERATOR, "=")) return expr;
+        advance();
+        if (expr->kind != EXPR_VARIABLE) throw std::runtime_error("Invalid assignment target.");
+        return node(EXPR_ASSIGN, expr->text, expression());
+    }
+
+    // Level 0: < > <= >=, 1: + -, 2: * /, 3: operands.
+    Node binary(int level) {
+        if (level == 3) return primary();
+        Node expr = binary(level + 1);
+        while (peek().kind == REF_OPERATOR) {
+            const std::string& v = peek().value;
+            bool matches = level == 0 ? v == "<" || v == ">" || v == "<=" || v == ">="
+                         : level == 1 ? v == "+" || v == "-"
+                                      : v == "*" || v == "/";
+            if (!matches) break;
+            std::string op = advance().value;
+            expr = node(EXPR_BINARY, op, expr, binary(level + 1));
+        }
+        return expr;
+    }
+
+    Node primary() {
+        ReferenceKind kind = peek().kind;
+        if (kind == REF_NUMBER || kind == REF_STRING || kind == REF_BOOLEAN) return node(EXPR_LITERAL, advance().value);
+        if (kind == REF_IDENTIFIER) return node(EXPR_VARIABLE, advance().value);
+        expect("(");
+        Node expr = expression();
+        expect(")");
+        return expr;
+    }
+
+    const std::vector<ReferenceToken>& tokens;
+    size_t current = 0;
+};
+
+// std::allocator, adding up the bytes it hands out.
+template <typename T>
+struct CountingAllocator {
+    using value_type = T;
+    size_t* bytes;
+
+    explicit CountingAllocator(size_t* b) : bytes(b) {}
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U>& other) : bytes(other.bytes) {}
+    T* allocate(size_t n) {
+        *bytes += n * sizeof(T);
+        return std::allocator<T>().allocate(n);
+    }
+    void deallocate(T* p, size_t n) { std::allocator<T>().deallocate(p, n); }
+    template <typename U>
+    bool operator==(const CountingAllocator<U>& other) const { return bytes == other.bytes; }
+    template <typename U>
+    bool operator!=(const CountingAllocator<U>& other) const { return bytes != other.bytes; }
+};
+
+// Copies a tree into SharedNodes, counting the nodes and the bytes
+// allocated for them.
+class SharedTreeBuilder {
+public:
+    explicit SharedTreeBuilder(const SymbolTable& symbols) : symbols(symbols) {}
+
+    size_t nodes = 0;
+    size_t bytes = 0;
+
+    std::shared_ptr<SharedNode> copy(Stmt* stmt) { return stmt ? stmt->accept(*this) : nullptr; }
+    std::shared_ptr<SharedNode> copy(Expr* expr) { return expr ? expr->accept(*this) : nullptr; }
+
+private:
+    friend struct ::Expr;
+    friend struct ::Stmt;
+
+    std::shared_ptr<SharedNode> node(int kind, std::string_view text = {}) {
+        nodes++;
+        auto n = std::allocate_shared<SharedNode>(CountingAllocator<SharedNode>(&bytes));
+        n->kind = kind;
+        n->text = std::string(text);
+        return n;
+    }
+    std::shared_ptr<SharedNode> node(int kind, std::string_view text, std::shared_ptr<SharedNode> first,
+                                     std::shared_ptr<SharedNode> second = nullptr,
+                                     std::shared_ptr<SharedNode> third = nullptr) {
+        auto n = node(kind, text);
+        n->first = std::move(first);
+        n->second = std::move(second);
+        n->third = std::move(third);
+        return n;
+    }
+
+    std::shared_ptr<SharedNode> visit(BinaryExpr& e) { return node(EXPR_BINARY, tokenSpelling(e.op), copy(e.left), copy(e.right)); }
+    std::shared_ptr<SharedNode> visit(LiteralExpr& e) { return node(EXPR_LITERAL, formatLiteral(e.value, symbols)); }
+    std::shared_ptr<SharedNode> visit(VariableExpr& e) { return node(EXPR_VARIABLE, symbols.name(e.name)); }
+    std::shared_ptr<SharedNode> visit(AssignExpr& e) { return node(EXPR_ASSIGN, symbols.name(e.name), copy(e.value)); }
+    std::shared_ptr<SharedNode> visit(ExprStmt& s) { return node(STMT_EXPR, {}, copy(s.expression)); }
+    std::shared_ptr<SharedNode> visit(AnnounceStmt& s) { return node(STMT_ANNOUNCE, {}, copy(s.expression)); }
+    std::shared_ptr<SharedNode> visit(VarDeclStmt& s) { return node(STMT_VAR_DECL, symbols.name(s.name), copy(s.initializer)); }
+    std::shared_ptr<SharedNode> visit(BlockStmt& s) {
+        auto n = node(STMT_BLOCK);
+        for (Stmt* stmt : s.statements) n->list.push_back(copy(stmt));
+        bytes += n->list.capacity() * sizeof(n->list[0]);
+        return n;
+    }
+    std::shared_ptr<SharedNode> visit(LoopStmt& s) { return node(STMT_LOOP, {}, copy(s.condition), copy(s.body)); }
+    std::shared_ptr<SharedNode> visit(FinishlineStmt& s) { return node(STMT_FINISHLINE, {}, copy(s.value)); }
+    std::shared_ptr<SharedNode> visit(FuncDefStmt& s) { return node(STMT_FUNC_DEF, symbols.name(s.name), copy(s.body)); }
+    std::shared_ptr<SharedNode> visit(IfStmt& s) {
+        return node(STMT_IF, {}, copy(s.condition), copy(s.thenBranch), copy(s.elseBranch));
+    }
+    std::shared_ptr<SharedNode> visit(ListenStmt& s) { return node(STMT_LISTEN, symbols.name(s.name)); }
+
+    const SymbolTable& symbols;
+};
+
+// Copies a tree into an arena, as the parser builds it.
+class ArenaTreeBuilder {
+public:
+    explicit ArenaTreeBuilder(AstArena& arena) : arena(arena) {}
+
+    Stmt* copy(Stmt* stmt) { return stmt ? stmt->accept(*this) : nullptr; }
+    Expr* copy(Expr* expr) { return expr ? expr->accept(*this) : nullptr; }
+
+private:
+    friend struct ::Expr;
+    friend struct ::Stmt;
+
+    Expr* visit(BinaryExpr& e) { return arena.make<BinaryExpr>(copy(e.left), e.op, e.line, copy(e.right)); }
+    Expr* visit(LiteralExpr& e) { return arena.make<LiteralExpr>(e.value, e.line); }
+    Expr* visit(VariableExpr& e) { return arena.make<VariableExpr>(e.name, e.line); }
+    Expr* visit(AssignExpr& e) { return arena.make<AssignExpr>(e.name, e.line, copy(e.value)); }
+    Stmt* visit(ExprStmt& s) { return arena.make<ExprStmt>(copy(s.expression)); }
+    Stmt* visit(AnnounceStmt& s) { return arena.make<AnnounceStmt>(copy(s.expression)); }
+    Stmt* visit(VarDeclStmt& s) { return arena.make<VarDeclStmt>(s.type, s.name, s.line, copy(s.initializer)); }
+    Stmt* visit(BlockStmt& s) {
+        std::vector<Stmt*> statements;
+        statements.reserve(s.statements.size());
+        for (Stmt* stmt : s.statements) statements.push_back(copy(stmt));
+        return arena.make<BlockStmt>(arena.list(statements.data(), statements.size()));
+    }
+    Stmt* visit(LoopStmt& s) { return arena.make<LoopStmt>(copy(s.condition), copy(s.body)); }
+    Stmt* visit(FinishlineStmt& s) { return arena.make<FinishlineStmt>(copy(s.value)); }
+    Stmt* visit(FuncDefStmt& s) { return arena.make<FuncDefStmt>(s.name, s.line, copy(s.body)); }
+    Stmt* visit(IfStmt& s) { return arena.make<IfStmt>(copy(s.condition), copy(s.thenBranch), copy(s.elseBranch)); }
+    Stmt* visit(ListenStmt& s) { return arena.make<ListenStmt>(s.name, s.line); }
+
+    AstArena& arena;
+};
+
+// Runs 'work' three times; returns the fastest time, in seconds.
+template <typename Work>
+double fastestOf3(Work&& work) {
+    double best = 0;
+    for (int run = 0; run < 3; run++) {
+        auto start = std::chrono::steady_clock::now();
+        work();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (run == 0 || seconds < best) best = seconds;
+    }
+    return best;
+}
+
+// Times the front end on a large generated program (see frontEndSource):
+// scan() with each kernel the CPU has, against the old scanner (see
+// referenceScan); the parser against the old one (see ReferenceParser),
+// on 1, 2, 4 and 8 threads (see Parser::parseParallel), with shared
+// subexpressions (see Parser::shareExpressions), and pulling tokens from
+// a Lexer; then building and freeing its tree in an AstArena,
+// against shared_ptr nodes (see SharedNode), and visiting every node of
+// it both ways. Reports how many nodes sharing saves. Returns 1 if the two scanners do not find the same tokens.
+int runFrontEndBenchmarks() {
+    std::string code = frontEndSource(20000);
+    size_t tokenCount = 0;
+    {
+        CompilationContext ctx;
+        tokenCount = scan(code, ctx).size();
+        size_t errors = 0;
+        if (referenceScan(code, errors).size() != tokenCount || errors || !ctx.diagnostics.empty()) {
+            std::cerr << "front end: scan() and the reference scanner disagree\n";
+            return 1;
+        }
+    }
+
+    char line[160];
+    snprintf(line, sizeof line, "front end (%.1f MB)", code.size() / 1e6);
+    std::string title = line;
+    snprintf(line, sizeof line, "\n%-28s %11s %14s\n", title.c_str(), "time", "throughput");
+    std::cout << line;
+    auto report = [&](const char* name, double seconds, double amount, const char* unit) {
+        snprintf(line, sizeof line, "%-28s %8.1f ms %9.1f %s\n", name, seconds * 1e3, amount / seconds / 1e6, unit);
+        std::cout << line;
+    };
+
+    double seconds = fastestOf3([&] {
+        size_t errors = 0;
+        referenceScan(code, errors);
+    });
+    report("scan, reference", seconds, (double)code.size(), "MB/s");
+    for (ScanKernel kernel : { SCAN_SCALAR, SCAN_SSE2, SCAN_AVX2 }) {
+        if (!setScanKernel(kernel)) continue;
+        seconds = fastestOf3([&] {
+            CompilationContext ctx;
+            scan(code, ctx);
+        });
+        report((std::string("scan, ") + scanKernelName()).c_str(), seconds, (double)code.size(), "MB/s");
+    }
+    setScanKernel(SCAN_AUTO);
+
+    CompilationContext ctx;
+    auto tokens = scan(code, ctx);
+    size_t errors = 0;
+    std::vector<ReferenceToken> referenceTokens = referenceScan(code, errors);
+    try {
+        seconds = fastestOf3([&] { ReferenceParser(referenceTokens).parse(); });
+    }
+    catch (std::exception& e) {
+        std::cerr << "front end: the reference parser failed: " << e.what() << "\n";
+        return 1;
+    }
+    report("parse, reference", seconds, (double)tokens.size(), "M tokens/s");
+    seconds = fastestOf3([&] { Parser(tokens, ctx).parse(); });
+    report("parse", seconds, (double)tokens.size(), "M tokens/s");
+    for (unsigned jobs : { 1u, 2u, 4u, 8u }) {
+        ThreadPool pool(jobs);
+        seconds = fastestOf3([&] { Parser(tokens, ctx).parseParallel(pool); });
+        std::string name = "parse, parallel, " + std::to_string(jobs) + (jobs == 1 ? " job" : " jobs");
+        report(name.c_str(), seconds, (double)tokens.size(), "M tokens/s");
+    }
+    seconds = fastestOf3([&] {
+        Parser parser(tokens, ctx);
+        parser.shareExpressions(true);
+        parser.parse();
+    });
+    report("parse, shared expressions", seconds, (double)tokens.size(), "M tokens/s");
+    seconds = fastestOf3([&] {
+        CompilationContext streamed;
+        Lexer lexer(std::string_view(code), streamed);
+        Parser(lexer, streamed).parse();
+    });
+    report("scan+parse, Lexer", seconds, (double)tokens.size(), "M tokens/s");
+
+    ParseResult program = Parser(tokens, ctx).parse();
+    size_t nodes = 0, sharedBytes = 0, arenaBytes = 0;
+    seconds = fastestOf3([&] {
+        SharedTreeBuilder copier(ctx.symbols);
+        std::vector<std::shared_ptr<SharedNode>> tree;
+        for (Stmt* stmt : program.statements) tree.push_back(copier.copy(stmt));
+        nodes = copier.nodes;
+        sharedBytes = copier.bytes;
+    });
+    report("AST build+free, shared_ptr", seconds, (double)nodes, "M nodes/s");
+    seconds = fastestOf3([&] {
+        AstArena arena;
+        ArenaTreeBuilder copier(arena);
+        for (Stmt* stmt : program.statements) copier.copy(stmt);
+        arenaBytes = arena.bytesUsed();
+    });
+    report("AST build+free, arena", seconds, (double)nodes, "M nodes/s");
+
+    SharedTreeBuilder copier(ctx.symbols);
+    std::vector<std::shared_ptr<SharedNode>> sharedTree;
+    for (Stmt* stmt : program.statements) sharedTree.push_back(copier.copy(stmt));
+    size_t visited = 0;
+    seconds = fastestOf3([&] {
+        SharedNodeCounter counter;
+        for (auto& stmt : sharedTree) stmt->accept(counter);
+        visited = counter.count;
+    });
+    report("visit, shared_ptr + virtual", seconds, (double)visited, "M visits/s");
+    seconds = fastestOf3([&] {
+        NodeCounter counter;
+        visited = 0;
+        for (Stmt* stmt : program.statements) visited += counter.count(stmt);
+    });
+    report("visit, accept()", seconds, (double)visited, "M visits/s");
+
+    snprintf(line, sizeof line, "AST memory: %.1f MB with shared_ptr, %.1f MB in the arena\n", sharedBytes / 1e6,
+             arenaBytes / 1e6);
+    std::cout << line;
+
+    Parser sharingParser(tokens, ctx);
+    sharingParser.shareExpressions(true);
+    ParseResult shared = sharingParser.parse();
+    DistinctNodeCounter distinct;
+    size_t sharedNodes = 0;
+    for (Stmt* stmt : shared.statements) sharedNodes += distinct.count(stmt);
+    snprintf(line, sizeof line, "Shared expressions: %zu nodes instead of %zu (%.1f%% fewer), %.1f MB of parser arena instead of %.1f MB\n",
+             sharedNodes, visited, 100.0 * (double)(visited - sharedNodes) / (double)visited,
+             shared.arena.bytesUsed() / 1e6, program.arena.bytesUsed() / 1e6);
+    std::cout << line;
+    return 0;
+}
+
+} // namespace
+
+int runBenchmarks() {
+    struct Benchmark {
+        const char* name;
+        const char* code;
+    };
+    static const Benchmark benchmarks[] = {
+        { "loop", R"(ignite() {
+            gear i = 0;
+            looplap (i < 30000000) {
+                i = i + 1;
+            }
+            finishline 0;
+        })" },
+        { "arithmetic", R"(ignite() {
+            gear i = 0;
+            gear sum = 0;
+            turbo x = 0.0;
+            looplap (i < 5000000) {
+                sum = sum + i * 3 - i / 7;
+                x = x * 0.5 + i;
+                i = i + 1;
+            }
+            announce sum;
+            announce x;
+            finishline 0;
+        })" },
+        { "branches", R"(ignite() {
+            gear i = 0;
+            gear even = 0;
+            gear odd = 0;
+            looplap (i < 5000000) {
+                track (i - i / 2 * 2 == 0) {
+                    even = even + 1;
+                }
+                pitstop {
+                    odd = odd + 1;
+                }
+                i = i + 1;
+            }
+            announce even - odd;
+            finishline 0;
+        })" },
+        { "strings", R"(ignite() {
+            gear i = 0;
+            gear found = 0;
+            exhaust lap = "";
+            looplap (i < 1000000) {
+                lap = "lap " + i;
+                track (lap == "lap 500000") {
+                    found = found + 1;
+                }
+                i = i + 1;
+            }
+            announce lap + " " + found;
+            finishline 0;
+        })" },
+        { "invariants", R"(ignite() {
+            gear i = 0;
+            gear base = 12;
+            gear total = 0;
+            exhaust label = "";
+            looplap (i < 3000000) {
+                total = total + base * 7 + i * 5;
+                total = total - base * 7;
+                label = "lap " + base;
+                i = i + 1;
+            }
+            announce total;
+            announce label;
+            finishline 0;
+        })" },
+    };
+
+    std::cout << "benchmark      instructions      time     M instr/s         ast      native   speedup\n";
+    std::vector<std::string> interpreterRows; // What the AST interpreter's nodes did, counted apart from the timed run
+    for (const Benchmark& b : benchmarks) {
+        CompilationContext ctx;
+        std::string code = b.code;
+        auto tokens = scan(code, ctx);
+        Parser parser(tokens, ctx);
+        ParseResult program = parser.parse();
+        BytecodeCompiler compiler(ctx);
+        BytecodeProgram bytecode = compiler.compile(program.statements);
+        if (!ctx.diagnostics.empty() || bytecode.entry < 0) {
+            std::cerr << b.name << ":\n";
+            ctx.diagnostics.print(std::cerr);
+            return 1;
+        }
+
+        const BytecodeFunction& entry = bytecode.functions[(size_t)bytecode.entry];
+        std::istringstream input;
+        std::ostringstream output;
+        Vm vm(input, output);
+        RunResult counted = vm.run(entry, ctx.diagnostics, true);
+        size_t countedOutput = output.str().size();
+        auto start = std::chrono::steady_clock::now();
+        RunResult timed = vm.run(entry, ctx.diagnostics);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (!counted.ok || !timed.ok) {
+            ctx.diagnostics.print(std::cerr);
+            return 1;
+        }
+
+        char line[160];
+        snprintf(line, sizeof line, "%-12s %14llu %7.1f ms %12.1f", b.name,
+                 (unsigned long long)counted.instructions, seconds * 1e3, counted.instructions / seconds / 1e6);
+        std::cout << line;
+
+        std::ostringstream astOutput;
+        AstInterpreter interpreter(ctx.symbols, input, astOutput);
+        auto& ignite = static_cast<FuncDefStmt&>(*program.statements[0]);
+        start = std::chrono::steady_clock::now();
+        RunResult interpreted = interpreter.run(ignite, ctx.diagnostics);
+        double astSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (!interpreted.ok || interpreted.value != timed.value || astOutput.str() != output.str().substr(countedOutput)) {
+            std::cerr << b.name << ": the AST interpreter disagrees with the VM\n";
+            ctx.diagnostics.print(std::cerr);
+            return 1;
+        }
+        snprintf(line, sizeof line, " %8.1f ms", astSeconds * 1e3);
+        std::cout << line;
+
+        std::ostringstream countedAstOutput;
+        AstInterpreter counting(ctx.symbols, input, countedAstOutput);
+        counting.run(ignite, ctx.diagnostics, true);
+        const InterpreterStats& stats = counting.stats();
+        char row[160];
+        snprintf(row, sizeof row, "%-15s %10llu %10llu %17llu %13llu\n", b.name, (unsigned long long)stats.rewrites,
+                 (unsigned long long)stats.deopts, (unsigned long long)stats.hits, (unsigned long long)stats.generic);
+        interpreterRows.push_back(row);
+
+        auto native = NativeFunction::compile(ignite, ctx.symbols);
+        if (!native) {
+            std::cout << "           -         -\n";
+            continue;
+        }
+        std::ostringstream nativeOutput;
+        start = std::chrono::steady_clock::now();
+        RunResult ran = native->run(input, nativeOutput, ctx.diagnostics);
+        double nativeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (!ran.ok || ran.value != timed.value || nativeOutput.str() != output.str().substr(countedOutput)) {
+            std::cerr << b.name << ": native code disagrees with the VM\n";
+            ctx.diagnostics.print(std::cerr);
+            return 1;
+        }
+        snprintf(line, sizeof line, " %8.1f ms %8.1fx\n", nativeSeconds * 1e3, seconds / nativeSeconds);
+        std::cout << line;
+    }
+
+    std::cout << "\nAST interpreter   rewrites     deopts  specialized runs  generic runs\n";
+    for (const std::string& row : interpreterRows) std::cout << row;
+
+    static const char* const passSets[] = { "none", "gvn", "licm", "sr", "dse", "default", "all" };
+    std::cout << "\nSSA passes          none         gvn        licm          sr         dse     default         all  time (default)\n";
+    for (const Benchmark& b : benchmarks) {
+        CompilationContext ctx;
+        std::string code = b.code;
+        auto tokens = scan(code, ctx);
+        Parser parser(tokens, ctx);
+        ParseResult program = parser.parse();
+        BytecodeProgram bytecode = BytecodeCompiler(ctx).compile(program.statements);
+        std::istringstream input;
+        std::ostringstream expected;
+        Vm reference(input, expected);
+        RunResult wanted = reference.run(bytecode.functions[(size_t)bytecode.entry], ctx.diagnostics);
+
+        char line[160];
+        snprintf(line, sizeof line, "%-12s", b.name);
+        std::cout << line;
+        auto& ignite = static_cast<FuncDefStmt&>(*program.statements[0]);
+        double defaultSeconds = 0;
+        for (const char* set : passSets) {
+            unsigned passes;
+            parsePasses(set, passes);
+            IrFunction function;
+            BytecodeFunction lowered;
+            if (!SsaBuilder(ctx.symbols, ctx.diagnostics).build(ignite, function)) return 1;
+            SsaPassManager(passes).run(function);
+            if (!generateBytecode(function, lowered, ctx.diagnostics)) {
+                ctx.diagnostics.print(std::cerr);
+                return 1;
+            }
+
+            std::ostringstream output;
+            Vm vm(input, output);
+            RunResult counted = vm.run(lowered, ctx.diagnostics, true);
+            if (!counted.ok || counted.value != wanted.value || output.str() != expected.str()) {
+                std::cerr << b.name << ": SSA code (" << set << ") disagrees with the VM\n";
+                ctx.diagnostics.print(std::cerr);
+                return 1;
+            }
+            snprintf(line, sizeof line, " %11llu", (unsigned long long)counted.instructions);
+            std::cout << line;
+            if (passes == PASS_DEFAULT) {
+                auto start = std::chrono::steady_clock::now();
+                vm.run(lowered, ctx.diagnostics);
+                defaultSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            }
+        }
+        snprintf(line, sizeof line, " %8.1f ms\n", defaultSeconds * 1e3);
+        std::cout << line;
+    }
+    return runFrontEndBenchmarks();
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// --- Benchmarks ---
+// What AutoSpeed --bench runs. The baselines they compare against (the
+// scanner, parser and tree of earlier versions) are kept in
+// benchmarks.cpp, and used nowhere else.
+
+/*
+ * runBenchmarks
+ * Runs each benchmark program on the VM: once counting instructions, then
+ * once timed without counting; then timed on the AST interpreter, and as
+ * machine code if the native backend covers it ("-" if not), and what the
+ * interpreter's nodes did on a separate counted run. Then each
+ * goes through SSA IR with each set of passes, and the VM counts the
+ * instructions of the bytecode made from it. Last come the front-end
+ * benchmarks (see runFrontEndBenchmarks). Returns 1 if one fails to
+ * compile or run, or a backend disagrees with the VM.
+ */
+int runBenchmarks();
+
+/*
+ * frontEndSource
+ * A large program for the front-end benchmarks: 'functions' functions
+ * that between them use every statement and expression kind.
+ */
+std::string frontEndSource(size_t functions);
@@ -0,0 +1,101 @@
+#include "bytecode.h"
+#include "literal.h"
+
+#include <cstdio>
+
+using namespace std;
+
+const char* opName(Op op) {
+    static const char* const names[] = {
+#define AUTOSPEED_OP_NAME(name) #name,
+        AUTOSPEED_OPS(AUTOSPEED_OP_NAME)
+#undef AUTOSPEED_OP_NAME
+    };
+    return op < OP_COUNT ? names[op] : "?";
+}
+
+/////////////////////// DISASSEMBLER ///////////////////////
+
+namespace {
+
+// How an instruction's operands read: n = numeric register, s = string
+// register, t = jump target, k/K = numeric/string constant, - = unused.
+const char* operandKinds(Op op) {
+    switch (op) {
+    case OP_LOAD_NUM:      return "nk";
+    case OP_LOAD_STR:      return "sK";
+    case OP_MOVE:          return "nn";
+    case OP_MOVE_STR:      return "ss";
+    case OP_I_TO_D:
+    case OP_D_TO_I:        return "nn";
+    case OP_EQ_S:
+    case OP_NE_S:
+    case OP_LT_S:
+    case OP_LE_S:          return "nss";
+    case OP_CONCAT:        return "sss";
+    case OP_STR_I:
+    case OP_STR_D:
+    case OP_STR_B:         return "sn";
+    case OP_JUMP:          return "t";
+    case OP_JUMP_IF_FALSE:
+    case OP_JUMP_IF_TRUE:  return "nt";
+    case OP_ANNOUNCE_S:
+    case OP_LISTEN_S:      return "s";
+    case OP_ANNOUNCE_I:
+    case OP_ANNOUNCE_D:
+    case OP_ANNOUNCE_B:
+    case OP_LISTEN_I:
+    case OP_LISTEN_D:
+    case OP_LISTEN_B:
+    case OP_RETURN:        return "n";
+    default:               return "nnn";
+    }
+}
+
+} // namespace
+
+string disassemble(const BytecodeFunction& function, const SymbolTable& symbols) {
+    string out = "engine ";
+    out += function.name == NO_SYMBOL ? "?" : symbols.name(function.name);
+    out += " (line " + to_string(function.line) + "): " +
+           to_string(function.numberRegisters) + " numeric and " +
+           to_string(function.stringRegisters) + " string registers, " +
+           to_string(function.numbers.size() + function.strings.size()) + " constants\n";
+
+    char text[64];
+    for (size_t pc = 0; pc < function.code.size(); pc++) {
+        const Instr& in = function.code[pc];
+        snprintf(text, sizeof text, "%6zu %5d  %-14s", pc, function.lines[pc], opName(in.op));
+        out += text;
+
+        const char* kinds = operandKinds(in.op);
+        const uint16_t operands[] = { in.a, in.b, in.c };
+        string comment;
+        for (int i = 0; kinds[i]; i++) {
+            if (i > 0) out += ", ";
+            switch (kinds[i]) {
+            case 'n': out += "n" + to_string(operands[i]); break;
+            case 's': out += "s" + to_string(operands[i]); break;
+            case 't': out += "-> " + to_string(in.target()); break;
+            case 'k': {
+                out += "#" + to_string(operands[i]);
+                Number k = function.numbers[operands[i]];
+                switch (function.numberTypes[operands[i]]) {
+                case TYPE_TURBO: comment = formatDouble(k.d); break;
+                case TYPE_FLAG:  comment = k.i ? "true" : "false"; break;
+                default:         comment = to_string(k.i); break;
+                }
+                break;
+            }
+            case 'K':
+                out += "#" + to_string(operands[i]);
+                comment = "\"" + function.strings[operands[i]] + "\"";
+                break;
+            }
+            if (kinds[i] == 't') break; // The target takes both b and c
+        }
+        if (!comment.empty()) out += "    ; " + comment;
+        out += '\n';
+    }
+    return out;
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "literal.h"
+#include "symbol_table.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Number
+ * A numeric register or constant: a gear, turbo or flag value.
+ */
+union Number {
+    int64_t i;
+    double d;
+};
+
+/*
+ * Bytecode
+ * A register machine with two register files: numeric registers (n, one
+ * Number each) and string registers (s). Constants sit in registers of
+ * their own, loaded once when the function starts, so an operand is
+ * always a register and no instruction reads the constant pool in a loop.
+ *
+ * Each instruction is 8 bytes: an opcode and three 16-bit operands a, b,
+ * c. Jumps keep their 32-bit target instruction index in b (low half) and
+ * c (high half). Comparisons write 0 or 1; '>' and '>=' are compiled as
+ * '<' and '<=' with the operands swapped.
+ *
+ * AUTOSPEED_OPS lists every opcode once, with what it does, so the enum,
+ * the disassembler's names and the VM's dispatch table cannot disagree.
+ */
+#define AUTOSPEED_OPS(X)                                                         \
+    X(LOAD_NUM)      /* n[a] = numbers[b]                                     */ \
+    X(LOAD_STR)      /* s[a] = strings[b]                                     */ \
+    X(MOVE)          /* n[a] = n[b]                                           */ \
+    X(MOVE_STR)      /* s[a] = s[b]                                           */ \
+    X(ADD_I)         /* n[a].i = n[b].i + n[c].i, wrapping                    */ \
+    X(SUB_I)                                                                     \
+    X(MUL_I)                                                                     \
+    X(DIV_I)         /* Fails on division by zero                             */ \
+    X(ADD_D)         /* n[a].d = n[b].d + n[c].d                              */ \
+    X(SUB_D)                                                                     \
+    X(MUL_D)                                                                     \
+    X(DIV_D)                                                                     \
+    X(I_TO_D)        /* n[a].d = n[b].i                                       */ \
+    X(D_TO_I)        /* n[a].i = n[b].d, truncated                            */ \
+    X(EQ_I)          /* n[a].i = n[b].i == n[c].i                             */ \
+    X(NE_I)                                                                      \
+    X(LT_I)                                                                      \
+    X(LE_I)                                                                      \
+    X(EQ_D)          /* n[a].i = n[b].d == n[c].d                             */ \
+    X(NE_D)                                                                      \
+    X(LT_D)                                                                      \
+    X(LE_D)                                                                      \
+    X(EQ_S)          /* n[a].i = s[b] == s[c]                                 */ \
+    X(NE_S)                                                                      \
+    X(LT_S)                                                                      \
+    X(LE_S)                                                                      \
+    X(CONCAT)        /* s[a] = s[b] + s[c]                                    */ \
+    X(STR_I)         /* s[a] = n[b].i as text                                 */ \
+    X(STR_D)                                                                     \
+    X(STR_B)                                                                     \
+    X(JUMP)          /* Go to target                                          */ \
+    X(JUMP_IF_FALSE) /* Go to target if n[a].i == 0                           */ \
+    X(JUMP_IF_TRUE)  /* Go to target if n[a].i != 0                           */ \
+    X(ANNOUNCE_I)    /* Write n[a].i and a newline                            */ \
+    X(ANNOUNCE_D)                                                                \
+    X(ANNOUNCE_B)                                                                \
+    X(ANNOUNCE_S)                                                                \
+    X(LISTEN_I)      /* Read a line into n[a].i; fails if it is not a gear    */ \
+    X(LISTEN_D)                                                                  \
+    X(LISTEN_B)                                                                  \
+    X(LISTEN_S)                                                                  \
+    X(RETURN)        /* Finish with n[a].i                                    */
+
+enum Op : uint8_t {
+#define AUTOSPEED_OP_ENUM(name) OP_##name,
+    AUTOSPEED_OPS(AUTOSPEED_OP_ENUM)
+#undef AUTOSPEED_OP_ENUM
+    OP_COUNT
+};
+
+const char* opName(Op op);
+
+struct Instr {
+    Op op;
+    uint8_t unused = 0;
+    uint16_t a = 0;
+    uint16_t b = 0;
+    uint16_t c = 0;
+
+    uint32_t target() const { return b | (uint32_t)c << 16; }
+    void setTarget(uint32_t t) {
+        b = (uint16_t)t;
+        c = (uint16_t)(t >> 16);
+    }
+};
+
+/*
+ * BytecodeFunction
+ * One compiled 'engine' (or ignite()). Execution starts at code[0], which
+ * loads the constants into their registers.
+ */
+struct BytecodeFunction {
+    Symbol name = NO_SYMBOL;
+    int line = 0;
+    std::vector<Instr> code;
+    std::vector<int> lines;             // Source line of each instruction
+    std::vector<Number> numbers;        // Numeric constants
+    std::vector<ValueType> numberTypes; // Their types, for the disassembler
+    std::vector<std::string> strings;   // String constants
+    uint32_t numberRegisters = 0;
+    uint32_t stringRegisters = 0;
+};
+
+/*
+ * BytecodeProgram
+ * Every function of a program, in source order. 'entry' is the index of
+ * ignite(), or -1 if there is none.
+ */
+struct BytecodeProgram {
+    std::vector<BytecodeFunction> functions;
+    int entry = -1;
+};
+
+/*
+ * disassemble
+ * A listing of 'function', one instruction per line with its index,
+ * source line and operands, constants shown by value.
+ */
+std::string disassemble(const BytecodeFunction& function, const SymbolTable& symbols);
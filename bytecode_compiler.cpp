@@ -0,0 +1,437 @@
+#include "bytecode_compiler.h"
+#include "type_checker.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+namespace {
+
+// Collects the literals of a function, in tree order, so that they can be
+// given registers before any code is emitted.
+class LiteralFinder {
+public:
+    vector<LiteralValue> found;
+
+    void walk(Stmt* stmt) { if (stmt) stmt->accept(*this); }
+    void walk(Expr* expr) { if (expr) expr->accept(*this); }
+
+    void visit(BinaryExpr& expr) { walk(expr.left); walk(expr.right); }
+    void visit(LiteralExpr& expr) { found.push_back(expr.value); }
+    void visit(VariableExpr&) {}
+    void visit(AssignExpr& expr) { walk(expr.value); }
+
+    void visit(ExprStmt& stmt) { walk(stmt.expression); }
+    void visit(AnnounceStmt& stmt) { walk(stmt.expression); }
+    void visit(VarDeclStmt& stmt) { walk(stmt.initializer); }
+    void visit(BlockStmt& stmt) { for (Stmt* s : stmt.statements) walk(s); }
+    void visit(LoopStmt& stmt) { walk(stmt.condition); walk(stmt.body); }
+    void visit(FinishlineStmt& stmt) { walk(stmt.value); }
+    void visit(FuncDefStmt&) {} // Not compiled when nested
+    void visit(IfStmt& stmt) { walk(stmt.condition); walk(stmt.thenBranch); walk(stmt.elseBranch); }
+    void visit(ListenStmt&) {}
+};
+
+ValueType typeOfLiteral(LiteralValue::Kind kind) {
+    switch (kind) {
+    case LiteralValue::INT:    return TYPE_GEAR;
+    case LiteralValue::DOUBLE: return TYPE_TURBO;
+    case LiteralValue::BOOL:   return TYPE_FLAG;
+    case LiteralValue::STRING: return TYPE_EXHAUST;
+    default:                   return TYPE_ERROR;
+    }
+}
+
+bool isNumeric(ValueType type) { return type == TYPE_GEAR || type == TYPE_TURBO; }
+
+} // namespace
+
+BytecodeProgram BytecodeCompiler::compile(const vector<Stmt*>& statements) {
+    BytecodeProgram program;
+    Symbol ignite = ctx.symbols.find("ignite");
+    for (Stmt* stmt : statements) {
+        if (!stmt || stmt->kind != STMT_FUNC_DEF) continue;
+        auto& func = static_cast<FuncDefStmt&>(*stmt);
+        if (func.name == ignite && program.entry < 0) program.entry = (int)program.functions.size();
+        program.functions.push_back(compile(func));
+    }
+    return program;
+}
+
+BytecodeFunction BytecodeCompiler::compile(FuncDefStmt& func) {
+    BytecodeFunction out;
+    out.name = func.name;
+    out.line = func.line;
+    fn = &out;
+    numberConstants.clear();
+    stringConstants.clear();
+    top = next = { 0, 0 };
+    hint = nullptr;
+    tooLarge = false;
+
+    line = func.line;
+    addConstants(func);
+    TypeChecker checker(ctx.symbols, ctx.diagnostics);
+    if (checker.check(func)) {
+        slotTypes = checker.slotTypes();
+        homes.assign(slotTypes.size(), Operand{ TYPE_ERROR, 0 });
+        statement(func.body);
+    }
+    emit(OP_RETURN, ZERO); // Falling off the end finishes with 0
+
+    fn = nullptr;
+    return out;
+}
+
+/////////////////////// CODE ///////////////////////
+
+uint32_t BytecodeCompiler::emit(Op op, uint32_t a, uint32_t b, uint32_t c) {
+    Instr in;
+    in.op = op;
+    in.a = (uint16_t)a;
+    in.b = (uint16_t)b;
+    in.c = (uint16_t)c;
+    fn->code.push_back(in);
+    fn->lines.push_back(line);
+    return here() - 1;
+}
+
+void BytecodeCompiler::patch(uint32_t jump, uint32_t target) {
+    fn->code[jump].setTarget(target);
+}
+
+void BytecodeCompiler::error(int at, DiagCode code, string message) {
+    ctx.diagnostics.report(at, 0, code, move(message));
+}
+
+/////////////////////// REGISTERS ///////////////////////
+
+// Constants take the lowest registers, in order of first use, after the
+// 0 and "" that the compiler itself needs. The code starts by loading
+// them.
+void BytecodeCompiler::addConstants(FuncDefStmt& func) {
+    LiteralFinder finder;
+    finder.walk(func.body);
+
+    constant(LiteralValue::ofInt(0));
+    stringConstants[NO_SYMBOL] = allocate(TYPE_EXHAUST, top);
+    fn->strings.push_back("");
+    next = top;
+    for (const LiteralValue& value : finder.found) constant(value);
+
+    for (uint32_t k = 0; k < fn->numbers.size(); k++) emit(OP_LOAD_NUM, k, k);
+    for (uint32_t k = 0; k < fn->strings.size(); k++) emit(OP_LOAD_STR, k, k);
+}
+
+BytecodeCompiler::Operand BytecodeCompiler::constant(const LiteralValue& value) {
+    ValueType type = typeOfLiteral(value.kind);
+    if (type == TYPE_EXHAUST) {
+        auto it = stringConstants.find(value.s);
+        if (it != stringConstants.end()) return { type, it->second };
+        uint32_t reg = allocate(type, top);
+        next.string = top.string;
+        stringConstants.emplace(value.s, reg);
+        fn->strings.emplace_back(ctx.symbols.name(value.s));
+        return { type, reg };
+    }
+
+    Number n;
+    if (type == TYPE_TURBO) n.d = value.d;
+    else if (type == TYPE_FLAG) n.i = value.b ? 1 : 0;
+    else n.i = value.i;
+    uint64_t bits;
+    memcpy(&bits, &n, sizeof bits);
+    auto it = numberConstants.find(bits);
+    if (it != numberConstants.end()) return { type, it->second };
+    uint32_t reg = allocate(type, top);
+    next.number = top.number;
+    numberConstants.emplace(bits, reg);
+    fn->numbers.push_back(n);
+    fn->numberTypes.push_back(type);
+    return { type, reg };
+}
+
+uint32_t BytecodeCompiler::allocate(ValueType type, Mark& mark) {
+    uint32_t& counter = type == TYPE_EXHAUST ? mark.string : mark.number;
+    uint32_t& most = type == TYPE_EXHAUST ? fn->stringRegisters : fn->numberRegisters;
+    if (counter > 0xFFFF) {
+        if (!tooLarge) error(line, DIAG_FUNCTION_TOO_LARGE, "Function needs more than 65536 registers.");
+        tooLarge = true;
+        return 0;
+    }
+    uint32_t reg = counter++;
+    most = max(most, counter);
+    return reg;
+}
+
+BytecodeCompiler::Operand BytecodeCompiler::result(ValueType type, const Operand* into) {
+    if (into && into->type == type) return *into;
+    return temporary(type);
+}
+
+/////////////////////// VARIABLES ///////////////////////
+
+// Variables are only made between statements, when no temporaries are in
+// use, so they stay packed below the temporaries. The register is the
+// slot's until the block around the declaration ends; no use of the slot
+// comes after that.
+BytecodeCompiler::Operand BytecodeCompiler::variable(uint32_t slot) {
+    ValueType type = slotTypes[slot];
+    homes[slot] = { type, allocate(type, top) };
+    next = top;
+    return homes[slot];
+}
+
+/////////////////////// VALUES ///////////////////////
+
+BytecodeCompiler::Operand BytecodeCompiler::expression(Expr* expr, const Operand* into) {
+    if (!expr) return { TYPE_ERROR, 0 };
+    hint = into;
+    return expr->accept(*this);
+}
+
+// 'value' as a 'type', in 'into' if that has the type. The checker only
+// lets gear and turbo convert into each other.
+BytecodeCompiler::Operand BytecodeCompiler::convert(Operand value, ValueType type, const Operand* into) {
+    if (value.type == type || !isNumeric(value.type) || !isNumeric(type)) return value;
+    Operand out = result(type, into);
+    emit(type == TYPE_TURBO ? OP_I_TO_D : OP_D_TO_I, out.reg, value.reg);
+    return out;
+}
+
+void BytecodeCompiler::store(Operand value, Operand variable) {
+    value = convert(value, variable.type, &variable);
+    if (value.reg == variable.reg) return;
+    emit(variable.type == TYPE_EXHAUST ? OP_MOVE_STR : OP_MOVE, variable.reg, value.reg);
+}
+
+BytecodeCompiler::Operand BytecodeCompiler::text(Operand value) {
+    if (value.type == TYPE_EXHAUST) return value;
+    Operand out = temporary(TYPE_EXHAUST);
+    emit(value.type == TYPE_GEAR ? OP_STR_I : value.type == TYPE_TURBO ? OP_STR_D : OP_STR_B, out.reg, value.reg);
+    return out;
+}
+
+uint32_t BytecodeCompiler::condition(Expr* expr) {
+    Operand value = expression(expr);
+    if (value.type != TYPE_TURBO) return value.reg;
+    Operand out = temporary(TYPE_FLAG);
+    emit(OP_NE_D, out.reg, value.reg, ZERO);
+    return out.reg;
+}
+
+bool BytecodeCompiler::assigns(Expr* expr) const {
+    if (!expr) return false;
+    switch (expr->kind) {
+    case EXPR_ASSIGN: return true;
+    case EXPR_BINARY: {
+        auto binary = static_cast<BinaryExpr*>(expr);
+        return assigns(binary->left) || assigns(binary->right);
+    }
+    default: return false;
+    }
+}
+
+// 'type' is the checker's type of the operation: an exhaust joins text,
+// a gear or turbo is done in that type.
+BytecodeCompiler::Operand BytecodeCompiler::arithmetic(TokenType op, ValueType type, Operand left, Operand right, const Operand* into) {
+    if (type == TYPE_EXHAUST) {
+        left = text(left);
+        right = text(right);
+        release();
+        Operand out = result(TYPE_EXHAUST, into);
+        emit(OP_CONCAT, out.reg, left.reg, right.reg);
+        return out;
+    }
+
+    left = convert(left, type, nullptr);
+    right = convert(right, type, nullptr);
+    release();
+    Operand out = result(type, into);
+    static const Op integerOps[] = { OP_ADD_I, OP_SUB_I, OP_MUL_I, OP_DIV_I };
+    static const Op decimalOps[] = { OP_ADD_D, OP_SUB_D, OP_MUL_D, OP_DIV_D };
+    int index = op == OP_PLUS ? 0 : op == OP_MINUS ? 1 : op == OP_STAR ? 2 : 3;
+    emit(type == TYPE_GEAR ? integerOps[index] : decimalOps[index], out.reg, left.reg, right.reg);
+    return out;
+}
+
+// The checker allows two numbers, two exhausts, or two flags (== and !=).
+BytecodeCompiler::Operand BytecodeCompiler::comparison(TokenType op, Operand left, Operand right, const Operand* into) {
+    if (op == OP_GREATER || op == OP_GREATER_EQUAL) {
+        swap(left, right);
+        op = op == OP_GREATER ? OP_LESS : OP_LESS_EQUAL;
+    }
+    int index = op == OP_EQUAL ? 0 : op == OP_NOT_EQUAL ? 1 : op == OP_LESS ? 2 : 3;
+
+    Op code;
+    if (isNumeric(left.type) && isNumeric(right.type)) {
+        bool integer = left.type == TYPE_GEAR && right.type == TYPE_GEAR;
+        static const Op integerOps[] = { OP_EQ_I, OP_NE_I, OP_LT_I, OP_LE_I };
+        static const Op decimalOps[] = { OP_EQ_D, OP_NE_D, OP_LT_D, OP_LE_D };
+        if (!integer) {
+            left = convert(left, TYPE_TURBO, nullptr);
+            right = convert(right, TYPE_TURBO, nullptr);
+        }
+        code = integer ? integerOps[index] : decimalOps[index];
+    }
+    else if (left.type == TYPE_EXHAUST && right.type == TYPE_EXHAUST) {
+        static const Op textOps[] = { OP_EQ_S, OP_NE_S, OP_LT_S, OP_LE_S };
+        code = textOps[index];
+    }
+    else {
+        code = index == 0 ? OP_EQ_I : OP_NE_I;
+    }
+    release();
+    Operand out = result(TYPE_FLAG, into);
+    emit(code, out.reg, left.reg, right.reg);
+    return out;
+}
+
+/////////////////////// EXPRESSIONS ///////////////////////
+
+// Operands are computed first; then the temporaries they used are given
+// back, so the result may land in one of them. That is safe because an
+// instruction reads its operands before it writes.
+BytecodeCompiler::Operand BytecodeCompiler::visit(BinaryExpr& expr) {
+    const Operand* into = hint;
+    Mark saved = top;
+    top = next; // Temporaries in use around this expression stay in use
+    Operand left = expression(expr.left);
+    // A variable (or an assignment, whose value is its variable) is read
+    // where the operator runs, so if the right side may assign to it, it
+    // must be read first.
+    bool inVariable = expr.left && (expr.left->kind == EXPR_VARIABLE || expr.left->kind == EXPR_ASSIGN);
+    if (inVariable && assigns(expr.right)) {
+        Operand copy = temporary(left.type);
+        emit(left.type == TYPE_EXHAUST ? OP_MOVE_STR : OP_MOVE, copy.reg, left.reg);
+        left = copy;
+    }
+    Operand right = expression(expr.right);
+
+    line = expr.line;
+    Operand out;
+    switch (expr.op) {
+    case OP_PLUS:
+    case OP_MINUS:
+    case OP_STAR:
+    case OP_SLASH:
+        out = arithmetic(expr.op, expr.type, left, right, into);
+        break;
+    default:
+        out = comparison(expr.op, left, right, into);
+        break;
+    }
+    Mark inner = next;
+    top = saved;
+    next = inner;
+    return out;
+}
+
+BytecodeCompiler::Operand BytecodeCompiler::visit(LiteralExpr& expr) {
+    line = expr.line;
+    return constant(expr.value);
+}
+
+BytecodeCompiler::Operand BytecodeCompiler::visit(VariableExpr& expr) {
+    line = expr.line;
+    return homes[expr.slot];
+}
+
+BytecodeCompiler::Operand BytecodeCompiler::visit(AssignExpr& expr) {
+    line = expr.line;
+    Operand variable = homes[expr.slot];
+    Operand value = expression(expr.value, &variable);
+    line = expr.line;
+    store(value, variable);
+    return variable;
+}
+
+/////////////////////// STATEMENTS ///////////////////////
+
+void BytecodeCompiler::statement(Stmt* stmt) {
+    if (!stmt) return;
+    stmt->accept(*this);
+    release();
+}
+
+void BytecodeCompiler::visit(ExprStmt& stmt) {
+    expression(stmt.expression);
+}
+
+void BytecodeCompiler::visit(AnnounceStmt& stmt) {
+    Operand value = expression(stmt.expression);
+    switch (value.type) {
+    case TYPE_GEAR:    emit(OP_ANNOUNCE_I, value.reg); break;
+    case TYPE_TURBO:   emit(OP_ANNOUNCE_D, value.reg); break;
+    case TYPE_FLAG:    emit(OP_ANNOUNCE_B, value.reg); break;
+    case TYPE_EXHAUST: emit(OP_ANNOUNCE_S, value.reg); break;
+    default: break;
+    }
+}
+
+// The variable comes into scope after its initializer, which may still
+// read an outer variable of the same name.
+void BytecodeCompiler::visit(VarDeclStmt& stmt) {
+    Operand value = variable(stmt.slot);
+    if (stmt.initializer) {
+        Operand initial = expression(stmt.initializer, &value);
+        line = stmt.line;
+        store(initial, value);
+    }
+    else {
+        line = stmt.line;
+        bool text = value.type == TYPE_EXHAUST;
+        emit(text ? OP_MOVE_STR : OP_MOVE, value.reg, text ? EMPTY : ZERO);
+    }
+}
+
+void BytecodeCompiler::visit(BlockStmt& stmt) {
+    Mark saved = top;
+    for (Stmt* s : stmt.statements) statement(s);
+    top = next = saved;
+}
+
+// The condition is tested at the bottom, so each lap costs one jump.
+void BytecodeCompiler::visit(LoopStmt& stmt) {
+    uint32_t toCondition = emit(OP_JUMP);
+    uint32_t body = here();
+    statement(stmt.body);
+    patch(toCondition, here());
+    uint32_t test = condition(stmt.condition);
+    patch(emit(OP_JUMP_IF_TRUE, test), body);
+}
+
+void BytecodeCompiler::visit(FinishlineStmt& stmt) {
+    Operand value = convert(expression(stmt.value), TYPE_GEAR, nullptr);
+    emit(OP_RETURN, value.reg);
+}
+
+void BytecodeCompiler::visit(FuncDefStmt&) {}
+
+void BytecodeCompiler::visit(IfStmt& stmt) {
+    uint32_t test = condition(stmt.condition);
+    uint32_t toElse = emit(OP_JUMP_IF_FALSE, test);
+    release();
+    statement(stmt.thenBranch);
+    if (!stmt.elseBranch) {
+        patch(toElse, here());
+        return;
+    }
+    uint32_t toEnd = emit(OP_JUMP);
+    patch(toElse, here());
+    statement(stmt.elseBranch);
+    patch(toEnd, here());
+}
+
+void BytecodeCompiler::visit(ListenStmt& stmt) {
+    line = stmt.line;
+    Operand value = homes[stmt.slot];
+    if (value.type == TYPE_ERROR) value = variable(stmt.slot); // Declares it
+    switch (value.type) {
+    case TYPE_GEAR:  emit(OP_LISTEN_I, value.reg); break;
+    case TYPE_TURBO: emit(OP_LISTEN_D, value.reg); break;
+    case TYPE_FLAG:  emit(OP_LISTEN_B, value.reg); break;
+    default:         emit(OP_LISTEN_S, value.reg); break;
+    }
+}
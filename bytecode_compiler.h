@@ -0,0 +1,120 @@
+#pragma once
+
+#include "bytecode.h"
+#include "parser.h"
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * BytecodeCompiler
+ * Compiles a parsed program to bytecode (see bytecode.h), one function at
+ * a time, in a single walk over each function's tree.
+ *
+ * Each function is type-checked first (TypeChecker), which binds its
+ * variables to frame slots and reports name and type errors; the compiler
+ * reports none of its own. Every operation gets the instruction for the
+ * types the checker gave its operands (Expr::type): gear with gear stays
+ * integer, gear with turbo is done in turbo, '+' with an exhaust on
+ * either side joins text. A value is converted to a variable's type when
+ * it is stored (gear <-> turbo). Conditions test a flag, gear or turbo
+ * (non-zero is true); finishline returns a gear, flag or turbo as a gear.
+ *
+ * Variables live in registers, found by their slot: a block's variables
+ * are freed when it ends, and an expression's temporaries when its
+ * statement ends. Reading a variable uses its register directly, with no
+ * copy. 'listen' into a name that is not declared declares it, as an
+ * exhaust.
+ *
+ * Errors go to ctx.diagnostics, at the line of the node and column 0.
+ * A function with errors is not compiled (its code only returns 0) and
+ * must not be run. The tree must be one that parsed without errors, and
+ * must not share expression nodes (see TypeChecker); top-level statements
+ * outside a function, and functions inside a function, are not compiled.
+ */
+class BytecodeCompiler {
+public:
+    explicit BytecodeCompiler(CompilationContext& ctx) : ctx(ctx) {}
+
+    BytecodeProgram compile(const std::vector<Stmt*>& statements);
+    BytecodeFunction compile(FuncDefStmt& func);
+
+private:
+    friend struct Expr; // accept() calls the visit() overloads
+    friend struct Stmt;
+
+    // Where a value is: its type and its register (in the numeric or the
+    // string file, by type).
+    struct Operand {
+        ValueType type;
+        uint32_t reg;
+    };
+
+    // Next free register of each file.
+    struct Mark {
+        uint32_t number;
+        uint32_t string;
+    };
+
+    CompilationContext& ctx;
+    BytecodeFunction* fn = nullptr;
+    std::unordered_map<uint64_t, uint32_t> numberConstants; // By bits
+    std::unordered_map<Symbol, uint32_t> stringConstants;
+    std::vector<ValueType> slotTypes; // Of each frame slot, from the TypeChecker
+    std::vector<Operand> homes;       // Register of each frame slot; TYPE_ERROR until declared
+    Mark top{ 0, 0 };  // Above the variables in scope
+    Mark next{ 0, 0 }; // Above the temporaries in use too
+    const Operand* hint = nullptr; // Where the expression being compiled should go, if it can
+    int line = 0;                  // Of the instructions being emitted
+    bool tooLarge = false;
+
+    static constexpr uint32_t ZERO = 0;  // Numeric register holding 0 (and 0.0, and false)
+    static constexpr uint32_t EMPTY = 0; // String register holding ""
+
+    // Code
+    uint32_t emit(Op op, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0); // Returns its index
+    void patch(uint32_t jump, uint32_t target);
+    uint32_t here() const { return (uint32_t)fn->code.size(); }
+    void error(int line, DiagCode code, std::string message);
+
+    // Registers
+    void addConstants(FuncDefStmt& func);
+    Operand constant(const LiteralValue& value);
+    uint32_t allocate(ValueType type, Mark& mark);
+    Operand temporary(ValueType type) { return { type, allocate(type, next) }; }
+    Operand result(ValueType type, const Operand* into); // 'into' if it has that type
+    void release() { next = top; }
+
+    // Variables
+    Operand variable(uint32_t slot); // A register for a new variable
+
+    // Values
+    Operand expression(Expr* expr, const Operand* into = nullptr);
+    Operand convert(Operand value, ValueType type, const Operand* into);
+    void store(Operand value, Operand variable);
+    Operand text(Operand value);      // As an exhaust
+    uint32_t condition(Expr* expr);   // A numeric register, true if non-zero
+    bool assigns(Expr* expr) const;   // Contains an AssignExpr
+
+    Operand arithmetic(TokenType op, ValueType type, Operand left, Operand right, const Operand* into);
+    Operand comparison(TokenType op, Operand left, Operand right, const Operand* into);
+
+    void statement(Stmt* stmt);
+
+    // Expression visitors
+    Operand visit(BinaryExpr& expr);
+    Operand visit(LiteralExpr& expr);
+    Operand visit(VariableExpr& expr);
+    Operand visit(AssignExpr& expr);
+
+    // Statement visitors
+    void visit(ExprStmt& stmt);
+    void visit(AnnounceStmt& stmt);
+    void visit(VarDeclStmt& stmt);
+    void visit(BlockStmt& stmt);
+    void visit(LoopStmt& stmt);
+    void visit(FinishlineStmt& stmt);
+    void visit(FuncDefStmt& stmt);
+    void visit(IfStmt& stmt);
+    void visit(ListenStmt& stmt);
+};
@@ -0,0 +1,742 @@
+#include "c_emitter.h"
+#include "literal.h"
+
+#include <cmath>
+#include <cstdio>
+
+using namespace std;
+
+namespace {
+
+// Written at the top of every generated program.
+const char* const RUNTIME = R"(#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* ---------------- Auto-Speed runtime ---------------- */
+
+/* exhaust: a variable owns its buffer; other values point anywhere. */
+typedef struct {
+    char* data;
+    size_t size;
+} as_str;
+
+#define AS_LIT(s) ((as_str){ (char*)(s), sizeof(s) - 1 })
+#define AS_EMPTY ((as_str){ NULL, 0 })
+
+static inline void as_fail(int line, const char* message, const char* detail) {
+    fflush(stdout);
+    fprintf(stderr, "Error [Line %d]: ", line);
+    fprintf(stderr, message, detail);
+    fputc('\n', stderr);
+    exit(1);
+}
+
+static inline void* as_alloc(void* old, size_t size) {
+    void* p = realloc(old, size ? size : 1);
+    if (!p) {
+        fputs("Out of memory.\n", stderr);
+        exit(1);
+    }
+    return p;
+}
+
+/* Integer arithmetic wraps, and turbo -> gear saturates. */
+static inline int64_t as_add(int64_t a, int64_t b) { return (int64_t)((uint64_t)a + (uint64_t)b); }
+static inline int64_t as_sub(int64_t a, int64_t b) { return (int64_t)((uint64_t)a - (uint64_t)b); }
+static inline int64_t as_mul(int64_t a, int64_t b) { return (int64_t)((uint64_t)a * (uint64_t)b); }
+
+static inline int64_t as_div(int64_t a, int64_t b, int line) {
+    if (b == 0) as_fail(line, "Division by zero.%s", "");
+    return b == -1 ? (int64_t)(0 - (uint64_t)a) : a / b;
+}
+
+/* A function, not a cast: GCC folds 0.0 - (double)i to -(double)i, which
+   is -0.0 when i is 0. */
+static inline double as_turbo(int64_t v) { return (double)v; }
+
+static inline int64_t as_truncate(double d) {
+    if (d != d) return 0;
+    if (d >= 9223372036854775807.0) return INT64_MAX;
+    if (d <= -9223372036854775808.0) return INT64_MIN;
+    return (int64_t)d;
+}
+
+/* Text made while evaluating a statement, freed by as_tmp_reset(). */
+typedef struct as_chunk {
+    struct as_chunk* next;
+    size_t used, size;
+    char data[];
+} as_chunk;
+
+static as_chunk* as_tmp;
+
+static inline char* as_tmp_alloc(size_t size) {
+    if (!as_tmp || as_tmp->size - as_tmp->used < size) {
+        size_t chunk = as_tmp ? 2 * as_tmp->size : 4096;
+        if (chunk < size) chunk = size;
+        as_chunk* c = (as_chunk*)as_alloc(NULL, sizeof(as_chunk) + chunk);
+        c->next = as_tmp;
+        c->used = 0;
+        c->size = chunk;
+        as_tmp = c;
+    }
+    char* p = as_tmp->data + as_tmp->used;
+    as_tmp->used += size;
+    return p;
+}
+
+static inline void as_tmp_reset(void) {
+    if (!as_tmp) return;
+    while (as_tmp->next) {
+        as_chunk* older = as_tmp->next;
+        as_tmp->next = older->next;
+        free(older);
+    }
+    as_tmp->used = 0;
+}
+
+static inline as_str as_concat(as_str a, as_str b) {
+    as_str s = { as_tmp_alloc(a.size + b.size), a.size + b.size };
+    if (a.size) memcpy(s.data, a.data, a.size);
+    if (b.size) memcpy(s.data + a.size, b.data, b.size);
+    return s;
+}
+
+static inline as_str as_assign(as_str* var, as_str value) {
+    if (value.data != var->data) {
+        var->data = (char*)as_alloc(var->data, value.size);
+        if (value.size) memcpy(var->data, value.data, value.size);
+    }
+    var->size = value.size;
+    return *var;
+}
+
+static inline as_str as_copy(as_str value) {
+    as_str var = AS_EMPTY;
+    return as_assign(&var, value);
+}
+
+static inline void as_free(as_str* var) {
+    free(var->data);
+    *var = AS_EMPTY;
+}
+
+static inline int as_compare(as_str a, as_str b) {
+    size_t n = a.size < b.size ? a.size : b.size;
+    int c = n ? memcmp(a.data, b.data, n) : 0;
+    if (c) return c;
+    return a.size < b.size ? -1 : a.size > b.size;
+}
+
+/* The shortest text that reads back as the same double, as fixed or
+   scientific notation, whichever is shorter, always with a '.' or 'e'. */
+static inline size_t as_format_turbo(double d, char* out) {
+    if (d != d) return (size_t)sprintf(out, signbit(d) ? "-nan" : "nan");
+    if (isinf(d)) return (size_t)sprintf(out, d < 0 ? "-inf" : "inf");
+    if (d == 0) return (size_t)sprintf(out, signbit(d) ? "-0.0" : "0.0");
+
+    char sci[40];
+    for (int precision = 0; precision <= 17; precision++) {
+        snprintf(sci, sizeof sci, "%.*e", precision, d);
+        if (strtod(sci, NULL) == d) break;
+    }
+    char digits[24];
+    size_t n = 0;
+    const char* p = sci + (d < 0);
+    for (; *p != 'e'; p++)
+        if (*p != '.') digits[n++] = *p;
+    int exponent = atoi(p + 1);
+
+    char fixed[400];
+    size_t f = 0;
+    if (exponent < 0) {
+        fixed[f++] = '0';
+        fixed[f++] = '.';
+        for (int k = -1; k > exponent; k--) fixed[f++] = '0';
+        for (size_t k = 0; k < n; k++) fixed[f++] = digits[k];
+    }
+    else if (exponent >= (int)n - 1) {
+        f = (size_t)sprintf(fixed, "%.0f", fabs(d)); /* Integers are written exactly */
+    }
+    else {
+        for (size_t k = 0; k < n || (int)k <= exponent; k++) {
+            if ((int)k == exponent + 1) fixed[f++] = '.';
+            fixed[f++] = k < n ? digits[k] : '0';
+        }
+    }
+    size_t s = 0;
+    char scientific[40];
+    scientific[s++] = digits[0];
+    if (n > 1) {
+        scientific[s++] = '.';
+        for (size_t k = 1; k < n; k++) scientific[s++] = digits[k];
+    }
+    s += (size_t)sprintf(scientific + s, "e%c%02d", exponent < 0 ? '-' : '+', exponent < 0 ? -exponent : exponent);
+
+    size_t size = 0;
+    if (d < 0) out[size++] = '-';
+    if (f <= s) {
+        memcpy(out + size, fixed, f);
+        size += f;
+        if (memchr(fixed, '.', f) == NULL) {
+            out[size++] = '.';
+            out[size++] = '0';
+        }
+    }
+    else {
+        memcpy(out + size, scientific, s);
+        size += s;
+    }
+    out[size] = '\0';
+    return size;
+}
+
+static inline as_str as_text_gear(int64_t v) {
+    char text[24];
+    int size = sprintf(text, "%" PRId64, v);
+    as_str s = { as_tmp_alloc((size_t)size), (size_t)size };
+    memcpy(s.data, text, (size_t)size);
+    return s;
+}
+
+static inline as_str as_text_turbo(double d) {
+    char text[400];
+    size_t size = as_format_turbo(d, text);
+    as_str s = { as_tmp_alloc(size), size };
+    memcpy(s.data, text, size);
+    return s;
+}
+
+static inline as_str as_text_flag(bool b) { return b ? AS_LIT("true") : AS_LIT("false"); }
+
+/* announce */
+static inline void as_announce_gear(int64_t v) { printf("%" PRId64 "\n", v); }
+static inline void as_announce_flag(bool b) { puts(b ? "true" : "false"); }
+
+static inline void as_announce_turbo(double d) {
+    char text[400];
+    size_t size = as_format_turbo(d, text);
+    text[size++] = '\n';
+    fwrite(text, 1, size, stdout);
+}
+
+static inline void as_announce_str(as_str s) {
+    fwrite(s.data, 1, s.size, stdout);
+    putchar('\n');
+}
+
+/* listen: one line of stdin; output so far is shown first. */
+static as_str as_line;
+static size_t as_line_capacity;
+
+static inline bool as_read_line(void) {
+    fflush(stdout);
+    as_line.size = 0;
+    int c;
+    bool any = false;
+    while ((c = getchar()) != EOF) {
+        any = true;
+        if (c == '\n') break;
+        if (as_line.size == as_line_capacity) {
+            as_line_capacity = as_line_capacity ? 2 * as_line_capacity : 128;
+            as_line.data = (char*)as_alloc(as_line.data, as_line_capacity + 1);
+        }
+        as_line.data[as_line.size++] = (char)c;
+    }
+    if (as_line.data) as_line.data[as_line.size] = '\0';
+    return any;
+}
+
+static inline void as_bad_input(const char* type, int line) {
+    char message[64];
+    snprintf(message, sizeof message, "listen expected a %s, got '%%s'.", type);
+    as_fail(line, message, as_line.data ? as_line.data : "");
+}
+
+/* The line without surrounding blanks; not blank, or a failure for 'type'. */
+static inline as_str as_read_value(const char* type, int line) {
+    if (!as_read_line()) as_fail(line, "listen found no more input.%s", "");
+    size_t first = 0, last = as_line.size;
+    while (first < last && strchr(" \t\r", as_line.data[first])) first++;
+    while (last > first && strchr(" \t\r", as_line.data[last - 1])) last--;
+    if (first == last) as_bad_input(type, line);
+    as_str value = { as_line.data + first, last - first };
+    return value;
+}
+
+static inline void as_listen_gear(int64_t* into, int line) {
+    as_str value = as_read_value("gear", line);
+    size_t k = 0;
+    bool negative = value.data[0] == '-';
+    if (negative) k++;
+    if (k == value.size) as_bad_input("gear", line);
+    uint64_t limit = negative ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX, n = 0;
+    for (; k < value.size; k++) {
+        char c = value.data[k];
+        if (c < '0' || c > '9' || n > (limit - (uint64_t)(c - '0')) / 10) as_bad_input("gear", line);
+        n = n * 10 + (uint64_t)(c - '0');
+    }
+    *into = negative ? (int64_t)(0 - n) : (int64_t)n;
+}
+
+static inline void as_listen_turbo(double* into, int line) {
+    as_str value = as_read_value("turbo", line);
+    char saved = value.data[value.size];
+    value.data[value.size] = '\0';
+    char* end = NULL;
+    *into = strtod(value.data, &end);
+    value.data[value.size] = saved;
+    if (end != value.data + value.size) as_bad_input("turbo", line);
+}
+
+static inline void as_listen_flag(bool* into, int line) {
+    as_str value = as_read_value("flag", line);
+    *into = value.size == 4 && memcmp(value.data, "true", 4) == 0;
+    if (!*into && !(value.size == 5 && memcmp(value.data, "false", 5) == 0)) as_bad_input("flag", line);
+}
+
+static inline void as_listen_str(as_str* into, int line) {
+    (void)line;
+    as_read_line();
+    if (as_line.size && as_line.data[as_line.size - 1] == '\r') as_line.size--;
+    as_assign(into, as_line);
+}
+
+/* ---------------- Program ---------------- */
+)";
+
+const char* cType(ValueType type) {
+    switch (type) {
+    case TYPE_TURBO:   return "double";
+    case TYPE_FLAG:    return "bool";
+    case TYPE_EXHAUST: return "as_str";
+    default:           return "int64_t";
+    }
+}
+
+const char* zeroOf(ValueType type) {
+    switch (type) {
+    case TYPE_TURBO:   return "0.0";
+    case TYPE_FLAG:    return "false";
+    case TYPE_EXHAUST: return "AS_EMPTY";
+    default:           return "0";
+    }
+}
+
+const char* suffixOf(ValueType type) {
+    switch (type) {
+    case TYPE_TURBO:   return "turbo";
+    case TYPE_FLAG:    return "flag";
+    case TYPE_EXHAUST: return "str";
+    default:           return "gear";
+    }
+}
+
+ValueType typeOfDeclaration(TokenType keyword) {
+    switch (keyword) {
+    case KW_TURBO:   return TYPE_TURBO;
+    case KW_EXHAUST: return TYPE_EXHAUST;
+    case KW_FLAG:    return TYPE_FLAG;
+    default:         return TYPE_GEAR;
+    }
+}
+
+// The operator as C writes it, which is as Auto-Speed does.
+string spelling(TokenType op) { return string(tokenSpelling(op)); }
+
+// A C string literal's contents.
+string escaped(string_view text) {
+    string result;
+    for (unsigned char c : text) {
+        switch (c) {
+        case '"':  result += "\\\""; break;
+        case '\\': result += "\\\\"; break;
+        case '\n': result += "\\n"; break;
+        case '\t': result += "\\t"; break;
+        case '\r': result += "\\r"; break;
+        case '?':  result += "\\?"; break; // No trigraphs
+        default:
+            if (c < 0x20 || c == 0x7F) {
+                char octal[8];
+                snprintf(octal, sizeof octal, "\\%03o", c);
+                result += octal;
+            }
+            else {
+                result += (char)c;
+            }
+        }
+    }
+    return result;
+}
+
+// True if the last statement of 'body' is a finishline.
+bool endsInReturn(const Stmt* body) {
+    if (body && body->kind == STMT_BLOCK) {
+        const auto& statements = static_cast<const BlockStmt*>(body)->statements;
+        body = statements.empty() ? nullptr : statements[statements.size() - 1];
+    }
+    return body && body->kind == STMT_FINISHLINE;
+}
+
+} // namespace
+
+string CEmitter::emit(const vector<Stmt*>& statements) {
+    string program = RUNTIME;
+    Symbol ignite = symbols.find("ignite");
+    bool hasMain = false;
+    unordered_map<Symbol, int> functions;
+    for (Stmt* stmt : statements) {
+        if (!stmt || stmt->kind != STMT_FUNC_DEF) continue;
+        auto& func = static_cast<FuncDefStmt&>(*stmt);
+        inMain = func.name == ignite && !hasMain;
+        if (inMain) {
+            hasMain = true;
+            function(func, "int main(void)");
+        }
+        else {
+            function(func, "int64_t " + cname('f', func.name, ++functions[func.name]) + "(void)");
+        }
+        program += "\n" + out;
+    }
+    return program;
+}
+
+/////////////////////// OUTPUT ///////////////////////
+
+void CEmitter::line(const string& text) {
+    out.append((size_t)(depth + 1) * 4, ' ');
+    out += text;
+    out += '\n';
+}
+
+// 'kind', the how-many-th declaration of the name this is, if not the
+// first, then '_' and the name. Names with '#' in them get an 'h' and have
+// '#' written as "_h" and '_' as "__".
+string CEmitter::cname(char kind, Symbol name, int count) {
+    string_view text = symbols.name(name);
+    bool hashes = text.find('#') != string_view::npos;
+    string result(1, kind);
+    if (count > 1) result += to_string(count);
+    result += hashes ? "h_" : "_";
+    for (char c : text) {
+        if (!hashes) result += c;
+        else if (c == '#') result += "_h";
+        else if (c == '_') result += "__";
+        else result += c;
+    }
+    return result;
+}
+
+string CEmitter::temporary(ValueType type) {
+    string name = "t" + to_string(++temporaryCount);
+    temporaries += "    " + string(cType(type)) + " " + name + ";\n";
+    return name;
+}
+
+void CEmitter::function(FuncDefStmt& func, const string& signature) {
+    out.clear();
+    temporaries.clear();
+    locals.clear();
+    declared.clear();
+    hoisted.clear();
+    temporaryCount = 0;
+    depth = 0;
+
+    if (func.body && func.body->kind == STMT_BLOCK) {
+        for (Stmt* s : static_cast<BlockStmt*>(func.body)->statements)
+            if (s) s->accept(*this);
+    }
+    else if (func.body) {
+        func.body->accept(*this);
+    }
+    if (!endsInReturn(func.body)) line("return 0;");
+    out = signature + " {\n" + temporaries + out + "}\n";
+}
+
+/////////////////////// SCOPES ///////////////////////
+
+const CEmitter::Local* CEmitter::find(Symbol name) const {
+    for (auto it = locals.rbegin(); it != locals.rend(); ++it)
+        if (it->name == name) return &*it;
+    return nullptr;
+}
+
+const CEmitter::Local& CEmitter::declare(Symbol name, ValueType type, const string& cname, int at) {
+    locals.push_back({ name, at, type, cname });
+    return locals.back();
+}
+
+// Frees the text of the block's variables as it ends.
+void CEmitter::endBlock(int outer) {
+    while (!locals.empty() && locals.back().depth > outer) {
+        if (locals.back().type == TYPE_EXHAUST) line("as_free(&" + locals.back().cname + ");");
+        locals.pop_back();
+    }
+}
+
+// A declaration that is a whole body gets its C variable here, before
+// the statement, and is assigned in it.
+void CEmitter::hoist(Stmt* body) {
+    if (!body) return;
+    ValueType type;
+    Symbol name;
+    if (body->kind == STMT_VAR_DECL) {
+        auto& decl = static_cast<VarDeclStmt&>(*body);
+        type = typeOfDeclaration(decl.type);
+        name = decl.name;
+    }
+    else if (body->kind == STMT_LISTEN && !find(static_cast<ListenStmt*>(body)->name)) {
+        type = TYPE_EXHAUST;
+        name = static_cast<ListenStmt*>(body)->name;
+    }
+    else {
+        return;
+    }
+    int count = ++declared[name];
+    string c = cname('v', name, count);
+    line(string(cType(type)) + " " + c + " = " + zeroOf(type) + ";");
+    hoisted[body] = c;
+}
+
+void CEmitter::body(Stmt* stmt) {
+    if (stmt && stmt->kind == STMT_BLOCK) {
+        stmt->accept(*this);
+        return;
+    }
+    line("{");
+    depth++;
+    if (stmt) stmt->accept(*this);
+    depth--;
+    line("}");
+}
+
+/////////////////////// EXPRESSIONS ///////////////////////
+
+string CEmitter::operand(const Code& code) {
+    return code.atomic ? code.text : "(" + code.text + ")";
+}
+
+// gear <-> turbo, or anything to text.
+CEmitter::Code CEmitter::convert(Code code, ValueType type) {
+    if (code.type == type) return code;
+    if (type == TYPE_TURBO) return { "as_turbo(" + code.text + ")", type, true, code.assigns, code.allocates };
+    if (type == TYPE_GEAR) return { "as_truncate(" + code.text + ")", type, true, code.assigns, code.allocates };
+    return { "as_text_" + string(suffixOf(code.type)) + "(" + code.text + ")", type, true, code.assigns,
+             code.allocates || code.type != TYPE_FLAG };
+}
+
+// Non-zero is true.
+CEmitter::Code CEmitter::condition(Expr* expr) {
+    Code code = expression(expr);
+    if (code.type == TYPE_TURBO) code = { operand(code) + " != 0.0", TYPE_FLAG, false, code.assigns, code.allocates };
+    else if (code.type == TYPE_GEAR) code = { operand(code) + " != 0", TYPE_FLAG, false, code.assigns, code.allocates };
+    if (code.allocates) code.text = "as_tmp_reset(), " + code.text;
+    return code;
+}
+
+// C leaves the order of operands open, so when an assignment makes it
+// matter, the left one is computed into a temporary first.
+void CEmitter::sequence(Code& left, const Code& right, string& prefix) {
+    if (!left.assigns && !right.assigns) return;
+    string t = temporary(left.type);
+    // Text is copied out of a variable the right operand may change.
+    bool copy = left.type == TYPE_EXHAUST;
+    prefix = t + " = " + (copy ? "as_concat(" + left.text + ", AS_EMPTY)" : left.text) + ", ";
+    left = { t, left.type, true, false, left.allocates || copy };
+}
+
+// Source literals are never negative, but folded ones (ast_optimizer.h)
+// can be; those are parenthesized, so "a - -1" cannot become "a--1".
+string CEmitter::literalText(const LiteralValue& value, const SymbolTable& symbols) {
+    switch (value.kind) {
+    case LiteralValue::INT: {
+        if (value.i == INT64_MIN) return "INT64_MIN";
+        string digits = value.i > INT32_MAX || value.i < INT32_MIN ? "INT64_C(" + to_string(value.i) + ")" : to_string(value.i);
+        return value.i < 0 ? "(" + digits + ")" : digits;
+    }
+    case LiteralValue::DOUBLE: {
+        string digits = isinf(value.d) ? (value.d < 0 ? "-HUGE_VAL" : "HUGE_VAL") : formatDouble(value.d);
+        return signbit(value.d) ? "(" + digits + ")" : digits;
+    }
+    case LiteralValue::BOOL:
+        return value.b ? "true" : "false";
+    default:
+        return "AS_LIT(\"" + escaped(symbols.name(value.s)) + "\")";
+    }
+}
+
+void CEmitter::statementEnd(const Code& code) {
+    if (code.allocates) line("as_tmp_reset();");
+}
+
+CEmitter::Code CEmitter::visit(BinaryExpr& expr) {
+    Code left = expression(expr.left);
+    Code right = expression(expr.right);
+    string prefix;
+    sequence(left, right, prefix);
+    bool assigns = left.assigns || right.assigns || !prefix.empty();
+    bool allocates = left.allocates || right.allocates;
+
+    Code result;
+    switch (expr.op) {
+    case OP_PLUS:
+    case OP_MINUS:
+    case OP_STAR:
+    case OP_SLASH:
+        if (expr.type == TYPE_EXHAUST) {
+            left = convert(left, TYPE_EXHAUST);
+            right = convert(right, TYPE_EXHAUST);
+            result = { "as_concat(" + left.text + ", " + right.text + ")", TYPE_EXHAUST, true, assigns, true };
+        }
+        else if (expr.type == TYPE_GEAR) {
+            static const char* const names[] = { "as_add", "as_sub", "as_mul", "as_div" };
+            int index = expr.op == OP_PLUS ? 0 : expr.op == OP_MINUS ? 1 : expr.op == OP_STAR ? 2 : 3;
+            string text = string(names[index]) + "(" + left.text + ", " + right.text;
+            if (index == 3) text += ", " + to_string(expr.line);
+            result = { text + ")", TYPE_GEAR, true, assigns, allocates };
+        }
+        else {
+            left = convert(left, TYPE_TURBO);
+            right = convert(right, TYPE_TURBO);
+            result = { operand(left) + " " + spelling(expr.op) + " " + operand(right), TYPE_TURBO, false, assigns,
+                       allocates };
+        }
+        break;
+    default:
+        if (left.type == TYPE_EXHAUST) {
+            result = { "as_compare(" + left.text + ", " + right.text + ") " + spelling(expr.op) + " 0", TYPE_FLAG,
+                       false, assigns, allocates };
+        }
+        else {
+            if (left.type == TYPE_TURBO || right.type == TYPE_TURBO) {
+                left = convert(left, TYPE_TURBO);
+                right = convert(right, TYPE_TURBO);
+            }
+            result = { operand(left) + " " + spelling(expr.op) + " " + operand(right), TYPE_FLAG, false, assigns,
+                       allocates };
+        }
+        break;
+    }
+    if (!prefix.empty()) result = { "(" + prefix + result.text + ")", result.type, true, true, result.allocates };
+    return result;
+}
+
+CEmitter::Code CEmitter::visit(LiteralExpr& expr) {
+    return { literalText(expr.value, symbols), expr.type, true, false, false };
+}
+
+CEmitter::Code CEmitter::visit(VariableExpr& expr) {
+    const Local* local = find(expr.name);
+    if (!local) return { "0", TYPE_ERROR, true, false, false }; // Not reached: the types were checked
+    return { local->cname, local->type, true, false, false };
+}
+
+CEmitter::Code CEmitter::visit(AssignExpr& expr) {
+    const Local* local = find(expr.name);
+    Code value = expression(expr.value);
+    if (!local) return { "0", TYPE_ERROR, true, false, false };
+    if (local->type == TYPE_EXHAUST)
+        return { "as_assign(&" + local->cname + ", " + value.text + ")", TYPE_EXHAUST, true, true, value.allocates };
+    if (value.assigns) {
+        // Stored only once the value, and what it assigns, is done.
+        string t = temporary(value.type);
+        Code stored = convert({ t, value.type, true, false, false }, local->type);
+        return { "(" + t + " = " + value.text + ", " + local->cname + " = " + stored.text + ")", local->type, true, true,
+                 value.allocates };
+    }
+    value = convert(value, local->type);
+    return { local->cname + " = " + value.text, local->type, false, true, value.allocates };
+}
+
+/////////////////////// STATEMENTS ///////////////////////
+
+void CEmitter::visit(ExprStmt& stmt) {
+    Code code = expression(stmt.expression);
+    line(code.text + ";");
+    statementEnd(code);
+}
+
+void CEmitter::visit(AnnounceStmt& stmt) {
+    Code code = expression(stmt.expression);
+    line("as_announce_" + string(suffixOf(code.type)) + "(" + code.text + ");");
+    statementEnd(code);
+}
+
+// The variable comes into scope after its initializer.
+void CEmitter::visit(VarDeclStmt& stmt) {
+    ValueType type = typeOfDeclaration(stmt.type);
+    Code value{ zeroOf(type), type, true, false, false };
+    if (stmt.initializer) value = convert(expression(stmt.initializer), type);
+
+    auto it = hoisted.find(&stmt);
+    if (it != hoisted.end()) {
+        line(type == TYPE_EXHAUST ? "as_assign(&" + it->second + ", " + value.text + ");" : it->second + " = " + value.text + ";");
+        declare(stmt.name, type, it->second, depth - 1); // Belongs to the block around the statement
+    }
+    else {
+        if (type == TYPE_EXHAUST && stmt.initializer) value.text = "as_copy(" + value.text + ")";
+        int count = ++declared[stmt.name];
+        string c = cname('v', stmt.name, count);
+        line(string(cType(type)) + " " + c + " = " + value.text + ";");
+        declare(stmt.name, type, c, depth);
+    }
+    statementEnd(value);
+}
+
+void CEmitter::visit(BlockStmt& stmt) {
+    line("{");
+    int outer = depth++;
+    for (Stmt* s : stmt.statements)
+        if (s) s->accept(*this);
+    endBlock(outer);
+    depth = outer;
+    line("}");
+}
+
+void CEmitter::visit(LoopStmt& stmt) {
+    hoist(stmt.body);
+    Code test = condition(stmt.condition);
+    line("while (" + test.text + ")");
+    body(stmt.body);
+}
+
+void CEmitter::visit(FinishlineStmt& stmt) {
+    Code code = expression(stmt.value);
+    if (code.type == TYPE_TURBO) code = convert(code, TYPE_GEAR);
+    line(inMain ? "return (int)" + operand(code) + ";" : "return " + code.text + ";");
+}
+
+void CEmitter::visit(FuncDefStmt&) {}
+
+void CEmitter::visit(IfStmt& stmt) {
+    hoist(stmt.thenBranch);
+    hoist(stmt.elseBranch);
+    Code test = condition(stmt.condition);
+    line("if (" + test.text + ")");
+    body(stmt.thenBranch);
+    if (!stmt.elseBranch) return;
+    line("else");
+    body(stmt.elseBranch);
+}
+
+void CEmitter::visit(ListenStmt& stmt) {
+    const Local* local = find(stmt.name);
+    if (!local) {
+        auto it = hoisted.find(&stmt);
+        if (it != hoisted.end()) {
+            local = &declare(stmt.name, TYPE_EXHAUST, it->second, depth - 1);
+        }
+        else {
+            int count = ++declared[stmt.name];
+            string c = cname('v', stmt.name, count);
+            line("as_str " + c + " = AS_EMPTY;");
+            local = &declare(stmt.name, TYPE_EXHAUST, c, depth);
+        }
+    }
+    line("as_listen_" + string(suffixOf(local->type)) + "(&" + local->cname + ", " + to_string(stmt.line) + ");");
+}
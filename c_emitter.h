@@ -0,0 +1,111 @@
+#pragma once
+
+#include "bytecode.h"
+#include "parser.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * CEmitter
+ * Translates a program to one portable C99 translation unit that needs
+ * nothing but the C library: a small runtime for text, announce and
+ * listen is written at the top of it (see RUNTIME in c_emitter.cpp).
+ *
+ * gear, turbo, flag and exhaust become int64_t, double, bool and as_str
+ * (a length and a heap buffer owned by the variable). ignite() becomes
+ * main(), whose exit status is what finishline returns; other functions
+ * become int64_t functions that nothing calls. Variables keep their
+ * names, with a "v_" prefix and a number in it when a name is declared
+ * again (see cname).
+ *
+ * The C program behaves as the VM does: integer arithmetic wraps,
+ * turbo -> gear saturates, operands are evaluated left to right (through
+ * temporaries where an assignment makes the order matter), and runtime
+ * errors are reported on stderr in the same form, with exit status 1.
+ * (The one difference: C does not say which sign a NaN gets, so where the
+ * VM announces "-nan" the C program may announce "nan".)
+ * Text made while evaluating a statement lives in a scratch arena that
+ * is emptied after it.
+ *
+ * The program must have been type-checked without errors (compiling it
+ * to bytecode does that): each operation is picked by the types the
+ * checker gave its operands (Expr::type). A declaration that is the whole body of a
+ * track, pitstop or looplap is declared before that statement, as the
+ * VM puts it in the enclosing block.
+ */
+class CEmitter {
+public:
+    explicit CEmitter(const SymbolTable& symbols) : symbols(symbols) {}
+
+    std::string emit(const std::vector<Stmt*>& statements);
+
+private:
+    friend struct Expr; // accept() calls the visit() overloads
+    friend struct Stmt;
+
+    // An expression as C.
+    struct Code {
+        std::string text;
+        ValueType type;
+        bool atomic;    // Needs no parentheses as an operand
+        bool assigns;   // Contains an assignment
+        bool allocates; // Makes text in the scratch arena
+    };
+
+    struct Local {
+        Symbol name;
+        int depth;
+        ValueType type;
+        std::string cname;
+    };
+
+    const SymbolTable& symbols;
+    std::string out;        // The function being written
+    std::string temporaries; // Its temporaries' declarations
+    int depth = 0;           // Of blocks, which is also the indentation
+    std::vector<Local> locals; // Innermost last
+    std::unordered_map<Symbol, int> declared; // Times each name was declared, per function
+    std::unordered_map<const Stmt*, std::string> hoisted; // Declarations made ahead of their statement
+    int temporaryCount = 0;
+    bool inMain = false;
+
+    // Output
+    void line(const std::string& text);
+    std::string cname(char kind, Symbol name, int count);
+    std::string temporary(ValueType type);
+    void function(FuncDefStmt& func, const std::string& signature);
+
+    // Scopes
+    const Local* find(Symbol name) const;
+    const Local& declare(Symbol name, ValueType type, const std::string& cname, int at);
+    void endBlock(int outer);
+    void hoist(Stmt* body);
+    void body(Stmt* stmt); // Always as a C block
+
+    // Expressions
+    Code expression(Expr* expr) { return expr->accept(*this); }
+    static std::string operand(const Code& code);
+    static Code convert(Code code, ValueType type);
+    Code condition(Expr* expr);
+    void sequence(Code& left, const Code& right, std::string& prefix);
+    static std::string literalText(const LiteralValue& value, const SymbolTable& symbols);
+    void statementEnd(const Code& code); // Empties the arena after text was made
+
+    // Expression visitors
+    Code visit(BinaryExpr& expr);
+    Code visit(LiteralExpr& expr);
+    Code visit(VariableExpr& expr);
+    Code visit(AssignExpr& expr);
+
+    // Statement visitors
+    void visit(ExprStmt& stmt);
+    void visit(AnnounceStmt& stmt);
+    void visit(VarDeclStmt& stmt);
+    void visit(BlockStmt& stmt);
+    void visit(LoopStmt& stmt);
+    void visit(FinishlineStmt& stmt);
+    void visit(FuncDefStmt& stmt);
+    void visit(IfStmt& stmt);
+    void visit(ListenStmt& stmt);
+};
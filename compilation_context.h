@@ -0,0 +1,15 @@
+#pragma once
+
+#include "diagnostics.h"
+#include "symbol_table.h"
+
+/*
+ * CompilationContext
+ * State shared by every phase that works on one program: the scanner
+ * fills it, the parser and later passes read it. It must outlive every
+ * token stream and AST built with it.
+ */
+struct CompilationContext {
+    SymbolTable symbols;     // Identifier names and string-literal contents
+    Diagnostics diagnostics; // Errors from every phase, printed by the caller
+};
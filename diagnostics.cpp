@@ -0,0 +1,32 @@
+#include "diagnostics.h"
+
+using namespace std;
+
+void Diagnostics::report(int line, int column, DiagCode code, string message) {
+    if (full()) return;
+    if (limit != 0 && list.size() == limit) {
+        list.push_back({ line, column, DIAG_TOO_MANY_ERRORS,
+                         "Too many errors (limit " + to_string(limit) + "); stopping." });
+        return;
+    }
+    list.push_back({ line, column, code, move(message) });
+}
+
+void Diagnostics::print(ostream& out) const {
+    string text;
+    for (const Diagnostic& d : list) {
+        text += "Error [Line " + to_string(d.line);
+        if (d.column > 0) text += ", Col " + to_string(d.column);
+        text += "]: ";
+        text += d.message;
+        text += '\n';
+    }
+    out << text;
+}
+
+int columnAt(const char* text, size_t offset, size_t base) {
+    size_t i = offset;
+    while (i > 0 && text[i - 1] != '\n') i--;
+    if (i == 0) return (int)(base + offset + 1);
+    return (int)(offset - i + 1);
+}
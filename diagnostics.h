@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*
+ * DiagCode
+ * What went wrong, for callers that react to particular errors instead of
+ * just printing them.
+ */
+enum DiagCode : uint8_t {
+    // Scanner
+    DIAG_UNKNOWN_CHARACTER,
+    DIAG_INVALID_UTF8,
+    DIAG_UNTERMINATED_STRING,
+    DIAG_NUMBER_OUT_OF_RANGE,
+    DIAG_MALFORMED_NUMBER,
+    DIAG_SOURCE_TOO_LARGE,    // Longer than a TokenStream can hold offsets for
+
+    // Parser
+    DIAG_EXPECTED_TOKEN,      // A specific token was missing (';', ')', ...)
+    DIAG_EXPECTED_EXPRESSION,
+    DIAG_INVALID_ASSIGNMENT,  // Left of '=' is not a variable
+    DIAG_UNTERMINATED_BLOCK,
+
+    // Compiler
+    DIAG_UNDEFINED_NAME,      // A variable that is not declared in any enclosing scope
+    DIAG_REDECLARED_NAME,     // Declared twice in one scope
+    DIAG_TYPE_MISMATCH,
+    DIAG_FUNCTION_TOO_LARGE,  // More registers than an instruction can name
+    DIAG_NO_ENTRY_POINT,      // No ignite() to run
+    DIAG_NESTED_FUNCTION,     // An engine defined inside another, which nothing could call
+
+    // Runtime
+    DIAG_DIVISION_BY_ZERO,
+    DIAG_BAD_INPUT,           // 'listen' read text that is not of the variable's type
+
+    DIAG_TOO_MANY_ERRORS      // The error limit was reached; later ones are dropped
+};
+
+/*
+ * Diagnostic
+ * One error. Lines and columns count from 1; column 0 means the column
+ * is not known.
+ */
+struct Diagnostic {
+    int line;
+    int column;
+    DiagCode code;
+    std::string message;
+};
+
+/*
+ * Diagnostics
+ * Collects the errors of every phase that works on one program, in the
+ * order they were found. Nothing is printed while scanning or parsing;
+ * the caller formats the whole list once, with print().
+ *
+ * An error limit can be set. Once it is reached one DIAG_TOO_MANY_ERRORS
+ * entry is added, further reports are dropped, and full() tells the
+ * parser to stop.
+ */
+class Diagnostics {
+public:
+    void report(int line, int column, DiagCode code, std::string message);
+
+    // 0 (the default) means no limit.
+    void setLimit(size_t maxErrors) { limit = maxErrors; }
+    bool full() const { return limit != 0 && list.size() > limit; }
+    // How many more errors fit before the limit is reached.
+    size_t room() const { return limit == 0 ? SIZE_MAX : list.size() < limit ? limit - list.size() : 0; }
+
+    bool empty() const { return list.empty(); }
+    size_t size() const { return list.size(); }
+    const std::vector<Diagnostic>& all() const { return list; }
+    void clear() { list.clear(); }
+
+    // Writes every entry as "Error [Line 3, Col 7]: message", one per
+    // line, in one write.
+    void print(std::ostream& out) const;
+
+private:
+    std::vector<Diagnostic> list;
+    size_t limit = 0;
+};
+
+/*
+ * columnAt
+ * The 1-based column of byte 'offset' of 'text'. Only the current line is
+ * looked at, so this is meant for error paths, not for every token.
+ * 'base' is the number of bytes of the line that come before text[0],
+ * for callers that only hold the tail of their input.
+ */
+int columnAt(const char* text, size_t offset, size_t base = 0);
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "ast_printer.h"
+#include "function_cache.h"
+#include "parser.h"
+#include "ssa_passes.h"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// --- Driver ---
+// The parts of AutoSpeed.cpp (the command line driver) that the
+// benchmarks and self-tests share.
+
+/*
+ * Options
+ * What the command line asked for.
+ */
+struct Options {
+    enum Mode { AST, CHECK, BYTECODE, RUN, INTERPRET, NATIVE, C, SSA, SSA_RUN };
+
+    size_t maxErrors = 0;
+    unsigned jobs = 1;
+    Mode mode = AST;
+    AstPrinter::Format format = AstPrinter::SEXPR;
+    std::string cacheDir; // AST cache (AST mode) or function cache (CHECK, BYTECODE); empty: none
+    std::string output;   // C mode: the executable to build; empty: print the C
+    bool optimize = false; // Run AstOptimizer on the tree before printing or running it
+    bool share = false;    // AST mode, sexpr format, not optimized: parse with Parser::shareExpressions
+    unsigned passes = PASS_DEFAULT; // SSA modes: the SsaPassManager passes to run
+};
+
+/*
+ * buildExecutable
+ * Writes the program as C to 'output'.c and compiles that with the
+ * system C compiler ($CC, or cc) at -O2 into 'output'. Returns the
+ * compiler's exit status.
+ */
+int buildExecutable(const std::string& source, const std::string& output);
+
+/*
+ * buildFunctions
+ * Type-checks (CHECK mode) or compiles and lists (BYTECODE mode) each
+ * function of a program through 'cache', so that only the functions that
+ * changed since the cache last saw the program are processed again. The
+ * outputs are the functions' listings (empty in CHECK mode); errors go to
+ * ctx.diagnostics.
+ */
+FunctionBuild buildFunctions(FunctionCache& cache, const ParseResult& program, CompilationContext& ctx,
+                             Options::Mode mode);
+
+/*
+ * functionCache
+ * The cache for buildFunctions in 'mode', kept in 'directory'. A listing
+ * has line numbers in it; a check has no output.
+ */
+FunctionCache functionCache(Options::Mode mode, const std::string& directory);
+
+/*
+ * builtInPrograms
+ * The programs main() runs through the scanner, parser and printer when
+ * it is given no file. TEST 2 and TEST 3 never end; TEST 9 does not parse.
+ */
+std::vector<std::string> builtInPrograms();
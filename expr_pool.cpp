@@ -0,0 +1,94 @@
+#include "expr_pool.h"
+#include "parser.h"
+
+#include <cstring>
+
+using namespace std;
+
+ExprPool::Key ExprPool::literalKey(const LiteralValue& value) {
+    uint64_t bits; // All of the union; the bytes a kind does not use are zero
+    memcpy(&bits, &value.i, sizeof bits);
+    return { EXPR_LITERAL | (uint64_t)value.kind << 8, bits, 0 };
+}
+
+ExprPool::Key ExprPool::binaryKey(const Expr* left, TokenType op, const Expr* right) {
+    return { EXPR_BINARY | (uint64_t)op << 8, (uint64_t)(uintptr_t)left, (uint64_t)(uintptr_t)right };
+}
+
+ExprPool::Key ExprPool::keyOf(const Expr* expr) {
+    switch (expr->kind) {
+    case EXPR_LITERAL:
+        return literalKey(static_cast<const LiteralExpr*>(expr)->value);
+    case EXPR_VARIABLE:
+        return { EXPR_VARIABLE, static_cast<const VariableExpr*>(expr)->name, 0 };
+    case EXPR_BINARY: {
+        auto bin = static_cast<const BinaryExpr*>(expr);
+        return binaryKey(bin->left, bin->op, bin->right);
+    }
+    default:
+        return { expr->kind, (uint64_t)(uintptr_t)expr, 0 }; // Never pooled
+    }
+}
+
+uint64_t ExprPool::hash(const Key& key) {
+    uint64_t h = key.head * 0x9E3779B97F4A7C15ull;
+    h = (h ^ key.a) * 0xBF58476D1CE4E5B9ull;
+    h = (h ^ key.b) * 0x94D049BB133111EBull;
+    return h ^ (h >> 31);
+}
+
+// Slot holding a node with 'key', or the empty slot where it would go.
+size_t ExprPool::slotFor(const Key& key, uint64_t h) const {
+    size_t mask = slots.size() - 1;
+    size_t i = (size_t)h & mask;
+    while (slots[i] && !(keyOf(slots[i]) == key)) i = (i + 1) & mask;
+    return i;
+}
+
+bool ExprPool::contains(const Expr* expr) const {
+    if (slots.empty()) return false;
+    Key key = keyOf(expr);
+    return slots[slotFor(key, hash(key))] == expr;
+}
+
+template <typename Make>
+Expr* ExprPool::intern(const Key& key, Make make) {
+    if (slots.empty()) slots.assign(256, nullptr);
+    size_t i = slotFor(key, hash(key));
+    if (slots[i]) return slots[i];
+
+    Expr* expr = make();
+    slots[i] = expr;
+    if (++count * 2 > slots.size()) grow(); // Keep the load under 1/2
+    return expr;
+}
+
+Expr* ExprPool::literal(AstArena& arena, const LiteralValue& value, int line) {
+    return intern(literalKey(value), [&] { return arena.make<LiteralExpr>(value, line); });
+}
+
+Expr* ExprPool::variable(AstArena& arena, Symbol name, int line) {
+    return intern({ EXPR_VARIABLE, name, 0 }, [&] { return arena.make<VariableExpr>(name, line); });
+}
+
+Expr* ExprPool::binary(AstArena& arena, Expr* left, TokenType op, int line, Expr* right) {
+    if (!contains(left) || !contains(right)) return arena.make<BinaryExpr>(left, op, line, right);
+    return intern(binaryKey(left, op, right), [&] { return arena.make<BinaryExpr>(left, op, line, right); });
+}
+
+void ExprPool::clear() {
+    slots.clear();
+    count = 0;
+}
+
+void ExprPool::grow() {
+    vector<Expr*> old(slots.size() * 2, nullptr);
+    old.swap(slots);
+    size_t mask = slots.size() - 1;
+    for (Expr* expr : old) {
+        if (!expr) continue;
+        size_t i = (size_t)hash(keyOf(expr)) & mask;
+        while (slots[i]) i = (i + 1) & mask;
+        slots[i] = expr;
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "ast_arena.h"
+#include "literal.h"
+#include "scanner.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct Expr;
+
+/*
+ * ExprPool
+ * Hash-consing for side-effect-free expressions. A literal, a variable
+ * read, or a binary operation on pooled operands is built once per pool;
+ * asking for the same one again returns the same node. As operands are
+ * pooled before the operations on them, two pooled subtrees are equal
+ * exactly when they are the same pointer, so later passes get a free
+ * common-subexpression test.
+ *
+ * An AssignExpr, and any expression containing one, is never pooled.
+ * Lines are not part of a node's identity: a shared node keeps the line
+ * of its first occurrence.
+ *
+ * The pool does not own the nodes; they go into the arena passed in, which
+ * must outlive the pool's use (see Parser::shareExpressions).
+ */
+class ExprPool {
+public:
+    Expr* literal(AstArena& arena, const LiteralValue& value, int line);
+    Expr* variable(AstArena& arena, Symbol name, int line);
+    // Shared only if both operands came from this pool.
+    Expr* binary(AstArena& arena, Expr* left, TokenType op, int line, Expr* right);
+
+    size_t size() const { return count; } // Distinct nodes in the pool
+    void clear();
+
+private:
+    // What makes two pooled nodes the same: the kind and the node's own
+    // fields, with operands compared by pointer.
+    struct Key {
+        uint64_t head; // ExprKind, plus the literal kind or the operator
+        uint64_t a;
+        uint64_t b;
+        bool operator==(const Key& o) const { return head == o.head && a == o.a && b == o.b; }
+    };
+
+    static Key literalKey(const LiteralValue& value);
+    static Key binaryKey(const Expr* left, TokenType op, const Expr* right);
+    static Key keyOf(const Expr* expr);
+    static uint64_t hash(const Key& key);
+    size_t slotFor(const Key& key, uint64_t h) const;
+    bool contains(const Expr* expr) const;
+    template <typename Make>
+    Expr* intern(const Key& key, Make make);
+    void grow();
+
+    std::vector<Expr*> slots; // Open-addressing table; nullptr is empty
+    size_t count = 0;
+};
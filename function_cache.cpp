@@ -0,0 +1,137 @@
+#include "function_cache.h"
+#include "mapped_file.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+using namespace std;
+
+// The key of a function's result for an ABSOLUTE_LINES pass: its hash,
+// made to differ for every line the function could be at and every
+// layout of its nodes from there.
+uint64_t FunctionCache::placed(uint64_t hash, FuncDefStmt& func) {
+    const uint64_t K = 0x9E3779B97F4A7C15ull;
+    hash = (hash ^ layoutHash(func)) * K;
+    hash = (hash ^ (uint64_t)(uint32_t)func.line) * K;
+    return hash ^ (hash >> 29);
+}
+
+const FunctionResult* FunctionCache::find(uint64_t hash, FuncDefStmt& func) {
+    auto it = entries.find(hash);
+    if (it == entries.end()) {
+        FunctionResult loaded;
+        if (directory.empty() || !load(hash, loaded)) return nullptr;
+        it = entries.emplace(hash, move(loaded)).first;
+    }
+    const FunctionResult& result = it->second;
+    if (!result.diagnostics.empty() && result.layout != layoutHash(func)) return nullptr;
+    return &result;
+}
+
+const FunctionResult& FunctionCache::store(uint64_t hash, FuncDefStmt& func, string output, const Diagnostics& found) {
+    FunctionResult& result = entries[hash];
+    result.output = move(output);
+    result.diagnostics = found.all();
+    for (Diagnostic& d : result.diagnostics) d.line -= func.line;
+    result.layout = found.empty() ? 0 : layoutHash(func);
+    if (!directory.empty()) save(hash, result);
+    return result;
+}
+
+void FunctionCache::replay(const FunctionResult& result, const FuncDefStmt& func, Diagnostics& diagnostics) {
+    for (const Diagnostic& d : result.diagnostics)
+        diagnostics.report(d.line + func.line, d.column, d.code, d.message);
+}
+
+/////////////////////// ON DISK ///////////////////////
+
+// One file per result:
+//   FileHeader, the pass name, then per diagnostic a DiagHeader and its
+//   message, then the output. Integers in host byte order.
+
+namespace {
+
+struct FileHeader {
+    char magic[8]; // "FNRESULT"
+    uint64_t hash;
+    uint64_t layout;
+    uint64_t outputSize;
+    uint32_t diagnosticCount;
+    uint32_t passSize;
+};
+
+struct DiagHeader {
+    int32_t line;
+    int32_t column;
+    uint32_t code;
+    uint32_t messageSize;
+};
+
+template <typename T>
+bool readValue(ifstream& in, T& value) {
+    return (bool)in.read(reinterpret_cast<char*>(&value), sizeof value);
+}
+
+bool readText(ifstream& in, string& text, uint64_t size) {
+    text.resize(size);
+    return (bool)in.read(&text[0], (streamsize)size);
+}
+
+} // namespace
+
+string FunctionCache::pathFor(uint64_t hash) const {
+    char name[32];
+    snprintf(name, sizeof name, "%016llx.fn", (unsigned long long)(hash ^ SymbolTable::hashText(pass)));
+    return directory + "/" + name;
+}
+
+bool FunctionCache::load(uint64_t hash, FunctionResult& result) const {
+    ifstream in(pathFor(hash), ios::binary);
+    FileHeader header;
+    if (!in || !readValue(in, header) || memcmp(header.magic, "FNRESULT", 8) != 0 ||
+        header.hash != hash || header.passSize != pass.size())
+        return false;
+
+    string name;
+    if (!readText(in, name, header.passSize) || name != pass) return false;
+    for (uint32_t i = 0; i < header.diagnosticCount; i++) {
+        DiagHeader d;
+        string message;
+        if (!readValue(in, d) || !readText(in, message, d.messageSize)) return false;
+        result.diagnostics.push_back({ d.line, d.column, (DiagCode)d.code, move(message) });
+    }
+    result.layout = header.layout;
+    return readText(in, result.output, header.outputSize);
+}
+
+// Best effort, like the AST cache: a result that cannot be saved is just
+// computed again next time.
+void FunctionCache::save(uint64_t hash, const FunctionResult& result) const {
+    string path = pathFor(hash), temp = temporaryPath(path);
+    {
+        ofstream out(temp, ios::binary | ios::trunc);
+        if (!out) return;
+        FileHeader header = {};
+        memcpy(header.magic, "FNRESULT", 8);
+        header.hash = hash;
+        header.layout = result.layout;
+        header.outputSize = result.output.size();
+        header.diagnosticCount = (uint32_t)result.diagnostics.size();
+        header.passSize = (uint32_t)pass.size();
+        out.write(reinterpret_cast<const char*>(&header), sizeof header);
+        out.write(pass.data(), (streamsize)pass.size());
+        for (const Diagnostic& d : result.diagnostics) {
+            DiagHeader dh = { d.line, d.column, d.code, (uint32_t)d.message.size() };
+            out.write(reinterpret_cast<const char*>(&dh), sizeof dh);
+            out.write(d.message.data(), (streamsize)d.message.size());
+        }
+        out.write(result.output.data(), (streamsize)result.output.size());
+        if (!out) {
+            out.close();
+            remove(temp.c_str());
+            return;
+        }
+    }
+    if (rename(temp.c_str(), path.c_str()) != 0) remove(temp.c_str());
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "diagnostics.h"
+#include "parser.h"
+#include "structural_hash.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/*
+ * FunctionResult
+ * What a pass produced for one function: its output (code, a listing,
+ * anything that fits in a string) and the errors it found, with lines
+ * counted from the function's line so that they survive the function
+ * moving.
+ */
+struct FunctionResult {
+    std::string output;
+    std::vector<Diagnostic> diagnostics;
+    uint64_t layout = 0; // layoutHash of the function, if there are diagnostics
+};
+
+/*
+ * FunctionBuild
+ * What FunctionCache::build did: one output per top-level function, in
+ * source order, and how many of them were reused.
+ */
+struct FunctionBuild {
+    std::vector<const std::string*> outputs; // Owned by the cache
+    size_t reused = 0;
+    size_t rebuilt = 0;
+};
+
+/*
+ * FunctionCache
+ * Results of one pass, per top-level function, keyed by the function's
+ * structural hash. A function that still hashes the same after an edit
+ * (or in a later run, with a directory) gets its old result back without
+ * the pass running, so a rebuild costs the hashing plus one pass run per
+ * changed function.
+ *
+ * A pass must only depend on the function it is given; functions in this
+ * language cannot see each other. Anything the pass reports must carry a
+ * line (column 0 if unknown): cached errors are put back at the lines they
+ * had relative to the function, and a result with errors is only reused
+ * if every node of the function kept its relative line.
+ *
+ * The output cannot be moved that way, so a pass whose output holds line
+ * numbers (a bytecode listing, code with a line table) must say so with
+ * ABSOLUTE_LINES: its results are then only reused for a function whose
+ * every node is still at the same line, and a function that an edit
+ * above it moved is processed again.
+ *
+ * 'pass' names the pass and its version; entries saved under another name
+ * are never returned. With a directory, every result is also saved there,
+ * one file each (written under a temporary name, see temporaryPath, and
+ * renamed into place), and looked for there on a miss in memory.
+ */
+class FunctionCache {
+public:
+    enum Lines {
+        RELATIVE_LINES, // The output has no line numbers in it
+        ABSOLUTE_LINES  // The output has line numbers in it
+    };
+
+    explicit FunctionCache(std::string pass, std::string directory = "", Lines lines = RELATIVE_LINES)
+        : pass(std::move(pass)), directory(std::move(directory)), lines(lines) {}
+
+    // Runs 'process(FuncDefStmt&, Diagnostics&)', which returns the output
+    // as a string, on each top-level function with no cached result, and
+    // reports every function's errors (cached or not) to 'diagnostics' in
+    // source order. Top-level statements that are not functions are
+    // skipped.
+    template <typename Process>
+    FunctionBuild build(const std::vector<Stmt*>& statements, const SymbolTable& symbols,
+                        Diagnostics& diagnostics, Process process);
+
+    size_t size() const { return entries.size(); }
+    void clear() { entries.clear(); }
+
+private:
+    std::string pass;
+    std::string directory;
+    Lines lines;
+    std::unordered_map<uint64_t, FunctionResult> entries; // Nodes do not move
+
+    static uint64_t placed(uint64_t hash, FuncDefStmt& func);
+    const FunctionResult* find(uint64_t hash, FuncDefStmt& func);
+    const FunctionResult& store(uint64_t hash, FuncDefStmt& func, std::string output, const Diagnostics& found);
+    static void replay(const FunctionResult& result, const FuncDefStmt& func, Diagnostics& diagnostics);
+    std::string pathFor(uint64_t hash) const;
+    bool load(uint64_t hash, FunctionResult& result) const;
+    void save(uint64_t hash, const FunctionResult& result) const;
+};
+
+template <typename Process>
+FunctionBuild FunctionCache::build(const std::vector<Stmt*>& statements, const SymbolTable& symbols,
+                                   Diagnostics& diagnostics, Process process) {
+    FunctionBuild out;
+    for (Stmt* stmt : statements) {
+        if (!stmt || stmt->kind != STMT_FUNC_DEF) continue;
+        FuncDefStmt& func = static_cast<FuncDefStmt&>(*stmt);
+        uint64_t hash = structuralHash(stmt, symbols);
+        if (lines == ABSOLUTE_LINES) hash = placed(hash, func);
+
+        const FunctionResult* result = find(hash, func);
+        if (result) {
+            out.reused++;
+        }
+        else {
+            Diagnostics found;
+            std::string output = process(func, found);
+            result = &store(hash, func, std::move(output), found);
+            out.rebuilt++;
+        }
+        replay(*result, func, diagnostics);
+        out.outputs.push_back(&result->output);
+    }
+    return out;
+}
@@ -0,0 +1,218 @@
+#include "incremental_parser.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+
+// Adds 'delta' to the line of every node under the statements it is given.
+class LineShifter {
+public:
+    explicit LineShifter(int delta) : delta(delta) {}
+
+    void shift(Stmt* stmt) { if (stmt) stmt->accept(*this); }
+    void shift(Expr* expr) { if (expr) expr->accept(*this); }
+
+    void visit(BinaryExpr& expr) { expr.line += delta; shift(expr.left); shift(expr.right); }
+    void visit(LiteralExpr& expr) { expr.line += delta; }
+    void visit(VariableExpr& expr) { expr.line += delta; }
+    void visit(AssignExpr& expr) { expr.line += delta; shift(expr.value); }
+
+    void visit(AnnounceStmt& stmt) { shift(stmt.expression); }
+    void visit(VarDeclStmt& stmt) { stmt.line += delta; shift(stmt.initializer); }
+    void visit(BlockStmt& stmt) { for (Stmt* s : stmt.statements) shift(s); }
+    void visit(LoopStmt& stmt) { shift(stmt.condition); shift(stmt.body); }
+    void visit(FinishlineStmt& stmt) { shift(stmt.value); }
+    void visit(FuncDefStmt& stmt) { stmt.line += delta; shift(stmt.body); }
+    void visit(ExprStmt& stmt) { shift(stmt.expression); }
+    void visit(IfStmt& stmt) { shift(stmt.condition); shift(stmt.thenBranch); shift(stmt.elseBranch); }
+    void visit(ListenStmt& stmt) { stmt.line += delta; }
+
+private:
+    int delta;
+};
+
+bool holds(Stmt* stmt, size_t start, size_t token) {
+    return stmt && start + stmt->tokenStart <= token && token < start + stmt->tokenStart + stmt->tokenCount;
+}
+
+// The statement directly inside 'parent' (whose first token is 'start')
+// that holds 'token', as the pointer to it; nullptr if there is none.
+Stmt** childHolding(Stmt* parent, size_t start, size_t token) {
+    switch (parent->kind) {
+    case STMT_BLOCK: {
+        ArenaList<Stmt*>& list = static_cast<BlockStmt*>(parent)->statements;
+        size_t lo = 0, hi = list.size();
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (start + list[mid]->tokenStart + list[mid]->tokenCount <= token) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo < list.size() && holds(list[lo], start, token) ? &list[lo] : nullptr;
+    }
+    case STMT_FUNC_DEF: {
+        auto func = static_cast<FuncDefStmt*>(parent);
+        return holds(func->body, start, token) ? &func->body : nullptr;
+    }
+    case STMT_LOOP: {
+        auto loop = static_cast<LoopStmt*>(parent);
+        return holds(loop->body, start, token) ? &loop->body : nullptr;
+    }
+    case STMT_IF: {
+        auto branch = static_cast<IfStmt*>(parent);
+        if (holds(branch->thenBranch, start, token)) return &branch->thenBranch;
+        if (holds(branch->elseBranch, start, token)) return &branch->elseBranch;
+        return nullptr;
+    }
+    default:
+        return nullptr;
+    }
+}
+
+// Calls fn on each statement directly inside 'parent' that comes after
+// its child '*slot'.
+template <typename F>
+void forEachAfter(Stmt* parent, Stmt** slot, F fn) {
+    if (parent->kind == STMT_BLOCK) {
+        auto block = static_cast<BlockStmt*>(parent);
+        for (Stmt** s = slot + 1; s != block->statements.end(); s++) fn(*s);
+    }
+    else if (parent->kind == STMT_IF) {
+        auto branch = static_cast<IfStmt*>(parent);
+        if (slot == &branch->thenBranch && branch->elseBranch) fn(branch->elseBranch);
+    }
+}
+
+} // namespace
+
+IncrementalParser::IncrementalParser(string source, CompilationContext& ctx)
+    : ctx(ctx), code(move(source)), stream(scan(code, ctx)) {
+    parseAll();
+}
+
+ReparseResult IncrementalParser::edit(size_t offset, size_t removed, string_view text) {
+    int lineDelta = (int)count(text.begin(), text.end(), '\n') -
+                    (int)count(code.begin() + (ptrdiff_t)offset, code.begin() + (ptrdiff_t)(offset + removed), '\n');
+    code.replace(offset, removed, text.data(), text.size());
+    RelexResult r = stream.relex(code, { offset, removed, text.size() });
+
+    if (tree.arena.bytesUsed() > 2 * liveBytes) return parseAll(); // Reclaim replaced nodes
+    if (r.removed == 0 && r.inserted == 0 && lineDelta == 0) return { nullptr, false, 0 };
+
+    // Walk down from the top level towards the first changed token. All
+    // ranges are still in the old token numbering here.
+    vector<PathEntry> path;
+    vector<Stmt*>& top = tree.statements;
+    auto it = partition_point(top.begin(), top.end(), [&](Stmt* s) { return s->tokenStart + s->tokenCount <= r.first; });
+    if (it != top.end() && holds(*it, 0, r.first)) {
+        path.push_back({ *it, (*it)->tokenStart, &*it });
+        while (Stmt** child = childHolding(path.back().node, path.back().start, r.first))
+            path.push_back({ *child, path.back().start + (*child)->tokenStart, child });
+    }
+
+    // Try the innermost block or function that strictly contains the
+    // change (its first and last tokens untouched), then the ones around it.
+    // One that runs to the end of the input is unterminated, and so are all
+    // around it; their errors all sit on END_OF_FILE, so take them as a whole.
+    size_t oldEof = stream.size() - 1 - r.inserted + r.removed;
+    for (size_t at = path.size(); at-- > 0;) {
+        Stmt* node = path[at].node;
+        if (node->kind != STMT_BLOCK && node->kind != STMT_FUNC_DEF) continue;
+        size_t start = path[at].start, end = start + node->tokenCount;
+        if (start >= r.first || r.first + r.removed >= end || end >= oldEof) continue;
+
+        ReparseResult out;
+        if (!reparse(path, at, r, out)) continue;
+
+        // Later siblings of every node on the path, and later top-level
+        // statements, moved by the change in token count; their lines by
+        // the change in line count. The nodes around the new one no longer
+        // have the structural hash they had.
+        ptrdiff_t tokenDelta = (ptrdiff_t)r.inserted - (ptrdiff_t)r.removed;
+        LineShifter lines(lineDelta);
+        auto moved = [&](Stmt* s) {
+            s->tokenStart = (uint32_t)((ptrdiff_t)s->tokenStart + tokenDelta);
+            if (lineDelta != 0) lines.shift(s);
+        };
+        auto resized = [&](Stmt* s) {
+            s->tokenCount = (uint32_t)((ptrdiff_t)s->tokenCount + tokenDelta);
+        };
+        for (size_t k = at; k > 0; k--) {
+            resized(path[k - 1].node);
+            path[k - 1].node->hash = 0;
+            forEachAfter(path[k - 1].node, path[k].slot, moved);
+        }
+        for (auto next = it + 1; next != top.end(); ++next) moved(*next);
+        return out;
+    }
+    return parseAll();
+}
+
+// Reparses path[at] in place. Fails (changing nothing) if the new node does
+// not end where the old one now should, since the parse around it would
+// then differ too.
+bool IncrementalParser::reparse(const vector<PathEntry>& path, size_t at, const RelexResult& r, ReparseResult& out) {
+    const PathEntry& target = path[at];
+    size_t oldEnd = target.start + target.node->tokenCount;
+    size_t newEnd = oldEnd + r.inserted - r.removed;
+
+    Parser parser(stream, ctx);
+    Diagnostics found;
+    vector<size_t> where;
+    parser.diagnostics = &found;
+    parser.errorTokens = &where;
+    parser.current = target.start;
+    parser.enclosingStart = at == 0 ? 0 : path[at - 1].start;
+    for (size_t k = 0; k < at; k++)
+        if (path[k].node->kind == STMT_BLOCK) parser.blockDepth++;
+
+    Stmt* node = target.node->kind == STMT_BLOCK ? parser.parseBlock() : parser.parseStatement();
+    if (!node || parser.current != newEnd) return false;
+
+    *target.slot = node;
+    tree.arena.adopt(move(parser.nodes));
+    // The node's own errors come after its first token ('{' or the keyword,
+    // already matched); one on that token was reported by a statement
+    // before it that failed.
+    takeErrors(found, where, target.start + 1, oldEnd, (ptrdiff_t)newEnd - (ptrdiff_t)oldEnd);
+    out = { node, false, newEnd - target.start };
+    return true;
+}
+
+// Replaces the errors at old tokens [from, to) with 'found', reported at
+// new tokens 'where', and renumbers the errors after them by 'delta'.
+void IncrementalParser::takeErrors(const Diagnostics& found, const vector<size_t>& where, size_t from, size_t to, ptrdiff_t delta) {
+    auto byToken = [](const ParseError& e, size_t token) { return e.token < token; };
+    auto first = lower_bound(errors.begin(), errors.end(), from, byToken);
+    auto last = lower_bound(first, errors.end(), to, byToken);
+    for (auto e = last; e != errors.end(); ++e) e->token = (size_t)((ptrdiff_t)e->token + delta);
+
+    vector<ParseError> fresh;
+    for (size_t i = 0; i < where.size(); i++)
+        fresh.push_back({ where[i], found.all()[i].code, found.all()[i].message });
+    first = errors.erase(first, last);
+    errors.insert(first, fresh.begin(), fresh.end());
+}
+
+ReparseResult IncrementalParser::parseAll() {
+    Parser parser(stream, ctx);
+    Diagnostics found;
+    vector<size_t> where;
+    parser.diagnostics = &found;
+    parser.errorTokens = &where;
+    tree = parser.parse();
+    liveBytes = tree.arena.bytesUsed();
+
+    errors.clear();
+    for (size_t i = 0; i < where.size(); i++)
+        errors.push_back({ where[i], found.all()[i].code, found.all()[i].message });
+    return { nullptr, true, stream.size() };
+}
+
+Diagnostics IncrementalParser::diagnostics() const {
+    Diagnostics out;
+    for (const ParseError& e : errors)
+        out.report(stream.line(e.token), columnAt(code.data(), stream.rawStart(e.token)), e.code, e.message);
+    return out;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "parser.h"
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ * ReparseResult
+ * What IncrementalParser::edit did.
+ */
+struct ReparseResult {
+    Stmt* node;          // The BlockStmt or FuncDefStmt that was reparsed and replaced, if any
+    bool full;           // The whole file had to be reparsed
+    size_t tokensParsed; // Tokens the parser went over
+};
+
+/*
+ * IncrementalParser
+ * Keeps a program's source, tokens and AST up to date across edits.
+ *
+ * After an edit the tokens are relexed (see TokenStream::relex), and only
+ * the smallest BlockStmt or FuncDefStmt whose tokens contain every changed
+ * token is parsed again. The new node replaces the old one in its parent.
+ * Every other node is kept as it was, so pointers to untouched subtrees
+ * stay valid, and so do their structural hashes (see structural_hash.h);
+ * the nodes around the new one lose theirs. The result is always the tree
+ * a full parse would build: if the reparsed node no longer ends where it
+ * did (say, a '}' was deleted), the next enclosing node is tried, and in
+ * the end the whole file.
+ *
+ * Cost: the reparse is bounded by the size of the reparsed node. On top of
+ * that come the relex, one integer per top-level statement, and, for an
+ * edit that adds or removes line breaks, a walk over the nodes after it to
+ * fix their line numbers.
+ *
+ * Replaced nodes stay in the arena; once they take up as much room as the
+ * live tree, the next edit does a full parse to reclaim it.
+ * Parser errors are kept per token, so diagnostics() stays accurate;
+ * scanner errors go to the context's diagnostics as relex() finds them.
+ */
+class IncrementalParser {
+public:
+    IncrementalParser(std::string code, CompilationContext& ctx);
+    IncrementalParser(const IncrementalParser&) = delete;
+    IncrementalParser& operator=(const IncrementalParser&) = delete;
+
+    // Replaces 'removed' bytes at 'offset' with 'text' and updates the AST.
+    ReparseResult edit(size_t offset, size_t removed, std::string_view text);
+
+    const std::string& source() const { return code; }
+    const TokenStream& tokens() const { return stream; }
+    const vector<Stmt*>& statements() const { return tree.statements; }
+
+    // The parser errors of the current tree, in source order.
+    Diagnostics diagnostics() const;
+
+private:
+    struct ParseError {
+        size_t token; // Where it was reported
+        DiagCode code;
+        std::string message;
+    };
+
+    // A node on the way from the top level down to an edit.
+    struct PathEntry {
+        Stmt* node;
+        size_t start;  // Absolute index of its first token
+        Stmt** slot;   // The pointer to it in its parent (or the top level)
+    };
+
+    ReparseResult parseAll();
+    bool reparse(const vector<PathEntry>& path, size_t at, const RelexResult& r, ReparseResult& out);
+    void takeErrors(const Diagnostics& found, const vector<size_t>& where, size_t from, size_t to, ptrdiff_t delta);
+
+    CompilationContext& ctx;
+    std::string code;
+    TokenStream stream;
+    ParseResult tree;
+    vector<ParseError> errors; // Sorted by token
+    size_t liveBytes = 0;      // Arena size right after the last full parse
+};
@@ -0,0 +1,33 @@
+#include "literal.h"
+
+#include <charconv>
+
+using namespace std;
+
+const char* typeName(ValueType type) {
+    switch (type) {
+    case TYPE_GEAR:    return "gear";
+    case TYPE_TURBO:   return "turbo";
+    case TYPE_EXHAUST: return "exhaust";
+    case TYPE_FLAG:    return "flag";
+    default:           return "error";
+    }
+}
+
+string formatDouble(double d) {
+    char buf[64];
+    auto res = to_chars(buf, buf + sizeof(buf), d);
+    string text(buf, res.ptr);
+    if (text.find_first_of(".eEn") == string::npos) text += ".0"; // 'n': inf/nan
+    return text;
+}
+
+string formatLiteral(const LiteralValue& value, const SymbolTable& symbols) {
+    switch (value.kind) {
+    case LiteralValue::INT:    return to_string(value.i);
+    case LiteralValue::DOUBLE: return formatDouble(value.d);
+    case LiteralValue::BOOL:   return value.b ? "true" : "false";
+    case LiteralValue::STRING: return string(symbols.name(value.s));
+    default:                   return "";
+    }
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "symbol_table.h"
+#include <cstdint>
+#include <string>
+
+/*
+ * ValueType
+ * The type of a variable or expression. Every expression's type is known
+ * before it runs (variables are declared with theirs, literals carry
+ * theirs; see TypeChecker), so no value carries a type tag at run time.
+ */
+enum ValueType : uint8_t {
+    TYPE_GEAR,    // Integer: int64_t
+    TYPE_TURBO,   // Decimal: double
+    TYPE_EXHAUST, // String
+    TYPE_FLAG,    // Boolean: 0 or 1 in an int64_t
+    TYPE_ERROR    // Of an expression that did not compile; no further errors about it
+};
+
+const char* typeName(ValueType type);
+
+/*
+ * LiteralValue
+ * A decoded literal: a gear-style integer, a turbo-style decimal, a flag,
+ * or a string (as its interned Symbol). The scanner decodes each literal
+ * once, so nothing later has to parse literal text again.
+ */
+struct LiteralValue {
+    enum Kind : uint8_t { NONE, INT, DOUBLE, BOOL, STRING };
+
+    Kind kind = NONE;
+    union {
+        int64_t i;
+        double d;
+        bool b;
+        Symbol s;
+    };
+
+    LiteralValue() : i(0) {}
+    static LiteralValue ofInt(int64_t v) { LiteralValue l; l.kind = INT; l.i = v; return l; }
+    static LiteralValue ofDouble(double v) { LiteralValue l; l.kind = DOUBLE; l.d = v; return l; }
+    static LiteralValue ofBool(bool v) { LiteralValue l; l.kind = BOOL; l.b = v; return l; }
+    static LiteralValue ofString(Symbol v) { LiteralValue l; l.kind = STRING; l.s = v; return l; }
+};
+
+/*
+ * wrapGear
+ * Gear arithmetic wraps instead of overflowing: it is done on uint64_t
+ * and the result read back as an int64_t.
+ */
+inline int64_t wrapGear(uint64_t v) { return (int64_t)v; }
+
+/*
+ * turboToGear
+ * A turbo made a gear: truncated toward zero, saturating at the ends of
+ * the gear range; NaN is 0. Inline, as the engines call these in their
+ * inner loops.
+ */
+inline int64_t turboToGear(double d) {
+    if (!(d == d)) return 0;
+    if (d >= 9223372036854775807.0) return INT64_MAX;
+    if (d <= -9223372036854775808.0) return INT64_MIN;
+    return (int64_t)d;
+}
+
+/*
+ * formatDouble
+ * The shortest text that reads back as the same double, always with a
+ * decimal point or exponent so it cannot be mistaken for an integer
+ * (3.0 prints as "3.0", not "3").
+ */
+std::string formatDouble(double d);
+
+/*
+ * formatLiteral
+ * A literal as it would be written in source (strings without quotes).
+ */
+std::string formatLiteral(const LiteralValue& value, const SymbolTable& symbols);
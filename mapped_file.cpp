@@ -0,0 +1,87 @@
+#include "mapped_file.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define AUTOSPEED_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#endif
+
+using namespace std;
+
+#ifdef AUTOSPEED_MMAP
+
+MappedFile::MappedFile(const string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw runtime_error("Cannot open file: " + path);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw runtime_error("Cannot read file: " + path);
+    }
+
+    length = static_cast<size_t>(st.st_size);
+    if (length > 0) {
+        void* p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            close(fd);
+            throw runtime_error("Cannot map file: " + path);
+        }
+        madvise(p, length, MADV_SEQUENTIAL); // Scanning reads front to back
+        bytes = static_cast<const char*>(p);
+        mapped = true;
+    }
+    close(fd); // The mapping stays valid without the descriptor
+}
+
+MappedFile::~MappedFile() {
+    if (mapped) munmap(const_cast<char*>(bytes), length);
+}
+
+#else
+
+MappedFile::MappedFile(const string& path) {
+    ifstream in(path, ios::binary | ios::ate);
+    if (!in) throw runtime_error("Cannot open file: " + path);
+
+    length = static_cast<size_t>(in.tellg());
+    char* buf = new char[length ? length : 1];
+    in.seekg(0);
+    in.read(buf, static_cast<streamsize>(length));
+    bytes = buf;
+}
+
+MappedFile::~MappedFile() {
+    delete[] bytes;
+}
+
+#endif
+
+string temporaryPath(const string& path) {
+    // The process id keeps running processes apart; the random part, a
+    // later process that got a reused id and a file an earlier one left.
+    static const uint64_t random = [] {
+        random_device device;
+        return (uint64_t)device() << 32 | device();
+    }();
+#ifdef AUTOSPEED_MMAP
+    static const unsigned long process = (unsigned long)getpid();
+#else
+    static const unsigned long process = 0;
+#endif
+    static atomic<uint64_t> calls{ 0 };
+    char suffix[80];
+    snprintf(suffix, sizeof suffix, ".%lu.%016llx.%llu.tmp", process, (unsigned long long)random,
+             (unsigned long long)calls++);
+    return path + suffix;
+}
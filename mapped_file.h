@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+/*
+ * MappedFile
+ * A read-only view of a whole file, memory-mapped where the platform
+ * supports it (the OS then reads pages lazily, as they are touched).
+ * Elsewhere the file is read into memory instead.
+ * Throws std::runtime_error if the file cannot be opened.
+ */
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+    std::string_view view() const { return std::string_view(bytes, length); }
+
+private:
+    const char* bytes = nullptr;
+    size_t length = 0;
+    bool mapped = false;  // true: munmap on destruction; false: delete[]
+};
+
+/*
+ * temporaryPath
+ * A file name next to 'path' that no other call, in this process or any
+ * other, gets: for writing a file in full before renaming it onto 'path',
+ * so that concurrent writers never share a half-written file.
+ */
+std::string temporaryPath(const std::string& path);
@@ -0,0 +1,1183 @@
+#include "native_codegen.h"
+#include "bytecode_compiler.h"
+#include "literal.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <initializer_list>
+#include <iterator>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__x86_64__) && defined(__linux__)
+#define AUTOSPEED_NATIVE 1
+#include <sys/mman.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+/////////////////////// RUNTIME ///////////////////////
+
+// What the generated code's calls work on. Output is buffered like the
+// VM's; 'lineStart' is where the line being announced began, so that a
+// runtime error halfway through an announce leaves no partial line.
+struct Runtime {
+    istream& in;
+    ostream& out;
+    Diagnostics& diagnostics;
+    string output;
+    size_t lineStart = 0;
+    bool failed = false;
+};
+
+constexpr size_t FLUSH_SIZE = 64 * 1024;
+
+void flush(Runtime& rt) {
+    rt.out.write(rt.output.data(), (streamsize)rt.output.size());
+    rt.output.clear();
+    rt.lineStart = 0;
+}
+
+// Called from generated code, with the platform's C calling convention.
+// An announce is one append call per piece of its text, then endLine.
+void appendGear(Runtime* rt, int64_t v) {
+    char digits[24];
+    auto res = to_chars(digits, digits + sizeof(digits), v);
+    rt->output.append(digits, res.ptr);
+}
+
+void appendTurbo(Runtime* rt, double d) {
+    rt->output += formatDouble(d);
+}
+
+void appendFlag(Runtime* rt, int64_t v) {
+    rt->output += v ? "true" : "false";
+}
+
+void appendText(Runtime* rt, const char* text, size_t size) {
+    rt->output.append(text, size);
+}
+
+void endLine(Runtime* rt) {
+    rt->output += '\n';
+    rt->lineStart = rt->output.size();
+    if (rt->output.size() >= FLUSH_SIZE) flush(*rt);
+}
+
+bool listen(Runtime* rt, int type, Number* into, int line) {
+    flush(*rt);
+    rt->out.flush();
+    string unused;
+    if (readInput(rt->in, (ValueType)type, *into, unused, rt->diagnostics, line)) return true;
+    rt->failed = true;
+    return false;
+}
+
+void divisionByZero(Runtime* rt, int line) {
+    rt->output.resize(rt->lineStart);
+    rt->diagnostics.report(line, 0, DIAG_DIVISION_BY_ZERO, "Division by zero.");
+    rt->failed = true;
+}
+
+/////////////////////// ASSEMBLER ///////////////////////
+
+enum Reg : int { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+// Condition codes; flipping the lowest bit negates one.
+enum Cond : uint8_t {
+    CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_BE = 0x6, CC_A = 0x7,
+    CC_S = 0x8, CC_P = 0xA, CC_NP = 0xB, CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF
+};
+
+// The /digit of the group-1 integer instructions. 'op r/m, r' is
+// digit * 8 + 1 and 'op r, r/m' digit * 8 + 3.
+enum Alu : uint8_t { ALU_ADD = 0, ALU_OR = 1, ALU_AND = 4, ALU_SUB = 5, ALU_XOR = 6, ALU_CMP = 7 };
+
+// An instruction's r/m operand: a register, or the frame slot [rbp + disp].
+struct Place {
+    bool memory;
+    int reg;
+    int32_t disp;
+};
+
+Place reg(int r) { return { false, r, 0 }; }
+Place slot(int32_t disp) { return { true, RBP, disp }; }
+
+bool fitsInt32(int64_t v) { return v >= INT32_MIN && v <= INT32_MAX; }
+bool fitsInt8(int64_t v) { return v >= -128 && v <= 127; }
+
+// Encodes the few x86-64 instructions the code generator uses. Jumps go
+// to labels, which are resolved by finish().
+class Assembler {
+public:
+    vector<uint8_t> code;
+
+    int label() {
+        labels.push_back(-1);
+        return (int)labels.size() - 1;
+    }
+    void bind(int label) { labels[(size_t)label] = (int64_t)code.size(); }
+
+    // prefix: a mandatory 66/F2 prefix, or 0. byteReg: the r/m register
+    // is a byte register, which needs a REX prefix for spl-dil.
+    void op(uint8_t prefix, bool w, int r, Place rm, initializer_list<uint8_t> opcode, bool byteReg = false) {
+        if (prefix) byte(prefix);
+        uint8_t rex = (uint8_t)(0x40 | (w ? 8 : 0) | ((r >> 3) & 1) << 2 | (rm.memory ? 0 : (rm.reg >> 3) & 1));
+        if (rex != 0x40 || (byteReg && !rm.memory && rm.reg >= 4)) byte(rex);
+        for (uint8_t b : opcode) byte(b);
+        if (rm.memory) {
+            byte((uint8_t)(0x85 | (r & 7) << 3)); // mod 10, rm 101: [rbp + disp32]
+            u32((uint32_t)rm.disp);
+        }
+        else {
+            byte((uint8_t)(0xC0 | (r & 7) << 3 | (rm.reg & 7)));
+        }
+    }
+
+    // Integer
+    void load(int d, Place src) { op(0, true, d, src, { 0x8B }); }
+    void store(Place dst, int s) { op(0, true, s, dst, { 0x89 }); }
+    void move(int d, int s) { if (d != s) store(reg(d), s); }
+    void loadImm(int d, int64_t v) {
+        if (fitsInt32(v)) {
+            op(0, true, 0, reg(d), { 0xC7 });
+            u32((uint32_t)v);
+            return;
+        }
+        byte((uint8_t)(0x48 | (d >> 3)));
+        byte((uint8_t)(0xB8 + (d & 7)));
+        u64((uint64_t)v);
+    }
+    void storeImm(Place dst, int32_t v) {
+        op(0, true, 0, dst, { 0xC7 });
+        u32((uint32_t)v);
+    }
+    void alu(Alu kind, int d, Place src) { op(0, true, d, src, { (uint8_t)(kind * 8 + 3) }); }
+    void aluStore(Alu kind, Place dst, int s) { op(0, true, s, dst, { (uint8_t)(kind * 8 + 1) }); }
+    void aluImm(Alu kind, Place dst, int32_t v) {
+        if (fitsInt8(v)) {
+            op(0, true, kind, dst, { 0x83 });
+            byte((uint8_t)v);
+            return;
+        }
+        op(0, true, kind, dst, { 0x81 });
+        u32((uint32_t)v);
+    }
+    void imul(int d, Place src) { op(0, true, d, src, { 0x0F, 0xAF }); }
+    void imulImm(int d, Place src, int32_t v) {
+        op(0, true, d, src, { 0x69 });
+        u32((uint32_t)v);
+    }
+    void test(int a, int b) { op(0, true, b, reg(a), { 0x85 }); }
+    void notReg(int r) { op(0, true, 2, reg(r), { 0xF7 }); }
+    void neg(int r) { op(0, true, 3, reg(r), { 0xF7 }); }
+    void idiv(Place src) { op(0, true, 7, src, { 0xF7 }); }
+    void cqo() { byte(0x48); byte(0x99); }
+    void setcc(Cond cc, int r) { op(0, false, 0, reg(r), { 0x0F, (uint8_t)(0x90 + cc) }, true); }
+    void zeroExtendByte(int r) { op(0, false, r, reg(r), { 0x0F, 0xB6 }, true); }
+    void lea(int d, int32_t disp) { op(0, true, d, slot(disp), { 0x8D }); }
+    void push(int r) {
+        if (r >= 8) byte(0x41);
+        byte((uint8_t)(0x50 + (r & 7)));
+    }
+    void pop(int r) {
+        if (r >= 8) byte(0x41);
+        byte((uint8_t)(0x58 + (r & 7)));
+    }
+    void call(const void* function) {
+        byte(0x48); // mov rax, imm64
+        byte(0xB8);
+        u64((uint64_t)(uintptr_t)function);
+        byte(0xFF); // call rax
+        byte(0xD0);
+    }
+    void ret() { byte(0xC3); }
+
+    // SSE2 scalar doubles
+    void sse(uint8_t prefix, uint8_t opcode, int x, Place src) { op(prefix, false, x, src, { 0x0F, opcode }); }
+    void loadSd(int x, Place src) { sse(0xF2, 0x10, x, src); }
+    void storeSd(Place dst, int x) { sse(0xF2, 0x11, x, dst); }
+    void moveSd(int d, int s) { if (d != s) loadSd(d, reg(s)); }
+    void ucomisd(int a, Place b) { sse(0x66, 0x2E, a, b); }
+    void zeroSd(int x) { sse(0, 0x57, x, reg(x)); } // xorps
+    void fromGear(int x, Place src) { op(0xF2, true, x, src, { 0x0F, 0x2A }); }  // cvtsi2sd
+    void truncateSd(int d, int x) { op(0xF2, true, d, reg(x), { 0x0F, 0x2C }); } // cvttsd2si
+    void bitsToSd(int x, int r) { op(0x66, true, x, reg(r), { 0x0F, 0x6E }); }  // movq xmm, r64
+    void sdToBits(int r, int x) { op(0x66, true, x, reg(r), { 0x0F, 0x7E }); }  // movq r64, xmm
+
+    // Control
+    void jump(int label) { branch(0xE9, 0, label); }
+    void jumpIf(Cond cc, int label) { branch(0x0F, (uint8_t)(0x80 + cc), label); }
+
+    // Fills in the jumps; false if a label was never bound.
+    bool finish() {
+        for (const Fixup& fix : fixups) {
+            int64_t target = labels[(size_t)fix.label];
+            if (target < 0) return false;
+            int32_t rel = (int32_t)(target - (int64_t)(fix.at + 4));
+            memcpy(&code[fix.at], &rel, 4);
+        }
+        return true;
+    }
+
+private:
+    struct Fixup {
+        size_t at; // Of the rel32
+        int label;
+    };
+
+    vector<int64_t> labels; // Offsets, -1 until bound
+    vector<Fixup> fixups;
+
+    void byte(uint8_t b) { code.push_back(b); }
+    void u32(uint32_t v) {
+        uint8_t bytes[4];
+        memcpy(bytes, &v, 4);
+        code.insert(code.end(), bytes, bytes + 4);
+    }
+    void u64(uint64_t v) {
+        uint8_t bytes[8];
+        memcpy(bytes, &v, 8);
+        code.insert(code.end(), bytes, bytes + 8);
+    }
+
+    // A backward jump that fits takes the 2-byte form.
+    void branch(uint8_t first, uint8_t second, int label) {
+        int64_t target = labels[(size_t)label];
+        size_t size = second ? 2 : 1;
+        if (target >= 0 && fitsInt8(target - (int64_t)(code.size() + 2))) {
+            byte(second ? (uint8_t)(second - 0x10) : 0xEB);
+            byte((uint8_t)(target - (int64_t)(code.size() + 1)));
+            return;
+        }
+        byte(first);
+        if (size == 2) byte(second);
+        fixups.push_back({ code.size(), label });
+        u32(0);
+    }
+};
+
+/////////////////////// FRAME ///////////////////////
+
+// The frame, below the saved rbp and the five callee-saved registers:
+//   [rbp - 48]       the Runtime*
+//   [rbp - 56]       where listen stores what it read
+//   [rbp - 64 - 8k]  the home of variable k
+// Every variable has a home, also those kept in registers: turbos in
+// xmm registers are saved there around calls.
+constexpr int32_t RUNTIME_SLOT = -48;
+constexpr int32_t INPUT_SLOT = -56;
+constexpr int32_t FIRST_HOME = -64;
+
+const int savedRegisters[] = { RBX, R12, R13, R14, R15 };
+const int gearRegisters[] = { RBX, R12, R13, R14, R15 };
+const int turboRegisters[] = { 8, 9, 10, 11, 12, 13, 14, 15 };
+// Temporaries. rax and rdx are left out: division needs them, and rax
+// is free to use within a single operation.
+const int gearScratch[] = { RCX, RSI, RDI, R8, R9, R10, R11 };
+const int turboScratch[] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+
+ValueType typeOfDeclaration(TokenType keyword) {
+    switch (keyword) {
+    case KW_TURBO:   return TYPE_TURBO;
+    case KW_EXHAUST: return TYPE_EXHAUST;
+    case KW_FLAG:    return TYPE_FLAG;
+    default:         return TYPE_GEAR;
+    }
+}
+
+bool isComparison(TokenType op) { return op >= OP_LESS && op <= OP_GREATER_EQUAL; }
+
+/////////////////////// USE COUNTS ///////////////////////
+
+// Decides which variables get registers: counts the uses of each
+// declaration, a use inside n loops counting 8^n, and finds what the
+// backend cannot compile (exhaust variables).
+class UseCounter {
+public:
+    struct Declaration {
+        VarDeclStmt* stmt;
+        ValueType type;
+        uint64_t weight;
+    };
+    vector<Declaration> declarations;
+    bool supported = true;
+
+    void walk(Stmt* stmt) { if (stmt) stmt->accept(*this); }
+    void walk(Expr* expr) { if (expr) expr->accept(*this); }
+
+    void visit(BinaryExpr& expr) { walk(expr.left); walk(expr.right); }
+    void visit(LiteralExpr&) {}
+    void visit(VariableExpr& expr) { use(expr.name); }
+    void visit(AssignExpr& expr) { walk(expr.value); use(expr.name); }
+
+    void visit(ExprStmt& stmt) { walk(stmt.expression); }
+    void visit(AnnounceStmt& stmt) { walk(stmt.expression); }
+    void visit(VarDeclStmt& stmt) {
+        walk(stmt.initializer);
+        ValueType type = typeOfDeclaration(stmt.type);
+        if (type == TYPE_EXHAUST) supported = false;
+        scope.push_back({ stmt.name, depth, declarations.size() });
+        declarations.push_back({ &stmt, type, 0 });
+    }
+    void visit(BlockStmt& stmt) {
+        depth++;
+        for (Stmt* s : stmt.statements) walk(s);
+        depth--;
+        while (!scope.empty() && scope.back().depth > depth) scope.pop_back();
+    }
+    void visit(LoopStmt& stmt) {
+        loops++;
+        walk(stmt.condition);
+        walk(stmt.body);
+        loops--;
+    }
+    void visit(FinishlineStmt& stmt) { walk(stmt.value); }
+    void visit(FuncDefStmt&) {}
+    void visit(IfStmt& stmt) { walk(stmt.condition); walk(stmt.thenBranch); walk(stmt.elseBranch); }
+    void visit(ListenStmt& stmt) { use(stmt.name); }
+
+private:
+    struct Name {
+        Symbol name;
+        int depth;
+        size_t declaration;
+    };
+    vector<Name> scope;
+    int depth = 0;
+    int loops = 0;
+
+    void use(Symbol name) {
+        for (auto it = scope.rbegin(); it != scope.rend(); ++it) {
+            if (it->name == name) {
+                declarations[it->declaration].weight += uint64_t(1) << (3 * min(loops, 20));
+                return;
+            }
+        }
+        supported = false; // listen into an undeclared name declares an exhaust
+    }
+};
+
+/////////////////////// CODE GENERATOR ///////////////////////
+
+// Lowers one function. Expressions are compiled to Values: constants stay
+// constants until an instruction needs them, variables are used where
+// they live, and operations leave their result in a scratch register.
+class NativeCompiler {
+public:
+    NativeCompiler(const SymbolTable& symbols, deque<string>& texts) : symbols(symbols), texts(texts) {}
+
+    // False if the function uses something the backend does not cover.
+    bool compile(FuncDefStmt& func);
+    const vector<uint8_t>& code() const { return as.code; }
+
+private:
+    friend struct ::Expr; // accept() calls the visit() overloads
+    friend struct ::Stmt;
+
+    struct Value {
+        enum Where : uint8_t { CONSTANT, REGISTER, SLOT };
+        ValueType type;
+        Where where;
+        bool temporary; // A scratch register, given back once used
+        int reg;
+        int32_t disp;
+        Number constant;
+
+        bool isTurbo() const { return type == TYPE_TURBO; }
+        Place place() const { return where == SLOT ? slot(disp) : ::reg(reg); }
+    };
+
+    struct Local {
+        Symbol name;
+        int depth;
+        Value home; // REGISTER or SLOT, never temporary
+    };
+
+    // A compare's outcome in the flags. For turbo == and !=, 'parity' says
+    // how an unordered (NaN) result counts: +1 false, -1 true, 0 no care.
+    struct Test {
+        Cond cc;
+        int parity;
+    };
+
+    const SymbolTable& symbols;
+    deque<string>& texts;
+    Assembler as;
+    unordered_map<const VarDeclStmt*, Value> homes;
+    vector<Value> turboHomes; // Saved around calls
+    vector<Local> locals;     // Innermost last
+    int depth = 0;
+    unsigned gearFree = 0, turboFree = 0; // Bit k: scratch register k is free
+    int exitLabel = 0, failLabel = 0, divisionLabel = 0;
+    vector<pair<int, int>> divisionChecks; // Label, line
+    bool supported = true;
+
+    // Registers
+    int gearTemporary();
+    int turboTemporary();
+    void release(const Value& value);
+    static Value temporary(ValueType type, int r) { return { type, Value::REGISTER, true, r, 0, Number{ 0 } }; }
+
+    // Values
+    const Local* find(Symbol name) const;
+    Value expression(Expr* expr) { return expr->accept(*this); }
+    int inGearTemporary(const Value& value);
+    int inTurboTemporary(const Value& value);
+    Place turboSource(Value& value); // Converting or loading only if needed
+    int truncate(const Value& value);
+    void store(const Value& value, const Value& home);
+    bool simple(Expr* expr) const { return expr->kind == EXPR_LITERAL || expr->kind == EXPR_VARIABLE; }
+
+    Value arithmetic(BinaryExpr& expr);
+    Value divide(Value left, Value right, int line);
+    Test compare(BinaryExpr& expr);
+    Test truth(Expr* expr);
+    void branch(Expr* condition, bool when, int label);
+    bool updateInPlace(AssignExpr& expr, const Value& home);
+
+    // Calls into the runtime
+    void call(const void* function);
+    void announcePiece(Expr* expr);
+
+    void statement(Stmt* stmt) { if (stmt) stmt->accept(*this); }
+
+    // Expression visitors
+    Value visit(BinaryExpr& expr);
+    Value visit(LiteralExpr& expr);
+    Value visit(VariableExpr& expr);
+    Value visit(AssignExpr& expr);
+
+    // Statement visitors
+    void visit(ExprStmt& stmt);
+    void visit(AnnounceStmt& stmt);
+    void visit(VarDeclStmt& stmt);
+    void visit(BlockStmt& stmt);
+    void visit(LoopStmt& stmt);
+    void visit(FinishlineStmt& stmt);
+    void visit(FuncDefStmt& stmt);
+    void visit(IfStmt& stmt);
+    void visit(ListenStmt& stmt);
+};
+
+bool NativeCompiler::compile(FuncDefStmt& func) {
+    UseCounter counter;
+    counter.walk(func.body);
+    if (!counter.supported) return false;
+
+    // Every variable gets a home slot; the most used ones a register too.
+    vector<size_t> order(counter.declarations.size());
+    for (size_t k = 0; k < order.size(); k++) order[k] = k;
+    stable_sort(order.begin(), order.end(),
+                [&](size_t a, size_t b) { return counter.declarations[a].weight > counter.declarations[b].weight; });
+    size_t gears = 0, turbos = 0;
+    for (size_t k : order) {
+        const UseCounter::Declaration& decl = counter.declarations[k];
+        Value home{ decl.type, Value::SLOT, false, 0, FIRST_HOME - 8 * (int32_t)k, Number{ 0 } };
+        if (decl.type == TYPE_TURBO && turbos < size(turboRegisters)) {
+            home.where = Value::REGISTER;
+            home.reg = turboRegisters[turbos++];
+            turboHomes.push_back(home);
+        }
+        else if (decl.type != TYPE_TURBO && gears < size(gearRegisters)) {
+            home.where = Value::REGISTER;
+            home.reg = gearRegisters[gears++];
+        }
+        homes[decl.stmt] = home;
+    }
+    gearFree = (1u << size(gearScratch)) - 1;
+    turboFree = (1u << size(turboScratch)) - 1;
+
+    // Prologue. The frame keeps rsp 16-byte aligned for calls.
+    int32_t frame = 16 + 8 * (int32_t)counter.declarations.size();
+    if (frame % 16 == 0) frame += 8;
+    as.push(RBP);
+    as.store(reg(RBP), RSP);
+    for (int r : savedRegisters) as.push(r);
+    as.aluImm(ALU_SUB, reg(RSP), frame);
+    as.store(slot(RUNTIME_SLOT), RDI);
+
+    exitLabel = as.label();
+    failLabel = as.label();
+    divisionLabel = as.label();
+    statement(func.body);
+    as.loadImm(RAX, 0); // Falling off the end finishes with 0
+
+    as.bind(exitLabel);
+    as.lea(RSP, -8 * (int32_t)size(savedRegisters));
+    for (size_t k = size(savedRegisters); k-- > 0;) as.pop(savedRegisters[k]);
+    as.pop(RBP);
+    as.ret();
+
+    // Runtime errors: the runtime reports them, and the function returns.
+    for (const auto& check : divisionChecks) {
+        as.bind(check.first);
+        as.loadImm(RSI, check.second);
+        as.jump(divisionLabel);
+    }
+    as.bind(divisionLabel);
+    as.load(RDI, slot(RUNTIME_SLOT));
+    as.call((const void*)&divisionByZero);
+    as.bind(failLabel);
+    as.loadImm(RAX, 0);
+    as.jump(exitLabel);
+
+    return supported && as.finish();
+}
+
+/////////////////////// REGISTERS ///////////////////////
+
+// Running out of scratch registers (a very deep expression) makes the
+// function unsupported rather than spilling.
+int NativeCompiler::gearTemporary() {
+    if (!gearFree) {
+        supported = false;
+        return gearScratch[0];
+    }
+    int k = 0;
+    while (!(gearFree & (1u << k))) k++;
+    gearFree &= ~(1u << k);
+    return gearScratch[k];
+}
+
+int NativeCompiler::turboTemporary() {
+    if (!turboFree) {
+        supported = false;
+        return turboScratch[0];
+    }
+    int k = 0;
+    while (!(turboFree & (1u << k))) k++;
+    turboFree &= ~(1u << k);
+    return turboScratch[k];
+}
+
+void NativeCompiler::release(const Value& value) {
+    if (!value.temporary) return;
+    if (value.isTurbo()) {
+        turboFree |= 1u << value.reg; // xmm0-xmm7 are scratch 0-7
+        return;
+    }
+    for (size_t k = 0; k < size(gearScratch); k++)
+        if (gearScratch[k] == value.reg) gearFree |= 1u << k;
+}
+
+/////////////////////// VALUES ///////////////////////
+
+const NativeCompiler::Local* NativeCompiler::find(Symbol name) const {
+    for (auto it = locals.rbegin(); it != locals.rend(); ++it)
+        if (it->name == name) return &*it;
+    return nullptr;
+}
+
+// A gear or flag in a scratch register of its own, to compute into.
+int NativeCompiler::inGearTemporary(const Value& value) {
+    if (value.temporary) return value.reg;
+    int r = gearTemporary();
+    if (value.where == Value::CONSTANT) as.loadImm(r, value.constant.i);
+    else as.load(r, value.place());
+    return r;
+}
+
+// A number as a turbo in a scratch register of its own.
+int NativeCompiler::inTurboTemporary(const Value& value) {
+    if (value.temporary && value.isTurbo()) return value.reg;
+    int x = turboTemporary();
+    if (value.isTurbo()) {
+        if (value.where != Value::CONSTANT) {
+            as.loadSd(x, value.place());
+        }
+        else if (value.constant.i == 0) {
+            as.zeroSd(x);
+        }
+        else {
+            as.loadImm(RAX, value.constant.i);
+            as.bitsToSd(x, RAX);
+        }
+        return x;
+    }
+    as.zeroSd(x); // cvtsi2sd keeps the upper bits: break the dependency
+    if (value.where == Value::CONSTANT) {
+        as.loadImm(RAX, value.constant.i);
+        as.fromGear(x, reg(RAX));
+    }
+    else {
+        as.fromGear(x, value.place());
+    }
+    release(value);
+    return x;
+}
+
+// A turbo operand for an SSE instruction, which may be a register or a
+// slot as it is. Anything else is made a turbo temporary, and 'value'
+// updated to release it.
+Place NativeCompiler::turboSource(Value& value) {
+    if (value.isTurbo() && value.where != Value::CONSTANT) return value.place();
+    value = temporary(TYPE_TURBO, inTurboTemporary(value));
+    return value.place();
+}
+
+// A turbo to a gear in a scratch register, saturating like the VM:
+// cvttsd2si gives INT64_MIN for NaN and out of range, which is fixed up
+// by the sign of the input.
+int NativeCompiler::truncate(const Value& value) {
+    Value source = value;
+    int x = inTurboTemporary(source);
+    int r = gearTemporary();
+    int done = as.label(), nan = as.label();
+    as.truncateSd(r, x);
+    as.loadImm(RAX, INT64_MIN);
+    as.alu(ALU_CMP, r, reg(RAX));
+    as.jumpIf(CC_NE, done);
+    as.ucomisd(x, reg(x));
+    as.jumpIf(CC_P, nan);
+    as.sdToBits(RAX, x);
+    as.test(RAX, RAX);
+    as.jumpIf(CC_S, done);
+    as.notReg(r); // INT64_MAX
+    as.jump(done);
+    as.bind(nan);
+    as.loadImm(r, 0);
+    as.bind(done);
+    release(temporary(TYPE_TURBO, x));
+    return r;
+}
+
+// Stores 'value' in a variable's home, converting between gear and turbo.
+void NativeCompiler::store(const Value& value, const Value& home) {
+    if (home.isTurbo()) {
+        Value v = value;
+        if (home.where == Value::REGISTER) {
+            if (v.isTurbo() && v.where != Value::CONSTANT) {
+                if (v.where == Value::SLOT || v.reg != home.reg) as.loadSd(home.reg, v.place());
+            }
+            else if (!v.isTurbo() && v.where != Value::CONSTANT) {
+                as.zeroSd(home.reg);
+                as.fromGear(home.reg, v.place());
+            }
+            else {
+                int x = inTurboTemporary(v);
+                as.moveSd(home.reg, x);
+                release(temporary(TYPE_TURBO, x));
+                return;
+            }
+            release(v);
+            return;
+        }
+        if (!(v.isTurbo() && v.where == Value::REGISTER)) v = temporary(TYPE_TURBO, inTurboTemporary(v));
+        as.storeSd(home.place(), v.reg);
+        release(v);
+        return;
+    }
+
+    Value v = value;
+    if (v.isTurbo()) v = temporary(TYPE_GEAR, truncate(v));
+    if (v.where == Value::CONSTANT) {
+        if (home.where == Value::REGISTER) as.loadImm(home.reg, v.constant.i);
+        else if (fitsInt32(v.constant.i)) as.storeImm(home.place(), (int32_t)v.constant.i);
+        else {
+            as.loadImm(RAX, v.constant.i);
+            as.store(home.place(), RAX);
+        }
+        return;
+    }
+    if (home.where == Value::REGISTER) {
+        if (v.where == Value::SLOT || v.reg != home.reg) as.load(home.reg, v.place());
+    }
+    else if (v.where == Value::REGISTER) {
+        as.store(home.place(), v.reg);
+    }
+    else if (v.disp != home.disp) {
+        as.load(RAX, v.place());
+        as.store(home.place(), RAX);
+    }
+    release(v);
+}
+
+/////////////////////// OPERATIONS ///////////////////////
+
+NativeCompiler::Value NativeCompiler::arithmetic(BinaryExpr& expr) {
+    Value left = expression(expr.left);
+    // A variable is read where the operator runs, so if the right side
+    // may assign to it, it is copied first (as in the bytecode compiler).
+    if (!simple(expr.right) && !left.temporary && left.where != Value::CONSTANT)
+        left = left.isTurbo() ? temporary(TYPE_TURBO, inTurboTemporary(left)) : temporary(left.type, inGearTemporary(left));
+    Value right = expression(expr.right);
+
+    if (expr.type == TYPE_GEAR) {
+        if (expr.op == OP_SLASH) return divide(left, right, expr.line);
+        // Commutative: compute into whichever side is a temporary already.
+        if (!left.temporary && right.temporary && expr.op != OP_MINUS) swap(left, right);
+        int d = inGearTemporary(left);
+        bool immediate = right.where == Value::CONSTANT && fitsInt32(right.constant.i);
+        Place src = right.place();
+        if (right.where == Value::CONSTANT && !immediate) {
+            as.loadImm(RAX, right.constant.i);
+            src = reg(RAX);
+        }
+        if (expr.op == OP_STAR) {
+            if (immediate) as.imulImm(d, reg(d), (int32_t)right.constant.i);
+            else as.imul(d, src);
+        }
+        else {
+            Alu kind = expr.op == OP_PLUS ? ALU_ADD : ALU_SUB;
+            if (immediate) as.aluImm(kind, reg(d), (int32_t)right.constant.i);
+            else as.alu(kind, d, src);
+        }
+        release(right);
+        return temporary(TYPE_GEAR, d);
+    }
+
+    if (!left.temporary && right.temporary && right.isTurbo() && (expr.op == OP_PLUS || expr.op == OP_STAR)) swap(left, right);
+    int d = inTurboTemporary(left);
+    Place src = turboSource(right);
+    static const uint8_t opcodes[] = { 0x58, 0x5C, 0x59, 0x5E }; // addsd subsd mulsd divsd
+    int index = expr.op == OP_PLUS ? 0 : expr.op == OP_MINUS ? 1 : expr.op == OP_STAR ? 2 : 3;
+    as.sse(0xF2, opcodes[index], d, src);
+    release(right);
+    return temporary(TYPE_TURBO, d);
+}
+
+// idiv needs rax and rdx, and faults on x / 0 and INT64_MIN / -1; the
+// first is a runtime error and the second wraps, as on the VM.
+NativeCompiler::Value NativeCompiler::divide(Value left, Value right, int line) {
+    bool known = right.where == Value::CONSTANT;
+    int64_t divisor = right.constant.i;
+    Place src = right.place();
+    if (known) {
+        right = temporary(TYPE_GEAR, inGearTemporary(right));
+        src = right.place();
+    }
+    if (left.where == Value::CONSTANT) as.loadImm(RAX, left.constant.i);
+    else as.load(RAX, left.place());
+    release(left);
+
+    if (!known || divisor == 0) {
+        int check = as.label();
+        divisionChecks.push_back({ check, line });
+        if (src.memory) as.aluImm(ALU_CMP, src, 0);
+        else as.test(src.reg, src.reg);
+        as.jumpIf(CC_E, check);
+    }
+    if (known && divisor == -1) {
+        as.neg(RAX);
+    }
+    else if (known) {
+        as.cqo();
+        as.idiv(src);
+    }
+    else {
+        int divideLabel = as.label(), done = as.label();
+        as.aluImm(ALU_CMP, src, -1);
+        as.jumpIf(CC_NE, divideLabel);
+        as.neg(RAX);
+        as.jump(done);
+        as.bind(divideLabel);
+        as.cqo();
+        as.idiv(src);
+        as.bind(done);
+    }
+    release(right);
+    int d = gearTemporary();
+    as.move(d, RAX);
+    return temporary(TYPE_GEAR, d);
+}
+
+// Compares the operands of a comparison, leaving the outcome in the flags.
+NativeCompiler::Test NativeCompiler::compare(BinaryExpr& expr) {
+    Value left = expression(expr.left);
+    if (!simple(expr.right) && !left.temporary && left.where != Value::CONSTANT)
+        left = left.isTurbo() ? temporary(TYPE_TURBO, inTurboTemporary(left)) : temporary(left.type, inGearTemporary(left));
+    Value right = expression(expr.right);
+    TokenType op = expr.op;
+
+    if (!left.isTurbo() && !right.isTurbo()) {
+        static const TokenType mirrored[] = { OP_GREATER, OP_LESS, OP_EQUAL, OP_NOT_EQUAL, OP_GREATER_EQUAL, OP_LESS_EQUAL };
+        if (left.where == Value::CONSTANT && right.where != Value::CONSTANT) {
+            swap(left, right);
+            op = mirrored[op - OP_LESS];
+        }
+        if (left.where == Value::CONSTANT || (left.where == Value::SLOT && right.where == Value::SLOT))
+            left = temporary(left.type, inGearTemporary(left));
+        if (right.where == Value::CONSTANT && fitsInt32(right.constant.i)) {
+            as.aluImm(ALU_CMP, left.place(), (int32_t)right.constant.i);
+        }
+        else if (right.where == Value::CONSTANT) {
+            as.loadImm(RAX, right.constant.i);
+            as.aluStore(ALU_CMP, left.place(), RAX);
+        }
+        else if (left.where == Value::SLOT) {
+            as.aluStore(ALU_CMP, left.place(), right.reg);
+        }
+        else {
+            as.alu(ALU_CMP, left.reg, right.place());
+        }
+        release(left);
+        release(right);
+        static const Cond conds[] = { CC_L, CC_G, CC_E, CC_NE, CC_LE, CC_GE };
+        return { conds[op - OP_LESS], 0 };
+    }
+
+    // ucomisd sets CF for "below" and all of ZF, PF and CF when unordered,
+    // so < and <= are tested as > and >= with the operands swapped.
+    if (op == OP_LESS || op == OP_LESS_EQUAL) {
+        swap(left, right);
+        op = op == OP_LESS ? OP_GREATER : OP_GREATER_EQUAL;
+    }
+    if (!(left.isTurbo() && left.where == Value::REGISTER)) left = temporary(TYPE_TURBO, inTurboTemporary(left));
+    Place src = turboSource(right);
+    as.ucomisd(left.reg, src);
+    release(left);
+    release(right);
+    switch (op) {
+    case OP_GREATER:       return { CC_A, 0 };
+    case OP_GREATER_EQUAL: return { CC_AE, 0 };
+    case OP_EQUAL:         return { CC_E, +1 };
+    default:               return { CC_NE, -1 };
+    }
+}
+
+// A condition's outcome in the flags: a comparison's own, or whether a
+// value is non-zero.
+NativeCompiler::Test NativeCompiler::truth(Expr* expr) {
+    if (expr->kind == EXPR_BINARY && isComparison(static_cast<BinaryExpr*>(expr)->op))
+        return compare(*static_cast<BinaryExpr*>(expr));
+    Value value = expression(expr);
+    if (value.isTurbo()) {
+        if (value.where != Value::REGISTER) value = temporary(TYPE_TURBO, inTurboTemporary(value));
+        int zero = turboTemporary();
+        as.zeroSd(zero);
+        as.ucomisd(value.reg, reg(zero));
+        release(temporary(TYPE_TURBO, zero));
+        release(value);
+        return { CC_NE, -1 };
+    }
+    if (value.where == Value::CONSTANT) value = temporary(value.type, inGearTemporary(value));
+    if (value.where == Value::SLOT) as.aluImm(ALU_CMP, value.place(), 0);
+    else as.test(value.reg, value.reg);
+    release(value);
+    return { CC_NE, 0 };
+}
+
+// Jumps to 'label' if 'condition' is 'when'.
+void NativeCompiler::branch(Expr* condition, bool when, int label) {
+    if (condition->kind == EXPR_LITERAL) {
+        const LiteralValue& value = static_cast<LiteralExpr*>(condition)->value;
+        bool truth = value.kind == LiteralValue::DOUBLE ? value.d != 0 : value.kind == LiteralValue::BOOL ? value.b : value.i != 0;
+        if (truth == when) as.jump(label);
+        return;
+    }
+    Test test = truth(condition);
+    Cond cc = when ? test.cc : (Cond)(test.cc ^ 1);
+    // Jumping when the outcome holds and the result was ordered ('and not
+    // parity'), or when it holds or was unordered ('or parity').
+    int parity = when ? test.parity : -test.parity;
+    if (parity > 0) {
+        int skip = as.label();
+        as.jumpIf(CC_P, skip);
+        as.jumpIf(cc, label);
+        as.bind(skip);
+    }
+    else {
+        if (parity < 0) as.jumpIf(CC_P, label);
+        as.jumpIf(cc, label);
+    }
+}
+
+// x = x + y, x = x - y and x = x * y, for a variable in a register and a
+// y that is a constant or a variable, are done on the register itself.
+bool NativeCompiler::updateInPlace(AssignExpr& expr, const Value& home) {
+    if (home.where != Value::REGISTER || !expr.value || expr.value->kind != EXPR_BINARY) return false;
+    auto& binary = static_cast<BinaryExpr&>(*expr.value);
+    if (binary.op != OP_PLUS && binary.op != OP_MINUS && binary.op != OP_STAR) return false;
+    if (binary.left->kind != EXPR_VARIABLE || !simple(binary.right)) return false;
+    const Local* target = find(static_cast<VariableExpr*>(binary.left)->name);
+    if (!target || target->home.disp != home.disp) return false;
+
+    ValueType rightType = binary.right->type;
+    if (home.type == TYPE_GEAR && rightType == TYPE_GEAR) {
+        Value right = expression(binary.right);
+        bool immediate = right.where == Value::CONSTANT && fitsInt32(right.constant.i);
+        Place src = right.place();
+        if (right.where == Value::CONSTANT && !immediate) {
+            as.loadImm(RAX, right.constant.i);
+            src = reg(RAX);
+        }
+        if (binary.op == OP_STAR) {
+            if (immediate) as.imulImm(home.reg, reg(home.reg), (int32_t)right.constant.i);
+            else as.imul(home.reg, src);
+        }
+        else {
+            Alu kind = binary.op == OP_PLUS ? ALU_ADD : ALU_SUB;
+            if (immediate) as.aluImm(kind, reg(home.reg), (int32_t)right.constant.i);
+            else as.alu(kind, home.reg, src);
+        }
+        return true;
+    }
+    if (home.type == TYPE_TURBO && (rightType == TYPE_TURBO || rightType == TYPE_GEAR)) {
+        Value right = expression(binary.right);
+        Place src = turboSource(right);
+        as.sse(0xF2, binary.op == OP_PLUS ? 0x58 : binary.op == OP_MINUS ? 0x5C : 0x59, home.reg, src);
+        release(right);
+        return true;
+    }
+    return false;
+}
+
+/////////////////////// CALLS ///////////////////////
+
+// The runtime may use any caller-saved register, which includes all the
+// xmm registers: turbo variables are saved to their homes around it.
+void NativeCompiler::call(const void* function) {
+    for (const Value& home : turboHomes) as.storeSd(slot(home.disp), home.reg);
+    as.load(RDI, slot(RUNTIME_SLOT));
+    as.call(function);
+    for (const Value& home : turboHomes) as.loadSd(home.reg, slot(home.disp));
+}
+
+// Text built with '+' is announced a piece at a time, never built.
+void NativeCompiler::announcePiece(Expr* expr) {
+    ValueType type = expr->type;
+    if (type == TYPE_EXHAUST) {
+        if (expr->kind == EXPR_LITERAL) {
+            texts.emplace_back(symbols.name(static_cast<LiteralExpr*>(expr)->value.s));
+            const string& text = texts.back();
+            as.loadImm(RSI, (int64_t)(uintptr_t)text.data());
+            as.loadImm(RDX, (int64_t)text.size());
+            call((const void*)&appendText);
+        }
+        else if (expr->kind == EXPR_BINARY) {
+            auto& binary = static_cast<BinaryExpr&>(*expr);
+            announcePiece(binary.left);
+            announcePiece(binary.right);
+        }
+        else {
+            supported = false; // An exhaust variable
+        }
+        return;
+    }
+
+    Value value = expression(expr);
+    if (value.isTurbo()) {
+        if (value.where == Value::CONSTANT) value = temporary(TYPE_TURBO, inTurboTemporary(value));
+        as.loadSd(0, value.place());
+        release(value);
+        call((const void*)&appendTurbo);
+        return;
+    }
+    if (value.where == Value::CONSTANT) as.loadImm(RSI, value.constant.i);
+    else as.load(RSI, value.place());
+    release(value);
+    call(type == TYPE_FLAG ? (const void*)&appendFlag : (const void*)&appendGear);
+}
+
+/////////////////////// EXPRESSIONS ///////////////////////
+
+NativeCompiler::Value NativeCompiler::visit(BinaryExpr& expr) {
+    if (isComparison(expr.op)) {
+        Test test = compare(expr);
+        int r = gearTemporary();
+        as.setcc(test.cc, r);
+        as.zeroExtendByte(r);
+        if (test.parity) {
+            as.setcc(test.parity > 0 ? CC_NP : CC_P, RAX);
+            as.zeroExtendByte(RAX);
+            as.alu(test.parity > 0 ? ALU_AND : ALU_OR, r, reg(RAX));
+        }
+        return temporary(TYPE_FLAG, r);
+    }
+    return arithmetic(expr); // Text outside an announce stops at its literals
+}
+
+NativeCompiler::Value NativeCompiler::visit(LiteralExpr& expr) {
+    Value value{ TYPE_GEAR, Value::CONSTANT, false, 0, 0, Number{ 0 } };
+    switch (expr.value.kind) {
+    case LiteralValue::INT:
+        value.constant.i = expr.value.i;
+        break;
+    case LiteralValue::DOUBLE:
+        value.type = TYPE_TURBO;
+        value.constant.d = expr.value.d;
+        break;
+    case LiteralValue::BOOL:
+        value.type = TYPE_FLAG;
+        value.constant.i = expr.value.b ? 1 : 0;
+        break;
+    default:
+        supported = false; // Text outside an announce
+        break;
+    }
+    return value;
+}
+
+NativeCompiler::Value NativeCompiler::visit(VariableExpr& expr) {
+    const Local* local = find(expr.name);
+    if (!local) {
+        supported = false;
+        return temporary(TYPE_GEAR, gearTemporary());
+    }
+    return local->home;
+}
+
+NativeCompiler::Value NativeCompiler::visit(AssignExpr& expr) {
+    const Local* local = find(expr.name);
+    if (!local) {
+        supported = false;
+        return temporary(TYPE_GEAR, gearTemporary());
+    }
+    Value home = local->home;
+    if (!updateInPlace(expr, home)) store(expression(expr.value), home);
+    return home;
+}
+
+/////////////////////// STATEMENTS ///////////////////////
+
+void NativeCompiler::visit(ExprStmt& stmt) {
+    release(expression(stmt.expression));
+}
+
+void NativeCompiler::visit(AnnounceStmt& stmt) {
+    announcePiece(stmt.expression);
+    call((const void*)&endLine);
+}
+
+// The variable comes into scope after its initializer.
+void NativeCompiler::visit(VarDeclStmt& stmt) {
+    Value home = homes[&stmt];
+    if (stmt.initializer) {
+        store(expression(stmt.initializer), home);
+    }
+    else {
+        Value zero{ home.type, Value::CONSTANT, false, 0, 0, Number{ 0 } };
+        store(zero, home);
+    }
+    locals.push_back({ stmt.name, depth, home });
+}
+
+void NativeCompiler::visit(BlockStmt& stmt) {
+    int outer = depth++;
+    for (Stmt* s : stmt.statements) statement(s);
+    while (!locals.empty() && locals.back().depth > outer) locals.pop_back();
+    depth = outer;
+}
+
+// The condition is tested at the bottom, as on the VM.
+void NativeCompiler::visit(LoopStmt& stmt) {
+    int body = as.label(), test = as.label();
+    as.jump(test);
+    as.bind(body);
+    statement(stmt.body);
+    as.bind(test);
+    branch(stmt.condition, true, body);
+}
+
+void NativeCompiler::visit(FinishlineStmt& stmt) {
+    Value value = expression(stmt.value);
+    if (value.isTurbo()) value = temporary(TYPE_GEAR, truncate(value));
+    if (value.where == Value::CONSTANT) as.loadImm(RAX, value.constant.i);
+    else as.load(RAX, value.place());
+    release(value);
+    as.jump(exitLabel);
+}
+
+void NativeCompiler::visit(FuncDefStmt&) {}
+
+void NativeCompiler::visit(IfStmt& stmt) {
+    int elseLabel = as.label(), end = as.label();
+    branch(stmt.condition, false, elseLabel);
+    statement(stmt.thenBranch);
+    if (stmt.elseBranch) as.jump(end);
+    as.bind(elseLabel);
+    statement(stmt.elseBranch);
+    as.bind(end);
+}
+
+void NativeCompiler::visit(ListenStmt& stmt) {
+    const Local* local = find(stmt.name);
+    if (!local) {
+        supported = false;
+        return;
+    }
+    Value home = local->home;
+    as.loadImm(RSI, home.type);
+    as.lea(RDX, INPUT_SLOT);
+    as.loadImm(RCX, stmt.line);
+    call((const void*)&listen);
+    as.zeroExtendByte(RAX);
+    as.test(RAX, RAX);
+    as.jumpIf(CC_E, failLabel);
+    if (home.isTurbo()) {
+        if (home.where == Value::REGISTER) as.loadSd(home.reg, slot(INPUT_SLOT));
+        else store(Value{ TYPE_TURBO, Value::SLOT, false, 0, INPUT_SLOT, Number{ 0 } }, home);
+    }
+    else {
+        store(Value{ home.type, Value::SLOT, false, 0, INPUT_SLOT, Number{ 0 } }, home);
+    }
+}
+
+} // namespace
+
+/////////////////////// NATIVE FUNCTION ///////////////////////
+
+unique_ptr<NativeFunction> NativeFunction::compile(FuncDefStmt& func, const SymbolTable& symbols) {
+#ifdef AUTOSPEED_NATIVE
+    unique_ptr<NativeFunction> native(new NativeFunction());
+    NativeCompiler compiler(symbols, native->texts);
+    if (!compiler.compile(func)) return nullptr;
+
+    // Written, then made executable: never writable and executable at once.
+    const vector<uint8_t>& code = compiler.code();
+    void* memory = mmap(nullptr, code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return nullptr;
+    memcpy(memory, code.data(), code.size());
+    if (mprotect(memory, code.size(), PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, code.size());
+        return nullptr;
+    }
+    native->code = memory;
+    native->size = code.size();
+    return native;
+#else
+    (void)func;
+    (void)symbols;
+    return nullptr;
+#endif
+}
+
+NativeFunction::~NativeFunction() {
+#ifdef AUTOSPEED_NATIVE
+    if (code) munmap(code, size);
+#endif
+}
+
+RunResult NativeFunction::run(istream& in, ostream& out, Diagnostics& diagnostics) const {
+    Runtime rt{ in, out, diagnostics, string() };
+    auto entry = reinterpret_cast<int64_t (*)(Runtime*)>(code);
+    int64_t value = entry(&rt);
+    flush(rt);
+    return { !rt.failed, rt.failed ? 0 : value, 0 };
+}
+
+RunResult runFromAst(const vector<Stmt*>& statements, CompilationContext& ctx, istream& in, ostream& out, Engine* used) {
+    if (used) *used = Engine::NONE;
+    BytecodeCompiler compiler(ctx);
+    BytecodeProgram program = compiler.compile(statements);
+    if (program.entry < 0 && ctx.diagnostics.empty())
+        ctx.diagnostics.report(1, 0, DIAG_NO_ENTRY_POINT, "No ignite() to run.");
+    if (!ctx.diagnostics.empty()) return { false, 0, 0 };
+
+    Symbol ignite = ctx.symbols.find("ignite");
+    for (Stmt* stmt : statements) {
+        if (!stmt || stmt->kind != STMT_FUNC_DEF || static_cast<FuncDefStmt*>(stmt)->name != ignite) continue;
+        if (auto native = NativeFunction::compile(static_cast<FuncDefStmt&>(*stmt), ctx.symbols)) {
+            if (used) *used = Engine::NATIVE;
+            return native->run(in, out, ctx.diagnostics);
+        }
+        break;
+    }
+    if (used) *used = Engine::VM;
+    Vm vm(in, out);
+    return vm.run(program.functions[(size_t)program.entry], ctx.diagnostics);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "diagnostics.h"
+#include "parser.h"
+#include "vm.h"
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <string>
+
+/*
+ * NativeFunction
+ * One function compiled from its AST straight to x86-64 machine code, in
+ * an executable mapping it owns. Only built on x86-64 Linux.
+ *
+ * The backend covers what tight numeric loops need: gear, turbo and flag
+ * variables and arithmetic, track/pitstop, looplap, finishline, announce
+ * (of any value, including text built with '+') and listen into a gear,
+ * turbo or flag. Exhaust variables and other uses of text are left to the
+ * bytecode VM (see runFromAst).
+ *
+ * The most used variables (by count of uses, loops weighing more) live in
+ * registers for the whole function: gears and flags in the callee-saved
+ * rbx, r12-r15, turbos in xmm8-xmm15; the rest live in the stack frame.
+ * Conditions compile to a compare and a conditional branch. announce and
+ * listen call a small runtime; turbo registers are saved around those
+ * calls. Behaviour matches the VM's, including wrapping integer
+ * arithmetic and the runtime errors it reports.
+ */
+class NativeFunction {
+public:
+    // The function as machine code, or nullptr if it uses something the
+    // backend does not cover (or this is not x86-64 Linux). 'func' must
+    // have been type-checked without errors (compiling it to bytecode does
+    // that): the operations are picked by Expr::type.
+    static std::unique_ptr<NativeFunction> compile(FuncDefStmt& func, const SymbolTable& symbols);
+
+    ~NativeFunction();
+    NativeFunction(const NativeFunction&) = delete;
+    NativeFunction& operator=(const NativeFunction&) = delete;
+
+    RunResult run(std::istream& in, std::ostream& out, Diagnostics& diagnostics) const;
+    size_t codeSize() const { return size; }
+
+private:
+    NativeFunction() = default;
+
+    void* code = nullptr;
+    size_t size = 0;
+    std::deque<std::string> texts; // String literals the code points into
+};
+
+/*
+ * Engine
+ * What runFromAst ran a program on.
+ */
+enum class Engine { NONE, NATIVE, VM };
+
+/*
+ * runFromAst
+ * Runs a parsed program's ignite(): compiles every function to bytecode
+ * (which type-checks it), then runs ignite() as machine code if the
+ * backend covers it and on the VM if not. Errors go to ctx.diagnostics;
+ * on any, the result is not ok and nothing may have run.
+ */
+RunResult runFromAst(const std::vector<Stmt*>& statements, CompilationContext& ctx,
+                     std::istream& in, std::ostream& out, Engine* used = nullptr);
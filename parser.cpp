@@ -1,297 +1,484 @@
 ﻿#include "parser.h"
-#include <iostream>
-#include <stdexcept>
+#include "thread_pool.h"
+
+#include <algorithm>
 
 using namespace std;
 
-Parser::Parser(const vector<Token>& tokens) : tokens(tokens) {}
+Parser::Parser(const TokenStream& tokens, CompilationContext& ctx)
+    : ctx(ctx), tokens(&tokens), diagnostics(&ctx.diagnostics), igniteName(ctx.symbols.intern("ignite")) {
+}
 
-vector<shared_ptr<Stmt>> Parser::parse() {
-    vector<shared_ptr<Stmt>> statements;
-    while (!isAtEnd()) {
-        try {
-            statements.push_back(parseStatement());
+Parser::Parser(Lexer& lexer, CompilationContext& ctx)
+    : ctx(ctx), lexer(&lexer), diagnostics(&ctx.diagnostics), igniteName(ctx.symbols.intern("ignite")) {
+}
+
+ParseResult Parser::parse() {
+    ParseResult result;
+    while (auto stmt = parseNext()) {
+        result.statements.push_back(stmt);
+    }
+    result.arena = move(nodes);
+    exprPool.clear();
+    return result;
+}
+
+/////////////////////// PARALLEL PARSE ///////////////////////
+
+namespace {
+
+// A run of whole top-level statements, parsed by one worker.
+struct ParseTask {
+    size_t begin;
+    size_t end; // Token index of the next task's first token
+    vector<Stmt*> statements;
+    Diagnostics diagnostics;
+};
+
+// Splits the tokens before END_OF_FILE at the 'engine's and 'ignite's that
+// start a top-level statement (see parseParallel), then groups neighbouring
+// pieces into tasks of about 'target' tokens.
+vector<ParseTask> splitTopLevel(const TokenStream& tokens, size_t target) {
+    vector<ParseTask> tasks;
+    size_t last = tokens.size() - 1; // END_OF_FILE
+    size_t begin = 0;
+    int depth = 0;
+    for (size_t i = 0; i < last; i++) {
+        switch (tokens.type(i)) {
+        case SYM_LEFT_BRACE:
+            depth++;
+            break;
+        case SYM_RIGHT_BRACE:
+            if (depth > 0) depth--; // The parser drops a stray top-level '}'
+            break;
+        case KW_ENGINE:
+        case KW_IGNITE:
+            if (depth == 0 && i - begin >= target && i > 0 &&
+                tokens.type(i - 1) != SYM_RIGHT_PAREN && tokens.type(i - 1) != KW_PITSTOP) {
+                tasks.push_back({ begin, i, {}, {} });
+                begin = i;
+            }
+            break;
+        default:
+            break;
         }
-        catch (runtime_error& e) {
-            cerr << e.what() << endl;
-            synchronize();
+    }
+    tasks.push_back({ begin, last, {}, {} });
+    return tasks;
+}
+
+} // namespace
+
+// Why the pieces can be parsed apart: a top-level statement never runs
+// past an 'engine' or 'ignite' at brace depth 0, unless that keyword starts
+// the body of a 'track', 'looplap' or 'pitstop' (and so follows ')' or
+// 'pitstop'; splitTopLevel does not cut there). Otherwise statements only
+// take such a keyword as their first token, and synchronize() stops at
+// one. So each piece parses exactly as it would in one sequential pass, and
+// joining the pieces' statements and diagnostics in order reproduces it.
+ParseResult Parser::parseParallel(ThreadPool& pool, size_t minTaskTokens) {
+    if (!tokens || current != 0 || pool.size() == 1) return parse();
+
+    size_t target = std::max(minTaskTokens, tokens->size() / (pool.size() * 8));
+    vector<ParseTask> tasks = splitTopLevel(*tokens, target);
+    if (tasks.size() == 1) return parse();
+
+    // One parser (and so one arena) per worker, built here: the
+    // constructor interns, the workers only read the symbol table.
+    vector<Parser> workers;
+    workers.reserve(pool.size());
+    for (unsigned w = 0; w < pool.size(); w++) {
+        workers.emplace_back(*tokens, ctx);
+        workers.back().sharing = sharing;
+    }
+
+    pool.run(tasks.size(), [&](size_t i, unsigned w) {
+        Parser& p = workers[w];
+        ParseTask& task = tasks[i];
+        p.current = task.begin;
+        p.endToken = task.end;
+        p.diagnostics = &task.diagnostics;
+        while (Stmt* stmt = p.parseNext()) task.statements.push_back(stmt);
+    });
+
+    ParseResult result;
+    for (ParseTask& task : tasks) {
+        // A task that would reach the error limit (or comes after it) is
+        // parsed again here, sequentially, so the parse stops exactly where
+        // parse() would.
+        if (diagnostics->full() || task.diagnostics.size() > diagnostics->room()) {
+            current = task.begin;
+            while (Stmt* stmt = parseNext()) result.statements.push_back(stmt);
+            break;
         }
+        for (const Diagnostic& d : task.diagnostics.all())
+            diagnostics->report(d.line, d.column, d.code, d.message);
+        result.statements.insert(result.statements.end(), task.statements.begin(), task.statements.end());
     }
-    return statements;
+
+    result.arena = move(nodes);
+    exprPool.clear();
+    for (Parser& p : workers) result.arena.adopt(move(p.nodes));
+    return result;
 }
 
-shared_ptr<Stmt> Parser::parseStatement() {
-    Token p = peek();
+Stmt* Parser::parseNext() {
+    while (!isAtEnd() && !diagnostics->full()) {
+        size_t start = current;
+        if (Stmt* stmt = parseStatement()) return stmt;
+        synchronize(start);
+    }
+    return nullptr;
+}
 
-    if (p.type == KEYWORD && p.value == "engine") {
+Stmt* Parser::parseStatement() {
+    return parseRanged(&Parser::dispatchStatement);
+}
+
+// Runs one statement's parse function and records the statement's token
+// range, relative to the statement around it (see Stmt::tokenStart).
+Stmt* Parser::parseRanged(Stmt* (Parser::*parse)()) {
+    size_t start = current;
+    size_t outer = enclosingStart;
+    enclosingStart = start;
+    Stmt* stmt = (this->*parse)();
+    enclosingStart = outer;
+    if (stmt) {
+        stmt->tokenStart = static_cast<uint32_t>(start - outer);
+        stmt->tokenCount = static_cast<uint32_t>(current - start);
+    }
+    return stmt;
+}
+
+Stmt* Parser::dispatchStatement() {
+    switch (peek().type) {
+    case KW_ENGINE:
         advance();
         return parseFuncDef();
-    }
-    if (p.type == KEYWORD && p.value == "ignite") {
+    case KW_IGNITE:
         advance();
         return parseIgniteFunc();
-    }
-    if (p.type == KEYWORD && (p.value == "gear" || p.value == "turbo" || p.value == "exhaust" || p.value == "flag")) {
+    case KW_GEAR:
+    case KW_TURBO:
+    case KW_EXHAUST:
+    case KW_FLAG:
         advance();
         return parseVarDecl();
-    }
-    if (p.type == KEYWORD && p.value == "looplap") {
+    case KW_LOOPLAP:
         advance();
         return parseLoopStmt();
-    }
-    if (p.type == KEYWORD && p.value == "announce") {
+    case KW_ANNOUNCE:
         advance();
         return parseAnnounceStmt();
-    }
-    if (p.type == KEYWORD && p.value == "finishline") {
+    case KW_FINISHLINE:
         advance();
         return parseFinishlineStmt();
-    }
-    if (p.type == KEYWORD && p.value == "track") {
+    case KW_TRACK:
         advance();
         return parseIfStmt();
-    }
-    if (p.type == KEYWORD && p.value == "listen") {
+    case KW_LISTEN:
         advance();
         return parseListenStmt();
-    }
-    if (check(SYMBOL) && peek().value == "{") {
+    case SYM_LEFT_BRACE:
         return parseBlock();
+    default:
+        return parseExprStatement();
     }
-    return parseExprStatement();
 }
 
-shared_ptr<Stmt> Parser::parseFuncDef() {
-    Token name = consume(IDENTIFIER, "Expect function name after 'engine'.");
-    Token open = consume(SYMBOL, "Expect '(' after function name.");
-    if (open.value != "(") throw runtime_error("Expect '(' after function name.");
-    Token close = consume(SYMBOL, "Expect ')' after function name.");
-    if (close.value != ")") throw runtime_error("Expect ')' after function name.");
+Stmt* Parser::parseFuncDef() {
+    if (!consume(IDENTIFIER, "Expect function name after 'engine'.")) return nullptr;
+    Token name = previous();
+    if (!consume(SYM_LEFT_PAREN, "Expect '(' after function name.")) return nullptr;
+    if (!consume(SYM_RIGHT_PAREN, "Expect ')' after function name.")) return nullptr;
     auto body = parseBlock();
-    return make_shared<FuncDefStmt>(name, body);
+    if (!body) return nullptr;
+    return nodes.make<FuncDefStmt>(name.symbol, name.line, body);
 }
 
-shared_ptr<Stmt> Parser::parseIgniteFunc() {
+Stmt* Parser::parseIgniteFunc() {
     // ignite() has no arguments, and its name is literally "ignite"
-    Token open = consume(SYMBOL, "Expect '(' after 'ignite'.");
-    if (open.value != "(") throw runtime_error("Expect '(' after 'ignite'.");
-    Token close = consume(SYMBOL, "Expect ')' after 'ignite'.");
-    if (close.value != ")") throw runtime_error("Expect ')' after 'ignite'.");
-
-    // Construct a fake identifier token named "ignite"
-    Token igniteName;
-    igniteName.type = IDENTIFIER;
-    igniteName.value = "ignite";
-    igniteName.line = open.line;
+    if (!consume(SYM_LEFT_PAREN, "Expect '(' after 'ignite'.")) return nullptr;
+    int line = previous().line;
+    if (!consume(SYM_RIGHT_PAREN, "Expect ')' after 'ignite'.")) return nullptr;
 
+    // The function's name is the keyword itself
     auto body = parseBlock();
-    return make_shared<FuncDefStmt>(igniteName, body);
+    if (!body) return nullptr;
+    return nodes.make<FuncDefStmt>(igniteName, line, body);
 }
 
-shared_ptr<Stmt> Parser::parseVarDecl() {
-    Token typeToken = previous();
-    Token name = consume(IDENTIFIER, "Expect variable name.");
-    shared_ptr<Expr> initializer = nullptr;
+Stmt* Parser::parseVarDecl() {
+    TokenType type = previous().type;
+    if (!consume(IDENTIFIER, "Expect variable name.")) return nullptr;
+    Token name = previous();
+    Expr* initializer = nullptr;
 
-    if (check(OPERATOR) && peek().value == "=") {
-        advance();
+    if (match(OP_ASSIGN)) {
         initializer = parseExpression();
+        if (!initializer) return nullptr;
     }
 
-    Token semi = consume(SYMBOL, "Expect ';' after variable.");
-    if (semi.value != ";") throw runtime_error("Expect ';' after variable.");
-    return make_shared<VarDeclStmt>(typeToken, name, initializer);
+    if (!consume(SYM_SEMICOLON, "Expect ';' after variable.")) return nullptr;
+    return nodes.make<VarDeclStmt>(type, name.symbol, name.line, initializer);
 }
 
-shared_ptr<Stmt> Parser::parseLoopStmt() {
-    Token open = consume(SYMBOL, "Expect '(' after 'looplap'.");
-    if (open.value != "(") throw runtime_error("Expect '(' after 'looplap'.");
+Stmt* Parser::parseLoopStmt() {
+    if (!consume(SYM_LEFT_PAREN, "Expect '(' after 'looplap'.")) return nullptr;
     auto condition = parseExpression();
-    Token close = consume(SYMBOL, "Expect ')' after condition.");
-    if (close.value != ")") throw runtime_error("Expect ')' after condition.");
+    if (!condition) return nullptr;
+    if (!consume(SYM_RIGHT_PAREN, "Expect ')' after condition.")) return nullptr;
     auto body = parseStatement();
-    return make_shared<LoopStmt>(condition, body);
+    if (!body) return nullptr;
+    return nodes.make<LoopStmt>(condition, body);
 }
 
-shared_ptr<Stmt> Parser::parseAnnounceStmt() {
+Stmt* Parser::parseAnnounceStmt() {
     auto value = parseExpression();
-    Token semi = consume(SYMBOL, "Expect ';' after announce.");
-    if (semi.value != ";") throw runtime_error("Expect ';' after announce.");
-    return make_shared<AnnounceStmt>(value);
+    if (!value) return nullptr;
+    if (!consume(SYM_SEMICOLON, "Expect ';' after announce.")) return nullptr;
+    return nodes.make<AnnounceStmt>(value);
 }
 
-shared_ptr<Stmt> Parser::parseFinishlineStmt() {
+Stmt* Parser::parseFinishlineStmt() {
     auto value = parseExpression();
-    Token semi = consume(SYMBOL, "Expect ';' after finishline.");
-    if (semi.value != ";") throw runtime_error("Expect ';' after finishline.");
-    return make_shared<FinishlineStmt>(value);
+    if (!value) return nullptr;
+    if (!consume(SYM_SEMICOLON, "Expect ';' after finishline.")) return nullptr;
+    return nodes.make<FinishlineStmt>(value);
 }
 
-shared_ptr<Stmt> Parser::parseListenStmt() {
-    Token name = consume(IDENTIFIER, "Expect variable name after 'listen'.");
-    Token semi = consume(SYMBOL, "Expect ';' after listen.");
-    if (semi.value != ";") throw runtime_error("Expect ';' after listen.");
-    return make_shared<ListenStmt>(name);
+Stmt* Parser::parseListenStmt() {
+    if (!consume(IDENTIFIER, "Expect variable name after 'listen'.")) return nullptr;
+    Token name = previous();
+    if (!consume(SYM_SEMICOLON, "Expect ';' after listen.")) return nullptr;
+    return nodes.make<ListenStmt>(name.symbol, name.line);
 }
 
-shared_ptr<Stmt> Parser::parseIfStmt() {
-    Token open = consume(SYMBOL, "Expect '(' after 'track'.");
-    if (open.value != "(") throw runtime_error("Expect '(' after 'track'.");
+Stmt* Parser::parseIfStmt() {
+    if (!consume(SYM_LEFT_PAREN, "Expect '(' after 'track'.")) return nullptr;
     auto condition = parseExpression();
-    Token close = consume(SYMBOL, "Expect ')' after condition.");
-    if (close.value != ")") throw runtime_error("Expect ')' after condition.");
+    if (!condition) return nullptr;
+    if (!consume(SYM_RIGHT_PAREN, "Expect ')' after condition.")) return nullptr;
     auto thenBranch = parseStatement();
+    if (!thenBranch) return nullptr;
 
-    shared_ptr<Stmt> elseBranch = nullptr;
-    if (peek().type == KEYWORD && peek().value == "pitstop") {
-        advance();
+    Stmt* elseBranch = nullptr;
+    if (match(KW_PITSTOP)) {
         elseBranch = parseStatement();
+        if (!elseBranch) return nullptr;
     }
-    return make_shared<IfStmt>(condition, thenBranch, elseBranch);
+    return nodes.make<IfStmt>(condition, thenBranch, elseBranch);
 }
 
-shared_ptr<Stmt> Parser::parseBlock() {
-    Token open = consume(SYMBOL, "Expect '{' to start block.");
-    if (open.value != "{") throw runtime_error("Expect '{' to start block.");
+Stmt* Parser::parseBlock() {
+    return parseRanged(&Parser::parseBlockBody);
+}
 
-    vector<shared_ptr<Stmt>> statements;
-    while (!(check(SYMBOL) && peek().value == "}")) {
-        if (isAtEnd()) throw runtime_error("Unterminated block. Missing '}'.");
-        statements.push_back(parseStatement());
+Stmt* Parser::parseBlockBody() {
+    if (!consume(SYM_LEFT_BRACE, "Expect '{' to start block.")) return nullptr;
+
+    // Nested blocks push onto the same scratch stack, then copy their own
+    // slice into the arena and pop it. A statement that fails is skipped,
+    // so the block keeps the ones around it.
+    size_t mark = blockScratch.size();
+    blockDepth++;
+    while (!check(SYM_RIGHT_BRACE) && !isAtEnd() && !diagnostics->full()) {
+        size_t start = current;
+        if (Stmt* stmt = parseStatement()) blockScratch.push_back(stmt);
+        else synchronize(start);
     }
+    blockDepth--;
 
-    Token close = consume(SYMBOL, "Expect '}' after block.");
-    if (close.value != "}") throw runtime_error("Expect '}' after block.");
-    return make_shared<BlockStmt>(statements);
+    if (!match(SYM_RIGHT_BRACE))
+        error(DIAG_UNTERMINATED_BLOCK, "Unterminated block. Missing '}'.");
+    auto statements = nodes.list(blockScratch.data() + mark, blockScratch.size() - mark);
+    blockScratch.resize(mark);
+    return nodes.make<BlockStmt>(statements);
 }
 
-shared_ptr<Stmt> Parser::parseExprStatement() {
+Stmt* Parser::parseExprStatement() {
     auto expr = parseExpression();
-    Token semi = consume(SYMBOL, "Expect ';' after expression.");
-    if (semi.value != ";") throw runtime_error("Expect ';' after expression.");
-    return make_shared<ExprStmt>(expr);
+    if (!expr) return nullptr;
+    if (!consume(SYM_SEMICOLON, "Expect ';' after expression.")) return nullptr;
+    return nodes.make<ExprStmt>(expr);
 }
 
 /////////////////////// EXPRESSIONS ///////////////////////
 
-shared_ptr<Expr> Parser::parseExpression() {
-    return parseAssignment();
+namespace {
+
+// Binding power of each token kind when it follows an operand.
+struct InfixTable {
+    uint8_t precedence[TOKEN_TYPE_COUNT];
+};
+
+constexpr InfixTable makeInfixTable() {
+    InfixTable t{};
+    t.precedence[OP_ASSIGN] = PREC_ASSIGNMENT;
+    t.precedence[OP_EQUAL] = PREC_EQUALITY;
+    t.precedence[OP_NOT_EQUAL] = PREC_EQUALITY;
+    t.precedence[OP_LESS] = PREC_COMPARISON;
+    t.precedence[OP_GREATER] = PREC_COMPARISON;
+    t.precedence[OP_LESS_EQUAL] = PREC_COMPARISON;
+    t.precedence[OP_GREATER_EQUAL] = PREC_COMPARISON;
+    t.precedence[OP_PLUS] = PREC_TERM;
+    t.precedence[OP_MINUS] = PREC_TERM;
+    t.precedence[OP_STAR] = PREC_FACTOR;
+    t.precedence[OP_SLASH] = PREC_FACTOR;
+    return t;
 }
 
-shared_ptr<Expr> Parser::parseAssignment() {
-    auto expr = parseComparison();
+constexpr InfixTable infixTable = makeInfixTable();
 
-    if (check(OPERATOR) && peek().value == "=") {
-        advance(); // consume '='
-        auto value = parseAssignment();
-        auto var = dynamic_pointer_cast<VariableExpr>(expr);
-        if (var) return make_shared<AssignExpr>(var->name, value);
-        throw runtime_error("Invalid assignment target.");
-    }
-    return expr;
-}
+} // namespace
+
+// Precedence climbing: after each operand, keep taking operators that bind
+// at least as tightly as minPrecedence. The right operand of a
+// left-associative operator only takes tighter operators; '=' is
+// right-associative and takes its own level again.
+Expr* Parser::parseExpression(Precedence minPrecedence) {
+    Expr* expr = parsePrimary();
+    if (!expr) return nullptr;
 
-shared_ptr<Expr> Parser::parseComparison() {
-    auto expr = parseTerm();
+    for (;;) {
+        TokenType kind = peek().type;
+        auto prec = static_cast<Precedence>(infixTable.precedence[kind]);
+        if (prec == PREC_NONE || prec < minPrecedence) break;
 
-    while (check(OPERATOR)) {
-        string v = peek().value;
-        if (v == "<" || v == ">" || v == "<=" || v == ">=") {
+        if (kind == OP_ASSIGN) {
+            // A bad target is reported but needs no recovery: the rest
+            // still parses, and the assignment is dropped.
+            auto var = expr->kind == EXPR_VARIABLE ? static_cast<VariableExpr*>(expr) : nullptr;
+            if (!var) error(DIAG_INVALID_ASSIGNMENT, "Invalid assignment target.");
+            advance();
+            auto value = parseExpression(PREC_ASSIGNMENT);
+            if (!value) return nullptr;
+            if (var) expr = nodes.make<AssignExpr>(var->name, var->line, value);
+        }
+        else {
             Token op = advance();
-            auto right = parseTerm();
-            expr = make_shared<BinaryExpr>(expr, op, right);
+            auto right = parseExpression(static_cast<Precedence>(prec + 1));
+            if (!right) return nullptr;
+            expr = sharing ? exprPool.binary(nodes, expr, kind, op.line, right)
+                           : nodes.make<BinaryExpr>(expr, kind, op.line, right);
         }
-        else break;
-    }
-    return expr;
-}
-
-shared_ptr<Expr> Parser::parseTerm() {
-    auto expr = parseFactor();
-
-    while (check(OPERATOR) && (peek().value == "+" || peek().value == "-")) {
-        Token op = advance();
-        auto right = parseFactor();
-        expr = make_shared<BinaryExpr>(expr, op, right);
-    }
-    return expr;
-}
-
-shared_ptr<Expr> Parser::parseFactor() {
-    auto expr = parsePrimary();
-
-    while (check(OPERATOR) && (peek().value == "*" || peek().value == "/")) {
-        Token op = advance();
-        auto right = parsePrimary();
-        expr = make_shared<BinaryExpr>(expr, op, right);
     }
     return expr;
 }
 
-shared_ptr<Expr> Parser::parsePrimary() {
-    if (match({ NUMBER, STRING, BOOLEAN })) {
-        return make_shared<LiteralExpr>(previous());
-    }
-    if (match({ IDENTIFIER })) {
-        return make_shared<VariableExpr>(previous());
-    }
-    if (match({ SYMBOL }) && previous().value == "(") {
+Expr* Parser::parsePrimary() {
+    Token t = peek();
+    switch (t.type) {
+    case INTEGER:
+    case DECIMAL:
+    case STRING:
+    case BOOLEAN:
+        advance();
+        if (sharing) return exprPool.literal(nodes, t.literal, t.line);
+        return nodes.make<LiteralExpr>(t.literal, t.line);
+    case IDENTIFIER:
+        advance();
+        if (sharing) return exprPool.variable(nodes, t.symbol, t.line);
+        return nodes.make<VariableExpr>(t.symbol, t.line);
+    case SYM_LEFT_PAREN: {
+        advance();
         auto expr = parseExpression();
-        Token close = consume(SYMBOL, "Expect ')'.");
-        if (close.value != ")") throw runtime_error("Expect ')'.");
+        if (!expr) return nullptr;
+        if (!consume(SYM_RIGHT_PAREN, "Expect ')'.")) return nullptr;
         return expr;
     }
-    throw runtime_error("Expect expression.");
+    default:
+        error(DIAG_EXPECTED_EXPRESSION, "Expect expression.");
+        return nullptr;
+    }
 }
 
 /////////////////// HELPERS ///////////////////
 
 bool Parser::isAtEnd() {
-    return peek().type == END_OF_FILE;
+    if (tokens) return current >= endToken || tokens->type(current) == END_OF_FILE;
+    return lexer->peek().type == END_OF_FILE;
 }
 
 Token Parser::peek() {
-    return tokens[current];
+    if (tokens) return (*tokens)[current];
+    return lexer->peek();
 }
 
 Token Parser::previous() {
-    return tokens[current - 1];
+    return prev;
 }
 
 Token Parser::advance() {
-    if (!isAtEnd()) current++;
+    if (!isAtEnd()) {
+        prev = tokens ? (*tokens)[current] : lexer->next();
+        current++;
+    }
     return previous();
 }
 
 bool Parser::check(TokenType type) {
     if (isAtEnd()) return false;
-    return peek().type == type;
+    if (tokens) return tokens->type(current) == type;
+    return lexer->peek().type == type;
 }
 
-bool Parser::match(const vector<TokenType>& types) {
-    for (auto t : types) {
-        if (check(t)) {
-            advance();
-            return true;
-        }
-    }
+bool Parser::match(TokenType type) {
+    if (!check(type)) return false;
+    advance();
+    return true;
+}
+
+bool Parser::consume(TokenType type, const char* message) {
+    if (match(type)) return true;
+    error(DIAG_EXPECTED_TOKEN, message);
     return false;
 }
 
-Token Parser::consume(TokenType type, const string& message) {
-    if (check(type)) return advance();
-    throw runtime_error(message + " At line: " + to_string(peek().line));
+void Parser::error(DiagCode code, const char* message) {
+    if (errorTokens) errorTokens->push_back(current);
+    int column = tokens ? columnAt(tokens->source().data(), tokens->rawStart(current)) : lexer->column();
+    diagnostics->report(peek().line, column, code, message);
 }
 
-void Parser::synchronize() {
-    advance();
+// Skips the rest of a statement that failed to parse: through the next
+// ';', or up to the '}' that closes the enclosing block or the next
+// keyword that starts a statement. Braces opened along the way are
+// skipped whole. Always moves past 'start', the statement's first token.
+void Parser::synchronize(size_t start) {
+    int depth = 0;
     while (!isAtEnd()) {
-        if (previous().type == SYMBOL && previous().value == ";") return;
-
-        if (peek().type == KEYWORD) {
-            if (peek().value == "engine" || peek().value == "ignite" || peek().value == "gear" ||
-                peek().value == "looplap" || peek().value == "finishline")
-                return;
+        switch (peek().type) {
+        case SYM_LEFT_BRACE:
+            depth++;
+            break;
+        case SYM_RIGHT_BRACE:
+            if (depth > 0) {
+                depth--;
+                break;
+            }
+            if (blockDepth > 0 && current > start) return;
+            advance(); // A stray '}' at the top level
+            return;
+        case SYM_SEMICOLON:
+            if (depth > 0) break;
+            advance();
+            return;
+        case KW_ENGINE:
+        case KW_IGNITE:
+        case KW_GEAR:
+        case KW_TURBO:
+        case KW_EXHAUST:
+        case KW_FLAG:
+        case KW_ANNOUNCE:
+        case KW_LISTEN:
+        case KW_TRACK:
+        case KW_LOOPLAP:
+        case KW_FINISHLINE:
+            if (depth == 0 && current > start) return;
+            break;
+        default:
+            break;
         }
         advance();
     }
@@ -1,13 +1,18 @@
 #pragma once
 
 #include "scanner.h"
+#include "ast_arena.h"
+#include "expr_pool.h"
+#include "literal.h"
+#include <cstdint>
 #include <vector>
 #include <string>
-#include <memory>
 
 using std::vector;
 using std::string;
-using std::shared_ptr;
+
+class ThreadPool;
+class IncrementalParser;
 
 // Forward declare AST node types
 struct BinaryExpr;
@@ -26,207 +31,332 @@ struct IfStmt;
 struct ListenStmt;
 
 // ----------------------
-// Visitor Interfaces
+// Node kinds
 // ----------------------
-template <typename R>
-struct ExprVisitor {
-    virtual ~ExprVisitor() = default;
-    virtual R visit(shared_ptr<BinaryExpr> expr) = 0;
-    virtual R visit(shared_ptr<LiteralExpr> expr) = 0;
-    virtual R visit(shared_ptr<VariableExpr> expr) = 0;
-    virtual R visit(shared_ptr<AssignExpr> expr) = 0;
+// Every node records its concrete type, so that accept() can dispatch with
+// a switch instead of a virtual call (see "Dispatch" below).
+enum ExprKind : uint8_t {
+    EXPR_BINARY,
+    EXPR_LITERAL,
+    EXPR_VARIABLE,
+    EXPR_ASSIGN
 };
 
-template <typename R>
-struct StmtVisitor {
-    virtual ~StmtVisitor() = default;
-    virtual R visit(shared_ptr<AnnounceStmt> stmt) = 0;
-    virtual R visit(shared_ptr<VarDeclStmt> stmt) = 0;
-    virtual R visit(shared_ptr<BlockStmt> stmt) = 0;
-    virtual R visit(shared_ptr<LoopStmt> stmt) = 0;
-    virtual R visit(shared_ptr<FinishlineStmt> stmt) = 0;
-    virtual R visit(shared_ptr<FuncDefStmt> stmt) = 0;
-    virtual R visit(shared_ptr<ExprStmt> stmt) = 0;
-    virtual R visit(shared_ptr<IfStmt> stmt) = 0;
-    virtual R visit(shared_ptr<ListenStmt> stmt) = 0;
+enum StmtKind : uint8_t {
+    STMT_EXPR,
+    STMT_ANNOUNCE,
+    STMT_VAR_DECL,
+    STMT_BLOCK,
+    STMT_LOOP,
+    STMT_FINISHLINE,
+    STMT_FUNC_DEF,
+    STMT_IF,
+    STMT_LISTEN
 };
 
 // ----------------------
 // Base AST classes
 // ----------------------
+// Nodes live in an AstArena and are never deleted on their own, so the
+// bases have no virtual destructor and every node is trivially destructible.
+//
+// A visitor is any class with a visit() overload for each expression node
+// type (to visit expressions) or each statement node type (to visit
+// statements), all returning the same type: string, int64_t, void, ...
+// node.accept(visitor) calls the overload for the node's kind. A visitor
+// that keeps its visit() overloads private befriends Expr and Stmt.
 struct Expr {
-    virtual ~Expr() = default;
-    virtual string accept(ExprVisitor<string>& visitor) = 0;
+    ExprKind kind;
+
+    // How the AST interpreter runs the node, which it rewrites once it has
+    // seen the node's operand types; 0 until the interpreter runs it (see
+    // ast_interpreter.h).
+    uint8_t spec = 0;
+
+    // The node's static type, set by TypeChecker (see type_checker.h);
+    // TYPE_ERROR until then, or if the node has a type error.
+    ValueType type = TYPE_ERROR;
+
+    // Of a VariableExpr or AssignExpr: the frame slot of its variable, set
+    // by ScopeResolver (see scope_resolver.h). The AST interpreter keeps
+    // the index of a text literal here.
+    uint32_t slot = 0;
+
+    template <typename Visitor>
+    decltype(auto) accept(Visitor&& visitor);
+protected:
+    explicit Expr(ExprKind k) : kind(k) {}
+    ~Expr() = default;
 };
 
 struct Stmt {
-    virtual ~Stmt() = default;
-    virtual string accept(StmtVisitor<string>& visitor) = 0;
+    StmtKind kind;
+
+    // Where the statement's tokens are: tokenCount tokens, starting
+    // tokenStart tokens after the first token of the statement it is part
+    // of (or at index tokenStart, for a top-level statement). Being
+    // relative, they stay correct when tokens before the parent shift.
+    uint32_t tokenStart = 0;
+    uint32_t tokenCount = 0;
+
+    // Structural hash of the statement and everything under it, or 0 if
+    // not computed yet (see structural_hash.h).
+    uint64_t hash = 0;
+
+    template <typename Visitor>
+    decltype(auto) accept(Visitor&& visitor);
+protected:
+    explicit Stmt(StmtKind k) : kind(k) {}
+    ~Stmt() = default;
 };
 
 // ----------------------
 // Expression Nodes
 // ----------------------
-struct BinaryExpr : Expr, public std::enable_shared_from_this<BinaryExpr> {
-    shared_ptr<Expr> left;
-    Token op;
-    shared_ptr<Expr> right;
+struct BinaryExpr : Expr {
+    Expr* left;
+    TokenType op; // One of the OP_ kinds
+    int line;     // Of the operator
+    Expr* right;
 
-    BinaryExpr(shared_ptr<Expr> l, Token o, shared_ptr<Expr> r)
-        : left(l), op(o), right(r) {
-    }
-    string accept(ExprVisitor<string>& visitor) override {
-        return visitor.visit(shared_from_this());
+    BinaryExpr(Expr* l, TokenType o, int ln, Expr* r)
+        : Expr(EXPR_BINARY), left(l), op(o), line(ln), right(r) {
     }
 };
 
-struct LiteralExpr : Expr, public std::enable_shared_from_this<LiteralExpr> {
-    Token value;
-    LiteralExpr(Token v) : value(v) {}
-    string accept(ExprVisitor<string>& visitor) override {
-        return visitor.visit(shared_from_this());
-    }
+struct LiteralExpr : Expr {
+    LiteralValue value; // Decoded by the scanner
+    int line;
+    LiteralExpr(LiteralValue v, int l) : Expr(EXPR_LITERAL), value(v), line(l) {}
 };
 
-struct VariableExpr : Expr, public std::enable_shared_from_this<VariableExpr> {
-    Token name;
-    VariableExpr(Token n) : name(n) {}
-    string accept(ExprVisitor<string>& visitor) override {
-        return visitor.visit(shared_from_this());
-    }
+struct VariableExpr : Expr {
+    Symbol name;
+    int line;
+    VariableExpr(Symbol n, int l) : Expr(EXPR_VARIABLE), name(n), line(l) {}
 };
 
-struct AssignExpr : Expr, public std::enable_shared_from_this<AssignExpr> {
-    Token name;
-    shared_ptr<Expr> value;
-    AssignExpr(Token n, shared_ptr<Expr> v) : name(n), value(v) {}
-    string accept(ExprVisitor<string>& visitor) override {
-        return visitor.visit(shared_from_this());
-    }
+struct AssignExpr : Expr {
+    Symbol name;
+    int line;
+    Expr* value;
+    AssignExpr(Symbol n, int l, Expr* v) : Expr(EXPR_ASSIGN), name(n), line(l), value(v) {}
 };
 
 // ----------------------
 // Statement Nodes
 // ----------------------
-struct ExprStmt : Stmt, public std::enable_shared_from_this<ExprStmt> {
-    shared_ptr<Expr> expression;
-    ExprStmt(shared_ptr<Expr> e) : expression(e) {}
-    string accept(StmtVisitor<string>& visitor) override {
-        return visitor.visit(shared_from_this());
-    }
+struct ExprStmt : Stmt {
+    Expr* expression;
+    ExprStmt(Expr* e) : Stmt(STMT_EXPR), expression(e) {}
 };
 
-struct AnnounceStmt : Stmt, public std::enable_shared_from_this<AnnounceStmt> {
-    shared_ptr<Expr> expression;
-    AnnounceStmt(shared_ptr<Expr> e) : expression(e) {}
-    string accept(StmtVisitor<string>& visitor) override {
-        return visitor.visit(shared_from_this());
-    }
+struct AnnounceStmt : Stmt {
+    Expr* expression;
+    AnnounceStmt(Expr* e) : Stmt(STMT_ANNOUNCE), expression(e) {}
 };
 
-struct VarDeclStmt : Stmt, public std::enable_shared_from_this<VarDeclStmt> {
-    Token typeToken;
-    Token name;
-    shared_ptr<Expr> initializer;
-    VarDeclStmt(Token t, Token n, shared_ptr<Expr> init)
-        : typeToken(t), name(n), initializer(init) {
-    }
-    string accept(StmtVisitor<string>& visitor) override {
-        return visitor.visit(shared_from_this());
+struct VarDeclStmt : Stmt {
+    TokenType type; // KW_GEAR, KW_TURBO, KW_EXHAUST or KW_FLAG
+    Symbol name;
+    int line;
+    Expr* initializer;
+    uint32_t slot = 0; // Frame slot, set by ScopeResolver
+    VarDeclStmt(TokenType t, Symbol n, int l, Expr* init)
+        : Stmt(STMT_VAR_DECL), type(t), name(n), line(l), initializer(init) {
     }
 };
 
-struct BlockStmt : Stmt, public std::enable_shared_from_this<BlockStmt> {
-    vector<shared_ptr<Stmt>> statements;
-    BlockStmt(vector<shared_ptr<Stmt>> s) : statements(s) {}
-    string accept(StmtVisitor<string>& visitor) override {
-        return visitor.visit(shared_from_this());
-    }
+struct BlockStmt : Stmt {
+    ArenaList<Stmt*> statements;
+    BlockStmt(ArenaList<Stmt*> s) : Stmt(STMT_BLOCK), statements(s) {}
 };
 
-struct LoopStmt : Stmt, public std::enable_shared_from_this<LoopStmt> {
-    shared_ptr<Expr> condition;
-    shared_ptr<Stmt> body;
-    LoopStmt(shared_ptr<Expr> c, shared_ptr<Stmt> b) : condition(c), body(b) {}
-    string accept(StmtVisitor<string>& visitor) override {
-        return visitor.visit(shared_from_this());
-    }
+struct LoopStmt : Stmt {
+    Expr* condition;
+    Stmt* body;
+    LoopStmt(Expr* c, Stmt* b) : Stmt(STMT_LOOP), condition(c), body(b) {}
 };
 
-struct FinishlineStmt : Stmt, public std::enable_shared_from_this<FinishlineStmt> {
-    shared_ptr<Expr> value;
-    FinishlineStmt(shared_ptr<Expr> v) : value(v) {}
-    string accept(StmtVisitor<string>& visitor) override {
-        return visitor.visit(shared_from_this());
-    }
+struct FinishlineStmt : Stmt {
+    Expr* value;
+    FinishlineStmt(Expr* v) : Stmt(STMT_FINISHLINE), value(v) {}
 };
 
-struct FuncDefStmt : Stmt, public std::enable_shared_from_this<FuncDefStmt> {
-    Token name;
-    shared_ptr<Stmt> body;
-    FuncDefStmt(Token n, shared_ptr<Stmt> b) : name(n), body(b) {}
-    string accept(StmtVisitor<string>& visitor) override {
-        return visitor.visit(shared_from_this());
+struct FuncDefStmt : Stmt {
+    Symbol name;
+    int line;
+    Stmt* body;
+    uint32_t frameSize = 0; // Slots its variables need, set by ScopeResolver
+    FuncDefStmt(Symbol n, int l, Stmt* b) : Stmt(STMT_FUNC_DEF), name(n), line(l), body(b) {}
+};
+
+struct IfStmt : Stmt {
+    Expr* condition;
+    Stmt* thenBranch;
+    Stmt* elseBranch;
+    IfStmt(Expr* c, Stmt* t, Stmt* e)
+        : Stmt(STMT_IF), condition(c), thenBranch(t), elseBranch(e) {
     }
 };
 
-struct IfStmt : Stmt, public std::enable_shared_from_this<IfStmt> {
-    shared_ptr<Expr> condition;
-    shared_ptr<Stmt> thenBranch;
-    shared_ptr<Stmt> elseBranch;
-    IfStmt(shared_ptr<Expr> c, shared_ptr<Stmt> t, shared_ptr<Stmt> e)
-        : condition(c), thenBranch(t), elseBranch(e) {
+struct ListenStmt : Stmt {
+    Symbol name;
+    int line;
+    uint32_t slot = 0; // Frame slot of the variable, set by ScopeResolver
+    ListenStmt(Symbol n, int l) : Stmt(STMT_LISTEN), name(n), line(l) {}
+};
+
+// ----------------------
+// Dispatch
+// ----------------------
+// One switch on the kind tag: a single indirect jump, and the visitor's
+// overload can be inlined. The last kind is handled after the switch so
+// that every path returns.
+template <typename Visitor>
+decltype(auto) Expr::accept(Visitor&& visitor) {
+    switch (kind) {
+    case EXPR_BINARY:   return visitor.visit(static_cast<BinaryExpr&>(*this));
+    case EXPR_LITERAL:  return visitor.visit(static_cast<LiteralExpr&>(*this));
+    case EXPR_VARIABLE: return visitor.visit(static_cast<VariableExpr&>(*this));
+    case EXPR_ASSIGN:   break;
     }
-    string accept(StmtVisitor<string>& visitor) override {
-        return visitor.visit(shared_from_this());
+    return visitor.visit(static_cast<AssignExpr&>(*this));
+}
+
+template <typename Visitor>
+decltype(auto) Stmt::accept(Visitor&& visitor) {
+    switch (kind) {
+    case STMT_EXPR:       return visitor.visit(static_cast<ExprStmt&>(*this));
+    case STMT_ANNOUNCE:   return visitor.visit(static_cast<AnnounceStmt&>(*this));
+    case STMT_VAR_DECL:   return visitor.visit(static_cast<VarDeclStmt&>(*this));
+    case STMT_BLOCK:      return visitor.visit(static_cast<BlockStmt&>(*this));
+    case STMT_LOOP:       return visitor.visit(static_cast<LoopStmt&>(*this));
+    case STMT_FINISHLINE: return visitor.visit(static_cast<FinishlineStmt&>(*this));
+    case STMT_FUNC_DEF:   return visitor.visit(static_cast<FuncDefStmt&>(*this));
+    case STMT_IF:         return visitor.visit(static_cast<IfStmt&>(*this));
+    case STMT_LISTEN:     break;
     }
+    return visitor.visit(static_cast<ListenStmt&>(*this));
+}
+
+// ----------------------
+// Parse result
+// ----------------------
+// The statements of a program together with the arena that owns their
+// nodes. Moving it keeps the nodes where they are; dropping it frees the
+// whole tree at once.
+struct ParseResult {
+    AstArena arena;
+    vector<Stmt*> statements;
 };
 
-struct ListenStmt : Stmt, public std::enable_shared_from_this<ListenStmt> {
-    Token name;
-    ListenStmt(Token n) : name(n) {}
-    string accept(StmtVisitor<string>& visitor) override {
-        return visitor.visit(shared_from_this());
-    }
+// ----------------------
+// Operator precedence
+// ----------------------
+// Binding power of the binary operators, lowest first. parseExpression
+// looks each operator kind up in a table of these (see parser.cpp), so a
+// new operator is one table entry.
+enum Precedence {
+    PREC_NONE,       // Not a binary operator: ends the expression
+    PREC_ASSIGNMENT, // =  (right-associative)
+    PREC_EQUALITY,   // == !=
+    PREC_COMPARISON, // < > <= >=
+    PREC_TERM,       // + -
+    PREC_FACTOR      // * /
 };
 
 // ----------------------
 // Parser Class
 // ----------------------
+// The parser reads either a whole TokenStream or pulls tokens from a Lexer
+// one at a time. It borrows its source (and through it, the source text);
+// both must outlive the parser. Names in the AST are Symbols of ctx.
+//
+// Syntax errors do not throw. They are added to ctx.diagnostics, the
+// parse functions return nullptr, and the nearest enclosing block (or the
+// top level) skips to the next statement and carries on. Parsing stops
+// early once the diagnostics' error limit is reached.
 class Parser {
 public:
-    Parser(const vector<Token>& tokens);
-    vector<shared_ptr<Stmt>> parse();
+    Parser(const TokenStream& tokens, CompilationContext& ctx);
+    Parser(TokenStream&&, CompilationContext&) = delete;
+    Parser(Lexer& lexer, CompilationContext& ctx);
+    ParseResult parse();
+
+    // Same result and diagnostics as parse(), but the top-level functions
+    // are parsed in parallel on 'pool'. A quick pass over the token kinds
+    // cuts the stream at each 'engine' and 'ignite' outside braces; the
+    // pieces are parsed as separate tasks and joined in source order.
+    // Falls back to parse() for a Lexer or once parseNext() has been used.
+    // No task but the last gets fewer than 'minTaskTokens' tokens: below
+    // MIN_TASK_TOKENS a task costs more to hand out than to parse. Tests
+    // lower it so that small inputs are cut too.
+    static constexpr size_t MIN_TASK_TOKENS = 4096;
+    ParseResult parseParallel(ThreadPool& pool, size_t minTaskTokens = MIN_TASK_TOKENS);
+
+    // Parses one top-level statement, skipping over (and reporting) any
+    // that fail. Returns nullptr at the end of the input, or once the
+    // error limit is reached. With a Lexer this
+    // lets a caller handle each statement before the rest is even scanned.
+    // The nodes belong to arena() until parse() hands it over.
+    Stmt* parseNext();
+    AstArena& arena() { return nodes; }
+
+    // Builds identical side-effect-free subexpressions only once and
+    // shares them (see ExprPool); off by default. Within a parseParallel()
+    // each worker shares among its own functions. A shared node has the
+    // line of its first occurrence. Only for trees that are printed or
+    // cached: ScopeResolver, TypeChecker, AstInterpreter and AstOptimizer
+    // keep per-use state in expression nodes (slot, type, spec) or edit
+    // them in place, and so need every use to be its own node.
+    void shareExpressions(bool on) { sharing = on; }
 
 private:
-    vector<Token> tokens;
-    int current = 0;
-
-    shared_ptr<Stmt> parseStatement();
-    shared_ptr<Stmt> parseFuncDef();
-    shared_ptr<Stmt> parseIgniteFunc(); // add if your .cpp defines it
-    shared_ptr<Stmt> parseVarDecl();
-    shared_ptr<Stmt> parseLoopStmt();
-    shared_ptr<Stmt> parseAnnounceStmt();
-    shared_ptr<Stmt> parseFinishlineStmt();
-    shared_ptr<Stmt> parseExprStatement();
-    shared_ptr<Stmt> parseBlock();
-    shared_ptr<Stmt> parseIfStmt();
-    shared_ptr<Stmt> parseListenStmt();
-
-    shared_ptr<Expr> parseExpression();
-    shared_ptr<Expr> parseAssignment();
-    shared_ptr<Expr> parseComparison();
-    shared_ptr<Expr> parseTerm();
-    shared_ptr<Expr> parseFactor();
-    shared_ptr<Expr> parsePrimary();
+    friend class IncrementalParser; // Restarts the parser inside a tree
+
+    CompilationContext& ctx;
+    const TokenStream* tokens = nullptr; // One of these two is set
+    Lexer* lexer = nullptr;
+    Diagnostics* diagnostics; // ctx.diagnostics, or a parallel task's own list
+    Symbol igniteName;
+    size_t current = 0;    // Number of tokens consumed
+    size_t endToken = SIZE_MAX; // Parallel tasks stop at this token index
+    size_t enclosingStart = 0;  // First token of the statement being parsed
+    vector<size_t>* errorTokens = nullptr; // If set, gets the token index of each error
+    Token prev{ UNKNOWN, "", 0, NO_SYMBOL, {} };
+    AstArena nodes;
+    bool sharing = false;
+    ExprPool exprPool;          // Nodes in 'nodes', when sharing
+    vector<Stmt*> blockScratch; // Statements of the blocks being parsed
+    int blockDepth = 0;         // Blocks open around the current statement
+
+    Stmt* parseStatement();
+    Stmt* parseRanged(Stmt* (Parser::*parse)());
+    Stmt* dispatchStatement();
+    Stmt* parseFuncDef();
+    Stmt* parseIgniteFunc(); // add if your .cpp defines it
+    Stmt* parseVarDecl();
+    Stmt* parseLoopStmt();
+    Stmt* parseAnnounceStmt();
+    Stmt* parseFinishlineStmt();
+    Stmt* parseExprStatement();
+    Stmt* parseBlock();
+    Stmt* parseBlockBody();
+    Stmt* parseIfStmt();
+    Stmt* parseListenStmt();
+
+    // Parses operators that bind at least as tightly as 'minPrecedence'.
+    Expr* parseExpression(Precedence minPrecedence = PREC_ASSIGNMENT);
+    Expr* parsePrimary();
 
     bool isAtEnd();
-    Token peek();    // Implementations should guard against out-of-range
+    Token peek();     // Tokens are views: returning them copies no text
     Token previous(); // Implementations should guard against current == 0
     Token advance();
     bool check(TokenType type);
-    bool match(const vector<TokenType>& types);
-    Token consume(TokenType type, const string& message);
-    void synchronize();
+    bool match(TokenType type);
+    bool consume(TokenType type, const char* message); // Reports if 'type' is not next
+    void error(DiagCode code, const char* message);    // Reports at the next token
+    void synchronize(size_t start);
 };
@@ -0,0 +1,352 @@
+#include "scan_kernels.h"
+
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define AUTOSPEED_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang only emit AVX2 instructions inside functions marked for it;
+// MSVC accepts the intrinsics anywhere.
+#if defined(AUTOSPEED_X86) && (defined(__GNUC__) || defined(__clang__))
+#define TARGET_AVX2 __attribute__((target("avx2,popcnt")))
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#else
+#define TARGET_AVX2
+#define TARGET_SSE2
+#endif
+
+namespace {
+
+inline bool isSpaceByte(uint8_t c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+inline bool isDigitByte(uint8_t c) { return c >= '0' && c <= '9'; }
+inline bool isWordByte(uint8_t c) {
+    uint8_t lower = c | 0x20;
+    return (lower >= 'a' && lower <= 'z') || isDigitByte(c) || c == '_' || c == '#';
+}
+
+/*
+ * Scalar kernels
+ * The reference behaviour. The SIMD kernels hand their last partial
+ * block to these.
+ */
+const char* skipSpaceScalar(const char* p, const char* end, int* lines) {
+    while (p < end && isSpaceByte((uint8_t)*p)) {
+        if (*p == '\n') ++*lines;
+        p++;
+    }
+    return p;
+}
+
+const char* skipWordScalar(const char* p, const char* end) {
+    while (p < end && isWordByte((uint8_t)*p)) p++;
+    return p;
+}
+
+const char* skipDigitsScalar(const char* p, const char* end) {
+    while (p < end && isDigitByte((uint8_t)*p)) p++;
+    return p;
+}
+
+// Consumes one special byte of a string body: a newline or the start of a
+// multi-byte UTF-8 sequence. p must not point at the closing quote.
+inline const char* stepStringByte(const char* p, const char* end, int* lines, bool* badUtf8) {
+    uint8_t c = (uint8_t)*p;
+    if (c < 0x80) {
+        if (c == '\n') ++*lines;
+        return p + 1;
+    }
+    size_t len = utf8SequenceLength(p, end);
+    if (len == 0) {
+        *badUtf8 = true;
+        return p + 1;
+    }
+    return p + len;
+}
+
+const char* findQuoteScalar(const char* p, const char* end, int* lines, bool* badUtf8) {
+    while (p < end && *p != '"') p = stepStringByte(p, end, lines, badUtf8);
+    return p;
+}
+
+inline int countTrailingZeros(uint32_t x) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long i;
+    _BitScanForward(&i, x);
+    return (int)i;
+#else
+    return __builtin_ctz(x);
+#endif
+}
+
+inline int popCount(uint32_t x) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    // __popcnt needs the POPCNT instruction, which SSE2 does not imply.
+    x = x - ((x >> 1) & 0x55555555u);
+    x = (x & 0x33333333u) + ((x >> 2) & 0x33333333u);
+    return (int)((((x + (x >> 4)) & 0x0F0F0F0Fu) * 0x01010101u) >> 24);
+#else
+    return __builtin_popcount(x);
+#endif
+}
+
+#ifdef AUTOSPEED_X86
+
+// Most runs in real code are short (one space, a five-letter name), and
+// for those a vector load costs more than it saves. The SIMD kernels
+// therefore look at this many bytes one at a time before going wide.
+constexpr int SCALAR_PREFIX = 4;
+
+/*
+ * SSE2 kernels (16 bytes per step)
+ * Each builds a bitmask of the bytes that belong to the run and stops at
+ * the first zero bit.
+ */
+TARGET_SSE2 inline uint32_t spaceMask16(__m128i v) {
+    // ' ' or '\t'..'\r'; the unsigned range check is done as a signed one
+    // after shifting '\t'..'\r' down to the bottom of the signed range.
+    __m128i shifted = _mm_sub_epi8(v, _mm_set1_epi8((char)('\t' + 128)));
+    __m128i ctrl = _mm_cmplt_epi8(shifted, _mm_set1_epi8((char)(-128 + 5)));
+    __m128i space = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+    return (uint32_t)_mm_movemask_epi8(_mm_or_si128(ctrl, space));
+}
+
+TARGET_SSE2 inline uint32_t digitMask16(__m128i v) {
+    __m128i shifted = _mm_sub_epi8(v, _mm_set1_epi8((char)('0' + 128)));
+    return (uint32_t)_mm_movemask_epi8(_mm_cmplt_epi8(shifted, _mm_set1_epi8((char)(-128 + 10))));
+}
+
+TARGET_SSE2 inline uint32_t wordMask16(__m128i v) {
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    __m128i shifted = _mm_sub_epi8(lower, _mm_set1_epi8((char)('a' + 128)));
+    __m128i alpha = _mm_cmplt_epi8(shifted, _mm_set1_epi8((char)(-128 + 26)));
+    __m128i extra = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('_')),
+                                 _mm_cmpeq_epi8(v, _mm_set1_epi8('#')));
+    return (uint32_t)_mm_movemask_epi8(_mm_or_si128(alpha, extra)) | digitMask16(v);
+}
+
+TARGET_SSE2 const char* skipSpaceSse2(const char* p, const char* end, int* lines) {
+    for (int k = 0; k < SCALAR_PREFIX; k++, p++) {
+        if (p == end || !isSpaceByte((uint8_t)*p)) return p;
+        if (*p == '\n') ++*lines;
+    }
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        uint32_t stop = ~spaceMask16(v) & 0xFFFF;
+        uint32_t nl = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+        if (stop) {
+            int k = countTrailingZeros(stop);
+            *lines += popCount(nl & ((1u << k) - 1));
+            return p + k;
+        }
+        *lines += popCount(nl);
+        p += 16;
+    }
+    return skipSpaceScalar(p, end, lines);
+}
+
+TARGET_SSE2 const char* skipWordSse2(const char* p, const char* end) {
+    for (int k = 0; k < SCALAR_PREFIX; k++, p++)
+        if (p == end || !isWordByte((uint8_t)*p)) return p;
+    while (end - p >= 16) {
+        uint32_t stop = ~wordMask16(_mm_loadu_si128((const __m128i*)p)) & 0xFFFF;
+        if (stop) return p + countTrailingZeros(stop);
+        p += 16;
+    }
+    return skipWordScalar(p, end);
+}
+
+TARGET_SSE2 const char* skipDigitsSse2(const char* p, const char* end) {
+    for (int k = 0; k < SCALAR_PREFIX; k++, p++)
+        if (p == end || !isDigitByte((uint8_t)*p)) return p;
+    while (end - p >= 16) {
+        uint32_t stop = ~digitMask16(_mm_loadu_si128((const __m128i*)p)) & 0xFFFF;
+        if (stop) return p + countTrailingZeros(stop);
+        p += 16;
+    }
+    return skipDigitsScalar(p, end);
+}
+
+TARGET_SSE2 const char* findQuoteSse2(const char* p, const char* end, int* lines, bool* badUtf8) {
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        // Stop at the quote or at any non-ASCII byte (which needs validating).
+        uint32_t stop = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')))
+                      | (uint32_t)_mm_movemask_epi8(v);
+        uint32_t nl = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+        if (!stop) {
+            *lines += popCount(nl);
+            p += 16;
+            continue;
+        }
+        int k = countTrailingZeros(stop);
+        *lines += popCount(nl & ((1u << k) - 1));
+        p += k;
+        if (*p == '"') return p;
+        p = stepStringByte(p, end, lines, badUtf8);
+    }
+    return findQuoteScalar(p, end, lines, badUtf8);
+}
+
+/*
+ * AVX2 kernels (32 bytes per step)
+ * Same logic as SSE2 with twice the width.
+ */
+TARGET_AVX2 inline uint32_t digitMask32(__m256i v) {
+    __m256i shifted = _mm256_sub_epi8(v, _mm256_set1_epi8((char)('0' + 128)));
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(_mm256_set1_epi8((char)(-128 + 10)), shifted));
+}
+
+TARGET_AVX2 inline uint32_t spaceMask32(__m256i v) {
+    __m256i shifted = _mm256_sub_epi8(v, _mm256_set1_epi8((char)('\t' + 128)));
+    __m256i ctrl = _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(-128 + 5)), shifted);
+    __m256i space = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+    return (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(ctrl, space));
+}
+
+TARGET_AVX2 inline uint32_t wordMask32(__m256i v) {
+    __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    __m256i shifted = _mm256_sub_epi8(lower, _mm256_set1_epi8((char)('a' + 128)));
+    __m256i alpha = _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(-128 + 26)), shifted);
+    __m256i extra = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')),
+                                    _mm256_cmpeq_epi8(v, _mm256_set1_epi8('#')));
+    return (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(alpha, extra)) | digitMask32(v);
+}
+
+TARGET_AVX2 const char* skipSpaceAvx2(const char* p, const char* end, int* lines) {
+    for (int k = 0; k < SCALAR_PREFIX; k++, p++) {
+        if (p == end || !isSpaceByte((uint8_t)*p)) return p;
+        if (*p == '\n') ++*lines;
+    }
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        uint32_t stop = ~spaceMask32(v);
+        uint32_t nl = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+        if (stop) {
+            int k = countTrailingZeros(stop);
+            *lines += popCount(nl & ((1u << k) - 1));
+            return p + k;
+        }
+        *lines += popCount(nl);
+        p += 32;
+    }
+    return skipSpaceSse2(p, end, lines);
+}
+
+TARGET_AVX2 const char* skipWordAvx2(const char* p, const char* end) {
+    for (int k = 0; k < SCALAR_PREFIX; k++, p++)
+        if (p == end || !isWordByte((uint8_t)*p)) return p;
+    while (end - p >= 32) {
+        uint32_t stop = ~wordMask32(_mm256_loadu_si256((const __m256i*)p));
+        if (stop) return p + countTrailingZeros(stop);
+        p += 32;
+    }
+    return skipWordSse2(p, end);
+}
+
+TARGET_AVX2 const char* skipDigitsAvx2(const char* p, const char* end) {
+    for (int k = 0; k < SCALAR_PREFIX; k++, p++)
+        if (p == end || !isDigitByte((uint8_t)*p)) return p;
+    while (end - p >= 32) {
+        uint32_t stop = ~digitMask32(_mm256_loadu_si256((const __m256i*)p));
+        if (stop) return p + countTrailingZeros(stop);
+        p += 32;
+    }
+    return skipDigitsSse2(p, end);
+}
+
+TARGET_AVX2 const char* findQuoteAvx2(const char* p, const char* end, int* lines, bool* badUtf8) {
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        uint32_t stop = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')))
+                      | (uint32_t)_mm256_movemask_epi8(v);
+        uint32_t nl = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+        if (!stop) {
+            *lines += popCount(nl);
+            p += 32;
+            continue;
+        }
+        int k = countTrailingZeros(stop);
+        *lines += popCount(nl & ((1u << k) - 1));
+        p += k;
+        if (*p == '"') return p;
+        p = stepStringByte(p, end, lines, badUtf8);
+    }
+    return findQuoteSse2(p, end, lines, badUtf8);
+}
+
+bool cpuHasAvx2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+#endif
+}
+
+#endif // AUTOSPEED_X86
+
+} // namespace
+
+size_t utf8SequenceLength(const char* p, const char* end) {
+    const uint8_t* s = (const uint8_t*)p;
+    size_t avail = (size_t)(end - p);
+    uint8_t c = s[0];
+    size_t len;
+    uint8_t lo = 0x80, hi = 0xBF; // Allowed range of the second byte
+
+    if (c >= 0xC2 && c <= 0xDF) len = 2;
+    else if (c >= 0xE0 && c <= 0xEF) {
+        len = 3;
+        if (c == 0xE0) lo = 0xA0;      // Overlong
+        else if (c == 0xED) hi = 0x9F; // Surrogates
+    }
+    else if (c >= 0xF0 && c <= 0xF4) {
+        len = 4;
+        if (c == 0xF0) lo = 0x90;      // Overlong
+        else if (c == 0xF4) hi = 0x8F; // Above U+10FFFF
+    }
+    else return 0;
+
+    if (avail < len) return 0;
+    if (s[1] < lo || s[1] > hi) return 0;
+    for (size_t k = 2; k < len; k++)
+        if ((s[k] & 0xC0) != 0x80) return 0;
+    return len;
+}
+
+const ScanKernels& scalarScanKernels() {
+    static const ScanKernels k = { "scalar", skipSpaceScalar, skipWordScalar, skipDigitsScalar, findQuoteScalar };
+    return k;
+}
+
+const ScanKernels* sse2ScanKernels() {
+#ifdef AUTOSPEED_X86
+    static const ScanKernels k = { "sse2", skipSpaceSse2, skipWordSse2, skipDigitsSse2, findQuoteSse2 };
+    return &k;
+#else
+    return nullptr;
+#endif
+}
+
+const ScanKernels* avx2ScanKernels() {
+#ifdef AUTOSPEED_X86
+    static const ScanKernels k = { "avx2", skipSpaceAvx2, skipWordAvx2, skipDigitsAvx2, findQuoteAvx2 };
+    static const bool supported = cpuHasAvx2();
+    return supported ? &k : nullptr;
+#else
+    return nullptr;
+#endif
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+
+// --- Scanner kernels ---
+// The hot inner loops of the scanner, in a scalar version and in
+// SSE2/AVX2 versions that look at 16/32 bytes at a time.
+// All versions return exactly the same results; the fastest one the CPU
+// supports is picked at run time (see setScanKernel in scanner.h).
+
+/*
+ * ScanKernels
+ * A table of the run-finding functions the scanner calls.
+ * Every function takes [p, end) and returns the first byte NOT in the run.
+ */
+struct ScanKernels {
+    const char* name;
+
+    // Skips ' ', \t, \n, \v, \f, \r. Adds the number of '\n' skipped to *lines.
+    const char* (*skipSpace)(const char* p, const char* end, int* lines);
+
+    // Skips identifier bytes: a-z A-Z 0-9 _ #
+    const char* (*skipWord)(const char* p, const char* end);
+
+    // Skips digits 0-9
+    const char* (*skipDigits)(const char* p, const char* end);
+
+    // Finds the closing '"' of a string body that starts at p (or end if
+    // there is none). Adds newlines in the body to *lines and validates the
+    // body as UTF-8, setting *badUtf8 if any sequence is malformed.
+    const char* (*findQuote)(const char* p, const char* end, int* lines, bool* badUtf8);
+};
+
+/*
+ * utf8SequenceLength
+ * Length (2-4) of the well-formed UTF-8 sequence starting at p, whose first
+ * byte is >= 0x80. Returns 0 for a malformed, overlong, surrogate or
+ * out-of-range sequence.
+ */
+size_t utf8SequenceLength(const char* p, const char* end);
+
+const ScanKernels& scalarScanKernels();
+const ScanKernels* sse2ScanKernels(); // nullptr when not built for x86
+const ScanKernels* avx2ScanKernels(); // nullptr when not built for x86 or the CPU lacks AVX2
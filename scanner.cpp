@@ -1,150 +1,710 @@
 #include "scanner.h" // Include our own header file
+#include "scan_kernels.h"
 
-#include <iostream>
 #include <string>
+#include <string_view>
 #include <vector>
-#include <unordered_set>
-#include <cctype>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
 
 // Use 'using namespace std' in the .cpp file, but not the .h file
 // This keeps the global namespace clean for the user.
 using namespace std;
 
 // --- "Private" Library Data ---
-// These are not visible to main.cpp
-
-unordered_set<string> keywords = {
-    "ignite", "engine",
-    "gear", "turbo", "exhaust", "flag",
-    "announce", "listen",
-    "track", "pitstop", "looplap", "overtake", "finishline",
-    "key", "#oil", "#car"
+// These are not visible to main.cpp.
+// Everything here is built at compile time: there is no global mutable
+// state, no locale lookup and no hashing of heap strings while scanning.
+namespace {
+
+/*
+ * CharClass
+ * What a byte can start. The scanner switches on this once per token.
+ */
+enum CharClass : uint8_t {
+    CC_OTHER,      // Anything not listed below (reported as unknown)
+    CC_SPACE,      // ' ', \t, \r, \v, \f
+    CC_NEWLINE,    // '\n'
+    CC_QUOTE,      // '"'
+    CC_WORD,       // a-z, A-Z and '#' (for #oil / #car)
+    CC_DIGIT,      // 0-9
+    CC_OPERATOR,   // + - * / = < > !
+    CC_SYMBOL,     // { } ( ) ;
+    CC_UTF8        // 0x80-0xFF: start (or stray part) of a multi-byte character
+};
+
+// Extra per-byte properties. (Identifier, number and string runs are
+// found by the kernels in scan_kernels.cpp.)
+enum CharFlag : uint8_t {
+    CF_EQ_PAIR = 1 // Operator that combines with a following '=' (==, !=, <=, >=)
+};
+
+/*
+ * The one list of operator and symbol spellings. The character tables and
+ * tokenSpelling are both generated from it.
+ */
+struct Punctuation {
+    string_view text;
+    TokenType type;
+};
+
+constexpr Punctuation punctuation[] = {
+    { "+", OP_PLUS }, { "-", OP_MINUS }, { "*", OP_STAR }, { "/", OP_SLASH },
+    { "=", OP_ASSIGN }, { "<", OP_LESS }, { ">", OP_GREATER },
+    { "==", OP_EQUAL }, { "!=", OP_NOT_EQUAL }, { "<=", OP_LESS_EQUAL }, { ">=", OP_GREATER_EQUAL },
+    { "{", SYM_LEFT_BRACE }, { "}", SYM_RIGHT_BRACE }, { "(", SYM_LEFT_PAREN }, { ")", SYM_RIGHT_PAREN },
+    { ";", SYM_SEMICOLON }
+};
+
+struct CharTables {
+    uint8_t cls[256];
+    uint8_t flags[256];
+    uint8_t single[256]; // Kind of the one-byte operator or symbol (UNKNOWN for a lone '!')
+    uint8_t paired[256]; // Kind of the byte followed by '=', for CF_EQ_PAIR bytes
+};
+
+constexpr CharTables makeCharTables() {
+    CharTables t{};
+    for (int c = 'a'; c <= 'z'; c++) t.cls[c] = CC_WORD;
+    for (int c = 'A'; c <= 'Z'; c++) t.cls[c] = CC_WORD;
+    for (int c = '0'; c <= '9'; c++) t.cls[c] = CC_DIGIT;
+    t.cls['#'] = CC_WORD; // '_' may continue a word but not start one
+    for (char c : { ' ', '\t', '\r', '\v', '\f' }) t.cls[(uint8_t)c] = CC_SPACE;
+    t.cls['\n'] = CC_NEWLINE;
+    t.cls['"'] = CC_QUOTE;
+    for (int c = 0x80; c <= 0xFF; c++) t.cls[c] = CC_UTF8;
+    for (auto& s : t.single) s = UNKNOWN;
+    for (const Punctuation& p : punctuation) {
+        uint8_t c = (uint8_t)p.text[0];
+        t.cls[c] = isSymbol(p.type) ? CC_SYMBOL : CC_OPERATOR;
+        if (p.text.size() == 2) {
+            t.flags[c] |= CF_EQ_PAIR;
+            t.paired[c] = p.type;
+        }
+        else {
+            t.single[c] = p.type;
+        }
+    }
+    return t;
+}
+
+constexpr CharTables charTables = makeCharTables();
+
+inline uint8_t charClass(char c) { return charTables.cls[(uint8_t)c]; }
+inline bool hasFlag(char c, CharFlag f) { return (charTables.flags[(uint8_t)c] & f) != 0; }
+
+/*
+ * The one list of reserved words. The keyword and boolean classification
+ * and tokenSpelling are generated from it.
+ */
+struct ReservedWord {
+    string_view text;
+    TokenType type;
+};
+
+constexpr ReservedWord reservedWords[] = {
+    { "ignite", KW_IGNITE }, { "engine", KW_ENGINE },
+    { "gear", KW_GEAR }, { "turbo", KW_TURBO }, { "exhaust", KW_EXHAUST }, { "flag", KW_FLAG },
+    { "announce", KW_ANNOUNCE }, { "listen", KW_LISTEN },
+    { "track", KW_TRACK }, { "pitstop", KW_PITSTOP }, { "looplap", KW_LOOPLAP },
+    { "overtake", KW_OVERTAKE }, { "finishline", KW_FINISHLINE },
+    { "key", KW_KEY }, { "#oil", KW_OIL }, { "#car", KW_CAR },
+    { "true", BOOLEAN }, { "false", BOOLEAN }
+};
+
+constexpr size_t RESERVED_COUNT = sizeof(reservedWords) / sizeof(reservedWords[0]);
+constexpr uint32_t RESERVED_TABLE_SIZE = 64; // Power of two
+
+/*
+ * Perfect hash over the reserved words: length, first and last byte.
+ * The multiplier is searched for at compile time so that no two
+ * reserved words share a slot.
+ */
+constexpr uint32_t reservedHash(uint32_t seed, const char* s, size_t len) {
+    return ((uint8_t)s[0] * seed + (uint8_t)s[len - 1] + (uint32_t)len * 7) & (RESERVED_TABLE_SIZE - 1);
+}
+
+constexpr uint32_t findReservedSeed() {
+    for (uint32_t seed = 1; seed < 10000; seed++) {
+        bool used[RESERVED_TABLE_SIZE] = {};
+        bool ok = true;
+        for (size_t k = 0; k < RESERVED_COUNT && ok; k++) {
+            uint32_t h = reservedHash(seed, reservedWords[k].text.data(), reservedWords[k].text.size());
+            if (used[h]) ok = false;
+            used[h] = true;
+        }
+        if (ok) return seed;
+    }
+    return 0;
+}
+
+constexpr uint32_t RESERVED_SEED = findReservedSeed();
+static_assert(RESERVED_SEED != 0, "No perfect hash seed for the reserved words");
+
+struct ReservedTable {
+    int8_t slot[RESERVED_TABLE_SIZE]; // Index into reservedWords, or -1
+};
+
+constexpr ReservedTable makeReservedTable() {
+    ReservedTable t{};
+    for (auto& s : t.slot) s = -1;
+    for (size_t k = 0; k < RESERVED_COUNT; k++)
+        t.slot[reservedHash(RESERVED_SEED, reservedWords[k].text.data(), reservedWords[k].text.size())] = (int8_t)k;
+    return t;
+}
+
+constexpr ReservedTable reservedTable = makeReservedTable();
+
+// Kind -> fixed spelling, for tokenSpelling.
+struct SpellingTable {
+    string_view text[TOKEN_TYPE_COUNT];
 };
 
-unordered_set<string> booleans = { "true", "false" };
-unordered_set<char> operators = { '+', '-', '*', '/', '=', '<', '>' };
-unordered_set<char> symbols = { '{', '}', '(', ')', ';' };
+constexpr SpellingTable makeSpellingTable() {
+    SpellingTable t{};
+    for (const ReservedWord& w : reservedWords)
+        if (w.type != BOOLEAN) t.text[w.type] = w.text;
+    for (const Punctuation& p : punctuation) t.text[p.type] = p.text;
+    return t;
+}
+
+constexpr SpellingTable spellingTable = makeSpellingTable();
+
+// One hash, at most one compare.
+inline TokenType classifyWord(const char* s, size_t len) {
+    int k = reservedTable.slot[reservedHash(RESERVED_SEED, s, len)];
+    if (k >= 0 && reservedWords[k].text == string_view(s, len))
+        return reservedWords[k].type;
+    return IDENTIFIER;
+}
+
+// Payload column -> LiteralValue, by token kind.
+LiteralValue literalFromPayload(TokenType type, uint64_t payload) {
+    switch (type) {
+    case INTEGER: return LiteralValue::ofInt(static_cast<int64_t>(payload));
+    case DECIMAL: {
+        double d;
+        memcpy(&d, &payload, sizeof d);
+        return LiteralValue::ofDouble(d);
+    }
+    case BOOLEAN: return LiteralValue::ofBool(payload != 0);
+    case STRING:  return LiteralValue::ofString(static_cast<Symbol>(payload));
+    default:      return LiteralValue();
+    }
+}
+
+const ScanKernels* widestKernels() {
+    if (auto* k = avx2ScanKernels()) return k;
+    if (auto* k = sse2ScanKernels()) return k;
+    return &scalarScanKernels();
+}
+
+// The one piece of run-time configuration: which kernel table scan() uses.
+std::atomic<const ScanKernels*> activeKernels{ widestKernels() };
+
+} // namespace
 // ---
 
+bool setScanKernel(ScanKernel kernel) {
+    const ScanKernels* k = nullptr;
+    switch (kernel) {
+    case SCAN_AUTO:   k = widestKernels(); break;
+    case SCAN_SCALAR: k = &scalarScanKernels(); break;
+    case SCAN_SSE2:   k = sse2ScanKernels(); break;
+    case SCAN_AVX2:   k = avx2ScanKernels(); break;
+    }
+    if (!k) return false;
+    activeKernels.store(k, std::memory_order_relaxed);
+    return true;
+}
+
+const char* scanKernelName() {
+    return activeKernels.load(std::memory_order_relaxed)->name;
+}
+
 /*
- * Implementation of the scan function
+ * TokenStream members
  */
-vector<Token> scan(const string& code) {
-    vector<Token> tok;
-    int i = 0;
-    int line = 1; // Start at line 1
+std::string_view TokenStream::text(size_t i) const {
+    if (kinds[i] == END_OF_FILE) return "EOF";
+    return std::string_view(src->data() + offsets[i], lengths[i]);
+}
 
-    while (i < code.size()) {
-        // 1. Skip Whitespace
-        if (isspace(code[i])) {
-            if (code[i] == '\n') line++; // Increment line counter
-            i++;
-            continue;
+void TokenStream::reserve(size_t n) {
+    kinds.reserve(n);
+    offsets.reserve(n);
+    lengths.reserve(n);
+    lines.reserve(n);
+    payloads.reserve(n);
+}
+
+void TokenStream::push(TokenType type, size_t offset, size_t length, int line, uint64_t payload) {
+    kinds.push_back(static_cast<uint8_t>(type));
+    offsets.push_back(static_cast<uint32_t>(offset));
+    lengths.push_back(static_cast<uint32_t>(length));
+    lines.push_back(line);
+    payloads.push_back(payload);
+}
+
+Symbol TokenStream::symbol(size_t i) const {
+    TokenType t = type(i);
+    return (t == IDENTIFIER || t == STRING) ? static_cast<Symbol>(payloads[i]) : NO_SYMBOL;
+}
+
+LiteralValue TokenStream::literal(size_t i) const {
+    return literalFromPayload(type(i), payloads[i]);
+}
+
+namespace {
+
+/*
+ * scanToken
+ * The scanner proper, shared by scan() and Lexer.
+ * Skips whitespace from 'pos' and reads one token out of c[0..n).
+ * When 'atEof' is false the buffer may end in the middle of a token; such a
+ * token is not produced. Instead SCAN_NEED_MORE is returned with 'pos' on
+ * its first byte (and 'line' as it was there), so the caller can add input
+ * and retry. Errors are only reported for tokens that are produced; they go
+ * to 'errors' (see ScanErrors).
+ */
+enum ScanResult { SCAN_TOKEN, SCAN_DONE, SCAN_NEED_MORE };
+
+struct RawToken {
+    TokenType type;
+    size_t offset;
+    size_t length;
+    int line;
+    uint64_t payload; // See TokenStream
+};
+
+// Where scanToken reports errors. 'columnBase' is how much of the current
+// line lies before the buffer, for a Lexer that has dropped scanned input.
+struct ScanErrors {
+    Diagnostics& diagnostics;
+    size_t columnBase;
+
+    void report(const char* c, size_t at, int line, DiagCode code, string message) const {
+        diagnostics.report(line, columnAt(c, at, columnBase), code, move(message));
+    }
+};
+
+// Decodes a number token's text into 'out'. Returns false, with 'out' 0,
+// for malformed numbers such as 1.2.3 and ones that do not fit an int64 or
+// a double.
+bool decodeNumber(const char* text, size_t len, bool isDecimal, uint64_t& out, DiagCode& error) {
+    const char* end = text + len;
+    out = 0;
+    if (isDecimal) {
+        double d = 0;
+        auto res = from_chars(text, end, d);
+        if (res.ec == errc::result_out_of_range) {
+            error = DIAG_NUMBER_OUT_OF_RANGE;
+            return false;
+        }
+        if (res.ec != errc() || res.ptr != end) {
+            error = DIAG_MALFORMED_NUMBER;
+            return false;
         }
+        memcpy(&out, &d, sizeof out);
+        return true;
+    }
+    int64_t v = 0;
+    auto res = from_chars(text, end, v);
+    if (res.ec != errc()) {
+        error = DIAG_NUMBER_OUT_OF_RANGE;
+        return false;
+    }
+    out = static_cast<uint64_t>(v);
+    return true;
+}
 
-        // 2. String
-        if (code[i] == '"') {
-            string str;
-            i++; // Consume opening "
-            int startLine = line; // In case string is multi-line
+ScanResult scanToken(const char* c, size_t n, bool atEof, const ScanKernels& k,
+                     size_t& pos, int& line, RawToken& out, const ScanErrors& errors) {
+    size_t i = pos;
 
-            while (i < code.size() && code[i] != '"') {
-                if (code[i] == '\n') line++; // Support multi-line strings
-                str += code[i++];
-            }
+    for (;;) {
+        if (i == n) {
+            pos = i;
+            return atEof ? SCAN_DONE : SCAN_NEED_MORE;
+        }
+        // 1. Skip Whitespace (counting newlines)
+        uint8_t cls = charClass(c[i]);
+        if (cls != CC_SPACE && cls != CC_NEWLINE) break;
+        i = k.skipSpace(c + i, c + n, &line) - c;
+    }
 
-            if (i == code.size()) {
-                cout << "Error [Line " << startLine << "]: Unterminated string!" << endl;
-                break; // Stop scanning
-            }
-            else {
-                tok.push_back({ STRING, str, startLine });
-                i++; // Consume closing "
-            }
+    size_t start = i;
+    pos = i;
+    out.line = line;
+    out.offset = start;
+    out.payload = 0;
+
+    switch (charClass(c[i])) {
+    // 2. String
+    case CC_QUOTE: {
+        int endLine = line; // In case string is multi-line
+        bool badUtf8 = false;
+        i = k.findQuote(c + i + 1, c + n, &endLine, &badUtf8) - c; // Skip opening "
+
+        if (i == n) {
+            if (!atEof) return SCAN_NEED_MORE;
+            errors.report(c, start, line, DIAG_UNTERMINATED_STRING, "Unterminated string!");
+            line = endLine;
+            pos = n;
+            return SCAN_DONE; // Stop scanning
         }
-        // 3. Identifier or Keyword
-        else if (isalpha(code[i]) || code[i] == '#') {
-            string word;
-            while (i < code.size() && (isalnum(code[i]) || code[i] == '#' || code[i] == '_')) {
-                word += code[i++];
-            }
+        if (badUtf8)
+            errors.report(c, start, line, DIAG_INVALID_UTF8, "Invalid UTF-8 in string!");
+        out.type = STRING;
+        out.offset = start + 1;
+        out.length = i - start - 1;
+        line = endLine;
+        pos = i + 1; // Consume closing "
+        return SCAN_TOKEN;
+    }
 
-            if (keywords.count(word))
-                tok.push_back({ KEYWORD, word, line });
-            else if (booleans.count(word))
-                tok.push_back({ BOOLEAN, word, line });
-            else
-                tok.push_back({ IDENTIFIER, word, line });
+    // 3. Identifier or Keyword
+    case CC_WORD:
+        i = k.skipWord(c + i, c + n) - c;
+        if (i == n && !atEof) return SCAN_NEED_MORE;
+        out.type = classifyWord(c + start, i - start);
+        out.payload = (out.type == BOOLEAN && c[start] == 't') ? 1 : 0;
+        break;
+
+    // 4. Number: digits, optionally followed by '.' and more digits.
+    //    Further '.'s are taken too, so 1.2.3 is one (malformed) number.
+    case CC_DIGIT: {
+        int dots = 0;
+        i = k.skipDigits(c + i, c + n) - c;
+        while (i < n && c[i] == '.') {
+            dots++;
+            i = k.skipDigits(c + i + 1, c + n) - c;
         }
-        // 4. Number
-        else if (isdigit(code[i])) {
-            string num;
-            bool hasDecimal = false;
-            while (i < code.size() && (isdigit(code[i]) || code[i] == '.')) {
-                if (code[i] == '.') {
-                    if (hasDecimal) break; // Found a second decimal
-                    hasDecimal = true;
-                }
-                num += code[i++];
-            }
-            tok.push_back({ NUMBER, num, line });
+        if (i == n && !atEof) return SCAN_NEED_MORE;
+        out.type = dots ? DECIMAL : INTEGER;
+        DiagCode error;
+        if (!decodeNumber(c + start, i - start, dots > 0, out.payload, error)) {
+            const char* what = error == DIAG_MALFORMED_NUMBER ? "Malformed number: " : "Number out of range: ";
+            errors.report(c, start, line, error, what + string(c + start, i - start));
         }
-        // 5. Operator
-        else if (code[i] == '+' || code[i] == '-' || code[i] == '*' || code[i] == '/' || code[i] == '=' || code[i] == '<' || code[i] == '>') {
-
-                // Check for two-char operators
-                if (i + 1 < code.length()) {
-                    char n = code[i + 1];
-
-                    if ((code[i] == '=' && n == '=') ||
-                        (code[i] == '<' && n == '=') ||
-                        (code[i] == '>' && n == '=') ||
-                        (code[i] == '!' && n == '=')) {
-
-                        string op;
-                        op += code[i];
-                        op += n;
-                        tok.push_back({ OPERATOR, op, line });
-                        i += 2;
-                        continue;
-                    }
-                }
-
-                // Single char operator
-                tok.push_back({ OPERATOR, string(1, code[i]), line });
-                i++;
-                continue;
-            }
+        break;
+    }
+
+    // 5. Operator (two-char forms: ==, !=, <=, >=)
+    case CC_OPERATOR:
+        if (i + 1 == n && !atEof && hasFlag(c[i], CF_EQ_PAIR)) return SCAN_NEED_MORE;
+        if (i + 1 < n && c[i + 1] == '=' && hasFlag(c[i], CF_EQ_PAIR)) {
+            out.type = static_cast<TokenType>(charTables.paired[(uint8_t)c[i]]);
+            i += 2;
+            break;
+        }
+        out.type = static_cast<TokenType>(charTables.single[(uint8_t)c[i]]);
+        if (out.type == UNKNOWN)
+            errors.report(c, i, line, DIAG_UNKNOWN_CHARACTER, string("Unknown character: ") + c[i]);
+        i++;
+        break;
+
+    // 6. Symbol
+    case CC_SYMBOL:
+        out.type = static_cast<TokenType>(charTables.single[(uint8_t)c[i]]);
+        i++;
+        break;
 
-            
-        // 6. Symbol
-        else if (symbols.count(code[i])) {
-            string sym(1, code[i++]);
-            tok.push_back({ SYMBOL, sym, line });
+    // 7. Non-ASCII outside a string: one unknown token per character
+    case CC_UTF8: {
+        if (n - i < 4 && !atEof) return SCAN_NEED_MORE; // May be a cut-off sequence
+        size_t len = utf8SequenceLength(c + i, c + n);
+        if (len == 0) {
+            errors.report(c, i, line, DIAG_INVALID_UTF8, "Invalid UTF-8 byte!");
+            len = 1;
         }
-        // 7. Unknown
         else {
-            string unknown(1, code[i++]);
-            cout << "Error [Line " << line << "]: Unknown character: " << unknown << endl;
-            tok.push_back({ UNKNOWN, unknown, line });
+            errors.report(c, i, line, DIAG_UNKNOWN_CHARACTER, "Unknown character: " + string(c + i, len));
         }
+        i += len;
+        out.type = UNKNOWN;
+        break;
     }
-    tok.push_back({ END_OF_FILE, "EOF", line });
+
+    // 8. Unknown
+    default:
+        errors.report(c, i, line, DIAG_UNKNOWN_CHARACTER, string("Unknown character: ") + c[i]);
+        i++;
+        out.type = UNKNOWN;
+        break;
+    }
+
+    out.length = i - start;
+    pos = i;
+    return SCAN_TOKEN;
+}
+
+// Interns the text of identifiers and strings as their payload.
+inline void internToken(SymbolTable& symbols, const char* c, RawToken& t) {
+    if (t.type == IDENTIFIER || t.type == STRING)
+        t.payload = symbols.intern(string_view(c + t.offset, t.length));
+}
+
+} // namespace
+
+/*
+ * Implementation of the scan function
+ */
+TokenStream scan(const string& code, CompilationContext& ctx) {
+    TokenStream tok(code, ctx);
+    if (code.size() > MAX_SOURCE_SIZE) {
+        ctx.diagnostics.report(1, 0, DIAG_SOURCE_TOO_LARGE, "Source is larger than 4 GiB.");
+        tok.push(END_OF_FILE, 0, 0, 1);
+        return tok;
+    }
+    tok.reserve(code.size() / 4 + 1); // Rough guess; avoids most regrowth
+    size_t i = 0;
+    int line = 1; // Start at line 1
+
+    const ScanKernels& k = *activeKernels.load(std::memory_order_relaxed);
+    ScanErrors errors{ ctx.diagnostics, 0 };
+    RawToken t;
+    while (scanToken(code.data(), code.size(), true, k, i, line, t, errors) == SCAN_TOKEN) {
+        internToken(ctx.symbols, code.data(), t);
+        tok.push(t.type, t.offset, t.length, t.line, t.payload);
+    }
+
+    tok.push(END_OF_FILE, code.size(), 0, line);
     return tok;
 }
 
+/*
+ * Incremental re-lexing
+ */
+namespace {
+
+// Resizes the slot [first, first + removed) of a column to 'count'
+// entries, moving the tail once. The new slots are left for the caller.
+template <typename T>
+void spliceColumn(vector<T>& column, size_t first, size_t removed, size_t count) {
+    auto at = column.begin() + (ptrdiff_t)(first + std::min(removed, count));
+    if (count > removed) column.insert(at, count - removed, T());
+    else column.erase(at, at + (ptrdiff_t)(removed - count));
+}
+
+} // namespace
+
+RelexResult TokenStream::relex(const string& code, const TextEdit& edit) {
+    size_t oldCount = size();
+    src = &code;
+    if (code.size() > MAX_SOURCE_SIZE) {
+        ctx->diagnostics.report(1, 0, DIAG_SOURCE_TOO_LARGE, "Source is larger than 4 GiB.");
+        kinds.clear(); offsets.clear(); lengths.clear(); lines.clear(); payloads.clear();
+        push(END_OF_FILE, 0, 0, 1);
+        return { 0, oldCount, 1 };
+    }
+    size_t editEnd = edit.offset + edit.inserted; // In new coordinates
+    ptrdiff_t delta = (ptrdiff_t)edit.inserted - (ptrdiff_t)edit.removed;
+
+    // 1. Restart point: tokens ending before the edit are unaffected. (A
+    //    token ending right at it may have been cut short by the byte there.)
+    size_t lo = 0, hi = oldCount - 1; // Never keep END_OF_FILE
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (rawEnd(mid) < edit.offset) lo = mid + 1;
+        else hi = mid;
+    }
+    size_t first = lo;
+    size_t pos = first == 0 ? 0 : rawEnd(first - 1);
+    int line = 1;
+    if (first > 0) {
+        line = lines[first - 1];
+        for (size_t i = rawStart(first - 1); i < pos; i++)
+            if (code[i] == '\n') line++; // Multi-line strings
+    }
+
+    // 2. Scan forward until a new token lines up with an old one.
+    const ScanKernels& k = *activeKernels.load(std::memory_order_relaxed);
+    ScanErrors errors{ ctx->diagnostics, 0 };
+    vector<RawToken> fresh;
+    size_t resume = oldCount; // Old token to resume from, or oldCount for none
+    RawToken t;
+    while (scanToken(code.data(), code.size(), true, k, pos, line, t, errors) == SCAN_TOKEN) {
+        size_t start = t.offset - (t.type == STRING ? 1 : 0);
+        if (start >= editEnd) {
+            size_t oldStart = (size_t)((ptrdiff_t)start - delta);
+            size_t a = first, b = oldCount - 1;
+            while (a < b) {
+                size_t mid = (a + b) / 2;
+                if (rawStart(mid) < oldStart) a = mid + 1;
+                else b = mid;
+            }
+            if (a < oldCount - 1 && rawStart(a) == oldStart) {
+                resume = a;
+                line = t.line; // Line of the old token's new position
+                break;
+            }
+        }
+        internToken(ctx->symbols, code.data(), t);
+        fresh.push_back(t);
+    }
+
+    // 3. Splice the new tokens in and shift the reused tail.
+    size_t removed = resume - first;
+    if (resume == oldCount) {
+        fresh.push_back({ END_OF_FILE, code.size(), 0, line, 0 });
+    }
+    else {
+        int lineDelta = line - lines[resume];
+        if (delta != 0)
+            for (size_t i = resume; i < oldCount; i++) offsets[i] = (uint32_t)((ptrdiff_t)offsets[i] + delta);
+        if (lineDelta != 0)
+            for (size_t i = resume; i < oldCount; i++) lines[i] += lineDelta;
+    }
+
+    spliceColumn(kinds, first, removed, fresh.size());
+    spliceColumn(offsets, first, removed, fresh.size());
+    spliceColumn(lengths, first, removed, fresh.size());
+    spliceColumn(lines, first, removed, fresh.size());
+    spliceColumn(payloads, first, removed, fresh.size());
+    for (size_t i = 0; i < fresh.size(); i++) {
+        kinds[first + i] = static_cast<uint8_t>(fresh[i].type);
+        offsets[first + i] = static_cast<uint32_t>(fresh[i].offset);
+        lengths[first + i] = static_cast<uint32_t>(fresh[i].length);
+        lines[first + i] = fresh[i].line;
+        payloads[first + i] = fresh[i].payload;
+    }
+
+    return { first, removed, fresh.size() };
+}
+
+/*
+ * Lexer members
+ */
+Lexer::Lexer(std::string_view source, CompilationContext& ctx)
+    : symbols(ctx.symbols), diagnostics(ctx.diagnostics),
+      window(source.data()), windowSize(source.size()), atEof(true) {
+}
+
+Lexer::Lexer(std::istream& in, CompilationContext& ctx, size_t chunkSize)
+    : symbols(ctx.symbols), diagnostics(ctx.diagnostics), in(&in), chunkSize(chunkSize ? chunkSize : 1) {
+}
+
+Token Lexer::next() {
+    Token t = peek(0);
+    head = (head + 1) % LOOKAHEAD;
+    buffered--;
+    return t;
+}
+
+Token Lexer::peek(size_t k) {
+    if (k >= LOOKAHEAD) throw out_of_range("Lexer lookahead is limited to " + to_string(LOOKAHEAD) + " tokens.");
+    while (buffered <= k) {
+        size_t slot = (head + buffered) % LOOKAHEAD;
+        ring[slot] = scanNext(ringOffset[slot]);
+        buffered++;
+    }
+    return ring[(head + k) % LOOKAHEAD];
+}
+
+int Lexer::column(size_t k) {
+    peek(k);
+    size_t at = ringOffset[(head + k) % LOOKAHEAD];
+    if (at < windowBase) return 0; // Stream mode has dropped that text
+    return columnAt(window, at - windowBase, columnBase);
+}
+
+Token Lexer::scanNext(size_t& offset) {
+    offset = windowBase + pos;
+    if (finished) return { END_OF_FILE, "EOF", line, NO_SYMBOL, {} };
+
+    const ScanKernels& k = *activeKernels.load(std::memory_order_relaxed);
+    RawToken t;
+    for (;;) {
+        ScanResult r = scanToken(window, windowSize, atEof, k, pos, line, t, ScanErrors{ diagnostics, columnBase });
+        if (r == SCAN_TOKEN) break;
+        if (r == SCAN_DONE) {
+            finished = true;
+            offset = windowBase + pos;
+            return { END_OF_FILE, "EOF", line, NO_SYMBOL, {} };
+        }
+        refill();
+    }
+    offset = windowBase + t.offset - (t.type == STRING ? 1 : 0);
+
+    internToken(symbols, window, t);
+    bool named = t.type == IDENTIFIER || t.type == STRING;
+    string_view text(window + t.offset, t.length);
+    // In stream mode the window is reused, so point at a stable copy of
+    // the text: the interned name, a fixed spelling, or the number pool.
+    if (in) {
+        if (named) text = symbols.name((Symbol)t.payload);
+        else if (t.type == BOOLEAN) text = t.payload ? "true" : "false";
+        else if (!tokenSpelling(t.type).empty()) text = tokenSpelling(t.type);
+        else text = keep(text);
+    }
+    return { t.type, text, t.line, named ? (Symbol)t.payload : NO_SYMBOL, literalFromPayload(t.type, t.payload) };
+}
+
+void Lexer::refill() {
+    // Drop what has been scanned; the token in progress starts at 'pos'.
+    // Remember how much of its line goes with it, for column().
+    size_t lineStart = pos;
+    while (lineStart > 0 && buffer[lineStart - 1] != '\n') lineStart--;
+    columnBase = lineStart > 0 ? pos - lineStart : columnBase + pos;
+    windowBase += pos;
+    buffer.erase(0, pos);
+    pos = 0;
+
+    size_t old = buffer.size();
+    buffer.resize(old + chunkSize);
+    in->read(&buffer[old], static_cast<std::streamsize>(chunkSize));
+    size_t got = static_cast<size_t>(in->gcount());
+    buffer.resize(old + got);
+    if (got == 0) atEof = true;
+
+    window = buffer.data();
+    windowSize = buffer.size();
+}
+
+string_view Lexer::keep(string_view text) {
+    if (text.empty()) return text;
+    char* dst;
+    if (text.size() > POOL_BLOCK / 4) {
+        // Long strings get a block of their own.
+        pool.emplace_back(new char[text.size()]);
+        dst = pool.back().get();
+    }
+    else {
+        if (text.size() > poolLeft) {
+            pool.emplace_back(new char[POOL_BLOCK]);
+            poolNext = pool.back().get();
+            poolLeft = POOL_BLOCK;
+        }
+        dst = poolNext;
+        poolNext += text.size();
+        poolLeft -= text.size();
+    }
+    memcpy(dst, text.data(), text.size());
+    return string_view(dst, text.size());
+}
+
 
 /*
  * Implementation of the helper function
  */
+string_view tokenSpelling(TokenType type) {
+    return type < TOKEN_TYPE_COUNT ? spellingTable.text[type] : string_view();
+}
+
 std::string tokenTypeToString(TokenType type) {
+    if (isKeyword(type))  return "KEYWORD";
+    if (isOperator(type)) return "OPERATOR";
+    if (isSymbol(type))   return "SYMBOL";
     switch (type) {
-    case KEYWORD:     return "KEYWORD";
     case IDENTIFIER:  return "IDENTIFIER";
-    case NUMBER:      return "NUMBER";
+    case INTEGER:     return "INTEGER";
+    case DECIMAL:     return "DECIMAL";
     case STRING:      return "STRING";
-    case OPERATOR:    return "OPERATOR";
-    case SYMBOL:      return "SYMBOL";
     case BOOLEAN:     return "BOOLEAN";
     case END_OF_FILE: return "END_OF_FILE";
     case UNKNOWN:     return "UNKNOWN";
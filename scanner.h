@@ -1,6 +1,13 @@
 #pragma once
 
+#include "compilation_context.h"
+#include "literal.h"
+
+#include <cstdint>
+#include <istream>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
 // --- Public Interface ---
@@ -8,41 +15,286 @@
 
 /*
  * TokenType
- * Defines all the possible categories a token can belong to.
+ * Defines all the possible kinds of token.
+ * Every keyword, operator and symbol has a kind of its own, so the parser
+ * can switch on the kind instead of comparing text. They are grouped in
+ * ranges; see isKeyword / isOperator / isSymbol.
  */
 enum TokenType {
-    KEYWORD,
     IDENTIFIER,
-    NUMBER,
+    INTEGER,  // 95   (gear)
+    DECIMAL,  // 2.01 (turbo)
     STRING,
-    OPERATOR,
-    SYMBOL,
     BOOLEAN,
     END_OF_FILE,
-    UNKNOWN // Added for any character that doesn't match
+    UNKNOWN, // Added for any character that doesn't match
+
+    // Keywords
+    KW_IGNITE,
+    KW_ENGINE,
+    KW_GEAR,
+    KW_TURBO,
+    KW_EXHAUST,
+    KW_FLAG,
+    KW_ANNOUNCE,
+    KW_LISTEN,
+    KW_TRACK,
+    KW_PITSTOP,
+    KW_LOOPLAP,
+    KW_OVERTAKE,
+    KW_FINISHLINE,
+    KW_KEY,
+    KW_OIL, // #oil
+    KW_CAR, // #car
+
+    // Operators
+    OP_PLUS,          // +
+    OP_MINUS,         // -
+    OP_STAR,          // *
+    OP_SLASH,         // /
+    OP_ASSIGN,        // =
+    OP_LESS,          // <
+    OP_GREATER,       // >
+    OP_EQUAL,         // ==
+    OP_NOT_EQUAL,     // !=
+    OP_LESS_EQUAL,    // <=
+    OP_GREATER_EQUAL, // >=
+
+    // Symbols
+    SYM_LEFT_BRACE,   // {
+    SYM_RIGHT_BRACE,  // }
+    SYM_LEFT_PAREN,   // (
+    SYM_RIGHT_PAREN,  // )
+    SYM_SEMICOLON,    // ;
+
+    TOKEN_TYPE_COUNT
 };
 
+constexpr bool isKeyword(TokenType t) { return t >= KW_IGNITE && t <= KW_CAR; }
+constexpr bool isOperator(TokenType t) { return t >= OP_PLUS && t <= OP_GREATER_EQUAL; }
+constexpr bool isSymbol(TokenType t) { return t >= SYM_LEFT_BRACE && t <= SYM_SEMICOLON; }
+
 /*
  * Token
- * A struct to hold the data for a single token.
+ * A lightweight view of a single token.
+ * 'value' points into the scanned source buffer, so copying a Token
+ * never copies characters. Identifiers and strings also carry their
+ * interned Symbol (see CompilationContext::symbols), and literals their
+ * value, decoded once by the scanner.
 */
 struct Token {
     TokenType type;
-    std::string value;
+    std::string_view value;
     int line; // The line number where the token was found
+    Symbol symbol = NO_SYMBOL; // IDENTIFIER and STRING only
+    LiteralValue literal;      // INTEGER, DECIMAL, BOOLEAN and STRING only
+};
+
+/*
+ * TextEdit
+ * A change to a source buffer: 'removed' bytes starting at 'offset' were
+ * replaced by 'inserted' new bytes.
+ */
+struct TextEdit {
+    size_t offset;
+    size_t removed;
+    size_t inserted;
+};
+
+/*
+ * RelexResult
+ * What TokenStream::relex changed: the old tokens [first, first + removed)
+ * were replaced by the new tokens [first, first + inserted). Tokens before
+ * 'first' are untouched; the ones after were only shifted.
+ */
+struct RelexResult {
+    size_t first;
+    size_t removed;
+    size_t inserted;
+};
+
+/*
+ * MAX_SOURCE_SIZE
+ * The longest source a TokenStream can hold: offsets and lengths are
+ * stored in 32 bits. scan() and relex() reject anything longer with
+ * DIAG_SOURCE_TOO_LARGE and leave only END_OF_FILE in the stream.
+ */
+constexpr size_t MAX_SOURCE_SIZE = UINT32_MAX;
+
+/*
+ * TokenStream
+ * The scanner's output, stored as a structure of arrays:
+ * one column each for kind, offset, length and line, plus an 8-byte
+ * payload: the Symbol of an identifier or string, or a literal's value.
+ * The stream borrows the source string it was scanned from;
+ * the caller must keep that string alive (and unchanged) for as long
+ * as the stream, or any Token read from it, is in use.
+ */
+class TokenStream {
+public:
+    TokenStream(const std::string& source, CompilationContext& ctx) : src(&source), ctx(&ctx) {}
+
+    size_t size() const { return kinds.size(); }
+    TokenType type(size_t i) const { return static_cast<TokenType>(kinds[i]); }
+    int line(size_t i) const { return lines[i]; }
+    std::string_view text(size_t i) const;
+    Symbol symbol(size_t i) const;
+    LiteralValue literal(size_t i) const;
+    Token operator[](size_t i) const { return { type(i), text(i), line(i), symbol(i), literal(i) }; }
+    const std::string& source() const { return *src; }
+
+    // Byte range of token i in the source, including a string's quotes.
+    size_t rawStart(size_t i) const { return offsets[i] - (kinds[i] == STRING ? 1 : 0); }
+    size_t rawEnd(size_t i) const { return offsets[i] + lengths[i] + (kinds[i] == STRING ? 1 : 0); }
+
+    void reserve(size_t n);
+    void push(TokenType type, size_t offset, size_t length, int line, uint64_t payload = 0);
+
+    /*
+     * relex
+     * Updates the stream after 'edit' was applied to its source, which now
+     * reads 'code' (the stream borrows 'code' from here on).
+     * Scanning restarts at the end of the last token the edit cannot have
+     * affected, and stops as soon as a new token starts where an old one
+     * did, past the edit: from there on the old tokens are reused with
+     * their offsets and lines shifted. This is exact because the scanner
+     * carries no state between tokens except the line number, so it also
+     * covers edits that open or close a multi-line string. Errors in the
+     * rescanned text are added to the context's diagnostics.
+     */
+    RelexResult relex(const std::string& code, const TextEdit& edit);
+
+private:
+    const std::string* src;
+    CompilationContext* ctx; // Where relex() interns new names and reports errors
+    std::vector<uint8_t> kinds;
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> lengths;
+    std::vector<int> lines;
+    std::vector<uint64_t> payloads;
 };
 
 /*
  * scan
  * The main scanner function.
- * Takes raw code as a string and returns a vector of Tokens.
+ * Takes raw code as a string and returns a TokenStream over it.
+ * Scanning does not allocate per token: every token refers back into 'code'.
+ * Identifier names and string contents are interned into ctx.symbols, and
+ * errors are added to ctx.diagnostics; scanning always continues past them.
  */
-std::vector<Token> scan(const std::string& code);
+TokenStream scan(const std::string& code, CompilationContext& ctx);
+TokenStream scan(std::string&& code, CompilationContext& ctx) = delete; // the stream would dangle
+
 
+/*
+ * Lexer
+ * A pull-based scanner: tokens are produced one at a time, on demand,
+ * instead of all at once like scan(). Only a few tokens of lookahead are
+ * kept, so the full token list is never built.
+ *
+ * Two sources are supported:
+ *  - a buffer the caller keeps alive, typically a memory-mapped file
+ *    (see MappedFile); pages are only read as the lexer reaches them.
+ *    Token values point into the buffer.
+ *  - an input stream (e.g. std::cin), read in chunks. The chunk buffer is
+ *    reused, so identifier and string values point at their interned
+ *    copies instead, and number text is copied into a pool owned by the
+ *    Lexer; keep the Lexer alive while it is in use.
+ */
+class Lexer {
+public:
+    static constexpr size_t LOOKAHEAD = 4;
+
+    Lexer(std::string_view source, CompilationContext& ctx);
+    Lexer(std::istream& in, CompilationContext& ctx, size_t chunkSize = 64 * 1024);
+    Lexer(const Lexer&) = delete;
+    Lexer& operator=(const Lexer&) = delete;
+
+    // Returns the next token and consumes it. After the end of the input,
+    // keeps returning END_OF_FILE.
+    Token next();
+
+    // Returns the token k places ahead without consuming anything.
+    // k must be less than LOOKAHEAD.
+    Token peek(size_t k = 0);
+
+    // The 1-based column of peek(k), or 0 if it is no longer known (stream
+    // mode keeps only the current chunk of long lines). For error messages.
+    int column(size_t k = 0);
+
+private:
+    Token scanNext(size_t& offset);
+    void refill();
+    std::string_view keep(std::string_view text);
+
+    SymbolTable& symbols;
+    Diagnostics& diagnostics;
+
+    // Input
+    const char* window = nullptr; // Bytes currently available to scan
+    size_t windowSize = 0;
+    size_t pos = 0;               // Scan position within the window
+    int line = 1;
+    bool atEof = false;           // No more input beyond the window
+    bool finished = false;        // END_OF_FILE has been produced
+    std::istream* in = nullptr;   // Stream mode only
+    size_t chunkSize = 0;
+    std::string buffer;           // Stream mode window storage
+    size_t windowBase = 0;        // Input offset of window[0]
+    size_t columnBase = 0;        // Bytes of window[0]'s line before it
+
+    // Lookahead ring
+    Token ring[LOOKAHEAD];
+    size_t ringOffset[LOOKAHEAD]; // Input offset of each token, for column()
+    size_t head = 0;
+    size_t buffered = 0;
+
+    // Stable storage for token text in stream mode
+    static constexpr size_t POOL_BLOCK = 64 * 1024;
+    std::vector<std::unique_ptr<char[]>> pool;
+    char* poolNext = nullptr;
+    size_t poolLeft = 0;
+};
+
+/*
+ * ScanKernel
+ * Which implementation of the scanner's inner loops (whitespace, identifier,
+ * number and string runs) to use. SCAN_AUTO, the default, picks the widest
+ * one the CPU supports. All of them produce identical tokens.
+ */
+enum ScanKernel {
+    SCAN_AUTO,
+    SCAN_SCALAR,
+    SCAN_SSE2,  // 16 bytes per step
+    SCAN_AVX2   // 32 bytes per step
+};
+
+/*
+ * setScanKernel
+ * Selects the kernel used by later calls to scan().
+ * Returns false (and changes nothing) if this CPU or build lacks it.
+ */
+bool setScanKernel(ScanKernel kernel);
+
+/*
+ * scanKernelName
+ * Name of the kernel scan() is currently using ("scalar", "sse2" or "avx2").
+ */
+const char* scanKernelName();
+
+
+/*
+ * tokenSpelling
+ * The fixed text of a keyword, operator or symbol kind (e.g. "<=").
+ * Empty for kinds whose text varies.
+ */
+std::string_view tokenSpelling(TokenType type);
 
 /*
  * tokenTypeToString
  * A helper function to get a printable name for a TokenType.
+ * Keywords, operators and symbols print as their group (KEYWORD, OPERATOR,
+ * SYMBOL); the token's text tells them apart.
  */
 std::string tokenTypeToString(TokenType type);
 
@@ -0,0 +1,127 @@
+#include "scope_resolver.h"
+
+#include <string>
+
+using namespace std;
+
+bool ScopeResolver::resolve(const vector<Stmt*>& statements) {
+    bool ok = true;
+    for (Stmt* stmt : statements)
+        if (stmt && stmt->kind == STMT_FUNC_DEF && !resolve(static_cast<FuncDefStmt&>(*stmt))) ok = false;
+    return ok;
+}
+
+bool ScopeResolver::resolve(FuncDefStmt& func) {
+    scope.clear();
+    types.clear();
+    depth = 0;
+    failed = false;
+    statement(func.body);
+    func.frameSize = (uint32_t)types.size();
+    return !failed;
+}
+
+/////////////////////// SCOPES ///////////////////////
+
+const ScopeResolver::Binding* ScopeResolver::find(Symbol name) const {
+    for (auto it = scope.rbegin(); it != scope.rend(); ++it)
+        if (it->name == name) return &*it;
+    return nullptr;
+}
+
+uint32_t ScopeResolver::declare(Symbol name, TokenType type, int line) {
+    const Binding* old = find(name);
+    if (old && old->depth == depth) {
+        failed = true;
+        diagnostics.report(line, 0, DIAG_REDECLARED_NAME,
+                           "Variable '" + string(symbols.name(name)) + "' is already declared in this block.");
+    }
+    uint32_t slot = (uint32_t)types.size();
+    types.push_back(type);
+    scope.push_back({ name, depth, slot });
+    return slot;
+}
+
+bool ScopeResolver::lookup(Symbol name, int line, uint32_t& slot) {
+    const Binding* binding = find(name);
+    if (!binding) {
+        failed = true;
+        diagnostics.report(line, 0, DIAG_UNDEFINED_NAME, "Undefined variable '" + string(symbols.name(name)) + "'.");
+        return false;
+    }
+    slot = binding->slot;
+    return true;
+}
+
+/////////////////////// EXPRESSIONS ///////////////////////
+
+void ScopeResolver::expression(Expr* expr) {
+    if (expr) expr->accept(*this);
+}
+
+void ScopeResolver::visit(BinaryExpr& expr) {
+    expression(expr.left);
+    expression(expr.right);
+}
+
+void ScopeResolver::visit(LiteralExpr&) {}
+
+void ScopeResolver::visit(VariableExpr& expr) {
+    lookup(expr.name, expr.line, expr.slot);
+}
+
+// The compiler looks the variable up before its value.
+void ScopeResolver::visit(AssignExpr& expr) {
+    lookup(expr.name, expr.line, expr.slot);
+    expression(expr.value);
+}
+
+/////////////////////// STATEMENTS ///////////////////////
+
+void ScopeResolver::statement(Stmt* stmt) {
+    if (stmt) stmt->accept(*this);
+}
+
+void ScopeResolver::visit(ExprStmt& stmt) {
+    expression(stmt.expression);
+}
+
+void ScopeResolver::visit(AnnounceStmt& stmt) {
+    expression(stmt.expression);
+}
+
+void ScopeResolver::visit(VarDeclStmt& stmt) {
+    expression(stmt.initializer);
+    stmt.slot = declare(stmt.name, stmt.type, stmt.line);
+}
+
+void ScopeResolver::visit(BlockStmt& stmt) {
+    int outer = depth++;
+    for (Stmt* s : stmt.statements) statement(s);
+    while (!scope.empty() && scope.back().depth > outer) scope.pop_back();
+    depth = outer;
+}
+
+// As in the compiler, the body comes before the condition.
+void ScopeResolver::visit(LoopStmt& stmt) {
+    statement(stmt.body);
+    expression(stmt.condition);
+}
+
+void ScopeResolver::visit(FinishlineStmt& stmt) {
+    expression(stmt.value);
+}
+
+void ScopeResolver::visit(FuncDefStmt&) {}
+
+void ScopeResolver::visit(IfStmt& stmt) {
+    expression(stmt.condition);
+    statement(stmt.thenBranch);
+    statement(stmt.elseBranch);
+}
+
+// Listening into a new name declares it as text.
+void ScopeResolver::visit(ListenStmt& stmt) {
+    if (const Binding* binding = find(stmt.name)) stmt.slot = binding->slot;
+    else stmt.slot = declare(stmt.name, KW_EXHAUST, stmt.line);
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "diagnostics.h"
+#include "parser.h"
+#include <cstdint>
+#include <vector>
+
+/*
+ * ScopeResolver
+ * Binds every variable of a function to a slot in a flat frame, once,
+ * before it runs, so that an executor reads and writes variables by index
+ * and never looks a name up.
+ *
+ * Each declaration (a VarDeclStmt, or a listen into a new name) gets a
+ * slot of its own, numbered in source order, so a slot always holds the
+ * one type it was declared with. The slot goes into the declaration
+ * (VarDeclStmt::slot, ListenStmt::slot) and into every read and
+ * assignment of the variable (Expr::slot); FuncDefStmt::frameSize is the
+ * number of slots. Names are looked up by the language's rules: a
+ * variable is in scope after its own initializer, to the end of its
+ * block; a declaration that is a whole track, pitstop or looplap body
+ * belongs to the enclosing block, and that of a looplap is in scope in
+ * its condition.
+ *
+ * Undefined and redeclared names are reported here, at their lines, and
+ * by nothing that runs after the resolver. Slots are only meaningful once resolve()
+ * returned true, and until the tree is edited. The tree must not share
+ * expressions (Parser::shareExpressions), as a shared read can mean a
+ * different variable in each place it is used.
+ */
+class ScopeResolver {
+public:
+    ScopeResolver(const SymbolTable& symbols, Diagnostics& diagnostics)
+        : symbols(symbols), diagnostics(diagnostics) {}
+
+    // Resolves every top-level function; false if any had errors.
+    bool resolve(const std::vector<Stmt*>& statements);
+    bool resolve(FuncDefStmt& func);
+
+    // Declared type of each slot of the function last resolved: KW_GEAR,
+    // KW_TURBO, KW_EXHAUST or KW_FLAG (KW_EXHAUST for a listen).
+    const std::vector<TokenType>& slotTypes() const { return types; }
+
+private:
+    friend struct Expr; // accept() calls the visit() overloads
+    friend struct Stmt;
+
+    struct Binding {
+        Symbol name;
+        int depth;
+        uint32_t slot;
+    };
+
+    const SymbolTable& symbols;
+    Diagnostics& diagnostics;
+    std::vector<Binding> scope; // Innermost last
+    std::vector<TokenType> types;
+    int depth = 0;
+    bool failed = false;
+
+    const Binding* find(Symbol name) const;
+    uint32_t declare(Symbol name, TokenType type, int line);
+    bool lookup(Symbol name, int line, uint32_t& slot);
+
+    void expression(Expr* expr);
+    void visit(BinaryExpr& expr);
+    void visit(LiteralExpr& expr);
+    void visit(VariableExpr& expr);
+    void visit(AssignExpr& expr);
+
+    void statement(Stmt* stmt);
+    void visit(ExprStmt& stmt);
+    void visit(AnnounceStmt& stmt);
+    void visit(VarDeclStmt& stmt);
+    void visit(BlockStmt& stmt);
+    void visit(LoopStmt& stmt);
+    void visit(FinishlineStmt& stmt);
+    void visit(FuncDefStmt& stmt);
+    void visit(IfStmt& stmt);
+    void visit(ListenStmt& stmt);
+};
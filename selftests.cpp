@@ -0,0 +1,1333 @@
+#include "selftests.h"
+#include "ast_cache.h"
+#include "ast_interpreter.h"
+#include "ast_optimizer.h"
+#include "ast_printer.h"
+#include "benchmarks.h"
+#include "bytecode_compiler.h"
+#include "c_emitter.h"
+#include "driver.h"
+#include "incremental_parser.h"
+#include "mapped_file.h"
+#include "native_codegen.h"
+#include "parser.h"
+#include "scanner.h"
+#include "scope_resolver.h"
+#include "ssa_builder.h"
+#include "ssa_codegen.h"
+#include "ssa_passes.h"
+#include "thread_pool.h"
+#include "type_checker.h"
+#include "vm.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <sys/wait.h>
+
+namespace {
+
+// One line per token: kind, byte range, line, and its name or value
+// spelled out, so that streams scanned into different contexts compare.
+std::string describeTokens(const TokenStream& tokens, const SymbolTable& symbols) {
+    std::string out;
+    for (size_t i = 0; i < tokens.size(); i++) {
+        out += std::to_string(tokens.type(i)) + " " + std::to_string(tokens.rawStart(i)) + "-" +
+               std::to_string(tokens.rawEnd(i)) + " line " + std::to_string(tokens.line(i));
+        if (tokens.symbol(i) != NO_SYMBOL) out += " " + std::string(symbols.name(tokens.symbol(i)));
+        LiteralValue literal = tokens.literal(i);
+        if (literal.kind != LiteralValue::NONE) out += " = " + formatLiteral(literal, symbols);
+        out += "\n";
+    }
+    return out;
+}
+
+// Random scanner input: mostly bits of tokens, with stray bytes, valid and
+// malformed UTF-8 in and out of strings, and long runs of one class of
+// byte, so that the kernels' 16- and 32-byte steps start and stop at every
+// point of a run, including the end of the input.
+std::string randomScanInput(std::mt19937& rng) {
+    static const char* const pieces[] = {
+        "gear", "ignite", "#oil", "#car", "true", "x_1", "9", "3.25", "1.2.3", "==", "<=", ">", "!=", "!", "+",
+        "{", "}", ";", "(", ")", " ", "\t", "\n", "\r\n", "\"", "\"lap\"", "@", ".",
+        "\xc3\xa9", "\xe2\x82\xac", "\xf0\x9f\x8f\x81",            // 2-, 3- and 4-byte sequences
+        "\xc0\xaf", "\xed\xa0\x80", "\xf4\x90\x80\x80", "\xe2\x82", "\x80", "\xff" // overlong, surrogate, too large, cut short, stray
+    };
+    static const char* const runs[] = { " \t\n\r\v\f", "abcXYZ_#019", "0123456789", "abc \n\xc3\xa9\xe2\x82\xac\xed\xa0\x80" };
+    std::string out;
+    for (size_t n = rng() % 48; n > 0; n--) {
+        if (rng() % 6) {
+            out += pieces[rng() % (sizeof pieces / sizeof *pieces)];
+            continue;
+        }
+        size_t kind = rng() % 4;
+        std::string run = runs[kind];
+        if (kind == 3) out += '"'; // A string body
+        for (size_t length = rng() % 100; length > 0; length--) out += run[rng() % run.size()];
+        if (kind == 3 && rng() % 4) out += '"';
+    }
+    return out;
+}
+
+// The SIMD scanner kernels against the scalar one (see setScanKernel):
+// the tokens and diagnostics of random input must be identical.
+bool testScanKernels(std::ostream& out) {
+    const int inputs = 20000;
+    std::mt19937 rng(3);
+    std::vector<std::string> tested;
+    for (int i = 0; i < inputs; i++) {
+        std::string code = randomScanInput(rng);
+        std::string expected;
+        for (ScanKernel kernel : { SCAN_SCALAR, SCAN_SSE2, SCAN_AVX2 }) {
+            if (!setScanKernel(kernel)) continue;
+            if (i == 0) tested.push_back(scanKernelName());
+            CompilationContext ctx;
+            TokenStream tokens = scan(code, ctx);
+            std::ostringstream result;
+            result << describeTokens(tokens, ctx.symbols);
+            ctx.diagnostics.print(result);
+            if (kernel == SCAN_SCALAR) expected = result.str();
+            else if (result.str() != expected) {
+                out << scanKernelName() << " and scalar disagree on:\n" << code << "\n--- scalar:\n"
+                    << expected << "--- " << scanKernelName() << ":\n" << result.str();
+                setScanKernel(SCAN_AUTO);
+                return false;
+            }
+        }
+    }
+    setScanKernel(SCAN_AUTO);
+    for (size_t i = 0; i < tested.size(); i++) out << (i ? ", " : "") << tested[i];
+    out << " agree on " << inputs << " inputs";
+    return true;
+}
+
+// TokenStream::relex against a full scan() of the edited text, after each
+// of a series of random edits to a program or to random input.
+bool testRelex(std::ostream& out) {
+    const int texts = 400, edits = 50;
+    std::mt19937 rng(5);
+    for (int t = 0; t < texts; t++) {
+        std::string code = t % 2 ? randomScanInput(rng) : frontEndSource(2);
+        CompilationContext ctx;
+        TokenStream tokens = scan(code, ctx);
+        for (int e = 0; e < edits; e++) {
+            std::string before = code;
+            size_t offset = rng() % (code.size() + 1);
+            size_t removed = std::min<size_t>(rng() % 16, code.size() - offset);
+            std::string inserted = randomScanInput(rng).substr(0, rng() % 16);
+            code.replace(offset, removed, inserted);
+            tokens.relex(code, { offset, removed, inserted.size() });
+
+            CompilationContext fresh;
+            std::string expected = describeTokens(scan(code, fresh), fresh.symbols);
+            std::string result = describeTokens(tokens, ctx.symbols);
+            if (result != expected) {
+                out << "relex differs from scan() after replacing " << removed << " bytes at " << offset << " of:\n"
+                    << before << "\n--- with:\n" << inserted << "\n--- scan():\n" << expected << "--- relex:\n" << result;
+                return false;
+            }
+        }
+    }
+    out << texts * edits << " edits relexed as scan() reads them";
+    return true;
+}
+
+// The line and token range of every node of a tree, which AstPrinter
+// leaves out, for comparing trees that must match exactly.
+class TreeLayout {
+public:
+    std::string of(Stmt* stmt) {
+        if (!stmt) return "_";
+        return "[" + std::to_string(stmt->tokenStart) + "+" + std::to_string(stmt->tokenCount) + "]" + stmt->accept(*this);
+    }
+    std::string of(Expr* expr) { return expr ? expr->accept(*this) : "_"; }
+
+private:
+    friend struct ::Expr;
+    friend struct ::Stmt;
+
+    static std::string at(int line) { return "@" + std::to_string(line); }
+
+    std::string visit(BinaryExpr& e) { return "(" + of(e.left) + at(e.line) + of(e.right) + ")"; }
+    std::string visit(LiteralExpr& e) { return "lit" + at(e.line); }
+    std::string visit(VariableExpr& e) { return "var" + at(e.line); }
+    std::string visit(AssignExpr& e) { return "set" + at(e.line) + of(e.value); }
+    std::string visit(ExprStmt& s) { return "expr " + of(s.expression); }
+    std::string visit(AnnounceStmt& s) { return "announce " + of(s.expression); }
+    std::string visit(VarDeclStmt& s) { return "decl" + at(s.line) + " " + of(s.initializer); }
+    std::string visit(BlockStmt& s) {
+        std::string out = "{";
+        for (Stmt* stmt : s.statements) out += " " + of(stmt);
+        return out + " }";
+    }
+    std::string visit(LoopStmt& s) { return "loop " + of(s.condition) + " " + of(s.body); }
+    std::string visit(FinishlineStmt& s) { return "finish " + of(s.value); }
+    std::string visit(FuncDefStmt& s) { return "func" + at(s.line) + " " + of(s.body); }
+    std::string visit(IfStmt& s) { return "if " + of(s.condition) + " " + of(s.thenBranch) + " " + of(s.elseBranch); }
+    std::string visit(ListenStmt& s) { return "listen" + at(s.line); }
+};
+
+// A tree as AstPrinter prints it, then its layout (see TreeLayout), then
+// the parser's errors.
+std::string describeTree(const std::vector<Stmt*>& statements, const SymbolTable& symbols, const Diagnostics& errors) {
+    std::ostringstream out;
+    AstPrinter(symbols).print(statements, out);
+    out << "\n";
+    TreeLayout layout;
+    for (Stmt* stmt : statements) out << layout.of(stmt) << "\n";
+    errors.print(out);
+    return out.str();
+}
+
+// IncrementalParser against a full parse of the edited text, after each of
+// a series of random edits: splices of statements, braces, keywords and
+// string quotes into small programs.
+bool testIncrementalParser(std::ostream& out) {
+    static const char* const pieces[] = {
+        "{", "}", ";", "(", ")", "=", "*", " ", "\n", "\n\n", "@", "\"s", "\"str\"", "pitstop", "gear x = 1;",
+        "announce y;", "track (a < b) {", "engine f() {", "ignite() {", "x = x + 2;\n", "looplap (1) { announce 2; }",
+        "finishline 0;", "listen z;", "turbo t = 1.5;"
+    };
+    static const char* const bodies[] = {
+        "  gear a = 1 + 2;\n", "  announce \"hi\";\n", "  track (a < 3) {\n    a = a - 1;\n  } pitstop {\n    listen a;\n  }\n",
+        "  looplap (a > 0) { { announce a; } }\n", "  finishline a * 2;\n"
+    };
+    const int programs = 1000, edits = 30;
+    std::mt19937 rng(12);
+    size_t partial = 0;
+    for (int p = 0; p < programs; p++) {
+        std::string code;
+        for (size_t f = rng() % 6 + 1; f > 0; f--) {
+            code += rng() % 2 ? "engine f" + std::to_string(f) + "() {\n" : std::string("ignite() {\n");
+            for (size_t s = rng() % 6; s > 0; s--) code += bodies[rng() % (sizeof bodies / sizeof *bodies)];
+            code += "}\n";
+        }
+        CompilationContext ctx;
+        IncrementalParser incremental(code, ctx);
+        for (int e = 0; e < edits; e++) {
+            size_t offset = rng() % (code.size() + 1);
+            size_t removed = rng() % 3 == 0 ? std::min<size_t>(rng() % 8, code.size() - offset) : 0;
+            std::string inserted = rng() % 4 == 0 ? "" : pieces[rng() % (sizeof pieces / sizeof *pieces)];
+            code.replace(offset, removed, inserted);
+            if (incremental.edit(offset, removed, inserted).node) partial++;
+
+            // The full parse's own errors are the ones after the scanner's.
+            CompilationContext fresh;
+            auto tokens = scan(code, fresh);
+            size_t scannerErrors = fresh.diagnostics.size();
+            ParseResult program = Parser(tokens, fresh).parse();
+            Diagnostics parserErrors;
+            for (size_t i = scannerErrors; i < fresh.diagnostics.size(); i++) {
+                const Diagnostic& d = fresh.diagnostics.all()[i];
+                parserErrors.report(d.line, d.column, d.code, d.message);
+            }
+
+            std::string expected = describeTree(program.statements, fresh.symbols, parserErrors);
+            std::string result = describeTree(incremental.statements(), ctx.symbols, incremental.diagnostics());
+            if (result != expected || incremental.source() != code) {
+                out << "the tree differs from a full parse after replacing " << removed << " bytes at " << offset
+                    << " with '" << inserted << "', giving:\n" << code << "\n--- full parse:\n" << expected
+                    << "--- incremental:\n" << result;
+                return false;
+            }
+        }
+    }
+    out << programs * edits << " edits (" << partial << " reparsed in part) leave the tree a full parse builds";
+    return true;
+}
+
+// The AST cache: a file written by writeAstCache prints as the tree it
+// came from, also when written by several threads at once; a file with a
+// byte changed or cut off either fails to open or prints without reading
+// out of bounds.
+bool testAstCache(std::ostream& out) {
+    std::string directory = temporaryPath((std::filesystem::temp_directory_path() / "autospeed-cache").string());
+    std::filesystem::create_directories(directory);
+    std::string path = directory + "/program.ast";
+    std::string code = frontEndSource(20);
+    CompilationContext ctx;
+    auto tokens = scan(code, ctx);
+    ParseResult program = Parser(tokens, ctx).parse();
+    std::ostringstream expected;
+    AstPrinter(ctx.symbols).print(program.statements, expected);
+
+    auto cleanUp = [&] {
+        std::error_code ignored;
+        std::filesystem::remove_all(directory, ignored);
+    };
+    uint64_t hash = hashSource(code);
+    std::vector<std::thread> writers;
+    for (int w = 0; w < 4; w++)
+        writers.emplace_back([&] {
+            for (int i = 0; i < 20; i++) writeAstCache(path, hash, code.size(), program.statements, ctx.symbols);
+        });
+    for (std::thread& writer : writers) writer.join();
+    AstImage image;
+    std::ostringstream printed;
+    if (!image.open(path, hash, code.size())) {
+        out << "a cache file written by 4 threads at once does not open";
+        cleanUp();
+        return false;
+    }
+    AstPrinter(ctx.symbols).print(image, printed);
+    if (printed.str() != expected.str()) {
+        out << "the cache file prints differently from its tree:\n" << printed.str() << "\n--- tree:\n" << expected.str();
+        cleanUp();
+        return false;
+    }
+
+    std::string bytes;
+    {
+        std::ifstream file(path, std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    const int damaged = 3000;
+    std::mt19937 rng(16);
+    int rejected = 0;
+    for (int i = 0; i < damaged; i++) {
+        std::string copy = bytes;
+        if (i % 10 == 0) copy.resize(rng() % copy.size());
+        else
+            for (int k = rng() % 4; k >= 0; k--) copy[rng() % copy.size()] = (char)rng();
+        std::string damagedPath = directory + "/damaged.ast";
+        std::ofstream(damagedPath, std::ios::binary | std::ios::trunc) << copy;
+        AstImage damagedImage;
+        if (!damagedImage.open(damagedPath, hash, code.size())) {
+            rejected++;
+            continue;
+        }
+        std::ostringstream reprinted;
+        AstPrinter(ctx.symbols).print(damagedImage, reprinted);
+        if (reprinted.str() != expected.str()) {
+            out << "damaged copy " << i << " opens and prints a different tree:\n" << reprinted.str();
+            cleanUp();
+            return false;
+        }
+    }
+    cleanUp();
+    out << "written by 4 threads at once, prints as its tree; of " << damaged << " damaged copies, " << rejected
+        << " were rejected and the rest print the same tree";
+    return true;
+}
+
+// CHECK and BYTECODE through a FunctionCache kept on disk, against
+// checking or compiling the whole program, after edits that move every
+// function below them and change one: same output and errors, with only
+// the changed function checked again, and every function above the
+// edits compiled only once.
+bool testFunctionCache(std::ostream& out) {
+    std::string directory = temporaryPath((std::filesystem::temp_directory_path() / "autospeed-functions").string());
+    std::string code = frontEndSource(10);
+    code.insert(code.find("engine lap5"), "engine badLap() {\n    gear fuel = \"empty\";\n    announce fuel + 1;\n}\n\n");
+    std::string edited = code;
+    edited.insert(edited.find("engine lap3"), "\n\n");
+    edited.replace(edited.find("fuel - 10", edited.find("engine lap7")), 9, "fuel - 11");
+    size_t functions = 12, unmoved = 3;
+
+    auto direct = [](const std::string& text, Options::Mode mode) {
+        CompilationContext ctx;
+        auto tokens = scan(text, ctx);
+        ParseResult program = Parser(tokens, ctx).parse();
+        std::ostringstream result;
+        if (mode == Options::CHECK) TypeChecker(ctx.symbols, ctx.diagnostics).check(program.statements);
+        else
+            for (const BytecodeFunction& function : BytecodeCompiler(ctx).compile(program.statements).functions)
+                result << disassemble(function, ctx.symbols) << "\n";
+        ctx.diagnostics.print(result);
+        return result.str();
+    };
+    auto cached = [&](const std::string& text, Options::Mode mode, FunctionBuild& build) {
+        CompilationContext ctx;
+        auto tokens = scan(text, ctx);
+        ParseResult program = Parser(tokens, ctx).parse();
+        FunctionCache cache = functionCache(mode, directory);
+        build = buildFunctions(cache, program, ctx, mode);
+        std::ostringstream result;
+        for (const std::string* output : build.outputs) result << *output;
+        ctx.diagnostics.print(result);
+        return result.str();
+    };
+
+    std::error_code ignored;
+    std::filesystem::create_directories(directory, ignored);
+    bool ok = true;
+    for (Options::Mode mode : { Options::CHECK, Options::BYTECODE }) {
+        const char* name = mode == Options::CHECK ? "check" : "bytecode";
+        FunctionBuild first, second;
+        std::string before = cached(code, mode, first), after = cached(edited, mode, second);
+        size_t wanted = mode == Options::CHECK ? functions - 1 : unmoved;
+        if (before != direct(code, mode) || after != direct(edited, mode)) {
+            out << name << " through the cache differs from " << name << " without it:\n" << after << "\n--- without:\n"
+                << direct(edited, mode);
+            ok = false;
+        }
+        else if (first.rebuilt != functions || second.reused != wanted) {
+            out << name << " after the edits reused " << second.reused << " of " << functions << " functions, not "
+                << wanted;
+            ok = false;
+        }
+        if (!ok) break;
+    }
+    std::filesystem::remove_all(directory, ignored);
+    if (ok) out << "check and bytecode match a full run after edits, reusing all but the functions they changed";
+    return ok;
+}
+
+// A tree written out as source, with each variable as name#slot and,
+// with 'types', each expression followed by ':' and its Expr::type, so
+// that the scope and type tests can spell out what they expect.
+class Annotated {
+public:
+    explicit Annotated(const SymbolTable& symbols, bool types = false) : symbols(symbols), types(types) {}
+
+    std::string of(Stmt* stmt) { return stmt ? stmt->accept(*this) : "_"; }
+    std::string of(Expr* expr) {
+        if (!expr) return "_";
+        std::string text = expr->accept(*this);
+        return types ? text + ":" + typeName(expr->type) : text;
+    }
+
+private:
+    friend struct ::Expr;
+    friend struct ::Stmt;
+
+    const SymbolTable& symbols;
+    bool types;
+
+    std::string variable(Symbol name, uint32_t slot) { return std::string(symbols.name(name)) + "#" + std::to_string(slot); }
+
+    std::string visit(BinaryExpr& e) { return "(" + of(e.left) + " " + std::string(tokenSpelling(e.op)) + " " + of(e.right) + ")"; }
+    std::string visit(LiteralExpr& e) {
+        std::string text = formatLiteral(e.value, symbols);
+        return e.value.kind == LiteralValue::STRING ? "\"" + text + "\"" : text;
+    }
+    std::string visit(VariableExpr& e) { return variable(e.name, e.slot); }
+    std::string visit(AssignExpr& e) { return "(" + variable(e.name, e.slot) + " = " + of(e.value) + ")"; }
+    std::string visit(ExprStmt& s) { return of(s.expression) + ";"; }
+    std::string visit(AnnounceStmt& s) { return "announce " + of(s.expression) + ";"; }
+    std::string visit(VarDeclStmt& s) {
+        std::string out = std::string(tokenSpelling(s.type)) + " " + variable(s.name, s.slot);
+        return out + (s.initializer ? " = " + of(s.initializer) : "") + ";";
+    }
+    std::string visit(BlockStmt& s) {
+        std::string out = "{";
+        for (Stmt* stmt : s.statements) out += " " + of(stmt);
+        return out + " }";
+    }
+    std::string visit(LoopStmt& s) { return "looplap " + of(s.condition) + " " + of(s.body); }
+    std::string visit(FinishlineStmt& s) { return "finishline " + of(s.value) + ";"; }
+    std::string visit(FuncDefStmt& s) { return "engine " + std::string(symbols.name(s.name)) + "() " + of(s.body); }
+    std::string visit(IfStmt& s) {
+        return "track " + of(s.condition) + " " + of(s.thenBranch) + (s.elseBranch ? " pitstop " + of(s.elseBranch) : "");
+    }
+    std::string visit(ListenStmt& s) { return "listen " + variable(s.name, s.slot) + ";"; }
+};
+
+// A program for the scope and type tests, and what they must make of it.
+struct AnnotationCase {
+    const char* code;
+    const char* expected;
+};
+
+// ScopeResolver on small programs: each function written out with its
+// slots and frame size, or else the errors it reported.
+bool testScopeResolver(std::ostream& out) {
+    static const AnnotationCase cases[] = {
+        // Shadowing: an initializer still reads the outer variable, and
+        // each declaration gets a slot of its own, in source order.
+        { R"(ignite() {
+    gear a = 1;
+    {
+        gear a = a + 1;
+        {
+            turbo b = 2.5;
+            announce a + b;
+        }
+        announce a;
+    }
+    announce a;
+    gear b = a;
+})",
+          "engine ignite() { gear a#0 = 1; { gear a#1 = (a#0 + 1); { turbo b#2 = 2.5; announce (a#1 + b#2); } "
+          "announce a#1; } announce a#0; gear b#3 = a#0; } frame 4\n" },
+        // Sibling blocks do not share slots; a looplap body declares into
+        // the enclosing block, and its condition sees it; listen declares
+        // a new name but reuses a declared one.
+        { R"(ignite() {
+    { gear x = 1; }
+    { exhaust x = "lap"; announce x; }
+    looplap (n < 3) gear n = 0;
+    listen name;
+    listen n;
+    track (n > 1) gear y = 1; pitstop gear z = 2;
+    announce name;
+})",
+          "engine ignite() { { gear x#0 = 1; } { exhaust x#1 = \"lap\"; announce x#1; } looplap (n#2 < 3) gear n#2 = 0; "
+          "listen name#3; listen n#2; track (n#2 > 1) gear y#4 = 1; pitstop gear z#5 = 2; announce name#3; } frame 6\n" },
+        // Every function numbers its slots from 0.
+        { R"(engine lap() { gear t = 1; announce t; }
+ignite() { turbo t = 2.0; gear u = 1; announce t; })",
+          "engine lap() { gear t#0 = 1; announce t#0; } frame 1\n"
+          "engine ignite() { turbo t#0 = 2.0; gear u#1 = 1; announce t#0; } frame 2\n" },
+        // Use before the declaration, in its own initializer and after its
+        // block; a redeclaration in one block, including the two branches
+        // of a track, which both belong to the enclosing one.
+        { R"(ignite() {
+    announce a;
+    gear a = a;
+    { gear b = 1; }
+    b = 2;
+    gear a = 3;
+    track (true) gear c = 1; pitstop gear c = 2;
+})",
+          "Error [Line 2]: Undefined variable 'a'.\n"
+          "Error [Line 3]: Undefined variable 'a'.\n"
+          "Error [Line 5]: Undefined variable 'b'.\n"
+          "Error [Line 6]: Variable 'a' is already declared in this block.\n"
+          "Error [Line 7]: Variable 'c' is already declared in this block.\n" },
+    };
+    for (const AnnotationCase& test : cases) {
+        CompilationContext ctx;
+        std::string code = test.code;
+        auto tokens = scan(code, ctx);
+        ParseResult parsed = Parser(tokens, ctx).parse();
+        std::ostringstream got;
+        if (ctx.diagnostics.empty() && ScopeResolver(ctx.symbols, ctx.diagnostics).resolve(parsed.statements)) {
+            Annotated annotated(ctx.symbols);
+            for (Stmt* stmt : parsed.statements)
+                got << annotated.of(stmt) << " frame " << static_cast<FuncDefStmt*>(stmt)->frameSize << "\n";
+        }
+        ctx.diagnostics.print(got);
+        if (got.str() != test.expected) {
+            out << "slots differ for:\n" << code << "\n--- expected:\n" << test.expected << "--- got:\n" << got.str();
+            return false;
+        }
+    }
+    out << std::size(cases) << " programs resolve to the expected slots and errors, with shadowing in nested blocks";
+    return true;
+}
+
+// TypeChecker on small programs: each function written out with the type
+// of every expression, or else the errors it reported. Name errors must
+// keep it from reporting type errors, and a nested engine or a second
+// ignite() is an error of its own.
+bool testTypeChecker(std::ostream& out) {
+    static const AnnotationCase cases[] = {
+        { R"(ignite() {
+    gear g = 7;
+    turbo t = g / 2;
+    exhaust s = "lap " + g;
+    flag f = g < t;
+    g = t * 2;
+    announce s + t + f;
+    track (f == true) announce "yes";
+    finishline g;
+})",
+          "engine ignite() { gear g#0 = 7:gear; turbo t#1 = (g#0:gear / 2:gear):gear; "
+          "exhaust s#2 = (\"lap \":exhaust + g#0:gear):exhaust; flag f#3 = (g#0:gear < t#1:turbo):flag; "
+          "(g#0 = (t#1:turbo * 2:gear):turbo):gear; announce ((s#2:exhaust + t#1:turbo):exhaust + f#3:flag):exhaust; "
+          "track (f#3:flag == true:flag):flag announce \"yes\":exhaust; finishline g#0:gear; }\n" },
+        // One error per mistake: nothing above a node with an error
+        // reports again, and gear and turbo convert into each other.
+        { R"(ignite() {
+    gear g = "x";
+    exhaust s = 1;
+    flag f = 1 < "a";
+    announce true + 1;
+    announce true < false;
+    track ("x") announce 1;
+    looplap (s) announce 2;
+    finishline "done";
+    g = 1.5;
+    announce (1 < "a") + 1;
+})",
+          "Error [Line 2]: Declaration: expected gear, got exhaust.\n"
+          "Error [Line 3]: Declaration: expected exhaust, got gear.\n"
+          "Error [Line 4]: Cannot compare gear and exhaust with '<'.\n"
+          "Error [Line 5]: Operator '+' cannot be applied to flag and gear.\n"
+          "Error [Line 6]: Cannot compare flag and flag with '<'.\n"
+          "Error [Line 7]: Condition: expected flag, gear or turbo, got exhaust.\n"
+          "Error [Line 8]: Condition: expected flag, gear or turbo, got exhaust.\n"
+          "Error [Line 9]: finishline: expected gear, flag or turbo, got exhaust.\n"
+          "Error [Line 11]: Cannot compare gear and exhaust with '<'.\n" },
+        { R"(ignite() {
+    gear g = "x";
+    announce missing;
+})",
+          "Error [Line 3]: Undefined variable 'missing'.\n" },
+        { R"(ignite() { engine inner() { gear g = "x"; } }
+engine other() { gear h = 1; }
+ignite() { announce 1; })",
+          "Error [Line 1]: engine inner is defined inside a function; define it at the top level.\n"
+          "Error [Line 3]: ignite() is already defined at line 1.\n" },
+    };
+    for (const AnnotationCase& test : cases) {
+        CompilationContext ctx;
+        std::string code = test.code;
+        auto tokens = scan(code, ctx);
+        ParseResult parsed = Parser(tokens, ctx).parse();
+        TypeChecker checker(ctx.symbols, ctx.diagnostics);
+        bool ok = ctx.diagnostics.empty() && checker.check(parsed.statements);
+        ok = checker.checkEntryPoint(parsed.statements) && ok;
+        std::ostringstream got;
+        if (ok) {
+            Annotated annotated(ctx.symbols, true);
+            for (Stmt* stmt : parsed.statements) got << annotated.of(stmt) << "\n";
+        }
+        ctx.diagnostics.print(got);
+        if (got.str() != test.expected) {
+            out << "types differ for:\n" << code << "\n--- expected:\n" << test.expected << "--- got:\n" << got.str();
+            return false;
+        }
+    }
+    out << std::size(cases) << " programs check to the expected types and errors";
+    return true;
+}
+
+// A program for the engine tests, with the input it reads.
+struct TestProgram {
+    std::string name;
+    std::string code;
+    std::string input;
+};
+
+// Random ignite() programs that type-check and end: declarations,
+// assignments, announce, listen, track/pitstop, blocks, counted looplap
+// and early finishline, over gear, turbo, exhaust and flag values,
+// including overflowing gears and huge turbos. Without exhaust variables
+// ('numeric'), text only appears in what is announced, which keeps the
+// programs within what the native backend covers.
+class RandomProgram {
+public:
+    RandomProgram(std::mt19937& rng, bool numeric) : rng(rng), numeric(numeric) {}
+
+    std::string code() {
+        text = "ignite() {\n";
+        scopes.assign(1, {});
+        statements(pick(8) + 2, 3);
+        text += "}\n";
+        return text;
+    }
+
+    // Lines for listen to read, some of them not numbers.
+    std::string input() {
+        static const char* const lines[] = { "5", "-3", "2.5", "true", "false", "x", " 7 ", "1e10", "" };
+        std::string out;
+        for (int n = pick(6); n > 0; n--) out += std::string(lines[pick(9)]) + "\n";
+        return out;
+    }
+
+private:
+    enum Type { GEAR, TURBO, EXHAUST, FLAG };
+
+    int pick(int n) { return (int)(rng() % (unsigned)n); }
+    Type anyType() { return numeric ? (Type)(pick(3) == 2 ? FLAG : pick(2)) : (Type)pick(4); }
+    void line(const std::string& s) { text += std::string(indent * 2, ' ') + s + "\n"; }
+
+    // A variable of 'type' in scope, or "". Loop counters (type -1) are
+    // only ever read, as gears, so that every loop ends.
+    std::string variable(int type, bool reading = false) {
+        std::vector<std::string> found;
+        for (const auto& scope : scopes)
+            for (const auto& v : scope)
+                if (v.second == type || (reading && type == GEAR && v.second == -1)) found.push_back(v.first);
+        return found.empty() ? "" : found[(size_t)pick((int)found.size())];
+    }
+
+    std::string literal(Type type) {
+        switch (type) {
+        case GEAR: {
+            int k = pick(10);
+            return k == 0 ? "9223372036854775807" : k == 1 ? "3000000000" : std::to_string(pick(20));
+        }
+        case TURBO: {
+            int k = pick(12);
+            return k == 0 ? "99999999999999999999.0" : k == 1 ? "0.0" : std::to_string(pick(40)) + "." + std::to_string(pick(10));
+        }
+        case EXHAUST: return "\"s" + std::to_string(pick(5)) + "\"";
+        default: return pick(2) ? "true" : "false";
+        }
+    }
+
+    std::string expression(Type type, int depth) {
+        static const char* const arithmetic[] = { "+", "-", "*", "/" };
+        static const char* const comparisons[] = { "<", "<=", ">", ">=", "==", "!=" };
+        int k = pick(depth <= 0 ? 2 : 7);
+        if (k == 0) return literal(type);
+        if (k == 1) {
+            std::string v = variable(type, true);
+            return v.empty() ? literal(type) : v;
+        }
+        if (k == 6) {
+            std::string v = variable(type);
+            if (!v.empty()) return "(" + v + " = " + expression(type, depth - 1) + ")";
+        }
+        switch (type) {
+        case GEAR:
+            return "(" + expression(GEAR, depth - 1) + " " + arithmetic[pick(4)] + " " + expression(GEAR, depth - 1) + ")";
+        case TURBO: { // At least one side a turbo
+            int a = pick(3);
+            Type left = a == 1 ? GEAR : TURBO, right = a == 1 ? TURBO : a == 0 ? (Type)pick(2) : TURBO;
+            return "(" + expression(left, depth - 1) + " " + arithmetic[pick(4)] + " " + expression(right, depth - 1) + ")";
+        }
+        case EXHAUST: { // Text joined with any value
+            Type other = (Type)pick(4);
+            if (pick(2)) return "(" + expression(EXHAUST, depth - 1) + " + " + expression(other, depth - 1) + ")";
+            return "(" + expression(other, depth - 1) + " + " + expression(EXHAUST, depth - 1) + ")";
+        }
+        default:
+            if (pick(2)) return "(" + expression(FLAG, depth - 1) + " " + comparisons[4 + pick(2)] + " " + expression(FLAG, depth - 1) + ")";
+            return "(" + expression((Type)pick(2), depth - 1) + " " + comparisons[pick(6)] + " " + expression((Type)pick(2), depth - 1) + ")";
+        }
+    }
+
+    void block(int count, int depth) {
+        indent++;
+        scopes.push_back({});
+        statements(count, depth);
+        scopes.pop_back();
+        indent--;
+    }
+
+    void statements(int count, int depth) {
+        static const char* const names[] = { "gear", "turbo", "exhaust", "flag" };
+        for (int i = 0; i < count; i++) {
+            int k = pick(depth <= 0 ? 3 : 7);
+            if (k == 0) {
+                Type type = anyType();
+                std::string name = "v" + std::to_string(counter++);
+                Type value = pick(3) == 0 && type == GEAR ? TURBO : pick(3) == 0 && type == TURBO ? GEAR : type;
+                if (pick(5) == 0) line(std::string(names[type]) + " " + name + ";");
+                else line(std::string(names[type]) + " " + name + " = " + expression(value, 2) + ";");
+                scopes.back().push_back({ name, type });
+            }
+            else if (k == 1) line("announce " + expression((Type)pick(4), 3) + ";");
+            else if (k == 2) {
+                Type type = anyType();
+                std::string v = variable(type);
+                if (!v.empty()) line(v + " = " + expression(type, 3) + ";");
+            }
+            else if (k == 3) {
+                line("track (" + expression(pick(2) ? FLAG : (Type)pick(2), 2) + ") {");
+                block(pick(3) + 1, depth - 1);
+                if (pick(2)) {
+                    line("} pitstop {");
+                    block(pick(3) + 1, depth - 1);
+                }
+                line("}");
+            }
+            else if (k == 4) { // Counted up or down, so that it ends; the counter is only read elsewhere
+                std::string counter = "c" + std::to_string(this->counter++), laps = std::to_string(pick(4) + 1);
+                bool up = pick(2);
+                line("gear " + counter + " = " + (up ? "0" : laps) + ";");
+                scopes.back().push_back({ counter, -1 });
+                line("looplap (" + counter + (up ? " < " + laps : " > 0") + ") {");
+                indent++;
+                scopes.push_back({});
+                statements(pick(3) + 1, depth - 1);
+                line(counter + " = " + counter + (up ? " + 1;" : " - 1;"));
+                scopes.pop_back();
+                indent--;
+                line("}");
+            }
+            else if (k == 5) {
+                line("{");
+                block(pick(3) + 1, depth - 1);
+                line("}");
+            }
+            else {
+                std::string v = variable(anyType());
+                if (!v.empty()) line("listen " + v + ";");
+            }
+            if (pick(15) == 0) {
+                Type type = anyType();
+                std::string name = "b" + std::to_string(counter++);
+                line("track (true) " + std::string(names[type]) + " " + name + " = " + expression(type, 1) + ";");
+                scopes.back().push_back({ name, type });
+            }
+            if (pick(40) == 0) {
+                int type = pick(3);
+                line("finishline " + expression(type == 2 ? FLAG : (Type)type, 2) + ";");
+            }
+        }
+    }
+
+    std::mt19937& rng;
+    bool numeric;
+    std::vector<std::vector<std::pair<std::string, int>>> scopes; // Name and Type of what is in scope
+    int counter = 0;
+    int indent = 1;
+    std::string text;
+};
+
+// The programs every engine must run alike: the built-in ones that parse
+// and end, the README sample made into one ignite() (engines cannot call
+// functions yet), a loop whose variables trade places, and 'random'
+// generated ones, half of them numeric.
+std::vector<TestProgram> engineTestPrograms(int random) {
+    std::vector<TestProgram> programs;
+    std::vector<std::string> builtIn = builtInPrograms();
+    for (size_t i = 0; i < builtIn.size(); i++) {
+        if (i == 1 || i == 2) continue; // TEST 2 and TEST 3 never end
+        CompilationContext ctx;
+        auto tokens = scan(builtIn[i], ctx);
+        Parser(tokens, ctx).parse();
+        if (ctx.diagnostics.empty()) programs.push_back({ "TEST " + std::to_string(i + 1), builtIn[i], "" });
+    }
+    programs.push_back({ "README", R"(ignite() {
+    announce "🏎️ Welcome to Auto-Speed!";
+    listen driverName;
+    announce "Driver: " + driverName;
+
+    gear fuel = 95;
+    track (fuel < 30) {
+        announce "⚠️ Low fuel! Head to pitstop!";
+    }
+    pitstop {
+        announce "✅ Fuel level is good.";
+    }
+
+    gear remaining = 0;
+    {
+        gear lap = 0;
+        gear fuel = 95;
+        exhaust carName = "Ferrari";
+        turbo speed = 2.5;
+        flag engineOn = true;
+
+        announce "🏁 Starting race with " + carName;
+        announce "Engine turbo: " + speed;
+
+        looplap (fuel > 0) {
+            announce "Lap number: " + lap;
+            lap = lap + 1;
+            fuel = fuel - 10;
+            speed = speed + 0.5;
+
+            track (speed >= 3.0) {
+                announce "🚀 Boost active!";
+            }
+        }
+
+        announce "🏁 Race finished after " + lap + " laps.";
+        announce "Remaining fuel: " + fuel;
+        remaining = fuel;
+    }
+
+    track (remaining > 20) {
+        announce "🏆 Great race, " + driverName + "!";
+    }
+    pitstop {
+        announce "⛽ Time to refuel, " + driverName + "!";
+    }
+    finishline remaining;
+})", "Max Verstappen\n" });
+    // Values that trade places every lap: the copies on the loop's back
+    // edge form cycles, which lowering from SSA must break.
+    programs.push_back({ "swaps", R"(ignite() {
+    gear a = 1;
+    gear b = 2;
+    gear c = 3;
+    exhaust s = "left";
+    exhaust t = "right";
+    gear i = 0;
+    looplap (i < 5) {
+        gear x = a;
+        a = b;
+        b = x;
+        x = a;
+        a = b;
+        b = c;
+        c = x;
+        exhaust u = s;
+        s = t;
+        t = u;
+        announce s + a + b + c;
+        i = i + 1;
+    }
+    finishline a * 100 + b * 10 + c;
+})", "" });
+    std::mt19937 rng(19);
+    for (int i = 0; i < random; i++) {
+        RandomProgram generator(rng, i % 2 == 0);
+        std::string code = generator.code();
+        programs.push_back({ "random program " + std::to_string(i + 1), code, generator.input() });
+    }
+    return programs;
+}
+
+// Parser::parseParallel against parse(): sources of several random
+// functions, some of them the body of a top-level track, looplap or
+// pitstop, and some damaged with stray braces, keywords and cut text, are
+// cut into tasks as small as one function, on 2 and 4 threads. The tree
+// and the errors must be the ones parse() gives, with no error limit and
+// with limits that stop the parse inside one of the tasks.
+bool testParallelParse(std::ostream& out) {
+    static const char* const prefixes[] = { "", "", "", "track (true) ", "track (false) announce 1; pitstop ", "looplap (false) " };
+    static const char* const damage[] = { "}", "{", ";", "track (", "engine ", "ignite() ", "gear", "@", ")", "\"" };
+    static const size_t limits[] = { 0, 1, 4 };
+    std::mt19937 rng(23);
+    ThreadPool pools[] = { ThreadPool(2), ThreadPool(4) };
+    int damaged = 0;
+    const int sources = 150;
+    for (int n = 0; n < sources; n++) {
+        std::string code;
+        for (int f = (int)(rng() % 8) + 2; f > 0; f--) {
+            RandomProgram generator(rng, rng() % 2 == 0);
+            std::string function = generator.code();
+            if (rng() % 2) function.replace(0, 8, "engine f" + std::to_string(f) + "()");
+            code += prefixes[rng() % std::size(prefixes)] + function;
+        }
+        if (n % 3 != 0) {
+            damaged++;
+            for (int k = (int)(rng() % 4) + 1; k > 0; k--) {
+                size_t at = rng() % code.size();
+                if (rng() % 2) code.erase(at, rng() % 5);
+                else code.insert(at, damage[rng() % std::size(damage)]);
+            }
+        }
+
+        for (size_t limit : limits) {
+            CompilationContext serial;
+            serial.diagnostics.setLimit(limit);
+            auto serialTokens = scan(code, serial);
+            ParseResult expectedTree = Parser(serialTokens, serial).parse();
+            std::string expected = describeTree(expectedTree.statements, serial.symbols, serial.diagnostics);
+            for (ThreadPool& pool : pools) {
+                for (size_t minTaskTokens : { (size_t)1, (size_t)32 }) {
+                    CompilationContext ctx;
+                    ctx.diagnostics.setLimit(limit);
+                    auto tokens = scan(code, ctx);
+                    ParseResult tree = Parser(tokens, ctx).parseParallel(pool, minTaskTokens);
+                    std::string got = describeTree(tree.statements, ctx.symbols, ctx.diagnostics);
+                    if (got != expected) {
+                        out << "parseParallel on " << pool.size() << " threads, tasks of at least " << minTaskTokens
+                            << " tokens and an error limit of " << limit << " differs from parse() for:\n"
+                            << code << "\n--- parse():\n" << expected << "--- parseParallel():\n" << got;
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+    out << sources << " sources (" << damaged << " damaged) parse as parse() does on 2 and 4 threads, cut into tasks "
+        << "of at least 1 and 32 tokens, with error limits of 0, 1 and 4";
+    return true;
+}
+
+// Walks a tree parsed with Parser::shareExpressions and checks what
+// sharing promises: no node with an assignment in it is reached twice, and
+// two side-effect-free subtrees that are equal are the same node. Each
+// expression's structure is spelled out as a key to compare them by.
+class SharingChecker {
+public:
+    std::string problem;
+    size_t uses = 0;   // Expression nodes, counting each use
+    size_t shared = 0; // Uses of a node reached before
+
+    void check(Stmt* stmt) {
+        if (stmt) stmt->accept(*this);
+    }
+
+private:
+    friend struct ::Expr;
+    friend struct ::Stmt;
+
+    struct Seen {
+        std::string key;
+        bool pure;
+    };
+
+    // The key of 'expr'; 'pure' is cleared if it holds an assignment.
+    std::string key(Expr* expr, bool& pure) {
+        if (!expr) return "-";
+        uses++;
+        auto found = seen.find(expr);
+        if (found != seen.end()) {
+            shared++;
+            if (!found->second.pure && problem.empty()) problem = "an assignment is used in two places";
+            pure = pure && found->second.pure;
+            return found->second.key;
+        }
+        bool outer = pureHere;
+        pureHere = true;
+        std::string k = expr->accept(*this);
+        bool mine = pureHere;
+        pureHere = outer;
+        seen[expr] = { k, mine };
+        if (mine) {
+            auto [other, added] = byKey.emplace(k, expr);
+            if (!added && problem.empty()) problem = "two equal subexpressions are not shared: " + k;
+        }
+        pure = pure && mine;
+        return k;
+    }
+
+    std::string visit(BinaryExpr& e) {
+        std::string left = key(e.left, pureHere);
+        return "(" + std::to_string(e.op) + " " + left + " " + key(e.right, pureHere) + ")";
+    }
+    std::string visit(LiteralExpr& e) {
+        uint64_t bits;
+        memcpy(&bits, &e.value.i, sizeof bits);
+        return "L" + std::to_string(e.value.kind) + ":" + std::to_string(bits);
+    }
+    std::string visit(VariableExpr& e) { return "V" + std::to_string(e.name); }
+    std::string visit(AssignExpr& e) {
+        pureHere = false;
+        return "A" + std::to_string(e.name) + " " + key(e.value, pureHere);
+    }
+
+    void expression(Expr* expr) {
+        bool pure = true;
+        key(expr, pure);
+    }
+    void visit(ExprStmt& s) { expression(s.expression); }
+    void visit(AnnounceStmt& s) { expression(s.expression); }
+    void visit(VarDeclStmt& s) { expression(s.initializer); }
+    void visit(BlockStmt& s) {
+        for (Stmt* stmt : s.statements) check(stmt);
+    }
+    void visit(LoopStmt& s) {
+        expression(s.condition);
+        check(s.body);
+    }
+    void visit(FinishlineStmt& s) { expression(s.value); }
+    void visit(FuncDefStmt& s) { check(s.body); }
+    void visit(IfStmt& s) {
+        expression(s.condition);
+        check(s.thenBranch);
+        check(s.elseBranch);
+    }
+    void visit(ListenStmt&) {}
+
+    bool pureHere = true; // Whether the expression being keyed has no assignment
+    std::unordered_map<const Expr*, Seen> seen;
+    std::unordered_map<std::string, const Expr*> byKey;
+};
+
+// Parser::shareExpressions against a plain parse: the engine test
+// programs, the front-end benchmark's source and damaged copies of them
+// print the same tree with the same errors, both from parse() and from
+// parseParallel() on 2 threads, and the shared tree keeps its promises
+// (see SharingChecker).
+bool testSharedExpressions(std::ostream& out) {
+    std::vector<std::string> sources;
+    for (const TestProgram& program : engineTestPrograms(100)) sources.push_back(program.code);
+    sources.push_back(frontEndSource(20));
+    std::mt19937 rng(14);
+    for (size_t i = 0, n = sources.size(); i < n; i += 3) {
+        std::string code = sources[i];
+        for (int k = 0; k < 3; k++) code.erase(rng() % code.size(), rng() % 4 + 1);
+        sources.push_back(code);
+    }
+
+    ThreadPool pool(2);
+    size_t uses = 0, shared = 0;
+    for (const std::string& code : sources) {
+        auto print = [](const ParseResult& tree, const CompilationContext& ctx) {
+            std::ostringstream text;
+            AstPrinter(ctx.symbols).print(tree.statements, text);
+            text << "\n";
+            ctx.diagnostics.print(text);
+            return text.str();
+        };
+        CompilationContext plainCtx;
+        auto plainTokens = scan(code, plainCtx);
+        std::string expected = print(Parser(plainTokens, plainCtx).parse(), plainCtx);
+
+        for (bool parallel : { false, true }) {
+            CompilationContext ctx;
+            auto tokens = scan(code, ctx);
+            Parser parser(tokens, ctx);
+            parser.shareExpressions(true);
+            ParseResult tree = parallel ? parser.parseParallel(pool, 1) : parser.parse();
+            std::string got = print(tree, ctx);
+            if (got != expected) {
+                out << "with shared expressions, " << (parallel ? "parseParallel()" : "parse()")
+                    << " prints differently for:\n" << code << "\n--- shared:\n" << got << "--- plain:\n" << expected;
+                return false;
+            }
+            if (parallel) continue; // Each worker shares only among its own functions
+            SharingChecker checker;
+            for (Stmt* stmt : tree.statements) checker.check(stmt);
+            if (!checker.problem.empty()) {
+                out << checker.problem << " in:\n" << code;
+                return false;
+            }
+            uses += checker.uses;
+            shared += checker.shared;
+        }
+    }
+    out << sources.size() << " sources print alike with and without sharing, from parse() and parseParallel(); "
+        << shared << " of " << uses << " expression uses share a node";
+    return true;
+}
+
+// What a run printed, what it finished with and the errors it reported,
+// as one text, so that runs on different engines compare.
+std::string describeRun(const std::string& output, const RunResult& result, const Diagnostics& errors) {
+    std::ostringstream out;
+    out << output << "--- " << (result.ok ? "finishline " + std::to_string(result.value) : std::string("stopped")) << "\n";
+    errors.print(out);
+    return out.str();
+}
+
+// Parses 'program' into a context of its own and runs it with 'run', which
+// is given the tree, the context and the streams (see describeRun).
+template <typename Run>
+std::string runDescribed(const TestProgram& program, Run&& run) {
+    CompilationContext ctx;
+    auto tokens = scan(program.code, ctx);
+    ParseResult parsed = Parser(tokens, ctx).parse();
+    std::istringstream in(program.input);
+    std::ostringstream out;
+    RunResult result = run(parsed, ctx, in, out);
+    return describeRun(out.str(), result, ctx.diagnostics);
+}
+
+// The reference run the engine tests compare against: the bytecode VM.
+RunResult runOnVm(ParseResult& program, CompilationContext& ctx, std::istream& in, std::ostream& out) {
+    BytecodeProgram code = BytecodeCompiler(ctx).compile(program.statements);
+    if (!ctx.diagnostics.empty() || code.entry < 0) return RunResult{ false, 0, 0 };
+    return Vm(in, out).run(code.functions[(size_t)code.entry], ctx.diagnostics);
+}
+
+// Shows where a run on some engine and the VM's differ.
+void reportMismatch(std::ostream& out, const TestProgram& program, const char* engine, const std::string& got,
+                    const std::string& expected) {
+    out << program.name << " on " << engine << " differs from the VM:\n" << program.code << "--- input:\n"
+        << program.input << "--- " << engine << ":\n" << got << "--- VM:\n" << expected;
+}
+
+// Native code against the VM (see runFromAst): same output, result and
+// errors on every engine test program.
+bool testNative(std::ostream& out) {
+    std::vector<TestProgram> programs = engineTestPrograms(400);
+    size_t native = 0;
+    for (const TestProgram& program : programs) {
+        std::string expected = runDescribed(program, runOnVm);
+        Engine used = Engine::NONE;
+        std::string got = runDescribed(program, [&](ParseResult& parsed, CompilationContext& ctx, std::istream& in, std::ostream& out) {
+            return runFromAst(parsed.statements, ctx, in, out, &used);
+        });
+        if (got != expected) {
+            reportMismatch(out, program, "native code", got, expected);
+            return false;
+        }
+        if (used == Engine::NATIVE) native++;
+    }
+    out << native << " of " << programs.size() << " programs ran as machine code, matching the VM; the rest fell back to it";
+    return true;
+}
+
+// AstInterpreter against the VM (see interpretFromAst): same output,
+// result and errors on every engine test program, with the rewrites it
+// made counted as it ran.
+bool testInterpreter(std::ostream& out) {
+    std::vector<TestProgram> programs = engineTestPrograms(400);
+    InterpreterStats total;
+    for (const TestProgram& program : programs) {
+        std::string expected = runDescribed(program, runOnVm);
+        std::string got = runDescribed(program, [&](ParseResult& parsed, CompilationContext& ctx, std::istream& in, std::ostream& out) {
+            InterpreterStats stats;
+            RunResult result = interpretFromAst(parsed.statements, ctx, in, out, &stats);
+            total.rewrites += stats.rewrites;
+            total.deopts += stats.deopts;
+            total.hits += stats.hits;
+            total.generic += stats.generic;
+            return result;
+        });
+        if (got != expected) {
+            reportMismatch(out, program, "the AST interpreter", got, expected);
+            return false;
+        }
+    }
+    out << programs.size() << " programs run as on the VM, with " << total.rewrites << " rewrites, " << total.deopts
+        << " deopts, " << total.hits << " specialized and " << total.generic << " generic node runs";
+    return true;
+}
+
+// Runs a program's ignite() as runSsa does in SSA_RUN mode: every function
+// built as SSA IR and put through 'passes', then the entry lowered to
+// bytecode for the VM.
+RunResult runOnSsa(ParseResult& program, CompilationContext& ctx, std::istream& in, std::ostream& out, unsigned passes) {
+    Symbol ignite = ctx.symbols.find("ignite");
+    SsaBuilder builder(ctx.symbols, ctx.diagnostics);
+    SsaPassManager manager(passes);
+    IrFunction entry;
+    bool found = false;
+    for (Stmt* stmt : program.statements) {
+        if (!stmt || stmt->kind != STMT_FUNC_DEF) continue;
+        auto& func = static_cast<FuncDefStmt&>(*stmt);
+        IrFunction function;
+        if (!builder.build(func, function)) continue;
+        manager.run(function);
+        if (func.name == ignite && !found) {
+            entry = std::move(function);
+            found = true;
+        }
+    }
+    BytecodeFunction code;
+    if (!ctx.diagnostics.empty() || !found || !generateBytecode(entry, code, ctx.diagnostics)) return RunResult{ false, 0, 0 };
+    return Vm(in, out).run(code, ctx.diagnostics);
+}
+
+// SSA construction, each set of passes and the lowering back to bytecode
+// (PHI coalescing and edge copies included) against the VM: same output,
+// result and errors on every engine test program.
+bool testSsa(std::ostream& out) {
+    static const char* const passSets[] = { "none", "gvn", "licm", "sr", "dse", "default", "all" };
+    std::vector<TestProgram> programs = engineTestPrograms(400);
+    for (const TestProgram& program : programs) {
+        std::string expected = runDescribed(program, runOnVm);
+        for (const char* set : passSets) {
+            unsigned passes;
+            parsePasses(set, passes);
+            std::string got = runDescribed(program, [&](ParseResult& parsed, CompilationContext& ctx, std::istream& in, std::ostream& out) {
+                return runOnSsa(parsed, ctx, in, out, passes);
+            });
+            if (got != expected) {
+                std::string engine = std::string("SSA code (") + set + ")";
+                reportMismatch(out, program, engine.c_str(), got, expected);
+                return false;
+            }
+        }
+    }
+    out << programs.size() << " programs run as on the VM through SSA IR with each of " << std::size(passSets)
+        << " sets of passes";
+    return true;
+}
+
+// AstOptimizer against the tree it was given: each engine test program,
+// optimized after it compiled, must run on the VM as it did before.
+bool testOptimizer(std::ostream& out) {
+    std::vector<TestProgram> programs = engineTestPrograms(400);
+    OptimizerStats total;
+    for (const TestProgram& program : programs) {
+        std::string expected = runDescribed(program, runOnVm);
+        std::string got = runDescribed(program, [&](ParseResult& parsed, CompilationContext& ctx, std::istream& in, std::ostream& out) {
+            BytecodeCompiler(ctx).compile(parsed.statements); // Checks the types, which the optimizer assumes
+            OptimizerStats stats = AstOptimizer(parsed.arena, ctx.symbols).optimize(parsed.statements);
+            total.nodesBefore += stats.nodesBefore;
+            total.nodesAfter += stats.nodesAfter;
+            return runOnVm(parsed, ctx, in, out);
+        });
+        if (got != expected) {
+            reportMismatch(out, program, "the optimized tree", got, expected);
+            return false;
+        }
+    }
+    out << programs.size() << " programs run as before with " << total.removed() << " of " << total.nodesBefore
+        << " nodes optimized away";
+    return true;
+}
+
+// Runs 'command' through the shell. Returns its exit status, or -1 if it
+// could not be run or did not exit.
+int runCommand(const std::string& command) {
+    int status = std::system(command.c_str());
+    return status != -1 && WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// The whole of a file, or "" if it cannot be read.
+std::string readWholeFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+// C output against the VM (see CEmitter), end to end: each engine test
+// program is emitted, built with the system C compiler as --output does,
+// and run on its input; it must print the same, report the same errors on
+// stderr, and exit with what finishline returned (1 on an error). Where
+// the VM announces "-nan" the C program may announce "nan". Skipped
+// without a C compiler.
+bool testCEmitter(std::ostream& out) {
+    const char* cc = std::getenv("CC");
+    std::string compiler = cc && *cc ? cc : "cc";
+    if (runCommand(compiler + " --version > /dev/null 2>&1") != 0) {
+        out << "skipped, no C compiler (" << compiler << ")";
+        return true;
+    }
+    std::string directory = temporaryPath((std::filesystem::temp_directory_path() / "autospeed-c").string());
+    std::error_code ignored;
+    std::filesystem::create_directories(directory, ignored);
+    std::string executable = directory + "/program", input = directory + "/input";
+    std::string output = directory + "/output", errors = directory + "/errors";
+    auto positiveNan = [](std::string text) {
+        for (size_t at = text.find("-nan"); at != std::string::npos; at = text.find("-nan", at)) text.erase(at, 1);
+        return text;
+    };
+
+    std::vector<TestProgram> programs = engineTestPrograms(60);
+    bool ok = true;
+    for (const TestProgram& program : programs) {
+        CompilationContext ctx;
+        auto tokens = scan(program.code, ctx);
+        ParseResult parsed = Parser(tokens, ctx).parse();
+        std::istringstream in(program.input);
+        std::ostringstream printed, expected;
+        RunResult result = runOnVm(parsed, ctx, in, printed); // Which also checks the types
+        expected << printed.str() << "--- exit " << (result.ok ? (int)(result.value & 0xFF) : 1) << "\n";
+        ctx.diagnostics.print(expected);
+
+        std::ofstream(input, std::ios::binary) << program.input;
+        std::string got = "--- did not build\n";
+        if (buildExecutable(CEmitter(ctx.symbols).emit(parsed.statements), executable) == 0) {
+            int status = runCommand("'" + executable + "' < '" + input + "' > '" + output + "' 2> '" + errors + "'");
+            got = readWholeFile(output) + "--- exit " + std::to_string(status) + "\n" + readWholeFile(errors);
+        }
+        if (positiveNan(got) != positiveNan(expected.str())) {
+            reportMismatch(out, program, "C", got, expected.str());
+            ok = false;
+            break;
+        }
+    }
+    std::filesystem::remove_all(directory, ignored);
+    if (ok) out << programs.size() << " programs built as C print, report and exit as they do on the VM";
+    return ok;
+}
+
+} // namespace
+
+int runSelfTests() {
+    struct SelfTest {
+        const char* name;
+        bool (*run)(std::ostream& out); // Writes a summary, or what went wrong
+    };
+    static const SelfTest tests[] = {
+        { "scan kernels", testScanKernels },
+        { "relex", testRelex },
+        { "incremental parser", testIncrementalParser },
+        { "parallel parser", testParallelParse },
+        { "shared expressions", testSharedExpressions },
+        { "ast cache", testAstCache },
+        { "function cache", testFunctionCache },
+        { "scope resolver", testScopeResolver },
+        { "type checker", testTypeChecker },
+        { "native code", testNative },
+        { "ast interpreter", testInterpreter },
+        { "ssa", testSsa },
+        { "optimizer", testOptimizer },
+        { "c output", testCEmitter },
+    };
+
+    int failed = 0;
+    for (const SelfTest& test : tests) {
+        std::ostringstream out;
+        bool ok = test.run(out);
+        std::cout << (ok ? "ok    " : "FAIL  ") << test.name << ": " << out.str() << "\n";
+        if (!ok) failed++;
+    }
+    return failed ? 1 : 0;
+}
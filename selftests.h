@@ -0,0 +1,11 @@
+#pragma once
+
+// --- Self-tests ---
+// What AutoSpeed --selftest runs (see selftests.cpp).
+
+/*
+ * runSelfTests
+ * Checks the fast paths against the code they stand in for, on generated
+ * input. Prints a line per test; returns 1 if one fails.
+ */
+int runSelfTests();
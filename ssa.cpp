@@ -0,0 +1,299 @@
+#include "ssa.h"
+
+#include <algorithm>
+#include <cstdio>
+
+using namespace std;
+
+const char* irOpName(IrOp op) {
+    static const char* const names[] = {
+#define AUTOSPEED_IR_OP_NAME(name) #name,
+        AUTOSPEED_IR_OPS(AUTOSPEED_IR_OP_NAME)
+#undef AUTOSPEED_IR_OP_NAME
+    };
+    return op < IR_COUNT ? names[op] : "?";
+}
+
+vector<uint32_t> IrFunction::successors(uint32_t block) const {
+    const IrInstr& last = terminator(block);
+    switch (last.op) {
+    case IR_JUMP:   return { last.targets[0] };
+    case IR_BRANCH: return { last.targets[0], last.targets[1] };
+    default:        return {};
+    }
+}
+
+size_t IrFunction::size() const {
+    size_t count = 0;
+    for (const IrBlock& block : blocks) count += block.code.size();
+    return count;
+}
+
+bool irCanFail(const IrFunction& function, const IrInstr& instr) {
+    if (instr.op == IR_LISTEN) return true;
+    if (instr.op != IR_DIV_I) return false;
+    const IrInstr& divisor = function.values[instr.b];
+    return divisor.op != IR_CONST || function.numbers[divisor.constant].i == 0;
+}
+
+bool irHasEffect(const IrFunction& function, const IrInstr& instr) {
+    switch (instr.op) {
+    case IR_ANNOUNCE:
+    case IR_LISTEN:
+    case IR_JUMP:
+    case IR_BRANCH:
+    case IR_RETURN:
+        return true;
+    default:
+        return irCanFail(function, instr);
+    }
+}
+
+/////////////////////// DOMINATORS ///////////////////////
+
+DominatorTree::DominatorTree(const IrFunction& function) {
+    size_t count = function.blocks.size();
+    parent.assign(count, NO_BLOCK);
+    kids.assign(count, {});
+    enter.assign(count, UINT32_MAX);
+    leave.assign(count, 0);
+
+    // Reverse postorder, by a DFS with an explicit stack of (block, next
+    // successor to visit).
+    vector<char> seen(count, 0);
+    vector<pair<uint32_t, size_t>> stack{ { 0, 0 } };
+    vector<vector<uint32_t>> successors(count);
+    seen[0] = 1;
+    successors[0] = function.successors(0);
+    while (!stack.empty()) {
+        auto& [block, next] = stack.back();
+        if (next < successors[block].size()) {
+            uint32_t s = successors[block][next++];
+            if (!seen[s]) {
+                seen[s] = 1;
+                successors[s] = function.successors(s);
+                stack.push_back({ s, 0 });
+            }
+            continue;
+        }
+        order.push_back(block);
+        stack.pop_back();
+    }
+    reverse(order.begin(), order.end());
+
+    vector<uint32_t> index(count, UINT32_MAX);
+    for (uint32_t k = 0; k < order.size(); k++) index[order[k]] = k;
+    auto intersect = [&](uint32_t a, uint32_t b) {
+        while (a != b) {
+            while (index[a] > index[b]) a = parent[a];
+            while (index[b] > index[a]) b = parent[b];
+        }
+        return a;
+    };
+    parent[0] = 0;
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (size_t k = 1; k < order.size(); k++) {
+            uint32_t block = order[k];
+            uint32_t idom = NO_BLOCK;
+            for (uint32_t p : function.blocks[block].preds) {
+                if (index[p] == UINT32_MAX || parent[p] == NO_BLOCK) continue; // Unreachable, or not reached yet
+                idom = idom == NO_BLOCK ? p : intersect(p, idom);
+            }
+            if (idom != parent[block]) {
+                parent[block] = idom;
+                changed = true;
+            }
+        }
+    }
+    parent[0] = NO_BLOCK;
+    for (uint32_t block : order)
+        if (parent[block] != NO_BLOCK) kids[parent[block]].push_back(block);
+
+    uint32_t clock = 0;
+    vector<pair<uint32_t, size_t>> walk{ { 0, 0 } };
+    enter[0] = clock++;
+    while (!walk.empty()) {
+        auto& [block, next] = walk.back();
+        if (next < kids[block].size()) {
+            uint32_t child = kids[block][next++];
+            enter[child] = clock++;
+            walk.push_back({ child, 0 });
+            continue;
+        }
+        leave[block] = clock++;
+        walk.pop_back();
+    }
+}
+
+vector<IrLoop> findLoops(const IrFunction& function, const DominatorTree& dominators) {
+    vector<IrLoop> loops;
+    vector<uint32_t> loopOf(function.blocks.size(), UINT32_MAX); // Index in 'loops', by header
+    for (uint32_t block : dominators.reversePostorder()) {
+        for (uint32_t s : function.successors(block)) {
+            if (!dominators.dominates(s, block)) continue;
+            if (loopOf[s] == UINT32_MAX) {
+                loopOf[s] = (uint32_t)loops.size();
+                loops.push_back({ s, NO_BLOCK, {}, {} });
+            }
+            loops[loopOf[s]].latches.push_back(block);
+        }
+    }
+
+    vector<char> inLoop(function.blocks.size(), 0);
+    for (IrLoop& loop : loops) {
+        // Everything that reaches a latch without going through the header.
+        loop.blocks.push_back(loop.header);
+        inLoop[loop.header] = 1;
+        vector<uint32_t> work = loop.latches;
+        while (!work.empty()) {
+            uint32_t block = work.back();
+            work.pop_back();
+            if (inLoop[block] || !dominators.reachable(block)) continue;
+            inLoop[block] = 1;
+            loop.blocks.push_back(block);
+            for (uint32_t p : function.blocks[block].preds) work.push_back(p);
+        }
+
+        uint32_t entering = NO_BLOCK;
+        size_t entries = 0;
+        for (uint32_t p : function.blocks[loop.header].preds) {
+            if (inLoop[p] || !dominators.reachable(p)) continue;
+            entering = p;
+            entries++;
+        }
+        if (entries == 1 && function.successors(entering).size() == 1) loop.preheader = entering;
+        for (uint32_t block : loop.blocks) inLoop[block] = 0;
+    }
+
+    // A loop inside another has fewer blocks than it.
+    stable_sort(loops.begin(), loops.end(), [](const IrLoop& a, const IrLoop& b) { return a.blocks.size() < b.blocks.size(); });
+    return loops;
+}
+
+/////////////////////// REWRITING ///////////////////////
+
+namespace {
+
+IrValue resolve(vector<IrValue>& forward, IrValue v) {
+    if (v == NO_VALUE) return v;
+    IrValue root = v;
+    while (forward[root] != root) root = forward[root];
+    while (forward[v] != root) {
+        IrValue next = forward[v];
+        forward[v] = root;
+        v = next;
+    }
+    return root;
+}
+
+} // namespace
+
+void replaceValues(IrFunction& function, vector<IrValue>& forward) {
+    for (IrBlock& block : function.blocks) {
+        for (IrValue v : block.code) {
+            IrInstr& instr = function.values[v];
+            instr.a = resolve(forward, instr.a);
+            instr.b = resolve(forward, instr.b);
+            for (IrValue& in : instr.incoming) in = resolve(forward, in);
+        }
+    }
+}
+
+size_t removeTrivialPhis(IrFunction& function) {
+    vector<IrValue> forward(function.values.size());
+    for (IrValue v = 0; v < forward.size(); v++) forward[v] = v;
+    size_t removed = 0;
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (IrBlock& block : function.blocks) {
+            auto out = block.code.begin();
+            for (IrValue v : block.code) {
+                IrInstr& instr = function.values[v];
+                IrValue same = NO_VALUE;
+                bool trivial = instr.op == IR_PHI;
+                for (size_t k = 0; trivial && k < instr.incoming.size(); k++) {
+                    IrValue in = resolve(forward, instr.incoming[k]);
+                    if (in == v || in == same) continue;
+                    if (same != NO_VALUE) trivial = false;
+                    same = in;
+                }
+                if (trivial && same != NO_VALUE) {
+                    forward[v] = same;
+                    removed++;
+                    changed = true;
+                    continue;
+                }
+                *out++ = v;
+            }
+            block.code.erase(out, block.code.end());
+        }
+    }
+    if (removed) replaceValues(function, forward);
+    return removed;
+}
+
+/////////////////////// PRINTER ///////////////////////
+
+namespace {
+
+string valueName(IrValue v) { return v == NO_VALUE ? "?" : "v" + to_string(v); }
+
+string constantText(const IrFunction& function, const IrInstr& instr) {
+    if (instr.type == TYPE_EXHAUST) return "\"" + function.strings[instr.constant] + "\"";
+    Number k = function.numbers[instr.constant];
+    switch (instr.type) {
+    case TYPE_TURBO: return formatDouble(k.d);
+    case TYPE_FLAG:  return k.i ? "true" : "false";
+    default:         return to_string(k.i);
+    }
+}
+
+} // namespace
+
+string printIr(const IrFunction& function, const SymbolTable& symbols) {
+    string out = "engine ";
+    out += function.name == NO_SYMBOL ? "?" : symbols.name(function.name);
+    out += " (line " + to_string(function.line) + "): " + to_string(function.layout.size()) + " blocks, " +
+           to_string(function.size()) + " instructions\n";
+
+    char text[64];
+    for (uint32_t b : function.layout) {
+        const IrBlock& block = function.blocks[b];
+        out += "b" + to_string(b) + ":";
+        for (size_t k = 0; k < block.preds.size(); k++) out += (k == 0 ? "  <- b" : ", b") + to_string(block.preds[k]);
+        out += '\n';
+
+        for (IrValue v : block.code) {
+            const IrInstr& instr = function.values[v];
+            if (instr.type != TYPE_ERROR)
+                snprintf(text, sizeof text, "%6d  %-6s %-8s= ", instr.line, valueName(v).c_str(), typeName(instr.type));
+            else
+                snprintf(text, sizeof text, "%6d  %-17s  ", instr.line, "");
+            out += text;
+            out += irOpName(instr.op);
+
+            switch (instr.op) {
+            case IR_CONST:
+                out += " " + constantText(function, instr);
+                break;
+            case IR_PHI:
+                for (size_t k = 0; k < instr.incoming.size(); k++)
+                    out += (k == 0 ? " [b" : ", [b") + to_string(block.preds[k]) + ": " + valueName(instr.incoming[k]) + "]";
+                break;
+            case IR_JUMP:
+                out += " b" + to_string(instr.targets[0]);
+                break;
+            case IR_BRANCH:
+                out += " " + valueName(instr.a) + ", b" + to_string(instr.targets[0]) + ", b" + to_string(instr.targets[1]);
+                break;
+            default:
+                if (instr.a != NO_VALUE) out += " " + valueName(instr.a);
+                if (instr.b != NO_VALUE) out += ", " + valueName(instr.b);
+                break;
+            }
+            out += '\n';
+        }
+    }
+    return out;
+}
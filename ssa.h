@@ -0,0 +1,203 @@
+#pragma once
+
+#include "bytecode.h"
+#include "literal.h"
+#include "symbol_table.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * SSA IR
+ * A function as a control flow graph of basic blocks, in static single
+ * assignment form: every value is defined by exactly one instruction, and
+ * where control flow joins, a PHI picks the value that came in along the
+ * edge that was taken. Variables are gone: reading one is using the value
+ * last stored in it. See SsaBuilder for how a tree becomes IR,
+ * SsaPassManager for the optimizations on it and generateBytecode for
+ * running it.
+ *
+ * An instruction is its value: IrValue v is IrFunction::values[v]. Each
+ * has a type, so that operations come unboxed, as in the bytecode (gear
+ * and flag arithmetic and comparisons are _I, turbo ones _D, exhaust ones
+ * _S; '>' and '>=' are '<' and '<=' with the operands swapped), and
+ * conversions are explicit. Constants are CONST instructions, all in the
+ * entry block.
+ *
+ * AUTOSPEED_IR_OPS lists every opcode once, with its operands, so the
+ * enum and the printer's names cannot disagree.
+ */
+#define AUTOSPEED_IR_OPS(X)                                                      \
+    X(CONST)    /* numbers[constant] or strings[constant], by type            */ \
+    X(PHI)      /* incoming[k] if control came from preds[k]                  */ \
+    X(ADD_I)    /* a + b, wrapping                                            */ \
+    X(SUB_I)                                                                     \
+    X(MUL_I)                                                                     \
+    X(DIV_I)    /* Fails on division by zero                                  */ \
+    X(ADD_D)                                                                     \
+    X(SUB_D)                                                                     \
+    X(MUL_D)                                                                     \
+    X(DIV_D)                                                                     \
+    X(I_TO_D)   /* a as a turbo                                               */ \
+    X(D_TO_I)   /* a as a gear, truncated                                     */ \
+    X(EQ_I)     /* a == b, as a flag                                          */ \
+    X(NE_I)                                                                      \
+    X(LT_I)                                                                      \
+    X(LE_I)                                                                      \
+    X(EQ_D)                                                                      \
+    X(NE_D)                                                                      \
+    X(LT_D)                                                                      \
+    X(LE_D)                                                                      \
+    X(EQ_S)                                                                      \
+    X(NE_S)                                                                      \
+    X(LT_S)                                                                      \
+    X(LE_S)                                                                      \
+    X(CONCAT)   /* a + b, as text                                             */ \
+    X(STR_I)    /* a as text                                                  */ \
+    X(STR_D)                                                                     \
+    X(STR_B)                                                                     \
+    X(ANNOUNCE) /* Writes a, by its type, and a newline                       */ \
+    X(LISTEN)   /* A line of input read as a value of the instruction's type  */ \
+    X(JUMP)     /* Go to targets[0]                                           */ \
+    X(BRANCH)   /* Go to targets[0] if a is non-zero, else to targets[1]      */ \
+    X(RETURN)   /* Finish with a                                              */
+
+enum IrOp : uint8_t {
+#define AUTOSPEED_IR_OP_ENUM(name) IR_##name,
+    AUTOSPEED_IR_OPS(AUTOSPEED_IR_OP_ENUM)
+#undef AUTOSPEED_IR_OP_ENUM
+    IR_COUNT
+};
+
+const char* irOpName(IrOp op);
+
+using IrValue = uint32_t;
+constexpr IrValue NO_VALUE = UINT32_MAX;
+constexpr uint32_t NO_BLOCK = UINT32_MAX;
+
+struct IrInstr {
+    IrOp op;
+    ValueType type = TYPE_ERROR; // Of its value; TYPE_ERROR if it has none
+    uint32_t block = 0;          // Where it is
+    int line = 0;                // Of the source it came from, for runtime errors
+    IrValue a = NO_VALUE;
+    IrValue b = NO_VALUE;
+    uint32_t constant = 0;       // CONST only
+    uint32_t targets[2] = { NO_BLOCK, NO_BLOCK }; // JUMP and BRANCH only
+    std::vector<IrValue> incoming; // PHI only: one value per predecessor of its block, in order
+};
+
+/*
+ * IrBlock
+ * Instructions that run in order: PHIs first, a terminator (JUMP, BRANCH
+ * or RETURN) last. An instruction taken out of 'code' is gone, though its
+ * slot in IrFunction::values stays.
+ */
+struct IrBlock {
+    std::vector<IrValue> code;
+    std::vector<uint32_t> preds; // Each edge once, in the order of PHI operands
+};
+
+/*
+ * IrFunction
+ * blocks[0] is the entry. 'layout' is the order the blocks go in when
+ * the function is made into bytecode: SsaBuilder puts a looplap's test
+ * after its body, as the bytecode compiler does, so a lap costs one jump.
+ */
+struct IrFunction {
+    Symbol name = NO_SYMBOL;
+    int line = 0;
+    std::vector<IrInstr> values;
+    std::vector<IrBlock> blocks;
+    std::vector<uint32_t> layout;
+    std::vector<Number> numbers;        // Numeric constants
+    std::vector<ValueType> numberTypes; // Their types, for the printer
+    std::vector<std::string> strings;   // String constants
+
+    const IrInstr& terminator(uint32_t block) const { return values[blocks[block].code.back()]; }
+    // The blocks a block's terminator goes to: none, one or two.
+    std::vector<uint32_t> successors(uint32_t block) const;
+    // Instructions in blocks, PHIs included.
+    size_t size() const;
+};
+
+/*
+ * irHasEffect
+ * Whether an instruction must run even if its value is not used: output,
+ * input, control flow, and a gear division that may fail.
+ */
+bool irHasEffect(const IrFunction& function, const IrInstr& instr);
+
+/*
+ * irCanFail
+ * Whether an instruction can stop the run: a gear division by anything
+ * but a non-zero constant, or a listen.
+ */
+bool irCanFail(const IrFunction& function, const IrInstr& instr);
+
+/*
+ * DominatorTree
+ * Block d dominates block b if every path from the entry to b goes
+ * through d. Built with Cooper, Harvey and Kennedy's iterative algorithm
+ * over the reverse postorder. Only blocks reachable from the entry are
+ * in the tree; dominates() is a constant-time test on its DFS numbering.
+ */
+class DominatorTree {
+public:
+    explicit DominatorTree(const IrFunction& function);
+
+    const std::vector<uint32_t>& reversePostorder() const { return order; }
+    uint32_t idom(uint32_t block) const { return parent[block]; } // NO_BLOCK for the entry
+    const std::vector<uint32_t>& children(uint32_t block) const { return kids[block]; }
+    bool reachable(uint32_t block) const { return enter[block] != UINT32_MAX; }
+    bool dominates(uint32_t d, uint32_t b) const { return enter[d] <= enter[b] && leave[b] <= leave[d]; }
+
+private:
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> parent;
+    std::vector<std::vector<uint32_t>> kids;
+    std::vector<uint32_t> enter; // Preorder and postorder numbers in the tree
+    std::vector<uint32_t> leave;
+};
+
+/*
+ * IrLoop
+ * A natural loop: 'header' dominates every block of it and is the target
+ * of its back edges, from 'latches'. 'preheader' is the one block outside
+ * the loop that enters it, if that block has no other successor;
+ * otherwise NO_BLOCK.
+ */
+struct IrLoop {
+    uint32_t header;
+    uint32_t preheader;
+    std::vector<uint32_t> latches;
+    std::vector<uint32_t> blocks; // Header included
+};
+
+/*
+ * findLoops
+ * Every loop of a function, inner loops before the loops around them.
+ */
+std::vector<IrLoop> findLoops(const IrFunction& function, const DominatorTree& dominators);
+
+/*
+ * replaceValues
+ * Makes every use of value v a use of forward[v] instead, following
+ * chains, for each v with forward[v] != v.
+ */
+void replaceValues(IrFunction& function, std::vector<IrValue>& forward);
+
+/*
+ * removeTrivialPhis
+ * Removes each PHI whose operands are all one value (or the PHI itself),
+ * using that value instead, until there are none. Returns how many went.
+ */
+size_t removeTrivialPhis(IrFunction& function);
+
+/*
+ * printIr
+ * A listing of 'function' for reading: its blocks in layout order, each
+ * with its predecessors, then one instruction per line with its value,
+ * type, operands and source line, constants shown by value.
+ */
+std::string printIr(const IrFunction& function, const SymbolTable& symbols);
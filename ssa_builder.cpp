@@ -0,0 +1,482 @@
+#include "ssa_builder.h"
+#include "type_checker.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+namespace {
+
+// Marks the slots of declarations (and listens) that are a whole track,
+// pitstop or looplap body rather than a statement of a block.
+class BareFinder {
+public:
+    friend struct ::Expr;
+    friend struct ::Stmt;
+
+    explicit BareFinder(vector<char>& bare) : bare(bare) {}
+
+    void walk(Stmt* stmt, bool whole) {
+        if (!stmt) return;
+        wholeBody = whole;
+        stmt->accept(*this);
+    }
+
+private:
+    vector<char>& bare;
+    bool wholeBody = false;
+
+    void visit(ExprStmt&) {}
+    void visit(AnnounceStmt&) {}
+    void visit(VarDeclStmt& stmt) { if (wholeBody) bare[stmt.slot] = 1; }
+    void visit(BlockStmt& stmt) { for (Stmt* s : stmt.statements) walk(s, false); }
+    void visit(LoopStmt& stmt) { walk(stmt.body, true); }
+    void visit(FinishlineStmt&) {}
+    void visit(FuncDefStmt&) {} // Not built when nested
+    void visit(IfStmt& stmt) { walk(stmt.thenBranch, true); walk(stmt.elseBranch, true); }
+    void visit(ListenStmt& stmt) { if (wholeBody) bare[stmt.slot] = 1; }
+};
+
+// Collects the slots a looplap's condition and body store to.
+class StoreFinder {
+public:
+    friend struct ::Expr;
+    friend struct ::Stmt;
+
+    vector<uint32_t> found;
+
+    void walk(Stmt* stmt) { if (stmt) stmt->accept(*this); }
+    void walk(Expr* expr) { if (expr) expr->accept(*this); }
+
+private:
+    void visit(BinaryExpr& expr) { walk(expr.left); walk(expr.right); }
+    void visit(LiteralExpr&) {}
+    void visit(VariableExpr&) {}
+    void visit(AssignExpr& expr) { found.push_back(expr.slot); walk(expr.value); }
+
+    void visit(ExprStmt& stmt) { walk(stmt.expression); }
+    void visit(AnnounceStmt& stmt) { walk(stmt.expression); }
+    void visit(VarDeclStmt& stmt) { walk(stmt.initializer); found.push_back(stmt.slot); }
+    void visit(BlockStmt& stmt) { for (Stmt* s : stmt.statements) walk(s); }
+    void visit(LoopStmt& stmt) { walk(stmt.condition); walk(stmt.body); }
+    void visit(FinishlineStmt& stmt) { walk(stmt.value); }
+    void visit(FuncDefStmt&) {}
+    void visit(IfStmt& stmt) { walk(stmt.condition); walk(stmt.thenBranch); walk(stmt.elseBranch); }
+    void visit(ListenStmt& stmt) { found.push_back(stmt.slot); }
+};
+
+bool isArithmetic(TokenType op) { return op == OP_PLUS || op == OP_MINUS || op == OP_STAR || op == OP_SLASH; }
+
+bool isNumeric(ValueType type) { return type == TYPE_GEAR || type == TYPE_TURBO; }
+
+// The value stored to 'slot' in 'values' (sorted by slot), or NO_VALUE.
+IrValue storedValue(const vector<pair<uint32_t, IrValue>>& values, uint32_t slot) {
+    auto it = lower_bound(values.begin(), values.end(), make_pair(slot, (IrValue)0));
+    return it != values.end() && it->first == slot ? it->second : NO_VALUE;
+}
+
+} // namespace
+
+bool SsaBuilder::build(FuncDefStmt& func, IrFunction& out) {
+    TypeChecker checker(symbols, diagnostics);
+    if (!checker.check(func)) return false;
+
+    out = IrFunction();
+    out.name = func.name;
+    out.line = func.line;
+    fn = &out;
+    slotTypes = checker.slotTypes();
+    defs.assign(slotTypes.size(), NO_VALUE);
+    bare.assign(slotTypes.size(), 0);
+    BareFinder(bare).walk(func.body, false);
+    undo.clear();
+    constants.clear();
+    numberConstants.clear();
+    stringConstants.clear();
+
+    line = func.line;
+    start(block());
+    statement(func.body);
+    if (current != NO_BLOCK) emit(IR_RETURN, TYPE_ERROR, zero(TYPE_GEAR)); // Falling off the end finishes with 0
+
+    vector<IrValue>& entry = out.blocks[0].code;
+    entry.insert(entry.begin(), constants.begin(), constants.end());
+    removeTrivialPhis(out);
+    fn = nullptr;
+    return true;
+}
+
+/////////////////////// BLOCKS ///////////////////////
+
+uint32_t SsaBuilder::block() {
+    fn->blocks.emplace_back();
+    return (uint32_t)fn->blocks.size() - 1;
+}
+
+void SsaBuilder::edge(uint32_t from, uint32_t to) {
+    fn->blocks[to].preds.push_back(from);
+}
+
+void SsaBuilder::start(uint32_t b) {
+    current = b;
+    fn->layout.push_back(b);
+}
+
+IrValue SsaBuilder::emit(IrOp op, ValueType type, IrValue a, IrValue b) {
+    IrInstr instr;
+    instr.op = op;
+    instr.type = type;
+    instr.block = current;
+    instr.line = line;
+    instr.a = a;
+    instr.b = b;
+    fn->values.push_back(move(instr));
+    IrValue v = (IrValue)fn->values.size() - 1;
+    fn->blocks[current].code.push_back(v);
+    return v;
+}
+
+void SsaBuilder::jump(uint32_t to) {
+    if (current == NO_BLOCK) return;
+    IrValue j = emit(IR_JUMP, TYPE_ERROR);
+    fn->values[j].targets[0] = to;
+    edge(current, to);
+    current = NO_BLOCK;
+}
+
+// Goes after the PHIs already in 'b'.
+IrValue SsaBuilder::phi(uint32_t b, ValueType type) {
+    IrInstr instr;
+    instr.op = IR_PHI;
+    instr.type = type;
+    instr.block = b;
+    instr.line = line;
+    fn->values.push_back(move(instr));
+    IrValue v = (IrValue)fn->values.size() - 1;
+    vector<IrValue>& code = fn->blocks[b].code;
+    auto at = find_if(code.begin(), code.end(), [&](IrValue c) { return fn->values[c].op != IR_PHI; });
+    code.insert(at, v);
+    return v;
+}
+
+/////////////////////// VALUES ///////////////////////
+
+IrValue SsaBuilder::constant(const LiteralValue& value) {
+    Number n;
+    switch (value.kind) {
+    case LiteralValue::DOUBLE:
+        n.d = value.d;
+        return numberConstant(TYPE_TURBO, n);
+    case LiteralValue::BOOL:
+        n.i = value.b ? 1 : 0;
+        return numberConstant(TYPE_FLAG, n);
+    case LiteralValue::STRING:
+        return stringConstant(value.s);
+    default:
+        n.i = value.i;
+        return numberConstant(TYPE_GEAR, n);
+    }
+}
+
+// Constants are made once each, for the entry block.
+IrValue SsaBuilder::numberConstant(ValueType type, Number n) {
+    uint64_t bits;
+    memcpy(&bits, &n, sizeof bits);
+    auto it = numberConstants.find({ type, bits });
+    if (it != numberConstants.end()) return it->second;
+
+    IrInstr instr;
+    instr.op = IR_CONST;
+    instr.type = type;
+    instr.line = fn->line;
+    instr.constant = (uint32_t)fn->numbers.size();
+    fn->numbers.push_back(n);
+    fn->numberTypes.push_back(type);
+    fn->values.push_back(move(instr));
+    IrValue v = (IrValue)fn->values.size() - 1;
+    constants.push_back(v);
+    numberConstants.emplace(make_pair(type, bits), v);
+    return v;
+}
+
+IrValue SsaBuilder::stringConstant(Symbol text) {
+    auto it = stringConstants.find(text);
+    if (it != stringConstants.end()) return it->second;
+
+    IrInstr instr;
+    instr.op = IR_CONST;
+    instr.type = TYPE_EXHAUST;
+    instr.line = fn->line;
+    instr.constant = (uint32_t)fn->strings.size();
+    fn->strings.emplace_back(text == NO_SYMBOL ? string_view() : symbols.name(text));
+    fn->values.push_back(move(instr));
+    IrValue v = (IrValue)fn->values.size() - 1;
+    constants.push_back(v);
+    stringConstants.emplace(text, v);
+    return v;
+}
+
+IrValue SsaBuilder::zero(ValueType type) {
+    if (type == TYPE_EXHAUST) return stringConstant(NO_SYMBOL);
+    Number n;
+    n.i = 0; // Also 0.0 and false
+    return numberConstant(type, n);
+}
+
+IrValue SsaBuilder::read(uint32_t slot) {
+    return defs[slot] != NO_VALUE ? defs[slot] : zero(slotTypes[slot]);
+}
+
+void SsaBuilder::store(uint32_t slot, IrValue value) {
+    undo.push_back({ slot, defs[slot] });
+    defs[slot] = value;
+}
+
+vector<uint32_t> SsaBuilder::stored(size_t mark) const {
+    vector<uint32_t> slots;
+    for (size_t k = mark; k < undo.size(); k++) slots.push_back(undo[k].first);
+    sort(slots.begin(), slots.end());
+    slots.erase(unique(slots.begin(), slots.end()), slots.end());
+    return slots;
+}
+
+void SsaBuilder::rollback(size_t mark) {
+    while (undo.size() > mark) {
+        defs[undo.back().first] = undo.back().second;
+        undo.pop_back();
+    }
+}
+
+// Only gear and turbo convert into each other.
+IrValue SsaBuilder::convert(IrValue value, ValueType type) {
+    ValueType from = fn->values[value].type;
+    if (from == type) return value;
+    return emit(type == TYPE_TURBO ? IR_I_TO_D : IR_D_TO_I, type, value);
+}
+
+IrValue SsaBuilder::text(IrValue value) {
+    switch (fn->values[value].type) {
+    case TYPE_EXHAUST: return value;
+    case TYPE_GEAR:    return emit(IR_STR_I, TYPE_EXHAUST, value);
+    case TYPE_TURBO:   return emit(IR_STR_D, TYPE_EXHAUST, value);
+    default:           return emit(IR_STR_B, TYPE_EXHAUST, value);
+    }
+}
+
+// A turbo is true if it is not 0.0.
+IrValue SsaBuilder::condition(Expr* expr) {
+    IrValue value = expression(expr);
+    if (fn->values[value].type != TYPE_TURBO) return value;
+    return emit(IR_NE_D, TYPE_FLAG, value, zero(TYPE_TURBO));
+}
+
+/////////////////////// EXPRESSIONS ///////////////////////
+
+IrValue SsaBuilder::expression(Expr* expr) {
+    if (!expr) return zero(TYPE_GEAR);
+    return expr->accept(*this);
+}
+
+// The left operand is a value, not a variable, so an assignment on the
+// right cannot change it, and needs no copy.
+IrValue SsaBuilder::visit(BinaryExpr& expr) {
+    IrValue left = expression(expr.left);
+    IrValue right = expression(expr.right);
+    line = expr.line;
+    ValueType l = fn->values[left].type, r = fn->values[right].type;
+
+    if (isArithmetic(expr.op)) {
+        int index = expr.op == OP_PLUS ? 0 : expr.op == OP_MINUS ? 1 : expr.op == OP_STAR ? 2 : 3;
+        if (expr.op == OP_PLUS && (l == TYPE_EXHAUST || r == TYPE_EXHAUST)) {
+            left = text(left);
+            right = text(right);
+            return emit(IR_CONCAT, TYPE_EXHAUST, left, right);
+        }
+        if (l == TYPE_GEAR && r == TYPE_GEAR) return emit((IrOp)(IR_ADD_I + index), TYPE_GEAR, left, right);
+        left = convert(left, TYPE_TURBO);
+        right = convert(right, TYPE_TURBO);
+        return emit((IrOp)(IR_ADD_D + index), TYPE_TURBO, left, right);
+    }
+
+    TokenType op = expr.op;
+    if (op == OP_GREATER || op == OP_GREATER_EQUAL) {
+        swap(left, right);
+        swap(l, r);
+        op = op == OP_GREATER ? OP_LESS : OP_LESS_EQUAL;
+    }
+    int index = op == OP_EQUAL ? 0 : op == OP_NOT_EQUAL ? 1 : op == OP_LESS ? 2 : 3;
+    if (isNumeric(l) && isNumeric(r) && !(l == TYPE_GEAR && r == TYPE_GEAR)) {
+        left = convert(left, TYPE_TURBO);
+        right = convert(right, TYPE_TURBO);
+        return emit((IrOp)(IR_EQ_D + index), TYPE_FLAG, left, right);
+    }
+    if (l == TYPE_EXHAUST) return emit((IrOp)(IR_EQ_S + index), TYPE_FLAG, left, right);
+    return emit((IrOp)(IR_EQ_I + index), TYPE_FLAG, left, right); // Gears, or flags with == and !=
+}
+
+IrValue SsaBuilder::visit(LiteralExpr& expr) {
+    return constant(expr.value);
+}
+
+IrValue SsaBuilder::visit(VariableExpr& expr) {
+    return read(expr.slot);
+}
+
+// Its value is the variable's new one.
+IrValue SsaBuilder::visit(AssignExpr& expr) {
+    IrValue value = expression(expr.value);
+    line = expr.line;
+    value = convert(value, slotTypes[expr.slot]);
+    store(expr.slot, value);
+    return value;
+}
+
+/////////////////////// STATEMENTS ///////////////////////
+
+// Code after a finishline cannot run and is not built.
+void SsaBuilder::statement(Stmt* stmt) {
+    if (stmt && current != NO_BLOCK) stmt->accept(*this);
+}
+
+void SsaBuilder::visit(ExprStmt& stmt) {
+    expression(stmt.expression);
+}
+
+void SsaBuilder::visit(AnnounceStmt& stmt) {
+    emit(IR_ANNOUNCE, TYPE_ERROR, expression(stmt.expression));
+}
+
+void SsaBuilder::visit(VarDeclStmt& stmt) {
+    ValueType type = slotTypes[stmt.slot];
+    IrValue value = stmt.initializer ? expression(stmt.initializer) : zero(type);
+    line = stmt.line;
+    store(stmt.slot, convert(value, type));
+}
+
+void SsaBuilder::visit(BlockStmt& stmt) {
+    for (Stmt* s : stmt.statements) statement(s);
+}
+
+// The header, which tests the condition, is laid out after the body, so
+// the body falls through into it and a lap costs one jump.
+void SsaBuilder::visit(LoopStmt& stmt) {
+    StoreFinder finder;
+    finder.walk(stmt.condition);
+    finder.walk(stmt.body);
+    vector<uint32_t>& slots = finder.found;
+    sort(slots.begin(), slots.end());
+    slots.erase(unique(slots.begin(), slots.end()), slots.end());
+    // A variable declared in a block of the loop is declared afresh on
+    // each lap before it is read; it needs no PHI.
+    slots.erase(remove_if(slots.begin(), slots.end(), [&](uint32_t s) { return defs[s] == NO_VALUE && !bare[s]; }),
+                slots.end());
+
+    uint32_t header = block();
+    jump(header);
+    current = header;
+    vector<IrValue> phis;
+    for (uint32_t slot : slots) {
+        IrValue entering = read(slot);
+        IrValue p = phi(header, slotTypes[slot]);
+        fn->values[p].incoming.push_back(entering);
+        phis.push_back(p);
+        store(slot, p);
+    }
+
+    IrValue test = condition(stmt.condition);
+    IrValue branch = emit(IR_BRANCH, TYPE_ERROR, test);
+    uint32_t body = block();
+    uint32_t exit = block();
+    edge(header, body);
+    edge(header, exit);
+    fn->values[branch].targets[0] = body;
+    fn->values[branch].targets[1] = exit;
+
+    size_t mark = undo.size();
+    start(body);
+    statement(stmt.body);
+    if (current != NO_BLOCK) {
+        for (size_t k = 0; k < slots.size(); k++) fn->values[phis[k]].incoming.push_back(defs[slots[k]]);
+        jump(header);
+    }
+    rollback(mark); // To the values the header's test left
+    fn->layout.push_back(header);
+    start(exit);
+}
+
+void SsaBuilder::visit(FinishlineStmt& stmt) {
+    IrValue value = expression(stmt.value);
+    if (fn->values[value].type == TYPE_TURBO) value = convert(value, TYPE_GEAR);
+    emit(IR_RETURN, TYPE_ERROR, value);
+    current = NO_BLOCK;
+}
+
+void SsaBuilder::visit(FuncDefStmt&) {}
+
+void SsaBuilder::visit(IfStmt& stmt) {
+    IrValue test = condition(stmt.condition);
+    uint32_t from = current;
+    IrValue branch = emit(IR_BRANCH, TYPE_ERROR, test);
+    current = NO_BLOCK;
+    size_t mark = undo.size();
+
+    // Each side's end (NO_BLOCK if it cannot fall through) and what it stored.
+    auto side = [&](Stmt* branchStmt, int target, uint32_t& end, vector<pair<uint32_t, IrValue>>& values) {
+        uint32_t b = block();
+        edge(from, b);
+        fn->values[branch].targets[target] = b;
+        start(b);
+        statement(branchStmt);
+        end = current;
+        for (uint32_t slot : stored(mark)) values.push_back({ slot, defs[slot] });
+        rollback(mark);
+    };
+    uint32_t thenEnd, elseEnd = from;
+    vector<pair<uint32_t, IrValue>> thenValues, elseValues;
+    side(stmt.thenBranch, 0, thenEnd, thenValues);
+    if (stmt.elseBranch) side(stmt.elseBranch, 1, elseEnd, elseValues);
+    if (thenEnd == NO_BLOCK && elseEnd == NO_BLOCK) {
+        current = NO_BLOCK;
+        return;
+    }
+
+    uint32_t join = block();
+    current = thenEnd;
+    jump(join);
+    if (stmt.elseBranch) {
+        current = elseEnd;
+        jump(join);
+    }
+    else {
+        edge(from, join);
+        fn->values[branch].targets[1] = join;
+    }
+    start(join);
+
+    vector<uint32_t> slots;
+    for (auto& entry : thenValues) slots.push_back(entry.first);
+    for (auto& entry : elseValues) slots.push_back(entry.first);
+    sort(slots.begin(), slots.end());
+    slots.erase(unique(slots.begin(), slots.end()), slots.end());
+    for (uint32_t slot : slots) {
+        // A variable declared inside one side is gone after it.
+        if (defs[slot] == NO_VALUE && !bare[slot]) continue;
+        IrValue before = read(slot);
+        IrValue onThen = storedValue(thenValues, slot), onElse = storedValue(elseValues, slot);
+        if (onThen == NO_VALUE) onThen = before;
+        if (onElse == NO_VALUE) onElse = before;
+        if (thenEnd == NO_BLOCK || onThen == onElse) store(slot, onElse);
+        else if (elseEnd == NO_BLOCK) store(slot, onThen);
+        else {
+            IrValue p = phi(join, slotTypes[slot]);
+            fn->values[p].incoming = { onThen, onElse };
+            store(slot, p);
+        }
+    }
+}
+
+void SsaBuilder::visit(ListenStmt& stmt) {
+    line = stmt.line;
+    store(stmt.slot, emit(IR_LISTEN, slotTypes[stmt.slot]));
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "diagnostics.h"
+#include "parser.h"
+#include "ssa.h"
+#include <cstdint>
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/*
+ * SsaBuilder
+ * Turns a function's tree into SSA IR (see ssa.h), in one walk.
+ *
+ * The function is type-checked first (TypeChecker), so each operation is
+ * built as the instruction for its operands' static types, with the same
+ * conversions the bytecode compiler makes. As it goes, the builder keeps
+ * the value each variable (frame slot) holds at the current point, and
+ * an undo log of what it overwrote:
+ *  - a track's branches each start from the values before it, and where
+ *    they join, a variable that differs between them gets a PHI;
+ *  - a looplap gets a PHI in its header for each variable stored in its
+ *    condition or body, whose operand from the back edge is the value at
+ *    the end of the body.
+ * Blocks are made only for code that can run: statements after a
+ * finishline in the same block are left out. A variable read before any
+ * value is stored in it (possible only for a declaration that is a whole
+ * track or looplap body) reads as 0 or "", as in a fresh frame. PHIs that
+ * turn out to pass on one value are removed at the end.
+ *
+ * Errors (those of TypeChecker) go to 'diagnostics'; build() then returns
+ * false and 'out' must not be used. The tree must be one that parsed
+ * without errors, and must not share expressions.
+ */
+class SsaBuilder {
+public:
+    SsaBuilder(const SymbolTable& symbols, Diagnostics& diagnostics) : symbols(symbols), diagnostics(diagnostics) {}
+
+    bool build(FuncDefStmt& func, IrFunction& out);
+
+private:
+    friend struct Expr; // accept() calls the visit() overloads
+    friend struct Stmt;
+
+    const SymbolTable& symbols;
+    Diagnostics& diagnostics;
+    IrFunction* fn = nullptr;
+    uint32_t current = NO_BLOCK; // Block being built; NO_BLOCK after a finishline
+    int line = 0;                // Of the instructions being made
+
+    std::vector<ValueType> slotTypes;
+    std::vector<IrValue> defs;                       // Value of each slot at this point; NO_VALUE if none yet
+    std::vector<char> bare;                          // Slots declared as a whole track or looplap body
+    std::vector<std::pair<uint32_t, IrValue>> undo; // (slot, value it had) for each store
+    std::vector<IrValue> constants;                  // Go into the entry block when done
+    std::map<std::pair<ValueType, uint64_t>, IrValue> numberConstants; // By type and bits
+    std::unordered_map<Symbol, IrValue> stringConstants;             // NO_SYMBOL for ""
+
+    // Blocks and instructions
+    uint32_t block(); // A new, empty block
+    void edge(uint32_t from, uint32_t to);
+    void start(uint32_t b); // Makes 'b' current and lays it out next
+    IrValue emit(IrOp op, ValueType type, IrValue a = NO_VALUE, IrValue b = NO_VALUE);
+    void jump(uint32_t to); // Ends the current block, if there is one
+    IrValue phi(uint32_t b, ValueType type);
+
+    // Values
+    IrValue constant(const LiteralValue& value);
+    IrValue numberConstant(ValueType type, Number n);
+    IrValue stringConstant(Symbol text);
+    IrValue zero(ValueType type);
+    IrValue read(uint32_t slot);
+    void store(uint32_t slot, IrValue value);
+    std::vector<uint32_t> stored(size_t mark) const; // Slots stored to since undo.size() was 'mark'
+    void rollback(size_t mark);
+    IrValue convert(IrValue value, ValueType type);
+    IrValue text(IrValue value);
+    IrValue condition(Expr* expr); // A gear or flag value, true if non-zero
+
+    // Expressions
+    IrValue expression(Expr* expr);
+    IrValue visit(BinaryExpr& expr);
+    IrValue visit(LiteralExpr& expr);
+    IrValue visit(VariableExpr& expr);
+    IrValue visit(AssignExpr& expr);
+
+    // Statements
+    void statement(Stmt* stmt);
+    void visit(ExprStmt& stmt);
+    void visit(AnnounceStmt& stmt);
+    void visit(VarDeclStmt& stmt);
+    void visit(BlockStmt& stmt);
+    void visit(LoopStmt& stmt);
+    void visit(FinishlineStmt& stmt);
+    void visit(FuncDefStmt& stmt);
+    void visit(IfStmt& stmt);
+    void visit(ListenStmt& stmt);
+};
@@ -0,0 +1,471 @@
+#include "ssa_codegen.h"
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+
+using namespace std;
+
+namespace {
+
+// Beyond this many pairs of values compared for interference, PHIs stop
+// being coalesced and keep their copies.
+constexpr size_t COALESCE_BUDGET = 1 << 22;
+
+static_assert(OP_STR_B - OP_ADD_I == IR_STR_B - IR_ADD_I, "IR and bytecode arithmetic must line up");
+
+bool hasValue(const IrInstr& instr) { return instr.type != TYPE_ERROR; }
+
+class Lowering {
+public:
+    Lowering(const IrFunction& function, BytecodeFunction& out, Diagnostics& diagnostics)
+        : function(function), out(out), diagnostics(diagnostics), dominators(function) {}
+
+    bool run();
+
+private:
+    // One register-to-register copy on an edge.
+    struct Copy {
+        bool text; // String registers, else numeric
+        uint32_t dst;
+        uint32_t src;
+    };
+
+    // Where an edge out of a branch that needs copies goes through.
+    struct Stub {
+        uint32_t to;
+        vector<Copy> copies;
+        int line;
+    };
+
+    const IrFunction& function;
+    BytecodeFunction& out;
+    Diagnostics& diagnostics;
+    DominatorTree dominators;
+
+    // Instructions numbered in layout order
+    vector<uint32_t> position; // By value
+    vector<uint32_t> blockAt;  // By position
+    vector<uint32_t> first;    // By block: its first position...
+    vector<uint32_t> last;     // ...and its last
+
+    // Liveness, by value
+    vector<vector<uint32_t>> uses;    // Positions of the non-PHI instructions using it, ascending
+    vector<vector<uint32_t>> liveOut; // Blocks it is live out of, ascending
+    vector<uint32_t> low;             // Its extent in the layout, in half steps: 2 * position for a use,
+    vector<uint32_t> high;            // 2 * position + 1 for a definition or the end of a block
+
+    // Coalescing and registers
+    vector<IrValue> leader;          // Union-find over values
+    vector<vector<IrValue>> members; // By leader
+    vector<uint32_t> registerOf;     // By value
+    uint32_t spareNumber = 0;
+    uint32_t spareString = 0;
+
+    // Code
+    vector<pair<uint32_t, uint32_t>> toBlocks; // (jump, block)
+    vector<pair<uint32_t, uint32_t>> toStubs;  // (jump, stub)
+    vector<Stub> stubs;
+    int line = 0;
+
+    void number();
+    void computeLiveness();
+    bool interfere(IrValue a, IrValue b) const;
+    IrValue find(IrValue v);
+    void coalesce();
+    bool allocate();
+
+    uint32_t emit(Op op, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0);
+    uint32_t here() const { return (uint32_t)out.code.size(); }
+    uint32_t reg(IrValue v) const { return registerOf[v]; }
+    vector<Copy> edgeCopies(uint32_t from, uint32_t to) const;
+    void emitCopies(vector<Copy> copies);
+    void jumpTo(uint32_t block);
+    uint32_t edgeTarget(uint32_t from, uint32_t to, bool& toBlock); // A block, or a new stub
+    void emitBlock(uint32_t block, uint32_t next);
+};
+
+bool Lowering::run() {
+    out.name = function.name;
+    out.line = function.line;
+    out.numbers = function.numbers;
+    out.numberTypes = function.numberTypes;
+    out.strings = function.strings;
+
+    number();
+    computeLiveness();
+    coalesce();
+    if (!allocate()) return false;
+
+    const vector<uint32_t>& layout = function.layout;
+    vector<uint32_t> address(function.blocks.size(), 0);
+    for (size_t k = 0; k < layout.size(); k++) {
+        address[layout[k]] = here();
+        emitBlock(layout[k], k + 1 < layout.size() ? layout[k + 1] : NO_BLOCK);
+    }
+    vector<uint32_t> stubAddress(stubs.size());
+    for (size_t k = 0; k < stubs.size(); k++) {
+        stubAddress[k] = here();
+        line = stubs[k].line;
+        emitCopies(stubs[k].copies);
+        jumpTo(stubs[k].to);
+    }
+    for (auto [jump, block] : toBlocks) out.code[jump].setTarget(address[block]);
+    for (auto [jump, stub] : toStubs) out.code[jump].setTarget(stubAddress[stub]);
+    return true;
+}
+
+/////////////////////// LIVENESS ///////////////////////
+
+void Lowering::number() {
+    position.assign(function.values.size(), 0);
+    first.assign(function.blocks.size(), 0);
+    last.assign(function.blocks.size(), 0);
+    for (uint32_t b : function.layout) {
+        first[b] = (uint32_t)blockAt.size();
+        for (IrValue v : function.blocks[b].code) {
+            position[v] = (uint32_t)blockAt.size();
+            blockAt.push_back(b);
+        }
+        last[b] = (uint32_t)blockAt.size() - 1;
+    }
+}
+
+// A value is live into the blocks on a path back from one of its uses to
+// its definition, and out of the blocks before those, and out of each
+// block a PHI takes it from.
+void Lowering::computeLiveness() {
+    size_t count = function.values.size();
+    uses.assign(count, {});
+    liveOut.assign(count, {});
+    low.assign(count, UINT32_MAX);
+    high.assign(count, 0);
+    vector<vector<uint32_t>> edges(count); // Blocks a PHI takes the value from
+
+    for (uint32_t b : function.layout) {
+        const IrBlock& block = function.blocks[b];
+        for (IrValue v : block.code) {
+            const IrInstr& instr = function.values[v];
+            if (instr.op == IR_PHI) {
+                for (size_t k = 0; k < instr.incoming.size(); k++) edges[instr.incoming[k]].push_back(block.preds[k]);
+                // Defined on entry to the block, by the copies at the end of
+                // each predecessor.
+                low[v] = 2 * first[b];
+                high[v] = 2 * first[b] + 1;
+                for (uint32_t p : block.preds) {
+                    low[v] = min(low[v], 2 * last[p] + 1);
+                    high[v] = max(high[v], 2 * last[p] + 1);
+                }
+                continue;
+            }
+            if (instr.a != NO_VALUE) uses[instr.a].push_back(position[v]);
+            if (instr.b != NO_VALUE && instr.b != instr.a) uses[instr.b].push_back(position[v]);
+            if (hasValue(instr) && instr.op != IR_CONST) low[v] = high[v] = 2 * position[v] + 1;
+        }
+    }
+
+    vector<IrValue> stamp(function.blocks.size(), NO_VALUE); // Blocks the value is known to be live into
+    vector<uint32_t> work;
+    for (IrValue v = 0; v < count; v++) {
+        if ((uses[v].empty() && edges[v].empty()) || function.values[v].op == IR_CONST) continue;
+        uint32_t def = function.values[v].block;
+        vector<uint32_t>& out = liveOut[v];
+        auto reach = [&](uint32_t b) {
+            if (b == def || stamp[b] == v) return;
+            stamp[b] = v;
+            work.push_back(b);
+        };
+        for (uint32_t at : uses[v]) {
+            high[v] = max(high[v], 2 * at);
+            reach(blockAt[at]);
+        }
+        for (uint32_t p : edges[v]) {
+            out.push_back(p);
+            reach(p);
+        }
+        while (!work.empty()) {
+            uint32_t b = work.back();
+            work.pop_back();
+            low[v] = min(low[v], 2 * first[b]);
+            for (uint32_t p : function.blocks[b].preds) {
+                out.push_back(p);
+                reach(p);
+            }
+        }
+        sort(out.begin(), out.end());
+        out.erase(unique(out.begin(), out.end()), out.end());
+        for (uint32_t b : out) high[v] = max(high[v], 2 * last[b] + 1);
+    }
+}
+
+// Two values interfere if one is live where the other is defined. In SSA
+// form that needs the definition of one to dominate the other's, so only
+// the later one's definition is looked at.
+bool Lowering::interfere(IrValue a, IrValue b) const {
+    const IrInstr& x = function.values[a];
+    const IrInstr& y = function.values[b];
+    IrValue earlier, later;
+    if (x.block == y.block) {
+        if (x.op == IR_PHI && y.op == IR_PHI) return true;
+        bool aFirst = x.op == IR_PHI || (y.op != IR_PHI && position[a] < position[b]);
+        earlier = aFirst ? a : b;
+        later = aFirst ? b : a;
+    }
+    else if (dominators.dominates(x.block, y.block)) {
+        earlier = a;
+        later = b;
+    }
+    else if (dominators.dominates(y.block, x.block)) {
+        earlier = b;
+        later = a;
+    }
+    else {
+        return false;
+    }
+
+    uint32_t block = function.values[later].block;
+    const vector<uint32_t>& out = liveOut[earlier];
+    if (binary_search(out.begin(), out.end(), block)) return true;
+    const vector<uint32_t>& at = uses[earlier];
+    auto next = upper_bound(at.begin(), at.end(), position[later]);
+    return next != at.end() && *next <= last[block];
+}
+
+/////////////////////// REGISTERS ///////////////////////
+
+IrValue Lowering::find(IrValue v) {
+    IrValue root = v;
+    while (leader[root] != root) root = leader[root];
+    while (leader[v] != root) {
+        IrValue next = leader[v];
+        leader[v] = root;
+        v = next;
+    }
+    return root;
+}
+
+// Each PHI joins its operands' groups if no two values of the groups
+// interfere; then the copy between them goes away. Constants keep their
+// own registers.
+void Lowering::coalesce() {
+    size_t count = function.values.size();
+    leader.resize(count);
+    members.assign(count, {});
+    for (IrValue v = 0; v < count; v++) {
+        leader[v] = v;
+        members[v].push_back(v);
+    }
+
+    size_t budget = COALESCE_BUDGET;
+    for (uint32_t b : function.layout) {
+        for (IrValue v : function.blocks[b].code) {
+            const IrInstr& phi = function.values[v];
+            if (phi.op != IR_PHI) break;
+            for (IrValue in : phi.incoming) {
+                IrValue p = find(v), q = find(in);
+                if (p == q || function.values[in].op == IR_CONST || function.values[in].type != phi.type) continue;
+                size_t cost = members[p].size() * members[q].size();
+                if (cost > budget) continue;
+                budget -= cost;
+                bool apart = true;
+                for (size_t i = 0; apart && i < members[p].size(); i++)
+                    for (size_t j = 0; apart && j < members[q].size(); j++) apart = !interfere(members[p][i], members[q][j]);
+                if (!apart) continue;
+
+                if (members[p].size() < members[q].size()) swap(p, q);
+                leader[q] = p;
+                members[p].insert(members[p].end(), members[q].begin(), members[q].end());
+                members[q].clear();
+                members[q].shrink_to_fit();
+            }
+        }
+    }
+}
+
+// Constants take the lowest registers, by their index, as in the
+// bytecode compiler, and hold them throughout. The other registers are
+// given out by linear scan over each group's extent, one register file at
+// a time: a register is free again once the extent it held has ended.
+bool Lowering::allocate() {
+    struct Extent {
+        uint32_t low;
+        uint32_t high;
+        IrValue group;
+    };
+    vector<Extent> extents[2]; // Numeric, string
+    for (IrValue v = 0; v < function.values.size(); v++) {
+        if (leader[v] != v || low[v] == UINT32_MAX) continue;
+        Extent extent{ UINT32_MAX, 0, v };
+        for (IrValue m : members[v]) {
+            extent.low = min(extent.low, low[m]);
+            extent.high = max(extent.high, high[m]);
+        }
+        extents[function.values[v].type == TYPE_EXHAUST].push_back(extent);
+    }
+
+    registerOf.assign(function.values.size(), 0);
+    uint32_t used[2] = { (uint32_t)function.numbers.size(), (uint32_t)function.strings.size() };
+    for (int file = 0; file < 2; file++) {
+        vector<Extent>& list = extents[file];
+        sort(list.begin(), list.end(), [](const Extent& a, const Extent& b) { return a.low < b.low; });
+        priority_queue<pair<uint32_t, uint32_t>, vector<pair<uint32_t, uint32_t>>, greater<>> active; // (high, register)
+        priority_queue<uint32_t, vector<uint32_t>, greater<>> free;
+        for (const Extent& extent : list) {
+            while (!active.empty() && active.top().first < extent.low) {
+                free.push(active.top().second);
+                active.pop();
+            }
+            uint32_t r;
+            if (!free.empty()) {
+                r = free.top();
+                free.pop();
+            }
+            else {
+                r = used[file]++;
+            }
+            active.push({ extent.high, r });
+            registerOf[extent.group] = r;
+        }
+    }
+    for (IrValue v = 0; v < function.values.size(); v++)
+        registerOf[v] = function.values[v].op == IR_CONST ? function.values[v].constant : registerOf[find(v)];
+
+    spareNumber = used[0]++;
+    spareString = used[1]++;
+    out.numberRegisters = used[0];
+    out.stringRegisters = used[1];
+    if (used[0] > 0x10000 || used[1] > 0x10000) {
+        diagnostics.report(function.line, 0, DIAG_FUNCTION_TOO_LARGE, "Function needs more than 65536 registers.");
+        return false;
+    }
+    return true;
+}
+
+/////////////////////// CODE ///////////////////////
+
+uint32_t Lowering::emit(Op op, uint32_t a, uint32_t b, uint32_t c) {
+    Instr in;
+    in.op = op;
+    in.a = (uint16_t)a;
+    in.b = (uint16_t)b;
+    in.c = (uint16_t)c;
+    out.code.push_back(in);
+    out.lines.push_back(line);
+    return here() - 1;
+}
+
+vector<Lowering::Copy> Lowering::edgeCopies(uint32_t from, uint32_t to) const {
+    const IrBlock& block = function.blocks[to];
+    size_t k = std::find(block.preds.begin(), block.preds.end(), from) - block.preds.begin();
+    vector<Copy> copies;
+    for (IrValue v : block.code) {
+        const IrInstr& phi = function.values[v];
+        if (phi.op != IR_PHI) break;
+        if (reg(v) != reg(phi.incoming[k])) copies.push_back({ phi.type == TYPE_EXHAUST, reg(v), reg(phi.incoming[k]) });
+    }
+    return copies;
+}
+
+// The copies happen at once: a copy goes when no other still reads its
+// destination; if each one's does, the copies form cycles, and one
+// destination is saved in the spare register to break its cycle.
+void Lowering::emitCopies(vector<Copy> copies) {
+    while (!copies.empty()) {
+        bool done = false;
+        for (size_t k = 0; k < copies.size() && !done; k++) {
+            const Copy& copy = copies[k];
+            bool read = any_of(copies.begin(), copies.end(), [&](const Copy& c) { return c.text == copy.text && c.src == copy.dst; });
+            if (read) continue;
+            emit(copy.text ? OP_MOVE_STR : OP_MOVE, copy.dst, copy.src);
+            copies.erase(copies.begin() + k);
+            done = true;
+        }
+        if (done) continue;
+
+        Copy& copy = copies.front();
+        uint32_t spare = copy.text ? spareString : spareNumber;
+        emit(copy.text ? OP_MOVE_STR : OP_MOVE, spare, copy.dst);
+        for (Copy& c : copies)
+            if (c.text == copy.text && c.src == copy.dst) c.src = spare;
+    }
+}
+
+void Lowering::jumpTo(uint32_t block) {
+    toBlocks.push_back({ emit(OP_JUMP), block });
+}
+
+uint32_t Lowering::edgeTarget(uint32_t from, uint32_t to, bool& toBlock) {
+    vector<Copy> copies = edgeCopies(from, to);
+    toBlock = copies.empty();
+    if (toBlock) return to;
+    stubs.push_back({ to, move(copies), line });
+    return (uint32_t)stubs.size() - 1;
+}
+
+void Lowering::emitBlock(uint32_t block, uint32_t next) {
+    for (IrValue v : function.blocks[block].code) {
+        const IrInstr& instr = function.values[v];
+        line = instr.line;
+        switch (instr.op) {
+        case IR_PHI:
+            break;
+        case IR_CONST:
+            emit(instr.type == TYPE_EXHAUST ? OP_LOAD_STR : OP_LOAD_NUM, reg(v), instr.constant);
+            break;
+        case IR_ANNOUNCE:
+            switch (function.values[instr.a].type) {
+            case TYPE_GEAR:    emit(OP_ANNOUNCE_I, reg(instr.a)); break;
+            case TYPE_TURBO:   emit(OP_ANNOUNCE_D, reg(instr.a)); break;
+            case TYPE_FLAG:    emit(OP_ANNOUNCE_B, reg(instr.a)); break;
+            default:           emit(OP_ANNOUNCE_S, reg(instr.a)); break;
+            }
+            break;
+        case IR_LISTEN:
+            switch (instr.type) {
+            case TYPE_GEAR:  emit(OP_LISTEN_I, reg(v)); break;
+            case TYPE_TURBO: emit(OP_LISTEN_D, reg(v)); break;
+            case TYPE_FLAG:  emit(OP_LISTEN_B, reg(v)); break;
+            default:         emit(OP_LISTEN_S, reg(v)); break;
+            }
+            break;
+        case IR_RETURN:
+            emit(OP_RETURN, reg(instr.a));
+            break;
+        case IR_JUMP:
+            emitCopies(edgeCopies(block, instr.targets[0]));
+            if (instr.targets[0] != next) jumpTo(instr.targets[0]);
+            break;
+        case IR_BRANCH: {
+            bool thenBlock, elseBlock;
+            uint32_t then = edgeTarget(block, instr.targets[0], thenBlock);
+            uint32_t otherwise = edgeTarget(block, instr.targets[1], elseBlock);
+            auto branch = [&](Op op, uint32_t target, bool toBlock) {
+                uint32_t jump = op == OP_JUMP ? emit(op) : emit(op, reg(instr.a));
+                (toBlock ? toBlocks : toStubs).push_back({ jump, target });
+            };
+            if (elseBlock && otherwise == next) {
+                branch(OP_JUMP_IF_TRUE, then, thenBlock);
+            }
+            else if (thenBlock && then == next) {
+                branch(OP_JUMP_IF_FALSE, otherwise, elseBlock);
+            }
+            else {
+                branch(OP_JUMP_IF_TRUE, then, thenBlock);
+                branch(OP_JUMP, otherwise, elseBlock);
+            }
+            break;
+        }
+        default: {
+            Op op = (Op)(OP_ADD_I + (instr.op - IR_ADD_I));
+            emit(op, reg(v), reg(instr.a), instr.b == NO_VALUE ? 0 : reg(instr.b));
+            break;
+        }
+        }
+    }
+}
+
+} // namespace
+
+bool generateBytecode(const IrFunction& function, BytecodeFunction& out, Diagnostics& diagnostics) {
+    return Lowering(function, out, diagnostics).run();
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "bytecode.h"
+#include "diagnostics.h"
+#include "ssa.h"
+
+/*
+ * generateBytecode
+ * Makes an IR function into bytecode for the VM, so that it can run and
+ * what the SSA passes did can be counted in instructions executed.
+ *
+ * PHIs become copies on the edges into their block. First each PHI is
+ * coalesced with its operands where their live ranges do not overlap
+ * (liveness is computed per value, by walking back from its uses), so
+ * that a variable updated in a loop keeps one register and needs no copy.
+ * The copies left go at the end of a predecessor with one successor, or,
+ * on an edge out of a branch, into a stub at the end of the code that
+ * jumps on to the block; copies that form a cycle go through a spare
+ * register. Registers are then given out by linear scan over each
+ * coalesced group's extent in the layout. Blocks go in layout order, and
+ * a jump to the next block is left out.
+ *
+ * Returns false, after reporting, if the function needs more registers
+ * than an instruction can name; 'out' must not be run then.
+ */
+bool generateBytecode(const IrFunction& function, BytecodeFunction& out, Diagnostics& diagnostics);
@@ -0,0 +1,356 @@
+#include "ssa_passes.h"
+
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+
+using namespace std;
+
+bool parsePasses(const string& text, unsigned& passes) {
+    if (text == "default" || text == "all") {
+        passes = text == "all" ? PASS_ALL : PASS_DEFAULT;
+        return true;
+    }
+    passes = PASS_NONE;
+    if (text == "none") return true;
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t end = text.find(',', start);
+        if (end == string::npos) end = text.size();
+        string name = text.substr(start, end - start);
+        if (name == "gvn") passes |= PASS_GVN;
+        else if (name == "licm") passes |= PASS_LICM;
+        else if (name == "sr") passes |= PASS_STRENGTH;
+        else if (name == "dse") passes |= PASS_DSE;
+        else return false;
+        start = end + 1;
+    }
+    return true;
+}
+
+void SsaPassManager::run(IrFunction& function) {
+    counters.instructionsBefore += function.size();
+    if (passes & PASS_GVN) valueNumbering(function);
+    if (passes & PASS_LICM) hoistInvariants(function);
+    if (passes & PASS_STRENGTH) reduceStrength(function);
+    if (passes & PASS_DSE) removeDeadStores(function);
+    counters.instructionsAfter += function.size();
+}
+
+namespace {
+
+// Instructions whose value depends only on their operands; CONST and PHI
+// are told apart by the caller.
+bool isPure(IrOp op) { return op <= IR_STR_B; }
+
+bool isCommutative(IrOp op) {
+    switch (op) {
+    case IR_ADD_I:
+    case IR_MUL_I:
+    case IR_ADD_D:
+    case IR_MUL_D:
+    case IR_EQ_I:
+    case IR_NE_I:
+    case IR_EQ_D:
+    case IR_NE_D:
+    case IR_EQ_S:
+    case IR_NE_S:
+        return true;
+    default:
+        return false;
+    }
+}
+
+struct ValueKey {
+    IrOp op;
+    ValueType type;
+    IrValue a;
+    IrValue b;
+    uint32_t constant;
+
+    bool operator==(const ValueKey& o) const {
+        return op == o.op && type == o.type && a == o.a && b == o.b && constant == o.constant;
+    }
+};
+
+struct ValueKeyHash {
+    size_t operator()(const ValueKey& k) const {
+        uint64_t h = (uint64_t)k.op << 56 ^ (uint64_t)k.type << 48 ^ (uint64_t)k.constant << 24;
+        h ^= (uint64_t)k.a * 0x9E3779B97F4A7C15ull;
+        h ^= (uint64_t)k.b * 0xC2B2AE3D27D4EB4Full;
+        return (size_t)(h ^ h >> 29);
+    }
+};
+
+vector<IrValue> identity(const IrFunction& function) {
+    vector<IrValue> forward(function.values.size());
+    for (IrValue v = 0; v < forward.size(); v++) forward[v] = v;
+    return forward;
+}
+
+IrValue follow(const vector<IrValue>& forward, IrValue v) {
+    if (v == NO_VALUE) return v;
+    while (forward[v] != v) v = forward[v];
+    return v;
+}
+
+// A new instruction in 'block', not yet placed in its code.
+IrValue make(IrFunction& function, IrOp op, ValueType type, IrValue a, IrValue b, uint32_t block, int line) {
+    IrInstr instr;
+    instr.op = op;
+    instr.type = type;
+    instr.block = block;
+    instr.line = line;
+    instr.a = a;
+    instr.b = b;
+    function.values.push_back(move(instr));
+    return (IrValue)function.values.size() - 1;
+}
+
+// Puts 'moved' at the end of 'block', before its terminator.
+void append(IrFunction& function, uint32_t block, const vector<IrValue>& moved) {
+    vector<IrValue>& code = function.blocks[block].code;
+    code.insert(code.end() - 1, moved.begin(), moved.end());
+}
+
+} // namespace
+
+/////////////////////// GLOBAL VALUE NUMBERING ///////////////////////
+
+// A value computed in a block is available in every block it dominates,
+// so the table holds what the blocks from the entry down to the current
+// one computed, and loses a block's entries when the walk leaves it.
+void SsaPassManager::valueNumbering(IrFunction& function) {
+    DominatorTree dominators(function);
+    vector<IrValue> forward = identity(function);
+    unordered_map<ValueKey, IrValue, ValueKeyHash> available;
+    vector<ValueKey> added; // Keys in 'available', in the order they went in
+
+    struct Visit {
+        uint32_t block;
+        size_t mark; // added.size() on entering the block
+        size_t next; // Next child
+    };
+    vector<Visit> stack;
+    auto enter = [&](uint32_t b) {
+        stack.push_back({ b, added.size(), 0 });
+        vector<IrValue>& code = function.blocks[b].code;
+        auto out = code.begin();
+        for (IrValue v : code) {
+            IrInstr& instr = function.values[v];
+            instr.a = follow(forward, instr.a);
+            instr.b = follow(forward, instr.b);
+            if (instr.op == IR_PHI) {
+                // Operands along back edges may not be numbered yet;
+                // removeTrivialPhis() below sees them all.
+                IrValue same = NO_VALUE;
+                bool trivial = true;
+                for (IrValue& in : instr.incoming) {
+                    in = follow(forward, in);
+                    if (in == v || in == same) continue;
+                    if (same != NO_VALUE) trivial = false;
+                    same = in;
+                }
+                if (trivial && same != NO_VALUE) {
+                    forward[v] = same;
+                    counters.merged++;
+                    continue;
+                }
+            }
+            else if (isPure(instr.op)) {
+                ValueKey key{ instr.op, instr.type, instr.a, instr.b, instr.constant };
+                if (isCommutative(key.op) && key.b < key.a) swap(key.a, key.b);
+                auto found = available.find(key);
+                if (found != available.end()) {
+                    forward[v] = found->second;
+                    counters.merged++;
+                    continue;
+                }
+                available.emplace(key, v);
+                added.push_back(key);
+            }
+            *out++ = v;
+        }
+        code.erase(out, code.end());
+    };
+
+    enter(0);
+    while (!stack.empty()) {
+        Visit& top = stack.back();
+        const vector<uint32_t>& children = dominators.children(top.block);
+        if (top.next < children.size()) {
+            enter(children[top.next++]);
+            continue;
+        }
+        while (added.size() > top.mark) {
+            available.erase(added.back());
+            added.pop_back();
+        }
+        stack.pop_back();
+    }
+    replaceValues(function, forward);
+    counters.merged += removeTrivialPhis(function);
+}
+
+/////////////////////// LOOP-INVARIANT CODE MOTION ///////////////////////
+
+// The loop's blocks are visited in reverse postorder, so an instruction
+// comes after the ones it uses, and can follow them out.
+void SsaPassManager::hoistInvariants(IrFunction& function) {
+    DominatorTree dominators(function);
+    vector<uint32_t> rank(function.blocks.size(), UINT32_MAX);
+    for (uint32_t k = 0; k < dominators.reversePostorder().size(); k++) rank[dominators.reversePostorder()[k]] = k;
+
+    vector<char> inLoop(function.blocks.size(), 0);
+    for (IrLoop& loop : findLoops(function, dominators)) {
+        if (loop.preheader == NO_BLOCK) continue;
+        sort(loop.blocks.begin(), loop.blocks.end(), [&](uint32_t a, uint32_t b) { return rank[a] < rank[b]; });
+        for (uint32_t b : loop.blocks) inLoop[b] = 1;
+        auto outside = [&](IrValue v) { return v == NO_VALUE || !inLoop[function.values[v].block]; };
+
+        vector<IrValue> hoisted;
+        for (uint32_t b : loop.blocks) {
+            vector<IrValue>& code = function.blocks[b].code;
+            auto out = code.begin();
+            for (IrValue v : code) {
+                IrInstr& instr = function.values[v];
+                bool invariant = isPure(instr.op) && instr.op != IR_CONST && instr.op != IR_PHI &&
+                                 !irCanFail(function, instr) && outside(instr.a) && outside(instr.b);
+                if (invariant) {
+                    instr.block = loop.preheader;
+                    hoisted.push_back(v);
+                    continue;
+                }
+                *out++ = v;
+            }
+            code.erase(out, code.end());
+        }
+        append(function, loop.preheader, hoisted);
+        counters.hoisted += hoisted.size();
+        for (uint32_t b : loop.blocks) inLoop[b] = 0;
+    }
+}
+
+/////////////////////// STRENGTH REDUCTION ///////////////////////
+
+// For a basic induction variable i = phi(init, i + step) and a factor k
+// from outside the loop, i * k becomes j = phi(init * k, j + step * k),
+// with init * k and step * k computed once, in the preheader.
+void SsaPassManager::reduceStrength(IrFunction& function) {
+    DominatorTree dominators(function);
+    vector<IrValue> forward = identity(function);
+    vector<char> inLoop(function.blocks.size(), 0);
+
+    auto grow = [&] { // For the instructions made since
+        for (IrValue v = (IrValue)forward.size(); v < function.values.size(); v++) forward.push_back(v);
+    };
+    for (IrLoop& loop : findLoops(function, dominators)) {
+        grow();
+        const vector<uint32_t>& preds = function.blocks[loop.header].preds;
+        if (loop.preheader == NO_BLOCK || loop.latches.size() != 1 || preds.size() != 2) continue;
+        size_t fromPreheader = preds[0] == loop.preheader ? 0 : 1;
+        size_t fromLatch = 1 - fromPreheader;
+        for (uint32_t b : loop.blocks) inLoop[b] = 1;
+        auto outside = [&](IrValue v) { return !inLoop[function.values[v].block]; };
+
+        // Basic induction variables: the step each lap adds (or subtracts),
+        // by header PHI.
+        struct Induction {
+            IrValue step;
+            IrOp op; // IR_ADD_I or IR_SUB_I
+        };
+        unordered_map<IrValue, Induction> inductions;
+        for (IrValue v : function.blocks[loop.header].code) {
+            const IrInstr& phi = function.values[v];
+            if (phi.op != IR_PHI) break;
+            if (phi.type != TYPE_GEAR) continue;
+            const IrInstr& next = function.values[phi.incoming[fromLatch]];
+            if (next.op == IR_ADD_I && next.a == v && outside(next.b)) inductions[v] = { next.b, IR_ADD_I };
+            else if (next.op == IR_ADD_I && next.b == v && outside(next.a)) inductions[v] = { next.a, IR_ADD_I };
+            else if (next.op == IR_SUB_I && next.a == v && outside(next.b)) inductions[v] = { next.b, IR_SUB_I };
+        }
+        if (inductions.empty()) {
+            for (uint32_t b : loop.blocks) inLoop[b] = 0;
+            continue;
+        }
+
+        // Multiplications of one by an invariant factor.
+        vector<IrValue> products;
+        for (uint32_t b : loop.blocks) {
+            for (IrValue v : function.blocks[b].code) {
+                const IrInstr& instr = function.values[v];
+                if (instr.op != IR_MUL_I) continue;
+                if ((inductions.count(instr.a) && outside(instr.b)) || (inductions.count(instr.b) && outside(instr.a)))
+                    products.push_back(v);
+            }
+        }
+
+        map<pair<IrValue, IrValue>, IrValue> derived; // (induction variable, factor) -> its multiple
+        vector<IrValue> setup;                         // For the preheader
+        for (IrValue product : products) {
+            IrValue i = function.values[product].a, k = function.values[product].b;
+            if (!inductions.count(i)) swap(i, k);
+            auto found = derived.find({ i, k });
+            if (found == derived.end()) {
+                Induction induction = inductions[i];
+                IrValue next = function.values[i].incoming[fromLatch];
+                IrValue init = function.values[i].incoming[fromPreheader];
+                int line = function.values[product].line;
+                IrValue start = make(function, IR_MUL_I, TYPE_GEAR, init, k, loop.preheader, line);
+                IrValue step = make(function, IR_MUL_I, TYPE_GEAR, induction.step, k, loop.preheader, line);
+                setup.push_back(start);
+                setup.push_back(step);
+
+                IrValue j = make(function, IR_PHI, TYPE_GEAR, NO_VALUE, NO_VALUE, loop.header, line);
+                uint32_t nextBlock = function.values[next].block;
+                IrValue jNext = make(function, induction.op, TYPE_GEAR, j, step, nextBlock, line);
+                function.values[j].incoming.resize(2);
+                function.values[j].incoming[fromPreheader] = start;
+                function.values[j].incoming[fromLatch] = jNext;
+
+                vector<IrValue>& header = function.blocks[loop.header].code;
+                header.insert(header.begin(), j);
+                vector<IrValue>& code = function.blocks[nextBlock].code;
+                code.insert(find(code.begin(), code.end(), next) + 1, jNext);
+                found = derived.emplace(make_pair(i, k), j).first;
+            }
+            forward[product] = found->second;
+            vector<IrValue>& code = function.blocks[function.values[product].block].code;
+            code.erase(find(code.begin(), code.end(), product));
+            counters.reduced++;
+        }
+        append(function, loop.preheader, setup);
+        for (uint32_t b : loop.blocks) inLoop[b] = 0;
+    }
+    grow();
+    replaceValues(function, forward);
+}
+
+/////////////////////// DEAD STORE ELIMINATION ///////////////////////
+
+void SsaPassManager::removeDeadStores(IrFunction& function) {
+    vector<char> used(function.values.size(), 0);
+    vector<IrValue> work;
+    auto mark = [&](IrValue v) {
+        if (v == NO_VALUE || used[v]) return;
+        used[v] = 1;
+        work.push_back(v);
+    };
+    for (const IrBlock& block : function.blocks)
+        for (IrValue v : block.code)
+            if (irHasEffect(function, function.values[v])) mark(v);
+    while (!work.empty()) {
+        const IrInstr& instr = function.values[work.back()];
+        work.pop_back();
+        mark(instr.a);
+        mark(instr.b);
+        for (IrValue in : instr.incoming) mark(in);
+    }
+
+    for (IrBlock& block : function.blocks) {
+        size_t before = block.code.size();
+        block.code.erase(remove_if(block.code.begin(), block.code.end(), [&](IrValue v) { return !used[v]; }),
+                         block.code.end());
+        counters.removed += before - block.code.size();
+    }
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "ssa.h"
+#include <cstddef>
+#include <string>
+
+/*
+ * SsaPass
+ * The optimizations SsaPassManager can run, as bits, so any set of them
+ * can be chosen.
+ */
+enum SsaPass : unsigned {
+    PASS_GVN = 1 << 0,      // Global value numbering
+    PASS_LICM = 1 << 1,     // Loop-invariant code motion
+    PASS_STRENGTH = 1 << 2, // Strength reduction of induction variables
+    PASS_DSE = 1 << 3,      // Dead store elimination
+    PASS_NONE = 0,
+    PASS_ALL = PASS_GVN | PASS_LICM | PASS_STRENGTH | PASS_DSE,
+
+    // What runs unless other passes are chosen. Strength reduction is left
+    // out: on the VM an add costs what a multiplication does, so it saves
+    // nothing per lap and adds two instructions before the loop.
+    PASS_DEFAULT = PASS_GVN | PASS_LICM | PASS_DSE
+};
+
+/*
+ * parsePasses
+ * A set of passes from text: "default", "all", "none", or names separated
+ * by commas (gvn, licm, sr, dse). Returns false for a name it does not know.
+ */
+bool parsePasses(const std::string& text, unsigned& passes);
+
+/*
+ * PassStats
+ * What the passes changed, over every function they ran on.
+ */
+struct PassStats {
+    size_t instructionsBefore = 0;
+    size_t instructionsAfter = 0;
+    size_t merged = 0;  // GVN: instructions that recomputed a value already there, and PHIs of one value
+    size_t hoisted = 0; // LICM: instructions moved out of a loop into its preheader
+    size_t reduced = 0; // Strength reduction: multiplications by an induction variable made additions
+    size_t removed = 0; // DSE: instructions whose values no one used
+};
+
+/*
+ * SsaPassManager
+ * Runs the chosen passes over a function, in this order:
+ *  - GVN walks the dominator tree with a table of the pure instructions
+ *    seen on the way down (by opcode and operands, commutative operands
+ *    sorted), and replaces an instruction that is already in the table by
+ *    the one there. It also drops PHIs whose operands are all one value.
+ *  - LICM moves pure instructions whose operands come from outside a loop
+ *    into the loop's preheader, inner loops first, so that they run once.
+ *    One that can fail (a gear division by a variable) stays, as it may
+ *    not run at all.
+ *  - Strength reduction finds basic induction variables, header PHIs that
+ *    each lap adds a loop-invariant step to (lap = lap + 1), and replaces
+ *    each gear multiplication of one by an invariant with a new induction
+ *    variable, which each lap adds step * factor to. Gear arithmetic
+ *    wraps, so the two agree on every lap.
+ *  - DSE: a store to a variable is a new value, so a store no one reads is
+ *    an instruction whose value is not used. Starting from instructions
+ *    with effects (output, input, control flow, divisions that may fail),
+ *    everything they use is marked; the rest, dead PHI cycles included,
+ *    is removed.
+ * Each pass leaves the function in SSA form and runs in time about linear
+ * in its size (LICM and strength reduction per loop).
+ */
+class SsaPassManager {
+public:
+    explicit SsaPassManager(unsigned passes = PASS_DEFAULT) : passes(passes) {}
+
+    void run(IrFunction& function);
+    const PassStats& stats() const { return counters; }
+
+private:
+    unsigned passes;
+    PassStats counters;
+
+    void valueNumbering(IrFunction& function);
+    void hoistInvariants(IrFunction& function);
+    void reduceStrength(IrFunction& function);
+    void removeDeadStores(IrFunction& function);
+};
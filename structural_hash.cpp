@@ -0,0 +1,132 @@
+#include "structural_hash.h"
+
+#include <cstring>
+
+using namespace std;
+
+namespace {
+
+const uint64_t K = 0x9E3779B97F4A7C15ull;
+
+uint64_t mix(uint64_t h, uint64_t v) {
+    h = (h ^ v) * K;
+    return h ^ (h >> 32);
+}
+
+// Expression tags are the ExprKind, statement tags 0x100 + StmtKind, so
+// that no two node types start from the same value.
+uint64_t start(uint64_t tag) { return mix(K, tag); }
+
+class StructuralHasher {
+public:
+    explicit StructuralHasher(const SymbolTable& symbols) : symbols(symbols) {}
+
+    uint64_t hash(Stmt* stmt) {
+        if (!stmt) return 0;
+        if (stmt->hash == 0) {
+            uint64_t h = stmt->accept(*this);
+            stmt->hash = h != 0 ? h : 1; // 0 means "not computed"
+        }
+        return stmt->hash;
+    }
+    uint64_t hash(Expr* expr) { return expr ? expr->accept(*this) : 0; }
+
+    uint64_t visit(BinaryExpr& expr) {
+        uint64_t h = mix(start(EXPR_BINARY), expr.op);
+        return mix(mix(h, hash(expr.left)), hash(expr.right));
+    }
+    uint64_t visit(LiteralExpr& expr) {
+        const LiteralValue& v = expr.value;
+        uint64_t bits = 0;
+        switch (v.kind) {
+        case LiteralValue::INT:    bits = (uint64_t)v.i; break;
+        case LiteralValue::DOUBLE: memcpy(&bits, &v.d, sizeof bits); break;
+        case LiteralValue::BOOL:   bits = v.b; break;
+        case LiteralValue::STRING: bits = symbols.hash(v.s); break;
+        default: break;
+        }
+        return mix(mix(start(EXPR_LITERAL), v.kind), bits);
+    }
+    uint64_t visit(VariableExpr& expr) { return mix(start(EXPR_VARIABLE), symbols.hash(expr.name)); }
+    uint64_t visit(AssignExpr& expr) {
+        return mix(mix(start(EXPR_ASSIGN), symbols.hash(expr.name)), hash(expr.value));
+    }
+
+    uint64_t visit(ExprStmt& stmt) { return mix(statement(STMT_EXPR), hash(stmt.expression)); }
+    uint64_t visit(AnnounceStmt& stmt) { return mix(statement(STMT_ANNOUNCE), hash(stmt.expression)); }
+    uint64_t visit(FinishlineStmt& stmt) { return mix(statement(STMT_FINISHLINE), hash(stmt.value)); }
+    uint64_t visit(VarDeclStmt& stmt) {
+        uint64_t h = mix(mix(statement(STMT_VAR_DECL), stmt.type), symbols.hash(stmt.name));
+        return mix(h, hash(stmt.initializer));
+    }
+    uint64_t visit(BlockStmt& stmt) {
+        uint64_t h = statement(STMT_BLOCK);
+        uint64_t count = 0;
+        for (Stmt* s : stmt.statements) {
+            if (!s) continue;
+            h = mix(h, hash(s));
+            count++;
+        }
+        return mix(h, count);
+    }
+    uint64_t visit(LoopStmt& stmt) {
+        return mix(mix(statement(STMT_LOOP), hash(stmt.condition)), hash(stmt.body));
+    }
+    uint64_t visit(FuncDefStmt& stmt) {
+        return mix(mix(statement(STMT_FUNC_DEF), symbols.hash(stmt.name)), hash(stmt.body));
+    }
+    uint64_t visit(IfStmt& stmt) {
+        uint64_t h = mix(mix(statement(STMT_IF), hash(stmt.condition)), hash(stmt.thenBranch));
+        return mix(h, hash(stmt.elseBranch));
+    }
+    uint64_t visit(ListenStmt& stmt) { return mix(statement(STMT_LISTEN), symbols.hash(stmt.name)); }
+
+private:
+    const SymbolTable& symbols;
+
+    static uint64_t statement(StmtKind kind) { return start(0x100 + kind); }
+};
+
+// Folds in the line of every node, relative to 'base', in tree order.
+class LayoutHasher {
+public:
+    explicit LayoutHasher(int base) : base(base) {}
+
+    uint64_t h = K;
+
+    void walk(Stmt* stmt) { if (stmt) stmt->accept(*this); else add(0); }
+    void walk(Expr* expr) { if (expr) expr->accept(*this); else add(0); }
+
+    void visit(BinaryExpr& expr) { line(expr.line); walk(expr.left); walk(expr.right); }
+    void visit(LiteralExpr& expr) { line(expr.line); }
+    void visit(VariableExpr& expr) { line(expr.line); }
+    void visit(AssignExpr& expr) { line(expr.line); walk(expr.value); }
+
+    void visit(ExprStmt& stmt) { walk(stmt.expression); }
+    void visit(AnnounceStmt& stmt) { walk(stmt.expression); }
+    void visit(FinishlineStmt& stmt) { walk(stmt.value); }
+    void visit(VarDeclStmt& stmt) { line(stmt.line); walk(stmt.initializer); }
+    void visit(BlockStmt& stmt) { for (Stmt* s : stmt.statements) if (s) walk(s); }
+    void visit(LoopStmt& stmt) { walk(stmt.condition); walk(stmt.body); }
+    void visit(FuncDefStmt& stmt) { line(stmt.line); walk(stmt.body); }
+    void visit(IfStmt& stmt) { walk(stmt.condition); walk(stmt.thenBranch); walk(stmt.elseBranch); }
+    void visit(ListenStmt& stmt) { line(stmt.line); }
+
+private:
+    int base;
+
+    void add(uint64_t v) { h = mix(h, v); }
+    void line(int line) { add((uint64_t)(int64_t)(line - base)); }
+};
+
+} // namespace
+
+uint64_t structuralHash(Stmt* stmt, const SymbolTable& symbols) {
+    return StructuralHasher(symbols).hash(stmt);
+}
+
+uint64_t layoutHash(FuncDefStmt& func) {
+    LayoutHasher hasher(func.line);
+    hasher.visit(func);
+    return hasher.h;
+}
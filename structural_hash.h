@@ -0,0 +1,27 @@
+#pragma once
+
+#include "parser.h"
+#include <cstdint>
+
+/*
+ * structuralHash
+ * A hash of what 'stmt' says, computed bottom-up (Merkle style): each
+ * node's hash covers its kind, its own fields and its children's hashes.
+ * Identifiers and string literals count by their text, numbers by their
+ * value. Lines and token positions are left out, so code that only moved
+ * hashes the same, and the hash is the same in every run.
+ *
+ * Every statement keeps its hash in Stmt::hash, and one that already has a
+ * hash is not walked again. Whoever changes a subtree in place must clear
+ * the hashes on the way down to it (IncrementalParser does); new nodes
+ * start without one. Expressions are hashed as part of their statement.
+ */
+uint64_t structuralHash(Stmt* stmt, const SymbolTable& symbols);
+
+/*
+ * layoutHash
+ * A hash of the lines of every node under 'func', counted from the line of
+ * the function. Together with structuralHash it tells whether something
+ * reported at a line inside the function still points at the same node.
+ */
+uint64_t layoutHash(FuncDefStmt& func);
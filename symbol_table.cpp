@@ -0,0 +1,79 @@
+#include "symbol_table.h"
+
+#include <cstring>
+
+using namespace std;
+
+SymbolTable::SymbolTable() : slots(256, NO_SYMBOL) {}
+
+uint64_t SymbolTable::hashText(string_view text) {
+    // FNV-1a
+    uint64_t h = 1469598103934665603ull;
+    for (unsigned char c : text) {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+// Slot holding 'text', or the empty slot where it would go.
+size_t SymbolTable::slotFor(string_view text, uint64_t h) const {
+    size_t mask = slots.size() - 1;
+    size_t i = (size_t)(h ^ (h >> 32)) & mask;
+    while (slots[i] != NO_SYMBOL) {
+        Symbol id = slots[i];
+        if (hashes[id] == h && names[id] == text) return i;
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+Symbol SymbolTable::find(string_view text) const {
+    return slots[slotFor(text, hashText(text))];
+}
+
+Symbol SymbolTable::intern(string_view text) {
+    uint64_t h = hashText(text);
+    size_t i = slotFor(text, h);
+    if (slots[i] != NO_SYMBOL) return slots[i];
+
+    Symbol id = (Symbol)names.size();
+    names.push_back(store(text));
+    hashes.push_back(h);
+    slots[i] = id;
+    if (names.size() * 2 > slots.size()) grow(); // Keep the load under 1/2
+    return id;
+}
+
+void SymbolTable::grow() {
+    vector<Symbol> old(slots.size() * 2, NO_SYMBOL);
+    old.swap(slots);
+    size_t mask = slots.size() - 1;
+    for (Symbol id = 0; id < names.size(); id++) {
+        size_t i = (size_t)(hashes[id] ^ (hashes[id] >> 32)) & mask;
+        while (slots[i] != NO_SYMBOL) i = (i + 1) & mask;
+        slots[i] = id;
+    }
+}
+
+string_view SymbolTable::store(string_view text) {
+    if (text.empty()) return string_view();
+    char* dst;
+    if (text.size() > BLOCK_SIZE / 4) {
+        // Long strings get a block of their own.
+        blocks.emplace_back(new char[text.size()]);
+        dst = blocks.back().get();
+    }
+    else {
+        if (text.size() > blockLeft) {
+            blocks.emplace_back(new char[BLOCK_SIZE]);
+            blockNext = blocks.back().get();
+            blockLeft = BLOCK_SIZE;
+        }
+        dst = blockNext;
+        blockNext += text.size();
+        blockLeft -= text.size();
+    }
+    memcpy(dst, text.data(), text.size());
+    return string_view(dst, text.size());
+}
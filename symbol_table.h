@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+/*
+ * Symbol
+ * A dense integer id for an interned string. Equal ids mean equal text,
+ * so names compare with one integer compare and can index arrays.
+ */
+using Symbol = uint32_t;
+constexpr Symbol NO_SYMBOL = 0xFFFFFFFFu;
+
+/*
+ * SymbolTable
+ * Interns identifier names and string-literal contents.
+ * Ids are handed out 0, 1, 2, ... in first-seen order. The text of every
+ * symbol is stored once, in blocks that never move, so the views returned
+ * by name() stay valid for the table's lifetime.
+ */
+class SymbolTable {
+public:
+    SymbolTable();
+    SymbolTable(const SymbolTable&) = delete;
+    SymbolTable& operator=(const SymbolTable&) = delete;
+
+    // Returns the id for 'text', adding it if it is new.
+    Symbol intern(std::string_view text);
+
+    // Returns the id for 'text', or NO_SYMBOL if it was never interned.
+    Symbol find(std::string_view text) const;
+
+    std::string_view name(Symbol id) const { return names[id]; }
+    uint64_t hash(Symbol id) const { return hashes[id]; }
+    size_t size() const { return names.size(); }
+
+    static uint64_t hashText(std::string_view text);
+
+private:
+    size_t slotFor(std::string_view text, uint64_t h) const;
+    void grow();
+    std::string_view store(std::string_view text);
+
+    std::vector<std::string_view> names; // Indexed by Symbol
+    std::vector<uint64_t> hashes;        // Indexed by Symbol
+    std::vector<Symbol> slots;           // Open-addressing table of ids
+
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+    std::vector<std::unique_ptr<char[]>> blocks;
+    char* blockNext = nullptr;
+    size_t blockLeft = 0;
+};
@@ -0,0 +1,94 @@
+#include "thread_pool.h"
+
+using namespace std;
+
+ThreadPool::ThreadPool(unsigned threads) {
+    if (threads == 0) threads = thread::hardware_concurrency();
+    workers = threads ? threads : 1;
+    slices.reset(new Slice[workers]);
+    // Worker 0 is whoever calls run().
+    for (unsigned w = 1; w < workers; w++) this->threads.emplace_back(&ThreadPool::loop, this, w);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard<std::mutex> g(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (thread& t : threads) t.join();
+}
+
+void ThreadPool::run(size_t count, const function<void(size_t, unsigned)>& fn) {
+    if (count == 0) return;
+    for (unsigned w = 0; w < workers; w++) {
+        lock_guard<std::mutex> g(slices[w].lock);
+        slices[w].next = count * w / workers;
+        slices[w].end = count * (w + 1) / workers;
+    }
+    {
+        lock_guard<std::mutex> g(mutex);
+        task = &fn;
+        running = workers - 1;
+        generation++;
+    }
+    wake.notify_all();
+
+    work(0);
+
+    unique_lock<std::mutex> g(mutex);
+    done.wait(g, [&] { return running == 0; });
+    task = nullptr;
+}
+
+void ThreadPool::loop(unsigned self) {
+    uint64_t seen = 0;
+    for (;;) {
+        {
+            unique_lock<std::mutex> g(mutex);
+            wake.wait(g, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+        }
+        work(self);
+        {
+            lock_guard<std::mutex> g(mutex);
+            if (--running == 0) done.notify_one();
+        }
+    }
+}
+
+void ThreadPool::work(unsigned self) {
+    size_t index;
+    while (take(self, index)) (*task)(index, self);
+}
+
+// Next index for worker 'self': from its own slice, else stolen.
+bool ThreadPool::take(unsigned self, size_t& index) {
+    {
+        lock_guard<std::mutex> g(slices[self].lock);
+        if (slices[self].next < slices[self].end) {
+            index = slices[self].next++;
+            return true;
+        }
+    }
+    // Only one slice is ever locked at a time, so thieves cannot deadlock.
+    for (unsigned k = 1; k < workers; k++) {
+        Slice& victim = slices[(self + k) % workers];
+        size_t from, to;
+        {
+            lock_guard<std::mutex> g(victim.lock);
+            size_t left = victim.end - victim.next;
+            if (left == 0) continue;
+            to = victim.end;
+            from = to - (left + 1) / 2;
+            victim.end = from;
+        }
+        lock_guard<std::mutex> g(slices[self].lock);
+        slices[self].next = from + 1;
+        slices[self].end = to;
+        index = from;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * ThreadPool
+ * A fixed set of threads for data-parallel loops. run(count, task) calls
+ * task(index, worker) once for every index in [0, count), spread over the
+ * pool's threads and the calling thread, and returns when all are done.
+ * 'worker' (0 .. size() - 1) tells the task which thread runs it, so it
+ * can use per-thread state without locking.
+ *
+ * The indices are dealt out as one contiguous slice per worker. A worker
+ * takes indices from the front of its own slice; once that is empty it
+ * steals the back half of another worker's slice. So a few large tasks
+ * (a long engine among many short ones) do not leave threads idle.
+ *
+ * Tasks must not throw. run() is not reentrant.
+ */
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned threads = 0); // 0: one per hardware thread
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Number of workers, counting the thread that calls run().
+    unsigned size() const { return workers; }
+
+    void run(size_t count, const std::function<void(size_t index, unsigned worker)>& task);
+
+private:
+    struct alignas(64) Slice {
+        std::mutex lock;
+        size_t next = 0; // Indices [next, end) are still to do
+        size_t end = 0;
+    };
+
+    void loop(unsigned self);
+    void work(unsigned self);
+    bool take(unsigned self, size_t& index);
+
+    unsigned workers;
+    std::unique_ptr<Slice[]> slices;
+    std::vector<std::thread> threads;
+
+    std::mutex mutex; // Guards everything below
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(size_t, unsigned)>* task = nullptr;
+    uint64_t generation = 0; // Bumped by each run()
+    unsigned running = 0;    // Pool threads still busy with this run
+    bool stopping = false;
+};
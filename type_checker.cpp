@@ -0,0 +1,190 @@
+#include "type_checker.h"
+#include "scope_resolver.h"
+
+#include <string>
+
+using namespace std;
+
+namespace {
+
+ValueType typeOfLiteral(LiteralValue::Kind kind) {
+    switch (kind) {
+    case LiteralValue::INT:    return TYPE_GEAR;
+    case LiteralValue::DOUBLE: return TYPE_TURBO;
+    case LiteralValue::BOOL:   return TYPE_FLAG;
+    case LiteralValue::STRING: return TYPE_EXHAUST;
+    default:                   return TYPE_ERROR;
+    }
+}
+
+ValueType typeOfDeclaration(TokenType keyword) {
+    switch (keyword) {
+    case KW_TURBO:   return TYPE_TURBO;
+    case KW_EXHAUST: return TYPE_EXHAUST;
+    case KW_FLAG:    return TYPE_FLAG;
+    default:         return TYPE_GEAR;
+    }
+}
+
+bool isNumeric(ValueType type) { return type == TYPE_GEAR || type == TYPE_TURBO; }
+
+// The line the compiler is at once it has compiled 'expr': that of its
+// top node.
+int lineOf(const Expr* expr) {
+    switch (expr->kind) {
+    case EXPR_BINARY:   return static_cast<const BinaryExpr*>(expr)->line;
+    case EXPR_LITERAL:  return static_cast<const LiteralExpr*>(expr)->line;
+    case EXPR_VARIABLE: return static_cast<const VariableExpr*>(expr)->line;
+    default:            return static_cast<const AssignExpr*>(expr)->line;
+    }
+}
+
+} // namespace
+
+bool TypeChecker::check(const vector<Stmt*>& statements) {
+    bool ok = true;
+    for (Stmt* stmt : statements)
+        if (stmt && stmt->kind == STMT_FUNC_DEF && !check(static_cast<FuncDefStmt&>(*stmt))) ok = false;
+    return ok;
+}
+
+bool TypeChecker::checkEntryPoint(const vector<Stmt*>& statements) {
+    Symbol ignite = symbols.find("ignite");
+    int first = 0;
+    bool ok = true;
+    for (Stmt* stmt : statements) {
+        if (!stmt || stmt->kind != STMT_FUNC_DEF) continue;
+        auto& func = static_cast<FuncDefStmt&>(*stmt);
+        if (func.name != ignite) continue;
+        if (first == 0) {
+            first = func.line;
+            continue;
+        }
+        diagnostics.report(func.line, 0, DIAG_REDECLARED_NAME, "ignite() is already defined at line " + to_string(first) + ".");
+        ok = false;
+    }
+    return ok;
+}
+
+bool TypeChecker::check(FuncDefStmt& func) {
+    ScopeResolver resolver(symbols, diagnostics);
+    slots.clear();
+    if (!resolver.resolve(func)) return false;
+    for (TokenType keyword : resolver.slotTypes()) slots.push_back(typeOfDeclaration(keyword));
+
+    failed = false;
+    statement(func.body);
+    return !failed;
+}
+
+void TypeChecker::error(int line, string message) {
+    failed = true;
+    diagnostics.report(line, 0, DIAG_TYPE_MISMATCH, move(message));
+}
+
+// Only gear and turbo convert into each other.
+void TypeChecker::convert(ValueType from, ValueType to, int line, const char* what) {
+    if (from == TYPE_ERROR || from == to || (isNumeric(from) && isNumeric(to))) return;
+    error(line, string(what) + ": expected " + typeName(to) + ", got " + typeName(from) + ".");
+}
+
+/////////////////////// EXPRESSIONS ///////////////////////
+
+ValueType TypeChecker::expression(Expr* expr) {
+    if (!expr) return TYPE_ERROR;
+    expr->type = expr->accept(*this);
+    return expr->type;
+}
+
+ValueType TypeChecker::visit(BinaryExpr& expr) {
+    ValueType left = expression(expr.left);
+    ValueType right = expression(expr.right);
+    if (left == TYPE_ERROR || right == TYPE_ERROR) return TYPE_ERROR;
+
+    switch (expr.op) {
+    case OP_PLUS:
+    case OP_MINUS:
+    case OP_STAR:
+    case OP_SLASH:
+        if (expr.op == OP_PLUS && (left == TYPE_EXHAUST || right == TYPE_EXHAUST)) return TYPE_EXHAUST;
+        if (isNumeric(left) && isNumeric(right)) return left == TYPE_GEAR && right == TYPE_GEAR ? TYPE_GEAR : TYPE_TURBO;
+        error(expr.line, "Operator '" + string(tokenSpelling(expr.op)) + "' cannot be applied to " + typeName(left) +
+              " and " + typeName(right) + ".");
+        return TYPE_ERROR;
+    default:
+        if ((isNumeric(left) && isNumeric(right)) || (left == TYPE_EXHAUST && right == TYPE_EXHAUST) ||
+            (left == TYPE_FLAG && right == TYPE_FLAG && (expr.op == OP_EQUAL || expr.op == OP_NOT_EQUAL)))
+            return TYPE_FLAG;
+        error(expr.line, "Cannot compare " + string(typeName(left)) + " and " + typeName(right) + " with '" +
+              string(tokenSpelling(expr.op)) + "'.");
+        return TYPE_ERROR;
+    }
+}
+
+ValueType TypeChecker::visit(LiteralExpr& expr) {
+    return typeOfLiteral(expr.value.kind);
+}
+
+ValueType TypeChecker::visit(VariableExpr& expr) {
+    return slots[expr.slot];
+}
+
+// Its value is the variable's, converted.
+ValueType TypeChecker::visit(AssignExpr& expr) {
+    ValueType variable = slots[expr.slot];
+    convert(expression(expr.value), variable, expr.line, "Assignment");
+    return variable;
+}
+
+void TypeChecker::condition(Expr* expr, const char* message) {
+    if (expression(expr) == TYPE_EXHAUST) error(lineOf(expr), message);
+}
+
+/////////////////////// STATEMENTS ///////////////////////
+
+void TypeChecker::statement(Stmt* stmt) {
+    if (stmt) stmt->accept(*this);
+}
+
+void TypeChecker::visit(ExprStmt& stmt) {
+    expression(stmt.expression);
+}
+
+void TypeChecker::visit(AnnounceStmt& stmt) {
+    expression(stmt.expression);
+}
+
+void TypeChecker::visit(VarDeclStmt& stmt) {
+    if (stmt.initializer) convert(expression(stmt.initializer), slots[stmt.slot], stmt.line, "Declaration");
+}
+
+void TypeChecker::visit(BlockStmt& stmt) {
+    for (Stmt* s : stmt.statements) statement(s);
+}
+
+// As in the compiler, the body comes before the condition.
+void TypeChecker::visit(LoopStmt& stmt) {
+    statement(stmt.body);
+    condition(stmt.condition, "Condition: expected flag, gear or turbo, got exhaust.");
+}
+
+void TypeChecker::visit(FinishlineStmt& stmt) {
+    condition(stmt.value, "finishline: expected gear, flag or turbo, got exhaust.");
+}
+
+// Nothing could ever call it, so it is rejected rather than checked.
+void TypeChecker::visit(FuncDefStmt& stmt) {
+    failed = true;
+    diagnostics.report(stmt.line, 0, DIAG_NESTED_FUNCTION,
+                       "engine " + string(symbols.name(stmt.name)) + " is defined inside a function; define it at the top level.");
+}
+
+void TypeChecker::visit(IfStmt& stmt) {
+    condition(stmt.condition, "Condition: expected flag, gear or turbo, got exhaust.");
+    statement(stmt.thenBranch);
+    statement(stmt.elseBranch);
+}
+
+void TypeChecker::visit(ListenStmt&) {
+    // Reads into its variable as that variable's type
+}
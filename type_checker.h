@@ -0,0 +1,81 @@
+#pragma once
+
+#include "diagnostics.h"
+#include "parser.h"
+#include <vector>
+
+/*
+ * TypeChecker
+ * Gives every expression of a function its static type (Expr::type) and
+ * reports type errors, before anything runs, so that an executor can use
+ * unboxed operations picked for those types and never test a type while
+ * it runs. It is the one place types are worked out: the interpreter,
+ * the SSA builder, the bytecode compiler, the native backend and the C
+ * emitter all take Expr::type from it.
+ *
+ * Names are first bound to frame slots by a ScopeResolver; a function
+ * with undefined or redeclared names is not type-checked. Then one walk
+ * over the tree, in the compiler's order, types each node from its
+ * operands:
+ *  - '+' with an exhaust on either side joins text (the other side is
+ *    written out as announce would), giving an exhaust;
+ *  - other arithmetic needs gear or turbo operands: gear with gear gives
+ *    a gear, and a turbo on either side gives a turbo;
+ *  - a comparison of two numbers, two exhausts, or (== and != only) two
+ *    flags gives a flag;
+ *  - assignments and declarations convert between gear and turbo only;
+ *  - a condition or finishline value cannot be an exhaust;
+ *  - an engine cannot be defined inside a function. Every executor skips
+ *    such a definition, so this is the one place it is reported.
+ * Errors are reported at the line of the node, in the order the bytecode
+ * compiler emits code. A node with an error is TYPE_ERROR and causes no
+ * further errors above it. The tree must not share expressions
+ * (Parser::shareExpressions), as a shared node could need a different
+ * type in each place it is used.
+ */
+class TypeChecker {
+public:
+    TypeChecker(const SymbolTable& symbols, Diagnostics& diagnostics)
+        : symbols(symbols), diagnostics(diagnostics) {}
+
+    // Checks every top-level function; false if any had errors.
+    bool check(const std::vector<Stmt*>& statements);
+    bool check(FuncDefStmt& func);
+
+    // Reports every ignite() after the first, which no engine would run;
+    // false if there was one.
+    bool checkEntryPoint(const std::vector<Stmt*>& statements);
+
+    // Type of each frame slot of the function last checked.
+    const std::vector<ValueType>& slotTypes() const { return slots; }
+
+private:
+    friend struct Expr; // accept() calls the visit() overloads
+    friend struct Stmt;
+
+    const SymbolTable& symbols;
+    Diagnostics& diagnostics;
+    std::vector<ValueType> slots;
+    bool failed = false;
+
+    void error(int line, std::string message);
+    void convert(ValueType from, ValueType to, int line, const char* what);
+
+    ValueType expression(Expr* expr);
+    ValueType visit(BinaryExpr& expr);
+    ValueType visit(LiteralExpr& expr);
+    ValueType visit(VariableExpr& expr);
+    ValueType visit(AssignExpr& expr);
+    void condition(Expr* expr, const char* message);
+
+    void statement(Stmt* stmt);
+    void visit(ExprStmt& stmt);
+    void visit(AnnounceStmt& stmt);
+    void visit(VarDeclStmt& stmt);
+    void visit(BlockStmt& stmt);
+    void visit(LoopStmt& stmt);
+    void visit(FinishlineStmt& stmt);
+    void visit(FuncDefStmt& stmt);
+    void visit(IfStmt& stmt);
+    void visit(ListenStmt& stmt);
+};
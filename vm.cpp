@@ -0,0 +1,257 @@
+#include "vm.h"
+#include "literal.h"
+
+#include <charconv>
+#include <cstdlib>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define AUTOSPEED_COMPUTED_GOTO 1
+#endif
+
+using namespace std;
+
+namespace {
+
+void appendInt(string& text, int64_t v) {
+    char digits[24];
+    auto res = to_chars(digits, digits + sizeof(digits), v);
+    text.append(digits, res.ptr);
+}
+
+string_view trimmed(const string& text) {
+    size_t first = text.find_first_not_of(" \t\r");
+    if (first == string::npos) return {};
+    size_t last = text.find_last_not_of(" \t\r");
+    return string_view(text).substr(first, last - first + 1);
+}
+
+} // namespace
+
+bool readInput(istream& in, ValueType type, Number& number, string& text, Diagnostics& diagnostics, int line) {
+    string got;
+    bool read = (bool)getline(in, got);
+    if (type == TYPE_EXHAUST) {
+        if (!got.empty() && got.back() == '\r') got.pop_back();
+        text = move(got);
+        return true;
+    }
+
+    string_view value = trimmed(got);
+    const char* first = value.data();
+    const char* last = first + value.size();
+    bool ok = read && !value.empty();
+    switch (type) {
+    case TYPE_GEAR: {
+        auto res = from_chars(first, last, number.i);
+        ok = ok && res.ec == errc() && res.ptr == last;
+        break;
+    }
+    case TYPE_TURBO: {
+        string copy(value);
+        char* end = nullptr;
+        number.d = strtod(copy.c_str(), &end);
+        ok = ok && end == copy.c_str() + copy.size();
+        break;
+    }
+    default:
+        ok = ok && (value == "true" || value == "false");
+        number.i = value == "true";
+        break;
+    }
+    if (!ok) {
+        diagnostics.report(line, 0, DIAG_BAD_INPUT,
+                           read ? "listen expected a " + string(typeName(type)) + ", got '" + got + "'." : "listen found no more input.");
+    }
+    return ok;
+}
+
+RunResult Vm::run(const BytecodeFunction& function, Diagnostics& diagnostics, bool countInstructions) {
+    RunResult result = countInstructions ? execute<true>(function, diagnostics) : execute<false>(function, diagnostics);
+    flush();
+    return result;
+}
+
+void Vm::flush() {
+    out.write(output.data(), (streamsize)output.size());
+    output.clear();
+}
+
+// Reads a line into the register of 'instr'; output so far is shown first.
+bool Vm::listen(const Instr& instr, Number* n, string* s, Diagnostics& diagnostics, int line) {
+    flush();
+    out.flush();
+    static const ValueType types[] = { TYPE_GEAR, TYPE_TURBO, TYPE_FLAG, TYPE_EXHAUST };
+    ValueType type = types[instr.op - OP_LISTEN_I];
+    Number unusedNumber;
+    string unusedText;
+    if (type == TYPE_EXHAUST) return readInput(in, type, unusedNumber, s[instr.a], diagnostics, line);
+    return readInput(in, type, n[instr.a], unusedText, diagnostics, line);
+}
+
+/////////////////////// DISPATCH LOOP ///////////////////////
+
+// CASE(name) starts an instruction's code; NEXT() and JUMP(target) end
+// it by going to the next instruction.
+#ifdef AUTOSPEED_COMPUTED_GOTO
+#define CASE(name) L_##name:
+#define DISPATCH()                         \
+    do {                                   \
+        if (Count) count++;                \
+        goto* labels[ip->op];              \
+    } while (0)
+#else
+#define CASE(name) case OP_##name:
+#define DISPATCH() goto dispatch
+#endif
+#define NEXT()       \
+    do {             \
+        ip++;        \
+        DISPATCH();  \
+    } while (0)
+#define JUMP(target)               \
+    do {                           \
+        ip = code + (target);      \
+        DISPATCH();                \
+    } while (0)
+#define FAIL(diagnostic, message)                                                       \
+    do {                                                                                \
+        diagnostics.report(function.lines[ip - code], 0, diagnostic, message);          \
+        return { false, 0, count };                                                     \
+    } while (0)
+
+template <bool Count>
+RunResult Vm::execute(const BytecodeFunction& function, Diagnostics& diagnostics) {
+    numbers.assign(function.numberRegisters, Number{ 0 });
+    if (strings.size() < function.stringRegisters) strings.resize(function.stringRegisters);
+
+    const Instr* code = function.code.data();
+    const Instr* ip = code;
+    Number* n = numbers.data();
+    string* s = strings.data();
+    const Number* kn = function.numbers.data();
+    const string* ks = function.strings.data();
+    uint64_t count = 0;
+
+#ifdef AUTOSPEED_COMPUTED_GOTO
+    static const void* const labels[] = {
+#define AUTOSPEED_OP_LABEL(name) &&L_##name,
+        AUTOSPEED_OPS(AUTOSPEED_OP_LABEL)
+#undef AUTOSPEED_OP_LABEL
+    };
+    DISPATCH();
+#else
+dispatch:
+    if (Count) count++;
+    switch (ip->op) {
+#endif
+
+    CASE(LOAD_NUM) { n[ip->a] = kn[ip->b]; NEXT(); }
+    CASE(LOAD_STR) { s[ip->a] = ks[ip->b]; NEXT(); }
+    CASE(MOVE) { n[ip->a] = n[ip->b]; NEXT(); }
+    CASE(MOVE_STR) { s[ip->a] = s[ip->b]; NEXT(); }
+
+    CASE(ADD_I) { n[ip->a].i = wrapGear((uint64_t)n[ip->b].i + (uint64_t)n[ip->c].i); NEXT(); }
+    CASE(SUB_I) { n[ip->a].i = wrapGear((uint64_t)n[ip->b].i - (uint64_t)n[ip->c].i); NEXT(); }
+    CASE(MUL_I) { n[ip->a].i = wrapGear((uint64_t)n[ip->b].i * (uint64_t)n[ip->c].i); NEXT(); }
+    CASE(DIV_I) {
+        int64_t left = n[ip->b].i, right = n[ip->c].i;
+        if (right == 0) FAIL(DIAG_DIVISION_BY_ZERO, "Division by zero.");
+        n[ip->a].i = right == -1 ? wrapGear(0 - (uint64_t)left) : left / right;
+        NEXT();
+    }
+    CASE(ADD_D) { n[ip->a].d = n[ip->b].d + n[ip->c].d; NEXT(); }
+    CASE(SUB_D) { n[ip->a].d = n[ip->b].d - n[ip->c].d; NEXT(); }
+    CASE(MUL_D) { n[ip->a].d = n[ip->b].d * n[ip->c].d; NEXT(); }
+    CASE(DIV_D) { n[ip->a].d = n[ip->b].d / n[ip->c].d; NEXT(); }
+    CASE(I_TO_D) { n[ip->a].d = (double)n[ip->b].i; NEXT(); }
+    CASE(D_TO_I) { n[ip->a].i = turboToGear(n[ip->b].d); NEXT(); }
+
+    CASE(EQ_I) { n[ip->a].i = n[ip->b].i == n[ip->c].i; NEXT(); }
+    CASE(NE_I) { n[ip->a].i = n[ip->b].i != n[ip->c].i; NEXT(); }
+    CASE(LT_I) { n[ip->a].i = n[ip->b].i < n[ip->c].i; NEXT(); }
+    CASE(LE_I) { n[ip->a].i = n[ip->b].i <= n[ip->c].i; NEXT(); }
+    CASE(EQ_D) { n[ip->a].i = n[ip->b].d == n[ip->c].d; NEXT(); }
+    CASE(NE_D) { n[ip->a].i = n[ip->b].d != n[ip->c].d; NEXT(); }
+    CASE(LT_D) { n[ip->a].i = n[ip->b].d < n[ip->c].d; NEXT(); }
+    CASE(LE_D) { n[ip->a].i = n[ip->b].d <= n[ip->c].d; NEXT(); }
+    CASE(EQ_S) { n[ip->a].i = s[ip->b] == s[ip->c]; NEXT(); }
+    CASE(NE_S) { n[ip->a].i = s[ip->b] != s[ip->c]; NEXT(); }
+    CASE(LT_S) { n[ip->a].i = s[ip->b] < s[ip->c]; NEXT(); }
+    CASE(LE_S) { n[ip->a].i = s[ip->b] <= s[ip->c]; NEXT(); }
+
+    CASE(CONCAT) {
+        // The destination may be either operand: s = s + "x" appends in place.
+        string& dest = s[ip->a];
+        if (ip->a == ip->b) dest += s[ip->c];
+        else if (ip->a == ip->c) dest.insert(0, s[ip->b]);
+        else {
+            dest.assign(s[ip->b]);
+            dest += s[ip->c];
+        }
+        NEXT();
+    }
+    CASE(STR_I) {
+        s[ip->a].clear();
+        appendInt(s[ip->a], n[ip->b].i);
+        NEXT();
+    }
+    CASE(STR_D) { s[ip->a] = formatDouble(n[ip->b].d); NEXT(); }
+    CASE(STR_B) { s[ip->a] = n[ip->b].i ? "true" : "false"; NEXT(); }
+
+    CASE(JUMP) { JUMP(ip->target()); }
+    CASE(JUMP_IF_FALSE) {
+        if (n[ip->a].i == 0) JUMP(ip->target());
+        NEXT();
+    }
+    CASE(JUMP_IF_TRUE) {
+        if (n[ip->a].i != 0) JUMP(ip->target());
+        NEXT();
+    }
+
+    CASE(ANNOUNCE_I) {
+        appendInt(output, n[ip->a].i);
+        output += '\n';
+        if (output.size() >= FLUSH_SIZE) flush();
+        NEXT();
+    }
+    CASE(ANNOUNCE_D) {
+        output += formatDouble(n[ip->a].d);
+        output += '\n';
+        if (output.size() >= FLUSH_SIZE) flush();
+        NEXT();
+    }
+    CASE(ANNOUNCE_B) {
+        output += n[ip->a].i ? "true\n" : "false\n";
+        if (output.size() >= FLUSH_SIZE) flush();
+        NEXT();
+    }
+    CASE(ANNOUNCE_S) {
+        output += s[ip->a];
+        output += '\n';
+        if (output.size() >= FLUSH_SIZE) flush();
+        NEXT();
+    }
+
+    CASE(LISTEN_I)
+    CASE(LISTEN_D)
+    CASE(LISTEN_B)
+    CASE(LISTEN_S) {
+        if (!listen(*ip, n, s, diagnostics, function.lines[ip - code])) return { false, 0, count };
+        NEXT();
+    }
+
+    CASE(RETURN) { return { true, n[ip->a].i, count }; }
+
+#ifndef AUTOSPEED_COMPUTED_GOTO
+    default:
+        break;
+    }
+#endif
+    return { true, 0, count }; // Not reached: every function ends in RETURN
+}
+
+#undef CASE
+#undef DISPATCH
+#undef NEXT
+#undef JUMP
+#undef FAIL
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "bytecode.h"
+#include "diagnostics.h"
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*
+ * RunResult
+ * How a run ended.
+ */
+struct RunResult {
+    bool ok;               // False if it stopped on a runtime error
+    int64_t value;         // What finishline returned; 0 at the end of the function
+    uint64_t instructions; // Executed, if they were counted
+};
+
+/*
+ * readInput
+ * Reads one line of 'in' as a value of 'type' for listen: a gear, turbo
+ * or flag into 'number' (surrounding blanks allowed), or the whole line
+ * into 'text' for an exhaust. False, after reporting at 'line', if there
+ * is no line or it does not hold a value of the type.
+ */
+bool readInput(std::istream& in, ValueType type, Number& number, std::string& text, Diagnostics& diagnostics, int line);
+
+/*
+ * Vm
+ * Runs bytecode functions (see bytecode.h).
+ *
+ * The dispatch loop jumps straight from one instruction's code to the
+ * next one's: with GCC and Clang through a table of label addresses
+ * (computed goto), elsewhere through a switch. Counting instructions is a
+ * separate instantiation of the loop, so a normal run pays nothing for it.
+ *
+ * announce appends to a buffer that goes to 'out' every FLUSH_SIZE bytes,
+ * before each listen and when the run ends. listen reads one line from
+ * 'in'. Runtime errors (division by zero, input of the wrong type) stop
+ * the run and are reported at the instruction's line.
+ */
+class Vm {
+public:
+    Vm(std::istream& in, std::ostream& out) : in(in), out(out) {}
+    Vm(const Vm&) = delete;
+    Vm& operator=(const Vm&) = delete;
+
+    RunResult run(const BytecodeFunction& function, Diagnostics& diagnostics, bool countInstructions = false);
+
+private:
+    static constexpr size_t FLUSH_SIZE = 64 * 1024;
+
+    std::istream& in;
+    std::ostream& out;
+    std::string output;
+    std::vector<Number> numbers;      // Register files, kept between runs
+    std::vector<std::string> strings;
+
+    template <bool Count>
+    RunResult execute(const BytecodeFunction& function, Diagnostics& diagnostics);
+    void flush();
+    bool listen(const Instr& instr, Number* n, std::string* s, Diagnostics& diagnostics, int line);
+};